@@ -0,0 +1,341 @@
+#include "animation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mesh_data.h"
+
+static int
+animationPath(const std::string &path)
+{
+  if (path == "translation") return ANIM_TRANSLATION;
+  if (path == "rotation") return ANIM_ROTATION;
+  if (path == "scale") return ANIM_SCALE;
+  if (path == "weights") return ANIM_WEIGHTS;
+  return -1;
+}
+
+static int
+animationInterpolation(const std::string &interpolation)
+{
+  if (interpolation == "STEP") return ANIM_STEP;
+  if (interpolation == "CUBICSPLINE") return ANIM_CUBICSPLINE;
+  return ANIM_LINEAR;
+}
+
+void
+buildAnimationClips(
+    const tinygltf::Model &model, std::vector<AnimationClip> *clips)
+{
+  clips->clear();
+  for (const tinygltf::Animation &animation : model.animations) {
+    AnimationClip clip;
+    clip.name = animation.name;
+    clip.start = INFINITY;
+    clip.end = -INFINITY;
+    std::map<int, unsigned> timeOffsets[ANIM_PATH_COUNT];  // by accessor
+
+    for (const tinygltf::AnimationChannel &channel : animation.channels) {
+      int path = animationPath(channel.target_path);
+      if (path < 0 || channel.target_node < 0 ||
+          channel.target_node >= (int)model.nodes.size() ||
+          channel.sampler < 0 ||
+          channel.sampler >= (int)animation.samplers.size())
+        continue;
+      const tinygltf::AnimationSampler &sampler =
+          animation.samplers[channel.sampler];
+      int interpolation = animationInterpolation(sampler.interpolation);
+
+      std::vector<float> times, values;
+      int n = 0;
+      if (!readAccessorFloats(model, sampler.input, &times, &n) || n != 1 ||
+          times.empty() ||
+          !readAccessorFloats(model, sampler.output, &values, &n))
+        continue;
+
+      // Weights outputs are scalars, one per morph target and key.
+      size_t perKey =
+          times.size() * (interpolation == ANIM_CUBICSPLINE ? 3 : 1);
+      if (values.size() % perKey != 0) continue;
+      int components = (int)(values.size() / perKey);
+      if ((path == ANIM_ROTATION && components != 4) ||
+          ((path == ANIM_TRANSLATION || path == ANIM_SCALE) &&
+              components != 3) ||
+          components == 0)
+        continue;
+      AnimationTracks &tracks = clip.paths[path];
+      auto shared = timeOffsets[path].find(sampler.input);
+      if (shared == timeOffsets[path].end()) {
+        shared = timeOffsets[path]
+                     .insert({sampler.input, (unsigned)tracks.times.size()})
+                     .first;
+        tracks.times.insert(tracks.times.end(), times.begin(), times.end());
+      }
+      tracks.node.push_back(channel.target_node);
+      tracks.interpolation.push_back((unsigned char)interpolation);
+      tracks.components.push_back(components);
+      tracks.timeOffset.push_back(shared->second);
+      tracks.keyCount.push_back((unsigned)times.size());
+      tracks.valueOffset.push_back((unsigned)tracks.values.size());
+      tracks.cursor.push_back(0);
+      tracks.values.insert(tracks.values.end(), values.begin(), values.end());
+
+      clip.start = std::min(clip.start, times.front());
+      clip.end = std::max(clip.end, times.back());
+    }
+
+    if (clip.start > clip.end) clip.start = clip.end = 0.0f;
+    clips->push_back(std::move(clip));
+  }
+}
+
+// Finds the key interval containing `t` and the position within it. The
+// search starts from the key of the previous evaluation, which is the same
+// or the next one during playback; only jumps (looping, seeking) fall back
+// to a binary search.
+static unsigned
+findKey(const float *times, unsigned count, float t, unsigned *cursor,
+    float *f)
+{
+  if (count < 2 || t <= times[0]) {
+    *f = 0.0f;
+    return 0;
+  }
+  if (t >= times[count - 1]) {
+    *f = 1.0f;
+    return count - 2;
+  }
+
+  unsigned k = std::min(*cursor, count - 2);
+  if (t < times[k]) {
+    if (k > 0 && t >= times[k - 1])
+      k--;
+    else
+      k = (unsigned)(std::upper_bound(times, times + k, t) - times) - 1;
+  } else if (t >= times[k + 1]) {
+    if (k + 2 < count && t < times[k + 2])
+      k++;
+    else
+      k = (unsigned)(std::upper_bound(times + k + 1, times + count, t) -
+                     times) -
+          1;
+  }
+  *cursor = k;
+
+  float dt = times[k + 1] - times[k];
+  *f = dt > 0.0f ? (t - times[k]) / dt : 0.0f;
+  return k;
+}
+
+// Samples track `i` of `tracks` at `t` into `out`, except LINEAR rotations
+// which are left to the slerp batch: those return false with the two keys
+// in `a` and `b`.
+static bool
+sampleTrack(AnimationTracks &tracks, size_t i, float t, float *out,
+    const float **a, const float **b, float *f)
+{
+  unsigned count = tracks.keyCount[i];
+  int components = tracks.components[i];
+  const float *times = &tracks.times[tracks.timeOffset[i]];
+  const float *values = &tracks.values[tracks.valueOffset[i]];
+  unsigned k = findKey(times, count, t, &tracks.cursor[i], f);
+
+  switch (tracks.interpolation[i]) {
+    case ANIM_STEP: {
+      const float *v = values + (*f < 1.0f ? k : k + 1) * components;
+      if (count < 2) v = values;
+      std::copy(v, v + components, out);
+      return true;
+    }
+    case ANIM_CUBICSPLINE: {
+      if (count < 2) {
+        std::copy(values + components, values + 2 * components, out);
+        return true;
+      }
+      float s = *f, s2 = s * s, s3 = s2 * s;
+      float dt = times[k + 1] - times[k];
+      float h00 = 2 * s3 - 3 * s2 + 1, h10 = (s3 - 2 * s2 + s) * dt;
+      float h01 = -2 * s3 + 3 * s2, h11 = (s3 - s2) * dt;
+      const float *k0 = values + k * 3 * components;
+      const float *k1 = k0 + 3 * components;
+      for (int c = 0; c < components; c++) {
+        out[c] = h00 * k0[components + c] + h10 * k0[2 * components + c] +
+                 h01 * k1[components + c] + h11 * k1[c];
+      }
+      return true;
+    }
+    default:
+      *a = values + k * components;
+      *b = count < 2 ? *a : *a + components;
+      return false;
+  }
+}
+
+static void
+normalizeQuat(float *q)
+{
+  float l = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  if (l > 0.0f)
+    for (int i = 0; i < 4; i++) q[i] /= l;
+}
+
+namespace {
+
+// Pending LINEAR rotations, one lane per track.
+struct SlerpBatch {
+  std::vector<float> ax, ay, az, aw, bx, by, bz, bw, t;
+  std::vector<float *> out;
+
+  void clear()
+  {
+    for (auto *v : {&ax, &ay, &az, &aw, &bx, &by, &bz, &bw, &t}) v->clear();
+    out.clear();
+  }
+
+  void add(const float *a, const float *b, float f, float *dst)
+  {
+    ax.push_back(a[0]), ay.push_back(a[1]), az.push_back(a[2]);
+    aw.push_back(a[3]);
+    bx.push_back(b[0]), by.push_back(b[1]), bz.push_back(b[2]);
+    bw.push_back(b[3]);
+    t.push_back(f);
+    out.push_back(dst);
+  }
+};
+
+}  // namespace
+
+// Slerp is approximated by a normalized lerp with a corrected parameter,
+// within about 0.001 radians of the exact result even for keys half a turn
+// apart. It needs no trigonometry and so vectorizes. Keys are blended along
+// the shortest arc.
+static inline float
+slerpParameter(float t, float d)
+{
+  float a = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+  float b = 0.848013f + d * (-1.06021f + d * 0.215638f);
+  float k = a * (t - 0.5f) * (t - 0.5f) + b;
+  return t + t * (t - 0.5f) * (t - 1.0f) * k;
+}
+
+static void
+slerpScalar(SlerpBatch &batch, size_t i)
+{
+  float a[4] = {batch.ax[i], batch.ay[i], batch.az[i], batch.aw[i]};
+  float b[4] = {batch.bx[i], batch.by[i], batch.bz[i], batch.bw[i]};
+  float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+  float sign = dot < 0.0f ? -1.0f : 1.0f;
+  float t = slerpParameter(batch.t[i], fabsf(dot));
+  float *q = batch.out[i];
+  for (int c = 0; c < 4; c++) q[c] = a[c] + (b[c] * sign - a[c]) * t;
+  normalizeQuat(q);
+}
+
+static void
+slerpBatch(SlerpBatch &batch)
+{
+  size_t count = batch.out.size();
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  const __m128 half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 ax = _mm_loadu_ps(&batch.ax[i]), ay = _mm_loadu_ps(&batch.ay[i]);
+    __m128 az = _mm_loadu_ps(&batch.az[i]), aw = _mm_loadu_ps(&batch.aw[i]);
+    __m128 bx = _mm_loadu_ps(&batch.bx[i]), by = _mm_loadu_ps(&batch.by[i]);
+    __m128 bz = _mm_loadu_ps(&batch.bz[i]), bw = _mm_loadu_ps(&batch.bw[i]);
+    __m128 t = _mm_loadu_ps(&batch.t[i]);
+
+    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+        _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+    __m128 sign = _mm_and_ps(dot, signMask);
+    __m128 d = _mm_andnot_ps(signMask, dot);
+    bx = _mm_xor_ps(bx, sign), by = _mm_xor_ps(by, sign);
+    bz = _mm_xor_ps(bz, sign), bw = _mm_xor_ps(bw, sign);
+
+    __m128 ka = _mm_add_ps(_mm_set1_ps(3.55645f),
+        _mm_mul_ps(d, _mm_set1_ps(-1.43519f)));
+    ka = _mm_add_ps(_mm_set1_ps(-3.2452f), _mm_mul_ps(d, ka));
+    ka = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, ka));
+    __m128 kb = _mm_add_ps(_mm_set1_ps(-1.06021f),
+        _mm_mul_ps(d, _mm_set1_ps(0.215638f)));
+    kb = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, kb));
+    __m128 th = _mm_sub_ps(t, half);
+    __m128 k = _mm_add_ps(_mm_mul_ps(ka, _mm_mul_ps(th, th)), kb);
+    __m128 ot = _mm_add_ps(t,
+        _mm_mul_ps(_mm_mul_ps(t, th), _mm_mul_ps(_mm_sub_ps(t, one), k)));
+
+    __m128 x = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), ot));
+    __m128 y = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), ot));
+    __m128 z = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), ot));
+    __m128 w = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), ot));
+    __m128 len = _mm_sqrt_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+            _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+    x = _mm_div_ps(x, len), y = _mm_div_ps(y, len);
+    z = _mm_div_ps(z, len), w = _mm_div_ps(w, len);
+
+    // Transpose to x, y, z, w per lane for the scattered stores.
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(batch.out[i + 0], x);
+    _mm_storeu_ps(batch.out[i + 1], y);
+    _mm_storeu_ps(batch.out[i + 2], z);
+    _mm_storeu_ps(batch.out[i + 3], w);
+  }
+#endif
+  for (; i < count; i++) slerpScalar(batch, i);
+}
+
+void
+animationApply(AnimationClip *clip, float time, SceneState *scene)
+{
+  static thread_local SlerpBatch batch;
+  batch.clear();
+
+  for (int path = 0; path < ANIM_PATH_COUNT; path++) {
+    AnimationTracks &tracks = clip->paths[path];
+    for (size_t i = 0; i < tracks.node.size(); i++) {
+      int node = tracks.node[i];
+      if (node >= (int)scene->useMatrix.size()) continue;
+
+      float *out;
+      float weights[64];
+      int components = tracks.components[i];
+      if (path == ANIM_TRANSLATION)
+        out = &scene->translation[node * 3];
+      else if (path == ANIM_ROTATION)
+        out = &scene->rotation[node * 4];
+      else if (path == ANIM_SCALE)
+        out = &scene->scale[node * 3];
+      else if (scene->weightOffset[node] < 0 || components > 64)
+        continue;
+      else
+        out = weights;
+
+      const float *a, *b;
+      float f;
+      if (!sampleTrack(tracks, i, time, out, &a, &b, &f)) {
+        if (path == ANIM_ROTATION) {
+          batch.add(a, b, f, out);
+          continue;
+        }
+        for (int c = 0; c < components; c++) out[c] = a[c] + (b[c] - a[c]) * f;
+      } else if (path == ANIM_ROTATION) {
+        normalizeQuat(out);
+      }
+
+      if (out == weights) {
+        int count = std::min(components, scene->weightCount[node]);
+        std::copy(weights, weights + count,
+            &scene->weights[scene->weightOffset[node]]);
+      }
+    }
+  }
+
+  slerpBatch(batch);
+}
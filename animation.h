@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "scene.h"
+#include "tiny_gltf.h"
+
+enum {
+  ANIM_TRANSLATION,
+  ANIM_ROTATION,
+  ANIM_SCALE,
+  ANIM_WEIGHTS,
+  ANIM_PATH_COUNT
+};
+
+enum { ANIM_STEP, ANIM_LINEAR, ANIM_CUBICSPLINE };
+
+// All tracks of a clip targeting one path, as structure-of-arrays indexed by
+// track. Times are shared between tracks sampled by the same input accessor.
+// Values are key-major; CUBICSPLINE keys hold in-tangent, value and
+// out-tangent, each `components` floats.
+typedef struct {
+  std::vector<int> node;
+  std::vector<unsigned char> interpolation;
+  std::vector<int> components;  // 3, 4, or the morph target count
+  std::vector<unsigned> timeOffset;
+  std::vector<unsigned> keyCount;
+  std::vector<unsigned> valueOffset;
+  std::vector<unsigned> cursor;  // key used by the last evaluation
+  std::vector<float> times;
+  std::vector<float> values;
+} AnimationTracks;
+
+typedef struct {
+  std::string name;
+  float start;
+  float end;
+  AnimationTracks paths[ANIM_PATH_COUNT];
+} AnimationClip;
+
+// Converts the animations of `model` to clips. Channels with invalid
+// samplers or targets are skipped.
+void buildAnimationClips(
+    const tinygltf::Model &model, std::vector<AnimationClip> *clips);
+
+// Evaluates `clip` at `time` (seconds, clamped to the clip) and writes the
+// animated properties into the local transforms of `scene`.
+void animationApply(AnimationClip *clip, float time, SceneState *scene);
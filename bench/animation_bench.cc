@@ -0,0 +1,176 @@
+// Headless benchmark of animation playback: sampling every track and
+// updating the world matrices of the animated scene.
+//
+//   animation-bench [model.gltf] [--frames N]
+//
+// Without a model, skeletons of 32-joint chains are generated, each joint
+// with translation and rotation tracks, at 1k, 4k and 16k nodes. Playback
+// advances one frame at a time; seeking jumps to random times, which defeats
+// the cached key cursors.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "animation.h"
+#include "scene.h"
+
+#define KEYS 60
+#define KEY_RATE 30.0f
+#define CHAIN 32
+
+static int
+addAccessor(tinygltf::Model *model, const std::vector<float> &data, int type)
+{
+  tinygltf::Buffer &buffer = model->buffers[0];
+  tinygltf::BufferView view;
+  view.buffer = 0;
+  view.byteOffset = buffer.data.size();
+  view.byteLength = data.size() * sizeof(float);
+  buffer.data.resize(buffer.data.size() + view.byteLength);
+  memcpy(&buffer.data[view.byteOffset], data.data(), view.byteLength);
+  model->bufferViews.push_back(view);
+
+  tinygltf::Accessor accessor;
+  accessor.bufferView = (int)model->bufferViews.size() - 1;
+  accessor.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+  accessor.type = type;
+  accessor.count = data.size() / tinygltf::GetNumComponentsInType(type);
+  model->accessors.push_back(accessor);
+  return (int)model->accessors.size() - 1;
+}
+
+static void
+syntheticModel(tinygltf::Model *model, int nodes)
+{
+  model->buffers.resize(1);
+  model->scenes.resize(1);
+  model->animations.resize(1);
+  tinygltf::Animation &animation = model->animations[0];
+
+  std::vector<float> times(KEYS);
+  for (int k = 0; k < KEYS; k++) times[k] = k / KEY_RATE;
+  int input = addAccessor(model, times, TINYGLTF_TYPE_SCALAR);
+
+  srand(1);
+  for (int n = 0; n < nodes; n++) {
+    tinygltf::Node node;
+    if (n % CHAIN == 0)
+      model->scenes[0].nodes.push_back(n);
+    else
+      model->nodes[n - 1].children.push_back(n);
+    model->nodes.push_back(node);
+
+    std::vector<float> t, r;
+    float phase = rand() / (float)RAND_MAX * 6.2831853f;
+    for (int k = 0; k < KEYS; k++) {
+      float a = phase + k * 0.1f;
+      t.insert(t.end(), {0.0f, 1.0f + 0.1f * sinf(a), 0.0f});
+      r.insert(r.end(), {sinf(a * 0.5f) * 0.6f, 0.0f, 0.0f, 0.8f});
+    }
+    for (int k = 0; k < KEYS; k++) {
+      float *q = &r[k * 4];
+      float l = sqrtf(q[0] * q[0] + q[3] * q[3]);
+      q[0] /= l;
+      q[3] /= l;
+    }
+
+    const char *paths[2] = {"translation", "rotation"};
+    int outputs[2] = {addAccessor(model, t, TINYGLTF_TYPE_VEC3),
+        addAccessor(model, r, TINYGLTF_TYPE_VEC4)};
+    for (int p = 0; p < 2; p++) {
+      tinygltf::AnimationSampler sampler;
+      sampler.input = input;
+      sampler.output = outputs[p];
+      sampler.interpolation = "LINEAR";
+      animation.samplers.push_back(sampler);
+      tinygltf::AnimationChannel channel;
+      channel.sampler = (int)animation.samplers.size() - 1;
+      channel.target_node = n;
+      channel.target_path = paths[p];
+      animation.channels.push_back(channel);
+    }
+  }
+}
+
+static void
+run(tinygltf::Model &model, int frames)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  std::vector<AnimationClip> clips;
+  buildAnimationClips(model, &clips);
+  SceneState scene;
+  sceneInit(model, displayedScene(model), &scene);
+  auto t1 = std::chrono::steady_clock::now();
+  if (clips.empty()) {
+    printf("no animations\n");
+    return;
+  }
+
+  AnimationClip &clip = clips[0];
+  size_t tracks = 0;
+  for (const AnimationTracks &p : clip.paths) tracks += p.node.size();
+  printf("nodes %zu, tracks %zu, load %.2f ms\n", model.nodes.size(), tracks,
+      std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+  float duration = clip.end - clip.start;
+  for (int seek = 0; seek < 2; seek++) {
+    double sampleMs = 0.0, worldMs = 0.0;
+    srand(2);
+    for (int f = 0; f < frames; f++) {
+      float t = seek ? rand() / (float)RAND_MAX * duration
+                     : fmodf(f / 60.0f, duration);
+      auto a = std::chrono::steady_clock::now();
+      animationApply(&clip, clip.start + t, &scene);
+      auto b = std::chrono::steady_clock::now();
+      sceneUpdateWorld(&scene);
+      auto c = std::chrono::steady_clock::now();
+      sampleMs += std::chrono::duration<double, std::milli>(b - a).count();
+      worldMs += std::chrono::duration<double, std::milli>(c - b).count();
+    }
+    printf("  %-8s sample %.3f ms (%.1f ns/track), world %.3f ms\n",
+        seek ? "seek" : "playback", sampleMs / frames,
+        sampleMs * 1e6 / frames / (double)tracks, worldMs / frames);
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string filename;
+  int frames = 500;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--frames" && i + 1 < argc)
+      frames = atoi(argv[++i]);
+    else
+      filename = arg;
+  }
+
+  if (filename.empty()) {
+    for (int nodes : {1024, 4096, 16384}) {
+      tinygltf::Model model;
+      syntheticModel(&model, nodes);
+      run(model, frames);
+    }
+    return EXIT_SUCCESS;
+  }
+
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  bool ok = filename.size() > 4 &&
+                    filename.compare(filename.size() - 4, 4, ".glb") == 0
+                ? loader.LoadBinaryFromFile(&model, &err, &warn, filename)
+                : loader.LoadASCIIFromFile(&model, &err, &warn, filename);
+  if (!ok) {
+    fprintf(stderr, "failed to load %s: %s\n", filename.c_str(), err.c_str());
+    return EXIT_FAILURE;
+  }
+  run(model, frames);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,220 @@
+// Benchmark of ray picking: mesh hierarchy builds for 1..N threads, top
+// level builds and refits, and picks from above the scene, checked against
+// a brute-force intersection of every triangle.
+//
+//   bvh-bench [--triangles N] [--instances K] [--rays R] [--check C]
+//
+// The mesh is a noisy height field of about N triangles (default 4M),
+// instanced K times (default 64) on a grid with random rotations. The first
+// C rays (default 16) are also intersected by brute force.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bvh.h"
+#include "jobs.h"
+#include "transform.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double
+millisecondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Appends `bytes` as a buffer view and returns an accessor on it.
+static int
+addAccessor(tinygltf::Model *model, const void *bytes, size_t size,
+    int componentType, int type, size_t count)
+{
+  tinygltf::Buffer &buffer = model->buffers[0];
+  tinygltf::BufferView view;
+  view.buffer = 0;
+  view.byteOffset = buffer.data.size();
+  view.byteLength = size;
+  buffer.data.insert(buffer.data.end(), (const unsigned char *)bytes,
+      (const unsigned char *)bytes + size);
+  model->bufferViews.push_back(view);
+
+  tinygltf::Accessor accessor;
+  accessor.bufferView = (int)model->bufferViews.size() - 1;
+  accessor.componentType = componentType;
+  accessor.type = type;
+  accessor.count = count;
+  model->accessors.push_back(accessor);
+  return (int)model->accessors.size() - 1;
+}
+
+// Height field of `side` x `side` quads over [0, 1] in x and z.
+static void
+heightField(tinygltf::Model *model, int side)
+{
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> noise(-0.002f, 0.002f);
+  std::vector<float> positions;
+  positions.reserve((size_t)(side + 1) * (side + 1) * 3);
+  for (int z = 0; z <= side; z++) {
+    for (int x = 0; x <= side; x++) {
+      float u = (float)x / side, v = (float)z / side;
+      positions.push_back(u);
+      positions.push_back(0.05f * sinf(u * 20.0f) * cosf(v * 17.0f) +
+                          noise(rng));
+      positions.push_back(v);
+    }
+  }
+  std::vector<uint32_t> indices;
+  indices.reserve((size_t)side * side * 6);
+  for (int z = 0; z < side; z++) {
+    for (int x = 0; x < side; x++) {
+      uint32_t i = z * (side + 1) + x;
+      uint32_t quad[6] = {i, i + side + 1, i + 1, i + 1, i + side + 1,
+          i + side + 2};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+
+  model->buffers.resize(1);
+  tinygltf::Primitive primitive;
+  primitive.attributes["POSITION"] =
+      addAccessor(model, positions.data(), positions.size() * sizeof(float),
+          TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3,
+          positions.size() / 3);
+  primitive.indices = addAccessor(model, indices.data(),
+      indices.size() * sizeof(uint32_t),
+      TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, TINYGLTF_TYPE_SCALAR,
+      indices.size());
+  primitive.mode = TINYGLTF_MODE_TRIANGLES;
+  model->meshes.resize(1);
+  model->meshes[0].primitives.push_back(primitive);
+}
+
+// Nearest hit over every triangle of every instance.
+static bool
+bruteForce(const PickScene &scene, const float origin[3],
+    const float direction[3], float *distance)
+{
+  bool hit = false;
+  for (size_t i = 0; i < scene.instances.size(); i++) {
+    const MeshBvh &mesh = scene.meshes[scene.instances[i].mesh];
+    float o[3], d[3];
+    mat4TransformPoint(scene.inverse[i], origin, o);
+    mat4TransformVector(scene.inverse[i], direction, d);
+    // A one-leaf hierarchy holding every triangle.
+    MeshBvh flat;
+    flat.positions = mesh.positions;
+    flat.indices = mesh.indices;
+    flat.triangles = mesh.triangles;
+    BvhNode root = mesh.nodes[0];
+    root.first = 0;
+    root.count = (uint32_t)mesh.triangles.size();
+    flat.nodes.push_back(root);
+    uint32_t triangle;
+    if (meshBvhRay(flat, o, d, distance, &triangle)) hit = true;
+  }
+  return hit;
+}
+
+int
+main(int argc, char **argv)
+{
+  size_t triangles = 4 << 20;
+  int instanceCount = 64, rays = 10000, check = 16;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--triangles" && i + 1 < argc)
+      triangles = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "--instances" && i + 1 < argc)
+      instanceCount = atoi(argv[++i]);
+    else if (arg == "--rays" && i + 1 < argc)
+      rays = atoi(argv[++i]);
+    else if (arg == "--check" && i + 1 < argc)
+      check = atoi(argv[++i]);
+  }
+
+  tinygltf::Model model;
+  int side = std::max(1, (int)sqrt(triangles / 2.0));
+  heightField(&model, side);
+  printf("mesh: %zu triangles, %d instances\n", (size_t)side * side * 2,
+      instanceCount);
+
+  int maxThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> threadCounts;
+  for (int t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+  threadCounts.push_back(maxThreads);
+  for (int threads : threadCounts) {
+    JobSystem *jobs = jobSystemCreate(threads);
+    MeshBvh bvh;
+    auto start = Clock::now();
+    buildMeshBvh(model, model.meshes[0], jobs, &bvh);
+    printf("threads %2d: mesh build %.1f ms, %zu nodes\n", threads,
+        millisecondsSince(start), bvh.nodes.size());
+    jobSystemDestroy(jobs);
+  }
+
+  JobSystem *jobs = jobSystemCreate(0);
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  int grid = std::max(1, (int)ceil(sqrt((double)instanceCount)));
+  std::vector<PickInstance> instances;
+  for (int i = 0; i < instanceCount; i++) {
+    float t[3] = {(float)(i % grid) * 1.5f, 0.0f, (float)(i / grid) * 1.5f};
+    float a = unit(rng) * 3.14159265f;
+    float q[4] = {0.0f, sinf(a), 0.0f, cosf(a)}, s[3] = {1.0f, 1.0f, 1.0f};
+    instances.push_back({i, 0, 0, mat4FromTRS(t, q, s)});
+  }
+
+  PickScene scene;
+  scene.jobs = jobs;
+  auto start = Clock::now();
+  pickSetInstances(model, instances, &scene);
+  printf("first pickSetInstances (mesh and top level): %.1f ms\n",
+      millisecondsSince(start));
+  scene.nodes.clear();  // forces a rebuild
+  start = Clock::now();
+  pickSetInstances(model, instances, &scene);
+  printf("top level build: %.3f ms\n", millisecondsSince(start));
+  for (PickInstance &instance : instances) instance.world.m[13] += 0.1f;
+  start = Clock::now();
+  pickSetInstances(model, instances, &scene);
+  printf("top level refit: %.3f ms\n", millisecondsSince(start));
+
+  // From above, at points spread over the instances.
+  float extent = grid * 1.5f;
+  double total = 0.0, worst = 0.0;
+  int hits = 0, mismatches = 0;
+  for (int r = 0; r < rays; r++) {
+    float origin[3] = {extent * 0.5f, 3.0f, -1.0f};
+    float target[3] = {unit(rng) * extent - 0.5f, 0.1f,
+        unit(rng) * extent - 0.5f};
+    float direction[3];
+    for (int a = 0; a < 3; a++) direction[a] = target[a] - origin[a];
+    PickHit hit;
+    auto t0 = Clock::now();
+    bool found = pickRay(scene, origin, direction, &hit);
+    double ms = millisecondsSince(t0);
+    total += ms;
+    worst = std::max(worst, ms);
+    hits += found;
+    if (r < check) {
+      float distance = INFINITY;
+      bool expected = bruteForce(scene, origin, direction, &distance);
+      if (expected != found || (found && distance != hit.distance))
+        mismatches++;
+    }
+  }
+  printf("pick: %.4f ms average, %.4f ms worst, %d/%d hits, "
+         "%d/%d mismatches against brute force\n",
+      total / rays, worst, hits, rays, mismatches, std::min(check, rays));
+  jobSystemDestroy(jobs);
+  return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,266 @@
+// Micro-benchmarks of the tiny_gltf paths the viewer depends on at load
+// time, reporting throughput and heap allocations per operation.
+//
+//   gltf-bench [--filter <substring>] [--min-time <seconds>]
+//              [--assets <dir>]
+//
+// Cases, each on the bundled Duck, Avocado and Cube models and on generated
+// inputs:
+//   parse     glTF JSON and buffers, images left encoded
+//   accessors 100k accessors, dominated by ParseAccessor
+//   nodes     100k nodes with TRS and children, dominated by ParseNode
+//   base64    a 16 MiB data URI through DecodeDataURI
+//   image     PNG decoding through LoadImageData
+//   write     WriteGltfSceneToStream with embedded buffers
+//   stream    writeGltf to /dev/null, embedding the same way
+// MB/s is of the input: the JSON for parse cases, the PNG for image cases,
+// the output for write cases. Allocations are those through operator new,
+// counted by memory_stats; stb_image allocates with malloc and is not
+// counted. Run from the source directory, or pass --assets.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gltf_writer.h"
+#include "memory_stats.h"
+#include "tiny_gltf.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static std::string filter;
+static double minTime = 0.5;
+
+// Runs `op` until `minTime` has passed, at least 3 times.
+static void
+run(const std::string &name, size_t bytes, const std::function<void()> &op)
+{
+  if (!filter.empty() && name.find(filter) == std::string::npos) return;
+  op();  // warm up
+
+  int iterations = 0;
+  uint64_t allocated = memoryAllocations();
+  auto start = Clock::now();
+  double elapsed = 0.0;
+  while (iterations < 3 || elapsed < minTime) {
+    op();
+    iterations++;
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+  uint64_t count = memoryAllocations() - allocated;
+
+  printf("%-36s %9.3f ms %9.1f MB/s %11.0f allocs/op\n", name.c_str(),
+      elapsed * 1000.0 / iterations, bytes * iterations / elapsed / 1e6,
+      (double)count / iterations);
+}
+
+static bool
+readFile(const std::string &path, std::string *out)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return false;
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  *out = contents.str();
+  return true;
+}
+
+// Keeps images encoded, so parsing is measured on its own.
+static bool
+skipImage(tinygltf::Image *, const int, std::string *, std::string *, int, int,
+    const unsigned char *, int, void *)
+{
+  return true;
+}
+
+static bool
+parse(const std::string &json, const std::string &baseDir,
+    tinygltf::Model *model)
+{
+  tinygltf::TinyGLTF loader;
+  loader.SetImageLoader(skipImage, nullptr);
+  std::string err, warn;
+  bool ok = loader.LoadASCIIFromString(model, &err, &warn, json.data(),
+      (unsigned int)json.size(), baseDir);
+  if (!ok) fprintf(stderr, "parse failed: %s\n", err.c_str());
+  return ok;
+}
+
+static void
+stream(const tinygltf::Model &model)
+{
+  std::string err;
+  if (!writeGltf(model, "/dev/null", true, true, false, &err))
+    fprintf(stderr, "write failed: %s\n", err.c_str());
+}
+
+static std::string
+base64(const unsigned char *data, size_t size)
+{
+  static const char table[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((size + 2) / 3 * 4);
+  for (size_t i = 0; i < size; i += 3) {
+    uint32_t v = data[i] << 16;
+    if (i + 1 < size) v |= data[i + 1] << 8;
+    if (i + 2 < size) v |= data[i + 2];
+    out += table[(v >> 18) & 63];
+    out += table[(v >> 12) & 63];
+    out += i + 1 < size ? table[(v >> 6) & 63] : '=';
+    out += i + 2 < size ? table[v & 63] : '=';
+  }
+  return out;
+}
+
+static std::string
+syntheticAccessors(int count)
+{
+  std::string json = "{\"asset\":{\"version\":\"2.0\"},"
+                     "\"buffers\":[{\"byteLength\":12,\"uri\":"
+                     "\"data:application/octet-stream;base64,"
+                     "AAAAAAAAAAAAAAAA\"}],"
+                     "\"bufferViews\":[{\"buffer\":0,\"byteLength\":12}],"
+                     "\"accessors\":[";
+  char item[160];
+  for (int i = 0; i < count; i++) {
+    snprintf(item, sizeof(item),
+        "%s{\"bufferView\":0,\"componentType\":5126,\"count\":1,"
+        "\"type\":\"VEC3\",\"min\":[0,0,0],\"max\":[%d,1,1]}",
+        i ? "," : "", i);
+    json += item;
+  }
+  return json + "]}";
+}
+
+// A tree with four children per node.
+static std::string
+syntheticNodes(int count)
+{
+  std::string json = "{\"asset\":{\"version\":\"2.0\"},"
+                     "\"scenes\":[{\"nodes\":[0]}],\"nodes\":[";
+  char item[256];
+  for (int i = 0; i < count; i++) {
+    snprintf(item, sizeof(item),
+        "%s{\"name\":\"node%d\",\"translation\":[%d,0,1],"
+        "\"rotation\":[0,0.7071068,0,0.7071068],\"scale\":[1,2,1]",
+        i ? "," : "", i, i);
+    json += item;
+    if (4 * i + 1 < count) {
+      json += ",\"children\":[";
+      for (int c = 4 * i + 1; c <= 4 * i + 4 && c < count; c++) {
+        if (c > 4 * i + 1) json += ",";
+        json += std::to_string(c);
+      }
+      json += "]";
+    }
+    json += "}";
+  }
+  return json + "]}";
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string assets = "assets";
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--filter" && i + 1 < argc)
+      filter = argv[++i];
+    else if (arg == "--min-time" && i + 1 < argc)
+      minTime = atof(argv[++i]);
+    else if (arg == "--assets" && i + 1 < argc)
+      assets = argv[++i];
+  }
+
+  struct Asset {
+    const char *name;
+    const char *images[3];
+  };
+  const Asset bundled[] = {
+      {"Duck", {"DuckCM.png"}},
+      {"Avocado",
+          {"Avocado_baseColor.png", "Avocado_normal.png",
+              "Avocado_roughnessMetallic.png"}},
+      {"Cube", {"Cube_BaseColor.png", "Cube_MetallicRoughness.png"}},
+  };
+
+  for (const Asset &asset : bundled) {
+    std::string dir = assets + "/" + asset.name + "/";
+    std::string json;
+    if (!readFile(dir + asset.name + ".gltf", &json)) {
+      fprintf(stderr, "missing %s%s.gltf, skipped\n", dir.c_str(), asset.name);
+      continue;
+    }
+
+    run(std::string("parse/") + asset.name, json.size(), [&]() {
+      tinygltf::Model model;
+      parse(json, dir, &model);
+    });
+
+    for (const char *image : asset.images) {
+      std::string png;
+      if (!image || !readFile(dir + image, &png)) continue;
+      run(std::string("image/") + image, png.size(), [&]() {
+        tinygltf::Image decoded;
+        std::string err, warn;
+        tinygltf::LoadImageData(&decoded, 0, &err, &warn, 0, 0,
+            (const unsigned char *)png.data(), (int)png.size(), nullptr);
+      });
+    }
+
+    tinygltf::Model model;
+    if (!parse(json, dir, &model)) continue;
+    std::ostringstream sized;
+    tinygltf::TinyGLTF writer;
+    writer.WriteGltfSceneToStream(&model, sized, false, false);
+    run(std::string("write/") + asset.name, sized.str().size(), [&]() {
+      std::ostringstream out;
+      writer.WriteGltfSceneToStream(&model, out, false, false);
+    });
+    run(std::string("stream/") + asset.name, sized.str().size(),
+        [&]() { stream(model); });
+  }
+
+  std::string accessors = syntheticAccessors(100000);
+  run("accessors/100k", accessors.size(), [&]() {
+    tinygltf::Model model;
+    parse(accessors, "", &model);
+  });
+
+  std::string nodes = syntheticNodes(100000);
+  run("nodes/100k", nodes.size(), [&]() {
+    tinygltf::Model model;
+    parse(nodes, "", &model);
+  });
+  {
+    tinygltf::Model model;
+    parse(nodes, "", &model);
+    tinygltf::TinyGLTF writer;
+    std::ostringstream sized;
+    writer.WriteGltfSceneToStream(&model, sized, false, false);
+    run("write/nodes-100k", sized.str().size(), [&]() {
+      std::ostringstream out;
+      writer.WriteGltfSceneToStream(&model, out, false, false);
+    });
+    run("stream/nodes-100k", sized.str().size(), [&]() { stream(model); });
+  }
+
+  std::vector<unsigned char> payload(16 << 20);
+  std::mt19937 rng(1);
+  for (unsigned char &b : payload) b = (unsigned char)rng();
+  std::string uri = "data:application/octet-stream;base64," +
+                    base64(payload.data(), payload.size());
+  run("base64/16MiB", uri.size(), [&]() {
+    std::vector<unsigned char> out;
+    std::string mime;
+    tinygltf::DecodeDataURI(&out, mime, uri, payload.size(), true);
+  });
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+// Scaling of the job system from one core to all of them, on the work it
+// runs in the viewer.
+//
+//   jobs-bench [--threads N] [--frames N]
+//
+// For every thread count up to N (all cores by default): the cost of an empty
+// parallel for, the world update of a wide 64k-node scene, and load-time
+// simplification of a batch of grid meshes. First, on 2 and 4 threads even
+// on fewer cores, more jobs than a pool block holds are kept live at once
+// and their results checked.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "jobs.h"
+#include "lod.h"
+#include "scene.h"
+
+#define GRID 64    // vertices per side of each simplified mesh
+#define MESHES 16  // meshes simplified per run
+
+typedef std::chrono::steady_clock Clock;
+
+static double
+elapsedMs(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// 256 roots with 16 children each, which have 16 children each: wide levels
+// are where the per-depth world update has parallelism to find.
+static void
+wideModel(tinygltf::Model *model)
+{
+  model->scenes.resize(1);
+  for (int r = 0; r < 256; r++) {
+    int root = (int)model->nodes.size();
+    model->scenes[0].nodes.push_back(root);
+    model->nodes.emplace_back();
+    model->nodes[root].translation = {(double)(r % 16), 0.0,
+        (double)(r / 16)};
+    for (int c = 0; c < 16; c++) {
+      int child = (int)model->nodes.size();
+      model->nodes[root].children.push_back(child);
+      model->nodes.emplace_back();
+      model->nodes[child].rotation = {0.0, sin(0.1 * c), 0.0, cos(0.1 * c)};
+      for (int g = 0; g < 16; g++) {
+        int leaf = (int)model->nodes.size();
+        model->nodes[child].children.push_back(leaf);
+        model->nodes.emplace_back();
+        model->nodes[leaf].translation = {0.0, 0.1 * g, 0.0};
+      }
+    }
+  }
+}
+
+// A bumpy grid, so the simplifier has error to weigh.
+static void
+gridMesh(int seed, std::vector<float> *positions,
+    std::vector<uint32_t> *indices)
+{
+  for (int y = 0; y < GRID; y++) {
+    for (int x = 0; x < GRID; x++) {
+      positions->push_back((float)x);
+      positions->push_back((float)y);
+      positions->push_back(
+          0.5f * sinf(x * 0.3f + seed) * cosf(y * 0.2f - seed));
+    }
+  }
+  for (int y = 0; y + 1 < GRID; y++) {
+    for (int x = 0; x + 1 < GRID; x++) {
+      uint32_t v = (uint32_t)(y * GRID + x);
+      indices->insert(indices->end(),
+          {v, v + 1, v + GRID, v + 1, v + GRID + 1, v + GRID});
+    }
+  }
+}
+
+// 20000 children of one parent, all created before any is waited for, and
+// a parallel for of 100000 single items. False when a job was lost or run
+// twice.
+static bool
+checkManyJobs(int threads)
+{
+  JobSystem *jobs = jobSystemCreate(threads);
+  const size_t children = 20000;
+  std::atomic<size_t> sum{0};
+  std::atomic<size_t> *total = &sum;
+  Job *parent = jobCreate(jobs, nullptr, [] {});
+  for (size_t i = 0; i < children; i++) {
+    jobRun(jobs, jobCreate(jobs, parent, [total, i] {
+      total->fetch_add(i + 1, std::memory_order_relaxed);
+    }));
+  }
+  jobRun(jobs, parent);
+  jobWait(jobs, parent);
+  bool ok = sum.load() == children * (children + 1) / 2;
+
+  const size_t count = 100000;
+  sum.store(0);
+  jobParallelFor(jobs, count, 1, [total](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      total->fetch_add(i + 1, std::memory_order_relaxed);
+  });
+  ok = ok && sum.load() == count * (count + 1) / 2;
+  jobSystemDestroy(jobs);
+  printf("threads %2d: %zu live jobs and a %zu item parallel for: %s\n",
+      threads, children, count, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static void
+run(int threads, int frames, const tinygltf::Model &model,
+    const std::vector<std::vector<float>> &positions,
+    const std::vector<std::vector<uint32_t>> &indices)
+{
+  JobSystem *jobs = jobSystemCreate(threads);
+
+  const int loops = 1000;
+  auto start = Clock::now();
+  for (int i = 0; i < loops; i++)
+    jobParallelFor(jobs, 1024, 16, [](size_t, size_t) {});
+  double emptyUs = elapsedMs(start) * 1000.0 / loops;
+
+  SceneState scene;
+  sceneInit(model, 0, &scene);
+  start = Clock::now();
+  for (int f = 0; f < frames; f++) sceneUpdateWorld(&scene, jobs);
+  double worldMs = elapsedMs(start) / frames;
+
+  std::vector<size_t> simplified(positions.size());
+  start = Clock::now();
+  jobParallelFor(jobs, positions.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t m = begin; m < end; m++) {
+      float error = 0.0f;
+      std::vector<uint32_t> result = simplifyTriangles(indices[m],
+          positions[m].data(), positions[m].size() / 3, NULL, 0,
+          indices[m].size() / 8, 0.05f, &error);
+      simplified[m] = result.size();
+    }
+  });
+  double lodMs = elapsedMs(start);
+
+  printf("threads %2d: parallel for %.2f us, world %.3f ms, "
+         "simplify %.1f ms\n",
+      threads, emptyUs, worldMs, lodMs);
+  jobSystemDestroy(jobs);
+}
+
+int
+main(int argc, char **argv)
+{
+  int maxThreads = (int)std::thread::hardware_concurrency();
+  int frames = 100;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--threads" && i + 1 < argc)
+      maxThreads = atoi(argv[++i]);
+    else if (arg == "--frames" && i + 1 < argc)
+      frames = atoi(argv[++i]);
+  }
+  if (maxThreads < 1) maxThreads = 1;
+
+  tinygltf::Model model;
+  wideModel(&model);
+  std::vector<std::vector<float>> positions(MESHES);
+  std::vector<std::vector<uint32_t>> indices(MESHES);
+  for (int m = 0; m < MESHES; m++) gridMesh(m, &positions[m], &indices[m]);
+  printf("nodes %zu, %d meshes of %zu triangles\n", model.nodes.size(),
+      MESHES, indices[0].size() / 3);
+
+  bool ok = checkManyJobs(2) && checkManyJobs(4);
+
+  for (int threads = 1; threads <= maxThreads; threads *= 2)
+    run(threads, frames, model, positions, indices);
+  if ((maxThreads & (maxThreads - 1)) != 0)
+    run(maxThreads, frames, model, positions, indices);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,101 @@
+// Headless benchmark of the CPU morph target fallback on a facial-rig-sized
+// primitive, against a scalar blend over every target.
+//
+//   morph-bench [--frames N]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "morph.h"
+
+#define VERTICES 12000
+#define TARGETS 64
+
+static void
+syntheticMorph(MorphPrimitive *morph)
+{
+  srand(1);
+  morph->vertexCount = VERTICES;
+  morph->targetCount = TARGETS;
+  morph->hasNormals = true;
+  morph->basePositions.resize(VERTICES * 3);
+  morph->baseNormals.resize(VERTICES * 3);
+  for (float &v : morph->basePositions) v = rand() / (float)RAND_MAX;
+  for (float &v : morph->baseNormals) v = rand() / (float)RAND_MAX;
+  morph->positionDeltas.assign(TARGETS, std::vector<float>(VERTICES * 3));
+  morph->normalDeltas.assign(TARGETS, std::vector<float>(VERTICES * 3));
+  for (int t = 0; t < TARGETS; t++) {
+    for (float &v : morph->positionDeltas[t])
+      v = (rand() / (float)RAND_MAX - 0.5f) * 0.01f;
+    for (float &v : morph->normalDeltas[t])
+      v = (rand() / (float)RAND_MAX - 0.5f) * 0.1f;
+  }
+}
+
+// Every target, zero or not, one at a time.
+static void
+naiveBlend(const MorphPrimitive &morph, const float *weights, float *positions,
+    float *normals)
+{
+  size_t n = morph.vertexCount * 3;
+  for (size_t i = 0; i < n; i++) {
+    positions[i] = morph.basePositions[i];
+    normals[i] = morph.baseNormals[i];
+  }
+  for (int t = 0; t < morph.targetCount; t++) {
+    for (size_t i = 0; i < n; i++) {
+      positions[i] += weights[t] * morph.positionDeltas[t][i];
+      normals[i] += weights[t] * morph.normalDeltas[t][i];
+    }
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  int frames = 200;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--frames" && i + 1 < argc) frames = atoi(argv[++i]);
+  }
+
+  MorphPrimitive morph;
+  syntheticMorph(&morph);
+  std::vector<float> positions(VERTICES * 3), normals(VERTICES * 3);
+  std::vector<float> expected(VERTICES * 3), expectedNormals(VERTICES * 3);
+  printf("vertices %d, targets %d\n", VERTICES, TARGETS);
+
+  for (int active : {4, 16, 64}) {
+    double naiveMs = 0.0, blendMs = 0.0, error = 0.0;
+    for (int f = 0; f < frames; f++) {
+      std::vector<float> weights(TARGETS, 0.0f);
+      for (int i = 0; i < active; i++)
+        weights[(i * 7 + f) % TARGETS] = 0.5f + 0.5f * sinf(f * 0.1f + i);
+
+      auto a = std::chrono::steady_clock::now();
+      naiveBlend(morph, weights.data(), expected.data(),
+          expectedNormals.data());
+      auto b = std::chrono::steady_clock::now();
+      int targets[MORPH_MAX_ACTIVE];
+      float compact[MORPH_MAX_ACTIVE];
+      int count = activeMorphTargets(
+          weights.data(), TARGETS, TARGETS, targets, compact);
+      morphBlend(morph, targets, compact, count, positions.data(),
+          normals.data());
+      auto c = std::chrono::steady_clock::now();
+
+      naiveMs += std::chrono::duration<double, std::milli>(b - a).count();
+      blendMs += std::chrono::duration<double, std::milli>(c - b).count();
+      for (size_t i = 0; i < positions.size(); i++)
+        error = fmax(error, fabs(positions[i] - expected[i]));
+    }
+    printf("active %2d: all targets %.3f ms, active only %.3f ms, "
+           "max error %.1e\n",
+        active, naiveMs / frames, blendMs / frames, error);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,205 @@
+// Headless benchmark of the software occlusion pass: occluder rasterization,
+// pyramid build and box tests, for 1..N threads.
+//
+//   occlusion-bench [model.gltf] [--frames N]
+//
+// Without a model, a grid of rooms with furniture is generated.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "jobs.h"
+#include "mesh_data.h"
+#include "occlusion.h"
+#include "scene.h"
+#include "transform.h"
+
+typedef struct {
+  std::vector<OccluderMesh> occluderMeshes;
+  std::vector<std::pair<int, Mat4>> occluders;  // mesh, world
+  std::vector<std::pair<Bounds, Mat4>> objects;
+  Bounds sceneBounds;
+} BenchScene;
+
+static OccluderMesh
+boxMesh(float sx, float sy, float sz)
+{
+  OccluderMesh m;
+  for (int i = 0; i < 8; i++) {
+    m.positions.push_back((i & 1) ? sx : -sx);
+    m.positions.push_back((i & 2) ? sy : -sy);
+    m.positions.push_back((i & 4) ? sz : -sz);
+  }
+  const uint32_t faces[6][4] = {{0, 2, 6, 4}, {1, 5, 7, 3}, {0, 4, 5, 1},
+      {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 6, 7, 5}};
+  for (auto &f : faces) {
+    uint32_t tri[6] = {f[0], f[1], f[2], f[0], f[2], f[3]};
+    m.indices.insert(m.indices.end(), tri, tri + 6);
+  }
+  return m;
+}
+
+static Mat4
+translation(float x, float y, float z)
+{
+  Mat4 m = mat4Identity();
+  m.m[12] = x;
+  m.m[13] = y;
+  m.m[14] = z;
+  return m;
+}
+
+// Rooms of 10x10 units with 3 unit high walls, each holding small boxes.
+static void
+syntheticScene(BenchScene *scene, int rooms, int objectsPerRoom)
+{
+  scene->occluderMeshes.push_back(boxMesh(5.0f, 1.5f, 0.1f));
+  scene->occluderMeshes.push_back(boxMesh(0.1f, 1.5f, 5.0f));
+  Bounds small = {{-0.3f, -0.3f, -0.3f}, {0.3f, 0.3f, 0.3f}};
+  srand(1);
+  for (int rz = 0; rz < rooms; rz++) {
+    for (int rx = 0; rx < rooms; rx++) {
+      float cx = rx * 10.0f, cz = rz * 10.0f;
+      scene->occluders.push_back({0, translation(cx, 1.5f, cz - 5.0f)});
+      scene->occluders.push_back({1, translation(cx - 5.0f, 1.5f, cz)});
+      for (int i = 0; i < objectsPerRoom; i++) {
+        float x = cx + (rand() / (float)RAND_MAX - 0.5f) * 8.0f;
+        float z = cz + (rand() / (float)RAND_MAX - 0.5f) * 8.0f;
+        scene->objects.push_back({small, translation(x, 0.3f, z)});
+      }
+    }
+  }
+  scene->sceneBounds = {{-5.0f, 0.0f, -5.0f},
+      {rooms * 10.0f - 5.0f, 3.0f, rooms * 10.0f - 5.0f}};
+}
+
+static bool
+modelScene(BenchScene *scene, const std::string &filename)
+{
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  bool ok = filename.size() > 4 &&
+                    filename.compare(filename.size() - 4, 4, ".glb") == 0
+                ? loader.LoadBinaryFromFile(&model, &err, &warn, filename)
+                : loader.LoadASCIIFromFile(&model, &err, &warn, filename);
+  if (!ok) {
+    fprintf(stderr, "failed to load %s: %s\n", filename.c_str(), err.c_str());
+    return false;
+  }
+
+  std::vector<Mat4> world;
+  computeWorldMatrices(model, displayedScene(model), &world);
+  std::vector<int> occluderIndex(model.meshes.size(), -1);
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    OccluderMesh mesh;
+    if (buildOccluderMesh(model, model.meshes[m],
+            meshIsTaggedOccluder(model.meshes[m]), &mesh)) {
+      occluderIndex[m] = (int)scene->occluderMeshes.size();
+      scene->occluderMeshes.push_back(std::move(mesh));
+    }
+  }
+
+  scene->sceneBounds = boundsEmpty();
+  for (size_t n = 0; n < model.nodes.size(); n++) {
+    int mesh = model.nodes[n].mesh;
+    if (mesh < 0) continue;
+    Bounds b = meshBounds(model, model.meshes[mesh]);
+    if (!boundsValid(b)) continue;
+    scene->objects.push_back({b, world[n]});
+    if (occluderIndex[mesh] >= 0)
+      scene->occluders.push_back({occluderIndex[mesh], world[n]});
+    Bounds wb = boundsTransform(world[n], b);
+    boundsExtend(scene->sceneBounds, wb.min);
+    boundsExtend(scene->sceneBounds, wb.max);
+  }
+  return true;
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string filename;
+  int frames = 200;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--frames" && i + 1 < argc)
+      frames = atoi(argv[++i]);
+    else
+      filename = arg;
+  }
+
+  BenchScene scene;
+  if (filename.empty())
+    syntheticScene(&scene, 16, 64);
+  else if (!modelScene(&scene, filename))
+    return EXIT_FAILURE;
+
+  size_t occluderTriangles = 0;
+  for (auto &o : scene.occluders)
+    occluderTriangles += scene.occluderMeshes[o.first].indices.size() / 3;
+  printf("occluders: %zu (%zu triangles), objects: %zu, buffer %dx%d\n",
+      scene.occluders.size(), occluderTriangles, scene.objects.size(),
+      OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+
+  const Bounds &sb = scene.sceneBounds;
+  float center[3], extent = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    center[i] = 0.5f * (sb.min[i] + sb.max[i]);
+    extent = std::max(extent, sb.max[i] - sb.min[i]);
+  }
+
+  int maxThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> threadCounts;
+  for (int t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+  threadCounts.push_back(maxThreads);
+
+  for (int threads : threadCounts) {
+    JobSystem *jobs = jobSystemCreate(threads);
+    OcclusionBuffer buffer;
+    occlusionInit(&buffer, OCCLUSION_WIDTH, OCCLUSION_HEIGHT, jobs);
+    Mat4 proj = mat4Perspective(45.0f, 2.0f, 0.1f, 1000.0f);
+
+    double renderMs = 0.0, testMs = 0.0;
+    size_t occluded = 0, tested = 0;
+    std::vector<OccluderInstance> instances;
+    for (int f = 0; f < frames; f++) {
+      // Walk around at eye height, looking across the scene.
+      float a = f * 6.2831853f / frames;
+      float eye[3] = {center[0] + cosf(a) * extent * 0.25f,
+          0.5f * (sb.min[1] + sb.max[1]),
+          center[2] + sinf(a) * extent * 0.25f};
+      float up[3] = {0.0f, 1.0f, 0.0f};
+      Mat4 viewProj = mat4Mul(proj, mat4LookAt(eye, center, up));
+
+      auto t0 = std::chrono::steady_clock::now();
+      instances.clear();
+      for (auto &o : scene.occluders)
+        instances.push_back(
+            {&scene.occluderMeshes[o.first], mat4Mul(viewProj, o.second)});
+      occlusionRender(&buffer, instances);
+      auto t1 = std::chrono::steady_clock::now();
+      for (auto &o : scene.objects)
+        occlusionTestBox(&buffer, mat4Mul(viewProj, o.second), o.first);
+      auto t2 = std::chrono::steady_clock::now();
+
+      renderMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+      testMs += std::chrono::duration<double, std::milli>(t2 - t1).count();
+      occluded += buffer.occluded;
+      tested += buffer.tested;
+    }
+
+    printf("threads %2d: render %.3f ms, test %.3f ms, culled %.1f%%\n",
+        threads, renderMs / frames, testMs / frames,
+        tested ? 100.0 * occluded / tested : 0.0);
+    jobSystemDestroy(jobs);
+  }
+
+  return EXIT_SUCCESS;
+}
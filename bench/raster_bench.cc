@@ -0,0 +1,205 @@
+// Benchmark of the software renderer, for 1..N threads, checking that every
+// thread count draws the same image.
+//
+//   raster-bench [model.gltf] [--frames N] [--size WxH] [--out file.png]
+//
+// Without a model, a 24x24 grid of spheres of 16k triangles each is
+// generated. The camera frames the scene from the front; --out writes the
+// last image.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture.h"
+#include "jobs.h"
+#include "loader.h"
+#include "mesh_data.h"
+#include "raster.h"
+#include "scene.h"
+#include "transform.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Appends `bytes` as a buffer view and returns an accessor on it.
+static int
+addAccessor(tinygltf::Model *model, const void *bytes, size_t size,
+    int componentType, int type, size_t count)
+{
+  tinygltf::Buffer &buffer = model->buffers[0];
+  tinygltf::BufferView view;
+  view.buffer = 0;
+  view.byteOffset = buffer.data.size();
+  view.byteLength = size;
+  buffer.data.insert(buffer.data.end(), (const unsigned char *)bytes,
+      (const unsigned char *)bytes + size);
+  model->bufferViews.push_back(view);
+
+  tinygltf::Accessor accessor;
+  accessor.bufferView = (int)model->bufferViews.size() - 1;
+  accessor.componentType = componentType;
+  accessor.type = type;
+  accessor.count = count;
+  model->accessors.push_back(accessor);
+  return (int)model->accessors.size() - 1;
+}
+
+// `grid` x `grid` unit spheres of `rings` x 2 `rings` quads, one node each.
+static void
+sphereGrid(tinygltf::Model *model, int grid, int rings)
+{
+  std::vector<float> positions, normals;
+  int segments = 2 * rings;
+  for (int r = 0; r <= rings; r++) {
+    float theta = (float)M_PI * r / rings;
+    for (int s = 0; s <= segments; s++) {
+      float phi = 2.0f * (float)M_PI * s / segments;
+      float n[3] = {sinf(theta) * cosf(phi), cosf(theta),
+          sinf(theta) * sinf(phi)};
+      positions.insert(positions.end(), n, n + 3);
+      normals.insert(normals.end(), n, n + 3);
+    }
+  }
+  std::vector<uint32_t> indices;
+  for (int r = 0; r < rings; r++) {
+    for (int s = 0; s < segments; s++) {
+      uint32_t i = r * (segments + 1) + s;
+      uint32_t quad[6] = {i, i + 1, i + segments + 1, i + 1,
+          i + segments + 2, i + segments + 1};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+
+  model->buffers.resize(1);
+  tinygltf::Primitive primitive;
+  size_t count = positions.size() / 3;
+  primitive.attributes["POSITION"] = addAccessor(model, positions.data(),
+      positions.size() * sizeof(float), TINYGLTF_COMPONENT_TYPE_FLOAT,
+      TINYGLTF_TYPE_VEC3, count);
+  primitive.attributes["NORMAL"] = addAccessor(model, normals.data(),
+      normals.size() * sizeof(float), TINYGLTF_COMPONENT_TYPE_FLOAT,
+      TINYGLTF_TYPE_VEC3, count);
+  primitive.indices = addAccessor(model, indices.data(),
+      indices.size() * sizeof(uint32_t), TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT,
+      TINYGLTF_TYPE_SCALAR, indices.size());
+  primitive.mode = TINYGLTF_MODE_TRIANGLES;
+  model->meshes.resize(1);
+  model->meshes[0].primitives.push_back(primitive);
+
+  model->scenes.resize(1);
+  for (int i = 0; i < grid * grid; i++) {
+    tinygltf::Node node;
+    node.mesh = 0;
+    node.translation = {2.5 * (i % grid - 0.5 * (grid - 1)),
+        2.5 * (i / grid - 0.5 * (grid - 1)), 0.0};
+    model->scenes[0].nodes.push_back((int)model->nodes.size());
+    model->nodes.push_back(node);
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string filename, out;
+  int frames = 20, width = 1280, height = 720;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--frames" && i + 1 < argc)
+      frames = atoi(argv[++i]);
+    else if (arg == "--size" && i + 1 < argc)
+      sscanf(argv[++i], "%dx%d", &width, &height);
+    else if (arg == "--out" && i + 1 < argc)
+      out = argv[++i];
+    else
+      filename = arg;
+  }
+  frames = std::max(frames, 1);
+
+  tinygltf::Model model;
+  if (filename.empty()) {
+    sphereGrid(&model, 24, 64);
+  } else {
+    std::string err, warn;
+    if (!loadModel(filename, &model, &err, &warn, NULL)) {
+      fprintf(stderr, "failed to load %s: %s\n", filename.c_str(),
+          err.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+  SceneState scene;
+  sceneInit(model, displayedScene(model), &scene);
+  sceneUpdateWorld(&scene);
+
+  // In front of the scene bounds, looking down -z like the viewer.
+  Bounds sb = boundsEmpty();
+  for (int n : scene.order) {
+    int mesh = model.nodes[n].mesh;
+    if (mesh < 0) continue;
+    Bounds b = boundsTransform(scene.world[n],
+        meshBounds(model, model.meshes[mesh]));
+    if (!boundsValid(b)) continue;
+    boundsExtend(sb, b.min);
+    boundsExtend(sb, b.max);
+  }
+  if (!boundsValid(sb)) {
+    fprintf(stderr, "nothing to draw\n");
+    return EXIT_FAILURE;
+  }
+  float center[3], extent = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    center[i] = 0.5f * (sb.min[i] + sb.max[i]);
+    extent = std::max(extent, sb.max[i] - sb.min[i]);
+  }
+  float eye[3] = {center[0], center[1], sb.max[2] + 1.3f * extent};
+  float up[3] = {0.0f, 1.0f, 0.0f};
+  Mat4 viewProj = mat4Mul(
+      mat4Perspective(45.0f, (float)width / height, 0.01f * extent,
+          10.0f * extent),
+      mat4LookAt(eye, center, up));
+
+  int maxThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> threadCounts;
+  for (int t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+  threadCounts.push_back(maxThreads);
+
+  std::vector<uint32_t> reference;
+  bool same = true;
+  for (int threads : threadCounts) {
+    JobSystem *jobs = jobSystemCreate(threads);
+    SoftwareRenderer renderer;
+    auto start = Clock::now();
+    rasterInit(model, width, height, jobs, &renderer);
+    double initMs =
+        std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count();
+    rasterFrame(&renderer, model, scene, viewProj);  // warm up
+    start = Clock::now();
+    for (int f = 0; f < frames; f++)
+      rasterFrame(&renderer, model, scene, viewProj);
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start)
+                    .count() /
+                frames;
+    printf("threads %2d: init %.1f ms, frame %.2f ms (%d draws, %zu "
+           "triangles set up, %zu binned), %.1f Mtriangles/s\n",
+        threads, initMs, ms, (int)renderer.draws, renderer.triangles,
+        renderer.binned, renderer.triangles / ms / 1e3);
+
+    if (reference.empty())
+      reference = renderer.color;
+    else if (reference != renderer.color)
+      same = false;
+    if (threads == threadCounts.back() && !out.empty()) {
+      if (captureWritePng(out, width, height, renderer.pitch * 4,
+              (const unsigned char *)renderer.color.data()))
+        printf("wrote %s\n", out.c_str());
+    }
+    jobSystemDestroy(jobs);
+  }
+  if (!same) printf("images differ between thread counts\n");
+  return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,138 @@
+// Headless benchmark of the CPU side of skinning: world transforms of the
+// skeletons and the joint palette uploaded each frame.
+//
+//   skinning-bench [model.gltf] [--frames N]
+//
+// Without a model, characters with a 64-joint skeleton sharing one mesh are
+// generated, 100 to 4000 of them, their joints swaying every frame.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+#include "skinning.h"
+
+#define JOINTS 64
+
+static void
+syntheticModel(tinygltf::Model *model, int characters)
+{
+  // Only the POSITION bounds of the mesh matter here.
+  model->scenes.resize(1);
+  model->meshes.resize(1);
+  tinygltf::Accessor position;
+  position.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+  position.type = TINYGLTF_TYPE_VEC3;
+  position.count = 0;
+  position.minValues = {-0.5, 0.0, -0.5};
+  position.maxValues = {0.5, (double)JOINTS * 0.1, 0.5};
+  model->accessors.push_back(position);
+  tinygltf::Primitive primitive;
+  primitive.attributes["POSITION"] = 0;
+  model->meshes[0].primitives.push_back(primitive);
+
+  for (int c = 0; c < characters; c++) {
+    tinygltf::Skin skin;
+    int root = (int)model->nodes.size();
+    for (int j = 0; j < JOINTS; j++) {
+      tinygltf::Node joint;
+      if (j == 0) {
+        joint.translation = {(c % 64) * 2.0, 0.0, (c / 64) * 2.0};
+        model->scenes[0].nodes.push_back(root);
+      } else {
+        joint.translation = {0.0, 0.1, 0.0};
+        model->nodes.back().children.push_back(root + j);
+      }
+      model->nodes.push_back(joint);
+      skin.joints.push_back(root + j);
+    }
+    model->skins.push_back(skin);
+
+    tinygltf::Node body;
+    body.mesh = 0;
+    body.skin = c;
+    model->scenes[0].nodes.push_back((int)model->nodes.size());
+    model->nodes.push_back(body);
+  }
+}
+
+static void
+run(const tinygltf::Model &model, int frames)
+{
+  std::vector<SkinData> skins;
+  buildSkins(model, &skins);
+  SceneState scene;
+  sceneInit(model, displayedScene(model), &scene);
+  JointPalette palette;
+
+  size_t joints = 0;
+  for (const SkinData &skin : skins) joints += skin.joints.size();
+  printf("skins %zu, joints %zu, palette %.1f KiB/frame\n", skins.size(),
+      joints, joints * sizeof(Mat4) / 1024.0);
+
+  double worldMs = 0.0, paletteMs = 0.0;
+  for (int f = 0; f < frames; f++) {
+    float angle = 0.05f * sinf(f * 0.1f);
+    for (const SkinData &skin : skins) {
+      for (int node : skin.joints) {
+        if (node < 0) continue;
+        float *q = &scene.rotation[node * 4];
+        q[0] = sinf(angle * 0.5f);
+        q[3] = cosf(angle * 0.5f);
+      }
+    }
+
+    auto a = std::chrono::steady_clock::now();
+    sceneUpdateWorld(&scene);
+    auto b = std::chrono::steady_clock::now();
+    updateJointPalette(skins, scene.world, &palette);
+    auto c = std::chrono::steady_clock::now();
+    worldMs += std::chrono::duration<double, std::milli>(b - a).count();
+    paletteMs += std::chrono::duration<double, std::milli>(c - b).count();
+  }
+  printf("  world %.3f ms, palette %.3f ms (%.1f ns/joint)\n", worldMs / frames,
+      paletteMs / frames,
+      joints ? paletteMs * 1e6 / frames / (double)joints : 0.0);
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string filename;
+  int frames = 200;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--frames" && i + 1 < argc)
+      frames = atoi(argv[++i]);
+    else
+      filename = arg;
+  }
+
+  if (filename.empty()) {
+    for (int characters : {100, 1000, 4000}) {
+      tinygltf::Model model;
+      syntheticModel(&model, characters);
+      run(model, frames);
+    }
+    return EXIT_SUCCESS;
+  }
+
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  std::string err, warn;
+  bool ok = filename.size() > 4 &&
+                    filename.compare(filename.size() - 4, 4, ".glb") == 0
+                ? loader.LoadBinaryFromFile(&model, &err, &warn, filename)
+                : loader.LoadASCIIFromFile(&model, &err, &warn, filename);
+  if (!ok) {
+    fprintf(stderr, "failed to load %s: %s\n", filename.c_str(), err.c_str());
+    return EXIT_FAILURE;
+  }
+  run(model, frames);
+  return EXIT_SUCCESS;
+}
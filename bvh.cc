@@ -0,0 +1,574 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "mesh_data.h"
+
+#define BVH_CHUNK 16384  // items binned by one job
+#define BVH_MAX_DEPTH 64  // deeper nodes are leaves, bounding ray stacks
+
+typedef struct {
+  Bounds bounds;     // of the items
+  Bounds centroids;  // of their centroids
+  uint32_t count;
+} BvhBin;
+
+template <typename ItemBounds>
+struct BvhBuild {
+  JobSystem *jobs;
+  BvhNode *nodes;
+  std::atomic<uint32_t> nodeCount;
+  uint32_t *items;
+  const float *centroids;  // 3 per item
+  ItemBounds itemBounds;   // (item, Bounds *)
+};
+
+static inline void
+boundsMerge(Bounds &a, const Bounds &b)
+{
+  for (int i = 0; i < 3; i++) {
+    a.min[i] = std::min(a.min[i], b.min[i]);
+    a.max[i] = std::max(a.max[i], b.max[i]);
+  }
+}
+
+static inline void
+boundsAdd(Bounds &a, const float p[3])
+{
+  for (int i = 0; i < 3; i++) {
+    a.min[i] = std::min(a.min[i], p[i]);
+    a.max[i] = std::max(a.max[i], p[i]);
+  }
+}
+
+static float
+halfArea(const Bounds &b)
+{
+  float x = b.max[0] - b.min[0], y = b.max[1] - b.min[1],
+        z = b.max[2] - b.min[2];
+  return x * y + y * z + z * x;
+}
+
+static void
+binsClear(BvhBin *bins)
+{
+  for (int i = 0; i < 3 * BVH_BINS; i++)
+    bins[i] = {boundsEmpty(), boundsEmpty(), 0};
+}
+
+// Bin of centroid coordinate `c`; partitioning must use the same rounding.
+static inline int
+binIndex(float c, float min, float scale)
+{
+  int k = (int)((c - min) * scale);
+  return std::min(std::max(k, 0), BVH_BINS - 1);
+}
+
+// Bins the items [begin, end) along all three axes into `bins`, 3 times
+// BVH_BINS of them.
+template <typename B>
+static void
+binItems(const BvhBuild<B> &build, uint32_t begin, uint32_t end,
+    const Bounds &centroids, const float scale[3], BvhBin *bins)
+{
+  binsClear(bins);
+  for (uint32_t i = begin; i < end; i++) {
+    uint32_t item = build.items[i];
+    Bounds b;
+    build.itemBounds(item, &b);
+    const float *c = build.centroids + 3 * item;
+    for (int axis = 0; axis < 3; axis++) {
+      BvhBin &bin = bins[axis * BVH_BINS +
+                         binIndex(c[axis], centroids.min[axis], scale[axis])];
+      boundsMerge(bin.bounds, b);
+      boundsAdd(bin.centroids, c);
+      bin.count++;
+    }
+  }
+}
+
+// Bounds and centroid bounds of the items [begin, end).
+template <typename B>
+static void
+rangeBounds(const BvhBuild<B> &build, uint32_t begin, uint32_t end,
+    Bounds *bounds, Bounds *centroids)
+{
+  *bounds = boundsEmpty();
+  *centroids = boundsEmpty();
+  for (uint32_t i = begin; i < end; i++) {
+    Bounds b;
+    build.itemBounds(build.items[i], &b);
+    boundsMerge(*bounds, b);
+    boundsAdd(*centroids, build.centroids + 3 * build.items[i]);
+  }
+}
+
+template <typename B>
+static void
+buildNode(BvhBuild<B> *build, uint32_t index, uint32_t begin, uint32_t end,
+    const Bounds &bounds, const Bounds &centroids, int depth)
+{
+  BvhNode &node = build->nodes[index];
+  for (int i = 0; i < 3; i++) {
+    node.min[i] = bounds.min[i];
+    node.max[i] = bounds.max[i];
+  }
+  node.first = begin;
+  node.count = end - begin;
+  uint32_t count = end - begin;
+  if (count <= BVH_LEAF_SIZE || depth >= BVH_MAX_DEPTH) return;
+
+  float scale[3];
+  for (int axis = 0; axis < 3; axis++) {
+    float extent = centroids.max[axis] - centroids.min[axis];
+    scale[axis] = extent > 0.0f ? BVH_BINS / extent : 0.0f;
+  }
+  BvhBin bins[3 * BVH_BINS];
+  if (build->jobs && count > BVH_PARALLEL_SIZE) {
+    size_t chunks = (count + BVH_CHUNK - 1) / BVH_CHUNK;
+    std::vector<BvhBin> chunkBins(chunks * 3 * BVH_BINS);
+    jobParallelFor(build->jobs, chunks, 1, [&](size_t b, size_t e) {
+      for (size_t c = b; c < e; c++) {
+        uint32_t first = begin + (uint32_t)(c * BVH_CHUNK);
+        binItems(*build, first, std::min(end, first + BVH_CHUNK), centroids,
+            scale, &chunkBins[c * 3 * BVH_BINS]);
+      }
+    });
+    binsClear(bins);
+    for (size_t c = 0; c < chunks; c++) {
+      for (int i = 0; i < 3 * BVH_BINS; i++) {
+        const BvhBin &bin = chunkBins[c * 3 * BVH_BINS + i];
+        boundsMerge(bins[i].bounds, bin.bounds);
+        boundsMerge(bins[i].centroids, bin.centroids);
+        bins[i].count += bin.count;
+      }
+    }
+  } else {
+    binItems(*build, begin, end, centroids, scale, bins);
+  }
+
+  // Cheapest split between bins by the surface area heuristic.
+  float bestCost = INFINITY;
+  int bestAxis = -1, bestSplit = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    if (scale[axis] == 0.0f) continue;
+    const BvhBin *axisBins = bins + axis * BVH_BINS;
+    float rightArea[BVH_BINS];
+    uint32_t rightCount[BVH_BINS];
+    Bounds acc = boundsEmpty();
+    uint32_t n = 0;
+    for (int k = BVH_BINS - 1; k > 0; k--) {
+      boundsMerge(acc, axisBins[k].bounds);
+      n += axisBins[k].count;
+      rightArea[k] = n ? halfArea(acc) : 0.0f;
+      rightCount[k] = n;
+    }
+    acc = boundsEmpty();
+    n = 0;
+    for (int k = 0; k < BVH_BINS - 1; k++) {
+      boundsMerge(acc, axisBins[k].bounds);
+      n += axisBins[k].count;
+      if (n == 0 || rightCount[k + 1] == 0) continue;
+      float cost = halfArea(acc) * n + rightArea[k + 1] * rightCount[k + 1];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = k;
+      }
+    }
+  }
+  // Visiting two children costs about as much as a triangle test more.
+  float area = halfArea(bounds);
+  if (count <= BVH_MAX_LEAF &&
+      (bestAxis < 0 || area + bestCost >= area * count))
+    return;
+
+  uint32_t mid;
+  Bounds childBounds[2], childCentroids[2];
+  if (bestAxis >= 0) {
+    int axis = bestAxis;
+    float min = centroids.min[axis], s = scale[axis];
+    const float *c = build->centroids;
+    mid = (uint32_t)(std::partition(build->items + begin,
+                         build->items + end,
+                         [&](uint32_t item) {
+                           return binIndex(c[3 * item + axis], min, s) <=
+                                  bestSplit;
+                         }) -
+                     build->items);
+    for (int side = 0; side < 2; side++) {
+      childBounds[side] = boundsEmpty();
+      childCentroids[side] = boundsEmpty();
+    }
+    for (int k = 0; k < BVH_BINS; k++) {
+      const BvhBin &bin = bins[axis * BVH_BINS + k];
+      int side = k <= bestSplit ? 0 : 1;
+      boundsMerge(childBounds[side], bin.bounds);
+      boundsMerge(childCentroids[side], bin.centroids);
+    }
+  } else {
+    // Every centroid is the same point: halve the list.
+    mid = begin + count / 2;
+    rangeBounds(*build, begin, mid, &childBounds[0], &childCentroids[0]);
+    rangeBounds(*build, mid, end, &childBounds[1], &childCentroids[1]);
+  }
+
+  uint32_t first = build->nodeCount.fetch_add(2);
+  node.first = first;
+  node.count = 0;
+  uint32_t ranges[3] = {begin, mid, end};
+  auto child = [&](size_t side) {
+    buildNode(build, first + (uint32_t)side, ranges[side], ranges[side + 1],
+        childBounds[side], childCentroids[side], depth + 1);
+  };
+  if (build->jobs && count > BVH_PARALLEL_SIZE) {
+    jobParallelFor(build->jobs, 2, 1, [&](size_t b, size_t e) {
+      for (size_t side = b; side < e; side++) child(side);
+    });
+  } else {
+    child(0);
+    child(1);
+  }
+}
+
+// Hierarchy over `count` items with `centroids`, their bounds given by
+// itemBounds(item, Bounds *). `items` receives them in leaf order.
+template <typename B>
+static void
+buildBvh(JobSystem *jobs, uint32_t count, const float *centroids,
+    const B &itemBounds, std::vector<BvhNode> *nodes,
+    std::vector<uint32_t> *items)
+{
+  nodes->clear();
+  items->resize(count);
+  if (count == 0) return;
+  for (uint32_t i = 0; i < count; i++) (*items)[i] = i;
+  nodes->resize(2 * (size_t)count - 1);
+
+  BvhBuild<B> build = {jobs, nodes->data(), {1}, items->data(), centroids,
+      itemBounds};
+  size_t chunks = (count + BVH_CHUNK - 1) / BVH_CHUNK;
+  std::vector<Bounds> chunkBounds(chunks), chunkCentroids(chunks);
+  jobParallelFor(jobs, chunks, 1, [&](size_t b, size_t e) {
+    for (size_t c = b; c < e; c++) {
+      uint32_t first = (uint32_t)(c * BVH_CHUNK);
+      rangeBounds(build, first, std::min(count, first + BVH_CHUNK),
+          &chunkBounds[c], &chunkCentroids[c]);
+    }
+  });
+  Bounds bounds = boundsEmpty(), centroidBounds = boundsEmpty();
+  for (size_t c = 0; c < chunks; c++) {
+    boundsMerge(bounds, chunkBounds[c]);
+    boundsMerge(centroidBounds, chunkCentroids[c]);
+  }
+
+  buildNode(&build, 0, 0, count, bounds, centroidBounds, 0);
+  nodes->resize(build.nodeCount.load());
+  nodes->shrink_to_fit();
+}
+
+void
+buildMeshBvh(const tinygltf::Model &model, const tinygltf::Mesh &mesh,
+    JobSystem *jobs, MeshBvh *out)
+{
+  *out = MeshBvh();
+  std::vector<uint32_t> indices;  // in primitive order
+  for (const tinygltf::Primitive &primitive : mesh.primitives) {
+    out->primitiveStart.push_back((uint32_t)(indices.size() / 3));
+    int mode = primitive.mode < 0 ? TINYGLTF_MODE_TRIANGLES : primitive.mode;
+    if (mode != TINYGLTF_MODE_TRIANGLES &&
+        mode != TINYGLTF_MODE_TRIANGLE_STRIP &&
+        mode != TINYGLTF_MODE_TRIANGLE_FAN)
+      continue;
+    auto it = primitive.attributes.find("POSITION");
+    std::vector<float> positions;
+    std::vector<uint32_t> source;
+    int components;
+    if (it == primitive.attributes.end() ||
+        !readAccessorFloats(model, it->second, &positions, &components) ||
+        components != 3 || !readIndices(model, primitive, &source))
+      continue;
+
+    uint32_t base = (uint32_t)(out->positions.size() / 3);
+    uint32_t vertices = (uint32_t)(positions.size() / 3);
+    out->positions.insert(
+        out->positions.end(), positions.begin(), positions.end());
+    // Triangles with an index out of range stay, degenerate, so that the
+    // numbering matches the primitive.
+    auto triangle = [&](uint32_t a, uint32_t b, uint32_t c) {
+      bool valid = a < vertices && b < vertices && c < vertices;
+      indices.push_back(base + (valid ? a : 0));
+      indices.push_back(base + (valid ? b : 0));
+      indices.push_back(base + (valid ? c : 0));
+    };
+    size_t n = source.size();
+    if (mode == TINYGLTF_MODE_TRIANGLES) {
+      for (size_t i = 0; i + 2 < n; i += 3)
+        triangle(source[i], source[i + 1], source[i + 2]);
+    } else if (mode == TINYGLTF_MODE_TRIANGLE_STRIP) {
+      for (size_t i = 0; i + 2 < n; i++)
+        triangle(source[i], source[i + 1], source[i + 2]);
+    } else {
+      for (size_t i = 1; i + 1 < n; i++)
+        triangle(source[0], source[i], source[i + 1]);
+    }
+  }
+  uint32_t count = (uint32_t)(indices.size() / 3);
+  out->primitiveStart.push_back(count);
+  if (count == 0) return;
+
+  const float *p = out->positions.data();
+  const uint32_t *t = indices.data();
+  std::vector<float> centroids(3 * (size_t)count);
+  jobParallelFor(jobs, count, BVH_CHUNK, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      for (int a = 0; a < 3; a++)
+        centroids[3 * i + a] = (p[3 * t[3 * i] + a] + p[3 * t[3 * i + 1] + a] +
+                                   p[3 * t[3 * i + 2] + a]) /
+                               3.0f;
+  });
+  auto triangleBounds = [p, t](uint32_t triangle, Bounds *b) {
+    *b = boundsEmpty();
+    for (int v = 0; v < 3; v++) boundsAdd(*b, p + 3 * t[3 * triangle + v]);
+  };
+  buildBvh(jobs, count, centroids.data(), triangleBounds, &out->nodes,
+      &out->triangles);
+
+  out->indices.resize(indices.size());
+  for (uint32_t i = 0; i < count; i++)
+    for (int v = 0; v < 3; v++)
+      out->indices[3 * i + v] = indices[3 * out->triangles[i] + v];
+}
+
+// Distance at which the ray enters `node`, if before `maxDistance`.
+static inline bool
+rayBox(const BvhNode &node, const float o[3], const float inverse[3],
+    float maxDistance, float *entry)
+{
+  float t0 = 0.0f, t1 = maxDistance;
+  for (int a = 0; a < 3; a++) {
+    float n = (node.min[a] - o[a]) * inverse[a];
+    float f = (node.max[a] - o[a]) * inverse[a];
+    t0 = fmaxf(t0, fminf(n, f));
+    t1 = fminf(t1, fmaxf(n, f));
+  }
+  *entry = t0;
+  return t0 <= t1;
+}
+
+// Moller-Trumbore, both faces.
+static inline bool
+rayTriangle(const float o[3], const float d[3], const float *v0,
+    const float *v1, const float *v2, float *distance)
+{
+  float e1[3], e2[3], s[3];
+  for (int a = 0; a < 3; a++) {
+    e1[a] = v1[a] - v0[a];
+    e2[a] = v2[a] - v0[a];
+    s[a] = o[a] - v0[a];
+  }
+  float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+      d[0] * e2[1] - d[1] * e2[0]};
+  float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+  if (det == 0.0f) return false;
+  float inv = 1.0f / det;
+  float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+  if (u < 0.0f || u > 1.0f) return false;
+  float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2],
+      s[0] * e1[1] - s[1] * e1[0]};
+  float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+  if (v < 0.0f || u + v > 1.0f) return false;
+  float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+  if (t <= 0.0f || t >= *distance) return false;
+  *distance = t;
+  return true;
+}
+
+// Front-to-back traversal of `nodes`, calling leaf(first, count) for the
+// leaves the ray enters before `*distance`, which leaf may shrink.
+template <typename Leaf>
+static void
+traverse(const std::vector<BvhNode> &nodes, const float o[3],
+    const float d[3], const float *distance, const Leaf &leaf)
+{
+  if (nodes.empty()) return;
+  float inverse[3] = {1.0f / d[0], 1.0f / d[1], 1.0f / d[2]};
+  struct {
+    uint32_t node;
+    float entry;
+  } stack[BVH_MAX_DEPTH + 1];
+  int top = 0;
+  float entry;
+  if (!rayBox(nodes[0], o, inverse, *distance, &entry)) return;
+  stack[top++] = {0, entry};
+  while (top > 0) {
+    top--;
+    if (stack[top].entry > *distance) continue;
+    const BvhNode &node = nodes[stack[top].node];
+    if (node.count) {
+      leaf(node.first, node.count);
+      continue;
+    }
+    float e0, e1;
+    bool h0 = rayBox(nodes[node.first], o, inverse, *distance, &e0);
+    bool h1 = rayBox(nodes[node.first + 1], o, inverse, *distance, &e1);
+    if (h0 && h1) {
+      bool swap = e1 < e0;
+      stack[top++] = {node.first + (swap ? 0u : 1u), swap ? e0 : e1};
+      stack[top++] = {node.first + (swap ? 1u : 0u), swap ? e1 : e0};
+    } else if (h0) {
+      stack[top++] = {node.first, e0};
+    } else if (h1) {
+      stack[top++] = {node.first + 1, e1};
+    }
+  }
+}
+
+bool
+meshBvhRay(const MeshBvh &bvh, const float origin[3],
+    const float direction[3], float *distance, uint32_t *triangle)
+{
+  bool hit = false;
+  const float *p = bvh.positions.data();
+  const uint32_t *t = bvh.indices.data();
+  traverse(bvh.nodes, origin, direction, distance,
+      [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; i++) {
+          if (rayTriangle(origin, direction, p + 3 * t[3 * i],
+                  p + 3 * t[3 * i + 1], p + 3 * t[3 * i + 2], distance)) {
+            *triangle = bvh.triangles[i];
+            hit = true;
+          }
+        }
+      });
+  return hit;
+}
+
+// Refits the top level to moved instances. Children always come after their
+// parent, so one backward pass does it.
+static void
+refitInstances(PickScene *scene, const std::vector<Bounds> &bounds)
+{
+  for (size_t n = scene->nodes.size(); n-- > 0;) {
+    BvhNode &node = scene->nodes[n];
+    Bounds b = boundsEmpty();
+    if (node.count) {
+      for (uint32_t i = node.first; i < node.first + node.count; i++)
+        boundsMerge(b, bounds[scene->order[i]]);
+    } else {
+      for (int c = 0; c < 2; c++) {
+        const BvhNode &child = scene->nodes[node.first + c];
+        Bounds cb = {{child.min[0], child.min[1], child.min[2]},
+            {child.max[0], child.max[1], child.max[2]}};
+        boundsMerge(b, cb);
+      }
+    }
+    for (int a = 0; a < 3; a++) {
+      node.min[a] = b.min[a];
+      node.max[a] = b.max[a];
+    }
+  }
+}
+
+void
+pickSetInstances(const tinygltf::Model &model,
+    const std::vector<PickInstance> &instances, PickScene *scene)
+{
+  scene->meshes.resize(model.meshes.size());
+  scene->meshBuilt.resize(model.meshes.size(), 0);
+  std::vector<int> missing;
+  for (const PickInstance &instance : instances) {
+    if (scene->meshBuilt[instance.mesh]) continue;
+    scene->meshBuilt[instance.mesh] = 1;
+    missing.push_back(instance.mesh);
+  }
+  jobParallelFor(scene->jobs, missing.size(), 1, [&](size_t b, size_t e) {
+    for (size_t i = b; i < e; i++)
+      buildMeshBvh(model, model.meshes[missing[i]], scene->jobs,
+          &scene->meshes[missing[i]]);
+  });
+
+  bool same = !scene->nodes.empty();
+  size_t count = 0;
+  for (const PickInstance &instance : instances) {
+    if (scene->meshes[instance.mesh].nodes.empty()) continue;
+    if (count < scene->instances.size()) {
+      const PickInstance &previous = scene->instances[count];
+      same = same && previous.node == instance.node &&
+             previous.instance == instance.instance &&
+             previous.mesh == instance.mesh;
+    }
+    count++;
+  }
+  same = same && count == scene->instances.size();
+
+  scene->instances.clear();
+  scene->inverse.clear();
+  std::vector<Bounds> bounds;
+  std::vector<float> centroids;
+  for (const PickInstance &instance : instances) {
+    const MeshBvh &mesh = scene->meshes[instance.mesh];
+    if (mesh.nodes.empty()) continue;
+    const BvhNode &root = mesh.nodes[0];
+    Bounds local = {{root.min[0], root.min[1], root.min[2]},
+        {root.max[0], root.max[1], root.max[2]}};
+    Bounds b = boundsTransform(instance.world, local);
+    scene->instances.push_back(instance);
+    scene->inverse.push_back(mat4AffineInverse(instance.world));
+    bounds.push_back(b);
+    for (int a = 0; a < 3; a++)
+      centroids.push_back(0.5f * (b.min[a] + b.max[a]));
+  }
+
+  if (same) {
+    refitInstances(scene, bounds);
+    return;
+  }
+  auto instanceBounds = [&bounds](uint32_t instance, Bounds *b) {
+    *b = bounds[instance];
+  };
+  buildBvh(scene->jobs, (uint32_t)bounds.size(), centroids.data(),
+      instanceBounds, &scene->nodes, &scene->order);
+}
+
+bool
+pickRay(const PickScene &scene, const float origin[3],
+    const float direction[3], PickHit *hit)
+{
+  float distance = INFINITY;
+  int best = -1;
+  uint32_t triangle = 0;
+  traverse(scene.nodes, origin, direction, &distance,
+      [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; i++) {
+          uint32_t instance = scene.order[i];
+          const Mat4 &inverse = scene.inverse[instance];
+          float o[3], d[3];
+          mat4TransformPoint(inverse, origin, o);
+          mat4TransformVector(inverse, direction, d);
+          const MeshBvh &mesh = scene.meshes[scene.instances[instance].mesh];
+          if (meshBvhRay(mesh, o, d, &distance, &triangle))
+            best = (int)instance;
+        }
+      });
+
+  *hit = PickHit{-1, 0, -1, -1, -1, distance, {0.0f, 0.0f, 0.0f}};
+  if (best < 0) return false;
+  const PickInstance &instance = scene.instances[best];
+  const std::vector<uint32_t> &start =
+      scene.meshes[instance.mesh].primitiveStart;
+  int primitive =
+      (int)(std::upper_bound(start.begin(), start.end(), triangle) -
+            start.begin()) -
+      1;
+  hit->node = instance.node;
+  hit->instance = instance.instance;
+  hit->mesh = instance.mesh;
+  hit->primitive = primitive;
+  hit->triangle = (int)(triangle - start[primitive]);
+  for (int a = 0; a < 3; a++)
+    hit->position[a] = origin[a] + direction[a] * distance;
+  return true;
+}
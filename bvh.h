@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "jobs.h"
+#include "tiny_gltf.h"
+#include "transform.h"
+
+// Bounding volume hierarchies for ray picking.
+//
+// Every mesh gets a hierarchy over the triangles of its triangle primitives,
+// in object space, built once with the surface area heuristic over binned
+// centroids and shared by all the nodes drawing the mesh. A top-level
+// hierarchy over the world bounds of those instances points into them; it
+// is refitted when the instances move and only rebuilt when they change.
+// Large nodes are binned and their children built in parallel on the job
+// system. Skinned and morphed meshes are picked in their rest pose.
+
+#define BVH_BINS 16
+#define BVH_LEAF_SIZE 2   // nodes this small are always leaves
+#define BVH_MAX_LEAF 8    // and up to this size when splitting costs more
+#define BVH_PARALLEL_SIZE 32768  // items above which a node uses the jobs
+
+// A node of either level. Inner nodes have a zero `count` and their
+// children at `first` and `first + 1`, always after them; leaves hold the
+// items [first, first + count).
+typedef struct {
+  float min[3];
+  uint32_t first;
+  float max[3];
+  uint32_t count;
+} BvhNode;
+
+typedef struct {
+  std::vector<BvhNode> nodes;  // empty without triangles
+  std::vector<float> positions;  // xyz per vertex, primitive after primitive
+  std::vector<uint32_t> indices;  // 3 per triangle, in leaf order
+  std::vector<uint32_t> triangles;  // mesh-wide number, in leaf order
+  // Mesh-wide number of the first triangle of each primitive, plus the
+  // total. Primitives that are not triangles have none.
+  std::vector<uint32_t> primitiveStart;
+} MeshBvh;
+
+typedef struct {
+  int node;
+  int instance;  // EXT_mesh_gpu_instancing instance, 0 without
+  int mesh;
+  Mat4 world;
+} PickInstance;
+
+typedef struct {
+  JobSystem *jobs;  // NULL builds on the caller
+  std::vector<MeshBvh> meshes;  // by mesh, built on first use
+  std::vector<unsigned char> meshBuilt;
+  std::vector<PickInstance> instances;  // of meshes with triangles
+  std::vector<Mat4> inverse;  // of their world transforms
+  std::vector<BvhNode> nodes;  // top level
+  std::vector<uint32_t> order;  // instances, in leaf order
+} PickScene;
+
+typedef struct {
+  int node;  // -1 when nothing is hit
+  int instance;
+  int mesh;
+  int primitive;
+  int triangle;  // within the primitive, strips and fans included
+  float distance;  // along the ray, in lengths of its direction
+  float position[3];  // world space
+} PickHit;
+
+// Hierarchy over the triangle, strip and fan primitives of `mesh`.
+void buildMeshBvh(const tinygltf::Model &model, const tinygltf::Mesh &mesh,
+    JobSystem *jobs, MeshBvh *out);
+
+// Nearest triangle of `bvh` hit by the ray closer than `*distance`, which is
+// updated. `direction` need not be normalized.
+bool meshBvhRay(const MeshBvh &bvh, const float origin[3],
+    const float direction[3], float *distance, uint32_t *triangle);
+
+// Sets the instances to pick from, building the hierarchies of the meshes
+// seen for the first time. The top level is refitted when the instances
+// are those of the previous call in the same order, and rebuilt otherwise.
+void pickSetInstances(const tinygltf::Model &model,
+    const std::vector<PickInstance> &instances, PickScene *scene);
+
+// Nearest triangle hit by the world-space ray. `direction` need not be
+// normalized.
+bool pickRay(const PickScene &scene, const float origin[3],
+    const float direction[3], PickHit *hit);
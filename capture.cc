@@ -0,0 +1,120 @@
+#include "capture.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "profiler.h"
+#include "stb_image_write.h"
+
+typedef struct {
+  std::string filename;
+  int width;
+  int height;
+  std::vector<unsigned char> pixels;
+} CaptureFrame;
+
+struct CaptureWriter {
+  size_t maxQueued;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable changed;  // a frame queued or written, or stop
+  std::deque<CaptureFrame> queue;
+  std::vector<std::vector<unsigned char>> spare;  // of written frames
+  size_t pending;  // queued or being written
+  bool stop;
+  size_t written;
+  size_t failed;
+};
+
+static void
+captureThread(CaptureWriter *writer)
+{
+  profilerSetThreadName("capture");
+  std::unique_lock<std::mutex> lock(writer->mutex);
+  for (;;) {
+    writer->changed.wait(
+        lock, [writer] { return !writer->queue.empty() || writer->stop; });
+    if (writer->queue.empty()) return;
+    CaptureFrame frame = std::move(writer->queue.front());
+    writer->queue.pop_front();
+    lock.unlock();
+    bool ok;
+    {
+      PROFILE_ZONE("write png");
+      ok = captureWritePng(frame.filename, frame.width, frame.height,
+          (size_t)frame.width * 4, frame.pixels.data());
+    }
+    lock.lock();
+    if (ok)
+      writer->written++;
+    else
+      writer->failed++;
+    writer->spare.push_back(std::move(frame.pixels));
+    writer->pending--;
+    writer->changed.notify_all();
+  }
+}
+
+CaptureWriter *
+captureWriterCreate(size_t maxQueued)
+{
+  CaptureWriter *writer = new CaptureWriter();
+  writer->maxQueued = maxQueued > 0 ? maxQueued : 1;
+  writer->thread = std::thread(captureThread, writer);
+  return writer;
+}
+
+void
+captureWriterDestroy(CaptureWriter *writer, size_t *written, size_t *failed)
+{
+  {
+    std::lock_guard<std::mutex> lock(writer->mutex);
+    writer->stop = true;
+  }
+  writer->changed.notify_all();
+  writer->thread.join();
+  *written = writer->written;
+  *failed = writer->failed;
+  delete writer;
+}
+
+std::vector<unsigned char>
+captureWriterBuffer(CaptureWriter *writer, size_t bytes)
+{
+  std::vector<unsigned char> pixels;
+  {
+    std::lock_guard<std::mutex> lock(writer->mutex);
+    if (!writer->spare.empty()) {
+      pixels = std::move(writer->spare.back());
+      writer->spare.pop_back();
+    }
+  }
+  pixels.resize(bytes);
+  return pixels;
+}
+
+void
+captureWriterQueue(CaptureWriter *writer, const std::string &filename,
+    int width, int height, std::vector<unsigned char> &&pixels)
+{
+  std::unique_lock<std::mutex> lock(writer->mutex);
+  writer->changed.wait(
+      lock, [writer] { return writer->pending < writer->maxQueued; });
+  writer->queue.push_back({filename, width, height, std::move(pixels)});
+  writer->pending++;
+  writer->changed.notify_all();
+}
+
+bool
+captureWritePng(const std::string &filename, int width, int height,
+    size_t rowBytes, const unsigned char *pixels)
+{
+  if (width <= 0 || height <= 0) return false;
+  // PNG rows go top to bottom: start at the last row and step back, which
+  // stb_image_write allows, rather than flipping a copy.
+  const unsigned char *top = pixels + (size_t)(height - 1) * rowBytes;
+  return stbi_write_png(filename.c_str(), width, height, 4, top,
+             -(int)rowBytes) != 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// PNG writing of captured frames on a thread of its own, so that encoding,
+// tens of milliseconds a frame, stays off the render loop. Frames are
+// written in the order they are queued.
+
+typedef struct CaptureWriter CaptureWriter;
+
+// Queueing a frame blocks while `maxQueued` are waiting or being written,
+// which bounds the memory held when the disk cannot keep up.
+CaptureWriter *captureWriterCreate(size_t maxQueued);
+
+// Writes every queued frame, stops the thread and tells how many frames
+// were written and how many failed.
+void captureWriterDestroy(CaptureWriter *writer, size_t *written,
+    size_t *failed);
+
+// `bytes` of storage for a frame, reusing the pixels of a written one.
+std::vector<unsigned char> captureWriterBuffer(CaptureWriter *writer,
+    size_t bytes);
+
+// Queues RGBA8 rows, bottom row first as OpenGL reads them back, to be
+// written to `filename`.
+void captureWriterQueue(CaptureWriter *writer, const std::string &filename,
+    int width, int height, std::vector<unsigned char> &&pixels);
+
+// Writes RGBA8 rows, bottom row first, to a PNG.
+bool captureWritePng(const std::string &filename, int width, int height,
+    size_t rowBytes, const unsigned char *pixels);
@@ -0,0 +1,5 @@
+// The #version line is prepended by the viewer. Only depth is written.
+
+void main(void)
+{
+}
@@ -0,0 +1,1080 @@
+#include "gltf_writer.h"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "stb_image_write.h"
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+#define DATA_URI_BUFFER "data:application/octet-stream;base64,"
+#define DATA_URI_PNG "data:image/png;base64,"
+
+namespace {
+
+// Buffered writes to a file descriptor. The first error is kept and later
+// writes are dropped.
+struct Output {
+  int fd = -1;
+  uint64_t offset = 0;  // bytes written, buffered ones included
+  size_t used = 0;
+  int error = 0;
+  char buffer[OUTPUT_BUFFER_SIZE];
+
+  bool flush();
+  bool writev(struct iovec *iov, int count);
+
+  void write(const char *data, size_t size)
+  {
+    if (size > OUTPUT_BUFFER_SIZE - used) {
+      flush();
+      if (size >= OUTPUT_BUFFER_SIZE) {  // no point copying it
+        struct iovec iov = {(void *)data, size};
+        writev(&iov, 1);
+        return;
+      }
+    }
+    memcpy(buffer + used, data, size);
+    used += size;
+    offset += size;
+  }
+
+  void put(char c)
+  {
+    if (used == OUTPUT_BUFFER_SIZE) flush();
+    buffer[used++] = c;
+    offset++;
+  }
+
+  void write(const char *s) { write(s, strlen(s)); }
+};
+
+// Encodes into an Output, three bytes at a time.
+struct Base64 {
+  Output *out;
+  unsigned char pending[3];
+  int count = 0;
+
+  explicit Base64(Output *out) : out(out) {}
+
+  void write(const unsigned char *data, size_t size);
+  void finish();
+};
+
+// Writes JSON into an Output, keeping track of where commas go.
+struct Json {
+  Output *out;
+  std::vector<bool> first;  // per open object or array
+  bool afterKey = false;
+
+  explicit Json(Output *out) : out(out) {}
+
+  void separate()
+  {
+    if (afterKey) {
+      afterKey = false;
+    } else if (!first.empty()) {
+      if (!first.back()) out->put(',');
+      first.back() = false;
+    }
+  }
+
+  void begin(char c)
+  {
+    separate();
+    out->put(c);
+    first.push_back(true);
+  }
+
+  void end(char c)
+  {
+    out->put(c);
+    first.pop_back();
+  }
+
+  void beginObject() { begin('{'); }
+  void endObject() { end('}'); }
+  void beginArray() { begin('['); }
+  void endArray() { end(']'); }
+
+  void key(const char *name)
+  {
+    separate();
+    quote(name, strlen(name));
+    out->put(':');
+    afterKey = true;
+  }
+
+  void quote(const char *s, size_t size);
+
+  void string(const std::string &s)
+  {
+    separate();
+    quote(s.data(), s.size());
+  }
+
+  void number(double value)
+  {
+    separate();
+    if (!std::isfinite(value)) {
+      out->write("null", 4);  // as nlohmann::json writes them
+      return;
+    }
+    char text[32];
+    std::to_chars_result r = std::to_chars(text, text + sizeof(text), value);
+    out->write(text, r.ptr - text);
+  }
+
+  void integer(int64_t value)
+  {
+    separate();
+    char text[24];
+    std::to_chars_result r = std::to_chars(text, text + sizeof(text), value);
+    out->write(text, r.ptr - text);
+  }
+
+  void boolean(bool value)
+  {
+    separate();
+    out->write(value ? "true" : "false");
+  }
+
+  void member(const char *name, int64_t value)
+  {
+    key(name);
+    integer(value);
+  }
+
+  void member(const char *name, double value)
+  {
+    key(name);
+    number(value);
+  }
+
+  void member(const char *name, const std::string &value)
+  {
+    key(name);
+    string(value);
+  }
+
+  template <typename T>
+  void array(const char *name, const std::vector<T> &values)
+  {
+    if (values.empty()) return;
+    key(name);
+    beginArray();
+    for (const T &v : values) {
+      if (std::is_integral<T>::value)
+        integer((int64_t)v);
+      else
+        number((double)v);
+    }
+    endArray();
+  }
+};
+
+}  // namespace
+
+bool
+Output::writev(struct iovec *iov, int count)
+{
+  while (count > 0 && !error) {
+    ssize_t n = ::writev(fd, iov, std::min(count, IOV_MAX));
+    if (n < 0) {
+      if (errno != EINTR) error = errno;
+      continue;
+    }
+    offset += n;
+    // Skip what was written; a short write leaves a partial iovec.
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return !error;
+}
+
+bool
+Output::flush()
+{
+  if (used == 0) return !error;
+  struct iovec iov = {buffer, used};
+  offset -= used;  // counted when buffered
+  used = 0;
+  return writev(&iov, 1);
+}
+
+void
+Base64::write(const unsigned char *data, size_t size)
+{
+  static const char table[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  while (count > 0 && count < 3 && size > 0) {
+    pending[count++] = *data++;
+    size--;
+  }
+  if (count == 3) {
+    count = 0;
+    write(pending, 3);
+  }
+
+  // Whole groups are encoded a block at a time.
+  char block[4096];
+  while (size >= 3) {
+    size_t groups = std::min(size / 3, sizeof(block) / 4);
+    for (size_t g = 0; g < groups; g++, data += 3) {
+      uint32_t v = data[0] << 16 | data[1] << 8 | data[2];
+      block[g * 4] = table[v >> 18];
+      block[g * 4 + 1] = table[(v >> 12) & 63];
+      block[g * 4 + 2] = table[(v >> 6) & 63];
+      block[g * 4 + 3] = table[v & 63];
+    }
+    out->write(block, groups * 4);
+    size -= groups * 3;
+  }
+  while (size > 0) {
+    pending[count++] = *data++;
+    size--;
+  }
+}
+
+void
+Base64::finish()
+{
+  static const char table[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  if (count == 0) return;
+  uint32_t v = pending[0] << 16 | (count > 1 ? pending[1] << 8 : 0);
+  char group[4] = {table[v >> 18], table[(v >> 12) & 63],
+      count > 1 ? table[(v >> 6) & 63] : '=', '='};
+  out->write(group, 4);
+  count = 0;
+}
+
+void
+Json::quote(const char *s, size_t size)
+{
+  out->put('"');
+  size_t start = 0;
+  for (size_t i = 0; i < size; i++) {
+    unsigned char c = s[i];
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    out->write(s + start, i - start);
+    start = i + 1;
+    char escape[8];
+    if (c == '"' || c == '\\') {
+      escape[0] = '\\';
+      escape[1] = c;
+      out->write(escape, 2);
+    } else {
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      out->write(escape, 6);
+    }
+  }
+  out->write(s + start, size - start);
+  out->put('"');
+}
+
+static bool
+serializable(const tinygltf::Value &value)
+{
+  return value.Type() != tinygltf::NULL_TYPE &&
+         value.Type() != tinygltf::BINARY_TYPE;
+}
+
+// Null and binary values are left out, like tinygltf does.
+static void
+writeValue(Json *json, const tinygltf::Value &value)
+{
+  switch (value.Type()) {
+    case tinygltf::REAL_TYPE:
+      json->number(value.Get<double>());
+      break;
+    case tinygltf::INT_TYPE:
+      json->integer(value.Get<int>());
+      break;
+    case tinygltf::BOOL_TYPE:
+      json->boolean(value.Get<bool>());
+      break;
+    case tinygltf::STRING_TYPE:
+      json->string(value.Get<std::string>());
+      break;
+    case tinygltf::ARRAY_TYPE:
+      json->beginArray();
+      for (const tinygltf::Value &v : value.Get<tinygltf::Value::Array>())
+        if (serializable(v)) writeValue(json, v);
+      json->endArray();
+      break;
+    case tinygltf::OBJECT_TYPE:
+      json->beginObject();
+      for (const auto &it : value.Get<tinygltf::Value::Object>()) {
+        if (!serializable(it.second)) continue;
+        json->key(it.first.c_str());
+        writeValue(json, it.second);
+      }
+      json->endObject();
+      break;
+  }
+}
+
+static void
+writeExtras(Json *json, const tinygltf::Value &extras)
+{
+  if (!serializable(extras)) return;
+  json->key("extras");
+  writeValue(json, extras);
+}
+
+// The body of an "extensions" object; an extension without a value is
+// written as {}.
+static void
+writeExtensionMembers(Json *json, const tinygltf::ExtensionMap &extensions)
+{
+  for (const auto &it : extensions) {
+    if (it.first.empty()) continue;
+    json->key(it.first.c_str());
+    if (serializable(it.second)) {
+      writeValue(json, it.second);
+    } else {
+      json->beginObject();
+      json->endObject();
+    }
+  }
+}
+
+static void
+writeExtensions(Json *json, const tinygltf::ExtensionMap &extensions)
+{
+  if (extensions.empty()) return;
+  json->key("extensions");
+  json->beginObject();
+  writeExtensionMembers(json, extensions);
+  json->endObject();
+}
+
+static const char *
+typeName(int type)
+{
+  switch (type) {
+    case TINYGLTF_TYPE_SCALAR:
+      return "SCALAR";
+    case TINYGLTF_TYPE_VEC2:
+      return "VEC2";
+    case TINYGLTF_TYPE_VEC3:
+      return "VEC3";
+    case TINYGLTF_TYPE_VEC4:
+      return "VEC4";
+    case TINYGLTF_TYPE_MAT2:
+      return "MAT2";
+    case TINYGLTF_TYPE_MAT3:
+      return "MAT3";
+    case TINYGLTF_TYPE_MAT4:
+      return "MAT4";
+  }
+  return "";
+}
+
+static void
+writeAccessor(Json *json, const tinygltf::Accessor &accessor)
+{
+  json->beginObject();
+  if (accessor.bufferView >= 0)
+    json->member("bufferView", (int64_t)accessor.bufferView);
+  if (accessor.byteOffset != 0)
+    json->member("byteOffset", (int64_t)accessor.byteOffset);
+  json->member("componentType", (int64_t)accessor.componentType);
+  json->member("count", (int64_t)accessor.count);
+
+  // Integer bounds are written as integers.
+  if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT ||
+      accessor.componentType == TINYGLTF_COMPONENT_TYPE_DOUBLE) {
+    json->array("min", accessor.minValues);
+    json->array("max", accessor.maxValues);
+  } else {
+    json->array("min",
+        std::vector<int>(accessor.minValues.begin(), accessor.minValues.end()));
+    json->array("max",
+        std::vector<int>(accessor.maxValues.begin(), accessor.maxValues.end()));
+  }
+  if (accessor.normalized) {
+    json->key("normalized");
+    json->boolean(true);
+  }
+  json->member("type", std::string(typeName(accessor.type)));
+  if (!accessor.name.empty()) json->member("name", accessor.name);
+  writeExtras(json, accessor.extras);
+
+  if (accessor.sparse.isSparse) {
+    json->key("sparse");
+    json->beginObject();
+    json->member("count", (int64_t)accessor.sparse.count);
+    json->key("indices");
+    json->beginObject();
+    json->member("bufferView", (int64_t)accessor.sparse.indices.bufferView);
+    json->member("byteOffset", (int64_t)accessor.sparse.indices.byteOffset);
+    json->member(
+        "componentType", (int64_t)accessor.sparse.indices.componentType);
+    json->endObject();
+    json->key("values");
+    json->beginObject();
+    json->member("bufferView", (int64_t)accessor.sparse.values.bufferView);
+    json->member("byteOffset", (int64_t)accessor.sparse.values.byteOffset);
+    json->endObject();
+    json->endObject();
+  }
+  json->endObject();
+}
+
+static void
+writeAnimation(Json *json, const tinygltf::Animation &animation)
+{
+  json->beginObject();
+  if (!animation.name.empty()) json->member("name", animation.name);
+
+  json->key("channels");
+  json->beginArray();
+  for (const tinygltf::AnimationChannel &channel : animation.channels) {
+    json->beginObject();
+    json->member("sampler", (int64_t)channel.sampler);
+    json->key("target");
+    json->beginObject();
+    json->member("node", (int64_t)channel.target_node);
+    json->member("path", channel.target_path);
+    writeExtensions(json, channel.target_extensions);
+    json->endObject();
+    writeExtras(json, channel.extras);
+    writeExtensions(json, channel.extensions);
+    json->endObject();
+  }
+  json->endArray();
+
+  json->key("samplers");
+  json->beginArray();
+  for (const tinygltf::AnimationSampler &sampler : animation.samplers) {
+    json->beginObject();
+    json->member("input", (int64_t)sampler.input);
+    json->member("output", (int64_t)sampler.output);
+    json->member("interpolation", sampler.interpolation);
+    writeExtras(json, sampler.extras);
+    json->endObject();
+  }
+  json->endArray();
+
+  writeExtras(json, animation.extras);
+  writeExtensions(json, animation.extensions);
+  json->endObject();
+}
+
+static void
+writeAsset(Json *json, const tinygltf::Asset &asset)
+{
+  json->beginObject();
+  if (!asset.generator.empty()) json->member("generator", asset.generator);
+  if (!asset.copyright.empty()) json->member("copyright", asset.copyright);
+  json->member("version", asset.version.empty() ? "2.0" : asset.version);
+  writeExtras(json, asset.extras);
+  writeExtensions(json, asset.extensions);
+  json->endObject();
+}
+
+static void
+writeBufferView(Json *json, const tinygltf::BufferView &view)
+{
+  json->beginObject();
+  json->member("buffer", (int64_t)view.buffer);
+  json->member("byteLength", (int64_t)view.byteLength);
+  if (view.byteStride >= 4)
+    json->member("byteStride", (int64_t)view.byteStride);
+  if (view.byteOffset > 0)
+    json->member("byteOffset", (int64_t)view.byteOffset);
+  if (view.target == TINYGLTF_TARGET_ARRAY_BUFFER ||
+      view.target == TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER)
+    json->member("target", (int64_t)view.target);
+  if (!view.name.empty()) json->member("name", view.name);
+  writeExtras(json, view.extras);
+  json->endObject();
+}
+
+static void
+writeTextureInfo(Json *json, const char *name, int index, int texCoord,
+    const char *factorName, double factor, const tinygltf::Value &extras,
+    const tinygltf::ExtensionMap &extensions)
+{
+  if (index < 0) return;
+  json->key(name);
+  json->beginObject();
+  json->member("index", (int64_t)index);
+  if (texCoord != 0) json->member("texCoord", (int64_t)texCoord);
+  if (factorName && factor != 1.0) json->member(factorName, factor);
+  writeExtras(json, extras);
+  writeExtensions(json, extensions);
+  json->endObject();
+}
+
+static void
+writeMaterial(Json *json, const tinygltf::Material &material)
+{
+  const tinygltf::PbrMetallicRoughness &pbr = material.pbrMetallicRoughness;
+  const tinygltf::NormalTextureInfo &normal = material.normalTexture;
+  const tinygltf::OcclusionTextureInfo &occlusion = material.occlusionTexture;
+  const tinygltf::TextureInfo &emissive = material.emissiveTexture;
+
+  json->beginObject();
+  if (!material.name.empty()) json->member("name", material.name);
+  if (material.alphaCutoff != 0.5)
+    json->member("alphaCutoff", material.alphaCutoff);
+  if (material.alphaMode != "OPAQUE")
+    json->member("alphaMode", material.alphaMode);
+  if (material.doubleSided) {
+    json->key("doubleSided");
+    json->boolean(true);
+  }
+  writeTextureInfo(json, "normalTexture", normal.index, normal.texCoord,
+      "scale", normal.scale, normal.extras, normal.extensions);
+  writeTextureInfo(json, "occlusionTexture", occlusion.index,
+      occlusion.texCoord, "strength", occlusion.strength, occlusion.extras,
+      occlusion.extensions);
+  writeTextureInfo(json, "emissiveTexture", emissive.index, emissive.texCoord,
+      nullptr, 1.0, emissive.extras, emissive.extensions);
+  if (material.emissiveFactor != std::vector<double>{0.0, 0.0, 0.0})
+    json->array("emissiveFactor", material.emissiveFactor);
+
+  // Left out when everything in it has its default value.
+  bool baseColor = pbr.baseColorFactor != std::vector<double>(4, 1.0);
+  if (baseColor || pbr.metallicFactor != 1.0 || pbr.roughnessFactor != 1.0 ||
+      pbr.baseColorTexture.index >= 0 ||
+      pbr.metallicRoughnessTexture.index >= 0 || !pbr.extensions.empty() ||
+      serializable(pbr.extras)) {
+    json->key("pbrMetallicRoughness");
+    json->beginObject();
+    if (baseColor) json->array("baseColorFactor", pbr.baseColorFactor);
+    if (pbr.metallicFactor != 1.0)
+      json->member("metallicFactor", pbr.metallicFactor);
+    if (pbr.roughnessFactor != 1.0)
+      json->member("roughnessFactor", pbr.roughnessFactor);
+    writeTextureInfo(json, "baseColorTexture", pbr.baseColorTexture.index,
+        pbr.baseColorTexture.texCoord, nullptr, 1.0,
+        pbr.baseColorTexture.extras, pbr.baseColorTexture.extensions);
+    writeTextureInfo(json, "metallicRoughnessTexture",
+        pbr.metallicRoughnessTexture.index,
+        pbr.metallicRoughnessTexture.texCoord, nullptr, 1.0,
+        pbr.metallicRoughnessTexture.extras,
+        pbr.metallicRoughnessTexture.extensions);
+    writeExtensions(json, pbr.extensions);
+    writeExtras(json, pbr.extras);
+    json->endObject();
+  }
+
+  writeExtensions(json, material.extensions);
+  writeExtras(json, material.extras);
+  json->endObject();
+}
+
+static void
+writeAttributes(Json *json, const std::map<std::string, int> &attributes)
+{
+  json->beginObject();
+  for (const auto &it : attributes)
+    json->member(it.first.c_str(), (int64_t)it.second);
+  json->endObject();
+}
+
+static void
+writeMesh(Json *json, const tinygltf::Mesh &mesh)
+{
+  json->beginObject();
+  json->key("primitives");
+  json->beginArray();
+  for (const tinygltf::Primitive &primitive : mesh.primitives) {
+    json->beginObject();
+    json->key("attributes");
+    writeAttributes(json, primitive.attributes);
+    if (primitive.indices >= 0)
+      json->member("indices", (int64_t)primitive.indices);
+    if (primitive.material >= 0)
+      json->member("material", (int64_t)primitive.material);
+    json->member("mode", (int64_t)primitive.mode);
+    if (!primitive.targets.empty()) {
+      json->key("targets");
+      json->beginArray();
+      for (const std::map<std::string, int> &target : primitive.targets)
+        writeAttributes(json, target);
+      json->endArray();
+    }
+    writeExtensions(json, primitive.extensions);
+    writeExtras(json, primitive.extras);
+    json->endObject();
+  }
+  json->endArray();
+
+  json->array("weights", mesh.weights);
+  if (!mesh.name.empty()) json->member("name", mesh.name);
+  writeExtensions(json, mesh.extensions);
+  writeExtras(json, mesh.extras);
+  json->endObject();
+}
+
+static void
+writeNode(Json *json, const tinygltf::Node &node)
+{
+  json->beginObject();
+  json->array("translation", node.translation);
+  json->array("rotation", node.rotation);
+  json->array("scale", node.scale);
+  json->array("matrix", node.matrix);
+  if (node.mesh != -1) json->member("mesh", (int64_t)node.mesh);
+  if (node.skin != -1) json->member("skin", (int64_t)node.skin);
+  if (node.camera != -1) json->member("camera", (int64_t)node.camera);
+  json->array("weights", node.weights);
+  writeExtras(json, node.extras);
+  writeExtensions(json, node.extensions);
+  if (!node.name.empty()) json->member("name", node.name);
+  json->array("children", node.children);
+  json->endObject();
+}
+
+static void
+writeScene(Json *json, const tinygltf::Scene &scene)
+{
+  json->beginObject();
+  json->array("nodes", scene.nodes);
+  if (!scene.name.empty()) json->member("name", scene.name);
+  writeExtras(json, scene.extras);
+  writeExtensions(json, scene.extensions);
+  json->endObject();
+}
+
+static void
+writeSkin(Json *json, const tinygltf::Skin &skin)
+{
+  json->beginObject();
+  json->key("joints");
+  json->beginArray();
+  for (int joint : skin.joints) json->integer(joint);
+  json->endArray();
+  if (skin.inverseBindMatrices >= 0)
+    json->member("inverseBindMatrices", (int64_t)skin.inverseBindMatrices);
+  if (skin.skeleton >= 0) json->member("skeleton", (int64_t)skin.skeleton);
+  if (!skin.name.empty()) json->member("name", skin.name);
+  json->endObject();
+}
+
+static void
+writeTexture(Json *json, const tinygltf::Texture &texture)
+{
+  json->beginObject();
+  if (texture.sampler >= 0) json->member("sampler", (int64_t)texture.sampler);
+  if (texture.source >= 0) json->member("source", (int64_t)texture.source);
+  if (!texture.name.empty()) json->member("name", texture.name);
+  writeExtras(json, texture.extras);
+  writeExtensions(json, texture.extensions);
+  json->endObject();
+}
+
+static void
+writeSampler(Json *json, const tinygltf::Sampler &sampler)
+{
+  json->beginObject();
+  if (sampler.magFilter != -1)
+    json->member("magFilter", (int64_t)sampler.magFilter);
+  if (sampler.minFilter != -1)
+    json->member("minFilter", (int64_t)sampler.minFilter);
+  json->member("wrapS", (int64_t)sampler.wrapS);
+  json->member("wrapT", (int64_t)sampler.wrapT);
+  writeExtras(json, sampler.extras);
+  json->endObject();
+}
+
+static void
+writeCamera(Json *json, const tinygltf::Camera &camera)
+{
+  json->beginObject();
+  json->member("type", camera.type);
+  if (!camera.name.empty()) json->member("name", camera.name);
+  if (camera.type == "orthographic") {
+    const tinygltf::OrthographicCamera &o = camera.orthographic;
+    json->key("orthographic");
+    json->beginObject();
+    json->member("zfar", o.zfar);
+    json->member("znear", o.znear);
+    json->member("xmag", o.xmag);
+    json->member("ymag", o.ymag);
+    writeExtras(json, o.extras);
+    json->endObject();
+  } else if (camera.type == "perspective") {
+    const tinygltf::PerspectiveCamera &p = camera.perspective;
+    json->key("perspective");
+    json->beginObject();
+    json->member("zfar", p.zfar);
+    json->member("znear", p.znear);
+    if (p.aspectRatio > 0) json->member("aspectRatio", p.aspectRatio);
+    if (p.yfov > 0) json->member("yfov", p.yfov);
+    writeExtras(json, p.extras);
+    json->endObject();
+  }
+  writeExtras(json, camera.extras);
+  writeExtensions(json, camera.extensions);
+  json->endObject();
+}
+
+static void
+writeLight(Json *json, const tinygltf::Light &light)
+{
+  json->beginObject();
+  if (!light.name.empty()) json->member("name", light.name);
+  json->member("intensity", light.intensity);
+  if (light.range > 0.0) json->member("range", light.range);
+  json->array("color", light.color);
+  json->member("type", light.type);
+  if (light.type == "spot") {
+    json->key("spot");
+    json->beginObject();
+    json->member("innerConeAngle", light.spot.innerConeAngle);
+    json->member("outerConeAngle", light.spot.outerConeAngle);
+    writeExtensions(json, light.spot.extensions);
+    writeExtras(json, light.spot.extras);
+    json->endObject();
+  }
+  writeExtensions(json, light.extensions);
+  writeExtras(json, light.extras);
+  json->endObject();
+}
+
+template <typename T>
+static void
+writeArray(Json *json, const char *name, const std::vector<T> &items,
+    void (*write)(Json *, const T &))
+{
+  if (items.empty()) return;
+  json->key(name);
+  json->beginArray();
+  for (const T &item : items) write(json, item);
+  json->endArray();
+}
+
+static std::string
+baseDir(const std::string &filename)
+{
+  size_t slash = filename.find_last_of('/');
+  return slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+}
+
+static std::string
+stem(const std::string &path)
+{
+  size_t slash = path.find_last_of('/');
+  std::string name =
+      slash == std::string::npos ? path : path.substr(slash + 1);
+  return name.substr(0, name.rfind('.'));
+}
+
+// A "uri" member encoded straight into the output.
+static void
+writeDataUri(Json *json, const char *header, const unsigned char *data,
+    size_t size)
+{
+  json->key("uri");
+  json->separate();
+  json->out->put('"');
+  json->out->write(header);
+  Base64 base64(json->out);
+  base64.write(data, size);
+  base64.finish();
+  json->out->put('"');
+}
+
+static bool
+writeFile(const std::string &path, const unsigned char *data, size_t size,
+    std::string *err)
+{
+  Output file;
+  file.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file.fd < 0) {
+    *err = "cannot create " + path + ": " + strerror(errno);
+    return false;
+  }
+  struct iovec iov = {(void *)data, size};
+  file.writev(&iov, 1);
+  if (close(file.fd) != 0 && !file.error) file.error = errno;
+  if (file.error) *err = "cannot write " + path + ": " + strerror(file.error);
+  return !file.error;
+}
+
+static void
+appendPng(void *context, void *data, int size)
+{
+  std::vector<unsigned char> *png = (std::vector<unsigned char> *)context;
+  png->insert(png->end(), (unsigned char *)data, (unsigned char *)data + size);
+}
+
+// stb_image_write builds the whole PNG in memory before handing it over.
+static bool
+encodePng(const tinygltf::Image &image, std::vector<unsigned char> *png)
+{
+  if (image.bits != 8 || image.width <= 0 || image.height <= 0 ||
+      image.image.size() <
+          (size_t)image.width * image.height * image.component)
+    return false;
+  return stbi_write_png_to_func(appendPng, png, image.width, image.height,
+             image.component, image.image.data(), 0) != 0;
+}
+
+static bool
+writeImage(Json *json, const tinygltf::Image &image, int index,
+    const std::string &dir, bool embed, std::string *err)
+{
+  json->beginObject();
+  std::vector<unsigned char> png;
+  if (!image.image.empty() && image.bufferView < 0 && !image.as_is) {
+    if (!encodePng(image, &png)) {
+      *err = "cannot encode image " + std::to_string(index) + " as PNG";
+      return false;
+    }
+    if (embed) {
+      writeDataUri(json, DATA_URI_PNG, png.data(), png.size());
+    } else {
+      std::string name = !image.uri.empty() && image.uri.find(':') ==
+                                                   std::string::npos
+                             ? stem(image.uri)
+                         : !image.name.empty() ? image.name
+                                               : std::to_string(index);
+      if (!writeFile(dir + name + ".png", png.data(), png.size(), err))
+        return false;
+      json->member("uri", name + ".png");
+    }
+  } else if (image.uri.empty()) {
+    json->member("mimeType", image.mimeType);
+    json->member("bufferView", (int64_t)image.bufferView);
+  } else {
+    json->member("uri", image.uri);
+  }
+
+  if (!image.name.empty()) json->member("name", image.name);
+  writeExtras(json, image.extras);
+  writeExtensions(json, image.extensions);
+  json->endObject();
+  return true;
+}
+
+static bool
+isDataUri(const std::string &uri)
+{
+  return uri.compare(0, 5, "data:") == 0;
+}
+
+static bool
+writeBuffer(Json *json, const tinygltf::Buffer &buffer, int index,
+    const std::string &filename, bool embed, bool bin, std::string *err)
+{
+  json->beginObject();
+  json->member("byteLength", (int64_t)buffer.data.size());
+  if (bin) {
+    // Written after the JSON, in the BIN chunk.
+  } else if (embed) {
+    writeDataUri(
+        json, DATA_URI_BUFFER, buffer.data.data(), buffer.data.size());
+  } else {
+    std::string uri = !buffer.uri.empty() && !isDataUri(buffer.uri)
+                          ? buffer.uri
+                          : stem(filename) +
+                                (index ? std::to_string(index) : "") + ".bin";
+    if (!writeFile(baseDir(filename) + uri, buffer.data.data(),
+            buffer.data.size(), err))
+      return false;
+    json->member("uri", uri);
+  }
+  if (!buffer.name.empty()) json->member("name", buffer.name);
+  writeExtras(json, buffer.extras);
+  json->endObject();
+  return true;
+}
+
+static bool
+writeModel(Json *json, const tinygltf::Model &model,
+    const std::string &filename, bool embedImages, bool embedBuffers,
+    bool glbBuffer, std::string *err)
+{
+  json->beginObject();
+  writeArray(json, "accessors", model.accessors, writeAccessor);
+
+  // Animations without channels are left out.
+  bool animations = false;
+  for (const tinygltf::Animation &animation : model.animations) {
+    if (animation.channels.empty()) continue;
+    if (!animations) {
+      json->key("animations");
+      json->beginArray();
+      animations = true;
+    }
+    writeAnimation(json, animation);
+  }
+  if (animations) json->endArray();
+
+  json->key("asset");
+  writeAsset(json, model.asset);
+  writeArray(json, "bufferViews", model.bufferViews, writeBufferView);
+  if (!model.extensionsRequired.empty()) {
+    json->key("extensionsRequired");
+    json->beginArray();
+    for (const std::string &name : model.extensionsRequired)
+      json->string(name);
+    json->endArray();
+  }
+  writeArray(json, "materials", model.materials, writeMaterial);
+  writeArray(json, "meshes", model.meshes, writeMesh);
+  writeArray(json, "nodes", model.nodes, writeNode);
+  if (model.defaultScene > -1)
+    json->member("scene", (int64_t)model.defaultScene);
+  writeArray(json, "scenes", model.scenes, writeScene);
+  writeArray(json, "skins", model.skins, writeSkin);
+  writeArray(json, "textures", model.textures, writeTexture);
+  writeArray(json, "samplers", model.samplers, writeSampler);
+  writeArray(json, "cameras", model.cameras, writeCamera);
+
+  // Lights are written as KHR_lights_punctual.
+  bool lights = !model.lights.empty();
+  if (!model.extensions.empty() || lights) {
+    json->key("extensions");
+    json->beginObject();
+    for (const auto &it : model.extensions) {
+      if (lights && it.first == "KHR_lights_punctual") continue;
+      tinygltf::ExtensionMap one = {it};
+      writeExtensionMembers(json, one);
+    }
+    if (lights) {
+      json->key("KHR_lights_punctual");
+      json->beginObject();
+      writeArray(json, "lights", model.lights, writeLight);
+      json->endObject();
+    }
+    json->endObject();
+  }
+  std::vector<std::string> used = model.extensionsUsed;
+  if (lights && std::find(used.begin(), used.end(), "KHR_lights_punctual") ==
+                    used.end())
+    used.push_back("KHR_lights_punctual");
+  if (!used.empty()) {
+    json->key("extensionsUsed");
+    json->beginArray();
+    for (const std::string &name : used) json->string(name);
+    json->endArray();
+  }
+  writeExtras(json, model.extras);
+
+  if (!model.buffers.empty()) {
+    json->key("buffers");
+    json->beginArray();
+    for (size_t i = 0; i < model.buffers.size(); i++) {
+      if (!writeBuffer(json, model.buffers[i], (int)i, filename, embedBuffers,
+              glbBuffer && i == 0, err))
+        return false;
+    }
+    json->endArray();
+  }
+
+  if (!model.images.empty()) {
+    json->key("images");
+    json->beginArray();
+    for (size_t i = 0; i < model.images.size(); i++) {
+      if (!writeImage(json, model.images[i], (int)i, baseDir(filename),
+              embedImages, err))
+        return false;
+    }
+    json->endArray();
+  }
+  json->endObject();
+  return true;
+}
+
+static void
+storeU32(unsigned char *p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (i * 8));
+}
+
+bool
+writeGltf(const tinygltf::Model &model, const std::string &filename,
+    bool embedImages, bool embedBuffers, bool binary, std::string *err)
+{
+  bool glbBuffer =
+      binary && !model.buffers.empty() && model.buffers[0].uri.empty();
+  const std::vector<unsigned char> *bin =
+      glbBuffer ? &model.buffers[0].data : nullptr;
+  if (bin && bin->size() > UINT32_MAX - 64) {
+    *err = "the first buffer is too large for a GLB";
+    return false;
+  }
+
+  Output *out = new Output;
+  out->fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out->fd < 0) {
+    *err = "cannot create " + filename + ": " + strerror(errno);
+    delete out;
+    return false;
+  }
+
+  // The GLB header and JSON chunk header are filled in once the sizes are
+  // known.
+  unsigned char header[20] = {};
+  if (binary) out->write((const char *)header, sizeof(header));
+  Json json(out);
+  bool ok = writeModel(&json, model, filename, embedImages, embedBuffers,
+      glbBuffer, err);
+
+  if (ok && binary) {
+    while (out->offset % 4) out->put(' ');
+    uint64_t jsonLength = out->offset - sizeof(header);
+    out->flush();
+
+    unsigned char chunk[8], padding[4] = {};
+    struct iovec iov[3];
+    int count = 0;
+    if (bin && !bin->empty()) {
+      uint32_t length = (uint32_t)((bin->size() + 3) & ~size_t(3));
+      storeU32(chunk, length);
+      storeU32(chunk + 4, 0x004e4942);  // BIN
+      iov[count++] = {chunk, sizeof(chunk)};
+      iov[count++] = {(void *)bin->data(), bin->size()};
+      if (length != bin->size())
+        iov[count++] = {padding, length - bin->size()};
+      out->writev(iov, count);
+    }
+
+    if (out->offset > UINT32_MAX) {
+      *err = "the file is too large for a GLB";
+      ok = false;
+    }
+    memcpy(header, "glTF", 4);
+    storeU32(header + 4, 2);
+    storeU32(header + 8, (uint32_t)out->offset);
+    storeU32(header + 12, (uint32_t)jsonLength);
+    storeU32(header + 16, 0x4e4f534a);  // JSON
+    if (!out->error && pwrite(out->fd, header, sizeof(header), 0) < 0)
+      out->error = errno;
+  } else if (ok) {
+    out->put('\n');
+  }
+
+  out->flush();
+  if (close(out->fd) != 0 && !out->error) out->error = errno;
+  if (ok && out->error) {
+    *err = "cannot write " + filename + ": " + strerror(out->error);
+    ok = false;
+  }
+  delete out;
+  return ok;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+#include "tiny_gltf.h"
+
+// Writes `model` as .gltf, or as .glb when `binary`, with the same output
+// rules as TinyGLTF::WriteGltfSceneToFile, but without its copies: the JSON
+// is written as it is generated instead of being built as a document and
+// dumped into a string, embedded buffers and images are base64 encoded
+// straight into the output, and the GLB BIN chunk and external .bin files
+// are written from Buffer::data with writev.
+//
+// With `binary`, the first buffer goes into the BIN chunk if it has no uri.
+// Other buffers are embedded as data URIs with `embedBuffers`, or else
+// written next to `filename` as <name>.bin, <name>1.bin, ... (or their own
+// uri if it is a file). Images with decoded pixels are encoded as PNG,
+// embedded with `embedImages` and otherwise written next to `filename`;
+// images without pixels keep their uri or buffer view. The JSON is compact.
+// Returns false with `err` set on failure.
+bool writeGltf(const tinygltf::Model &model, const std::string &filename,
+    bool embedImages, bool embedBuffers, bool binary, std::string *err);
@@ -0,0 +1,57 @@
+#include "instancing.h"
+
+#include "mesh_data.h"
+
+void
+instanceFromWorld(const Mat4 &world, InstanceData *out)
+{
+  memcpy(out->model, world.m, sizeof(out->model));
+  mat4NormalMatrix(world, out->normal);
+  out->palette = -1.0f;
+}
+
+static bool
+readInstanceAttribute(const tinygltf::Model &model,
+    const tinygltf::Value &attributes, const char *name, int components,
+    size_t *count, std::vector<float> *out)
+{
+  if (!attributes.Has(name)) return true;
+  const tinygltf::Value &index = attributes.Get(name);
+  int n = 0;
+  if (!index.IsNumber() ||
+      !readAccessorFloats(model, index.GetNumberAsInt(), out, &n) ||
+      n != components)
+    return false;
+
+  size_t elements = out->size() / components;
+  if (*count != 0 && *count != elements) return false;
+  *count = elements;
+  return true;
+}
+
+bool
+readGpuInstances(const tinygltf::Model &model, const tinygltf::Node &node,
+    std::vector<Mat4> *local)
+{
+  auto it = node.extensions.find("EXT_mesh_gpu_instancing");
+  if (it == node.extensions.end() || !it->second.Has("attributes"))
+    return false;
+  const tinygltf::Value &attributes = it->second.Get("attributes");
+
+  std::vector<float> t, r, s;
+  size_t count = 0;
+  if (!readInstanceAttribute(model, attributes, "TRANSLATION", 3, &count, &t) ||
+      !readInstanceAttribute(model, attributes, "ROTATION", 4, &count, &r) ||
+      !readInstanceAttribute(model, attributes, "SCALE", 3, &count, &s))
+    return false;
+  if (count == 0) return false;
+
+  const float zero[3] = {0, 0, 0}, one[3] = {1, 1, 1};
+  const float identity[4] = {0, 0, 0, 1};
+  local->resize(count);
+  for (size_t i = 0; i < count; i++) {
+    (*local)[i] = mat4FromTRS(t.empty() ? zero : &t[i * 3],
+        r.empty() ? identity : &r[i * 4], s.empty() ? one : &s[i * 3]);
+  }
+  return true;
+}
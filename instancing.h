@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+#include "tiny_gltf.h"
+#include "transform.h"
+
+// Per-instance vertex data: world matrix and normal matrix, both
+// column-major, and the first joint of the skin in the joint palette.
+// Streamed as instanced vertex attributes.
+typedef struct {
+  float model[16];
+  float normal[9];
+  float palette;  // -1 for unskinned instances
+} InstanceData;
+
+// Unskinned instance placed by `world`.
+void instanceFromWorld(const Mat4 &world, InstanceData *out);
+
+// EXT_mesh_gpu_instancing: the TRANSLATION/ROTATION/SCALE of every instance
+// of the node's mesh, relative to the node. Returns false when the node does
+// not use the extension or its accessors are invalid.
+bool readGpuInstances(const tinygltf::Model &model,
+    const tinygltf::Node &node, std::vector<Mat4> *local);
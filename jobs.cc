@@ -0,0 +1,322 @@
+#include "jobs.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+#define JOB_DEQUE_SIZE 4096  // power of two
+#define JOB_POOL_SIZE 4096   // jobs per pool block
+#define JOB_SPINS 64         // failed steals before a worker sleeps
+#define JOB_RANGES 16        // ranges a parallel for makes per worker, at most
+
+namespace {
+
+// Chase-Lev deque, in the formulation of Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (PPoPP 2013), with a fixed buffer.
+struct JobDeque {
+  std::atomic<long> top{0};
+  std::atomic<long> bottom{0};
+  std::atomic<Job *> jobs[JOB_DEQUE_SIZE];
+
+  // Owner only. False when full.
+  bool push(Job *job)
+  {
+    long b = bottom.load(std::memory_order_relaxed);
+    long t = top.load(std::memory_order_acquire);
+    if (b - t >= JOB_DEQUE_SIZE) return false;
+    jobs[b & (JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Owner only, newest first.
+  Job *pop()
+  {
+    long b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Job *job = jobs[b & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+    if (t == b) {
+      // Last job: race the thieves for it.
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+              std::memory_order_relaxed))
+        job = nullptr;
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+  }
+
+  // Any thread, oldest first.
+  Job *steal()
+  {
+    long t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+    Job *job = jobs[t & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+            std::memory_order_relaxed))
+      return nullptr;
+    return job;
+  }
+};
+
+struct JobWorker {
+  JobSystem *system;
+  int index;
+  JobDeque deque;
+  std::vector<std::unique_ptr<Job[]>> pool;  // blocks of JOB_POOL_SIZE
+  size_t next = 0;
+  unsigned seed;
+};
+
+thread_local JobWorker *currentWorker = nullptr;
+
+}  // namespace
+
+struct JobSystem {
+  std::vector<std::unique_ptr<JobWorker>> workers;
+  std::vector<std::thread> threads;
+  std::atomic<bool> quit{false};
+  std::atomic<int> sleeping{0};
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+};
+
+// The parent is read first: once its count drops to 0, the slot of a job
+// can be reused by its owner.
+static void
+finishJob(Job *job)
+{
+  while (job) {
+    Job *parent = job->parent;
+    if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1) break;
+    job = parent;
+  }
+}
+
+static void
+executeJob(Job *job)
+{
+  job->function(job->data);
+  finishJob(job);
+}
+
+static Job *
+findJob(JobWorker *worker)
+{
+  Job *job = worker->deque.pop();
+  if (job) return job;
+
+  JobSystem *system = worker->system;
+  int count = (int)system->workers.size();
+  if (count < 2) return nullptr;
+  worker->seed = worker->seed * 1103515245u + 12345u;
+  int start = (int)((worker->seed >> 16) % (unsigned)count);
+  for (int i = 0; i < count; i++) {
+    int victim = (start + i) % count;
+    if (victim == worker->index) continue;
+    job = system->workers[victim]->deque.steal();
+    if (job) return job;
+  }
+  return nullptr;
+}
+
+static void
+workerLoop(JobWorker *worker)
+{
+  currentWorker = worker;
+  JobSystem *system = worker->system;
+  std::string name = "worker " + std::to_string(worker->index);
+  profilerSetThreadName(name.c_str());
+  int idle = 0;
+  while (!system->quit.load(std::memory_order_acquire)) {
+    Job *job = findJob(worker);
+    if (job) {
+      executeJob(job);
+      idle = 0;
+      continue;
+    }
+    if (++idle < JOB_SPINS) {
+      std::this_thread::yield();
+      continue;
+    }
+    // Wakeups are sent without the lock, so a missed one only costs the
+    // timeout.
+    system->sleeping.fetch_add(1);
+    {
+      std::unique_lock<std::mutex> lock(system->sleepMutex);
+      system->wake.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    system->sleeping.fetch_sub(1);
+  }
+  currentWorker = nullptr;
+}
+
+JobSystem *
+jobSystemCreate(int threads)
+{
+  if (threads <= 0)
+    threads = (int)std::max(1u, std::thread::hardware_concurrency());
+
+  JobSystem *system = new JobSystem;
+  for (int i = 0; i < threads; i++) {
+    system->workers.emplace_back(new JobWorker);
+    JobWorker *worker = system->workers.back().get();
+    worker->system = system;
+    worker->index = i;
+    worker->seed = 2654435761u * (unsigned)(i + 1);
+    worker->pool.emplace_back(new Job[JOB_POOL_SIZE]);
+    for (int j = 0; j < JOB_POOL_SIZE; j++)
+      worker->pool[0][j].unfinished.store(0);
+  }
+  currentWorker = system->workers[0].get();
+  for (int i = 1; i < threads; i++)
+    system->threads.emplace_back(workerLoop, system->workers[i].get());
+  return system;
+}
+
+void
+jobSystemDestroy(JobSystem *system)
+{
+  if (!system) return;
+  system->quit.store(true, std::memory_order_release);
+  system->wake.notify_all();
+  for (std::thread &thread : system->threads) thread.join();
+  if (currentWorker && currentWorker->system == system)
+    currentWorker = nullptr;
+  delete system;
+}
+
+int
+jobSystemThreads(const JobSystem *system)
+{
+  return system ? (int)system->workers.size() : 1;
+}
+
+Job *
+jobCreate(JobSystem *system, Job *parent, void (*function)(void *data),
+    const void *data, size_t size)
+{
+  JobWorker *worker = currentWorker;
+  assert(worker && worker->system == system && size <= JOB_DATA_SIZE);
+  (void)system;
+
+  // Slots are taken in turn, skipping those whose job or children are not
+  // finished, e.g. the parents of running jobs. When every slot is live the
+  // pool grows by a block; blocks are kept until the system is destroyed.
+  Job *job = nullptr;
+  size_t capacity = worker->pool.size() * JOB_POOL_SIZE;
+  for (size_t i = 0; i < capacity && !job; i++) {
+    size_t slot = worker->next++ % capacity;
+    Job *candidate = &worker->pool[slot / JOB_POOL_SIZE][slot % JOB_POOL_SIZE];
+    if (candidate->unfinished.load(std::memory_order_acquire) == 0)
+      job = candidate;
+  }
+  if (!job) {
+    worker->pool.emplace_back(new Job[JOB_POOL_SIZE]);
+    Job *block = worker->pool.back().get();
+    for (int j = 0; j < JOB_POOL_SIZE; j++) block[j].unfinished.store(0);
+    job = &block[0];
+    worker->next = capacity + 1;
+  }
+  job->function = function;
+  job->parent = parent;
+  job->unfinished.store(1, std::memory_order_relaxed);
+  if (parent) parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+  if (size) memcpy(job->data, data, size);
+  return job;
+}
+
+void
+jobRun(JobSystem *system, Job *job)
+{
+  JobWorker *worker = currentWorker;
+  if (!worker->deque.push(job)) {
+    executeJob(job);
+    return;
+  }
+  if (system->sleeping.load(std::memory_order_relaxed) > 0)
+    system->wake.notify_one();
+}
+
+void
+jobWait(JobSystem *system, Job *job)
+{
+  JobWorker *worker = currentWorker;
+  (void)system;
+  while (job->unfinished.load(std::memory_order_acquire) > 0) {
+    Job *next = findJob(worker);
+    if (next)
+      executeJob(next);
+    else
+      std::this_thread::yield();
+  }
+}
+
+namespace {
+struct ParallelRange {
+  JobSystem *system;
+  Job *root;
+  void (*fn)(const void *ctx, size_t begin, size_t end);
+  const void *ctx;
+  size_t begin, end, grain;
+};
+}  // namespace
+
+static void
+runRange(void *data)
+{
+  ParallelRange range = *static_cast<ParallelRange *>(data);
+  while (range.end - range.begin > range.grain) {
+    ParallelRange half = range;
+    half.begin = range.begin + (range.end - range.begin) / 2;
+    range.end = half.begin;
+    jobRun(range.system,
+        jobCreate(range.system, range.root, runRange, &half, sizeof(half)));
+  }
+  range.fn(range.ctx, range.begin, range.end);
+}
+
+void
+jobParallelFor(JobSystem *system, size_t count, size_t grain,
+    void (*fn)(const void *ctx, size_t begin, size_t end), const void *ctx)
+{
+  if (count == 0) return;
+  grain = std::max(grain, (size_t)1);
+  if (!system || system->workers.size() < 2 || count <= grain) {
+    fn(ctx, 0, count);
+    return;
+  }
+
+  // A few ranges per worker balance the load; more only cost jobs.
+  size_t ranges = system->workers.size() * JOB_RANGES;
+  grain = std::max(grain, (count + ranges - 1) / ranges);
+
+  // The caller takes the first half itself and helps with the rest. The
+  // root stays unfinished for the whole loop, so it lives on the stack
+  // rather than holding a pool slot.
+  Job root;
+  root.function = nullptr;
+  root.parent = nullptr;
+  root.unfinished.store(1, std::memory_order_relaxed);
+  ParallelRange range = {system, &root, fn, ctx, 0, count, grain};
+  runRange(&range);
+  finishJob(&root);
+  jobWait(system, &root);
+}
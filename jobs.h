@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+// Work-stealing job system.
+//
+// Every worker owns a lock-free deque: it pushes and pops jobs at one end
+// while idle workers steal from the other, so scheduling takes no lock. The
+// thread that creates the system is worker 0 and runs jobs while it waits.
+// A job counts itself and its unfinished children; waiting on a job returns
+// once the whole tree under it is done.
+//
+// Jobs are allocated from a per-worker pool, reusing the slots of finished
+// jobs, and must only be created and run from the creating thread or from
+// inside jobs.
+
+#define JOB_DATA_SIZE 64
+
+typedef struct JobSystem JobSystem;
+
+typedef struct Job {
+  void (*function)(void *data);
+  struct Job *parent;
+  std::atomic<int> unfinished;
+  alignas(16) unsigned char data[JOB_DATA_SIZE];
+} Job;
+
+// `threads` <= 0 uses every core. One thread runs everything on the caller.
+JobSystem *jobSystemCreate(int threads);
+void jobSystemDestroy(JobSystem *system);
+int jobSystemThreads(const JobSystem *system);
+
+// Copies `size` bytes of `data` into the job. With a `parent`, the parent
+// is not finished before this job is.
+Job *jobCreate(JobSystem *system, Job *parent, void (*function)(void *data),
+    const void *data, size_t size);
+void jobRun(JobSystem *system, Job *job);
+// Runs other jobs until `job` and its children are finished.
+void jobWait(JobSystem *system, Job *job);
+
+// Runs fn(ctx, begin, end) over [0, count) in ranges of about `grain`,
+// split recursively so that thieves take large halves. Large counts get
+// larger ranges, a few per worker. Returns when all are done. A NULL
+// `system` runs everything on the caller.
+void jobParallelFor(JobSystem *system, size_t count, size_t grain,
+    void (*fn)(const void *ctx, size_t begin, size_t end), const void *ctx);
+
+// Job running a copy of `f`, which must be a small trivially copyable
+// callable such as a lambda capturing pointers.
+template <typename F>
+Job *
+jobCreate(JobSystem *system, Job *parent, const F &f)
+{
+  static_assert(sizeof(F) <= JOB_DATA_SIZE && alignof(F) <= 16 &&
+                    std::is_trivially_copyable<F>::value,
+      "job data too large or not trivially copyable");
+  return jobCreate(
+      system, parent, [](void *data) { (*static_cast<F *>(data))(); }, &f,
+      sizeof(F));
+}
+
+// f(begin, end) over [0, count).
+template <typename F>
+void
+jobParallelFor(JobSystem *system, size_t count, size_t grain, const F &f)
+{
+  jobParallelFor(
+      system, count, grain,
+      [](const void *ctx, size_t begin, size_t end) {
+        (*static_cast<const F *>(ctx))(begin, end);
+      },
+      &f);
+}
@@ -0,0 +1,111 @@
+#include "loader.h"
+
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "memory_stats.h"
+#include "profiler.h"
+
+namespace {
+struct PendingImage {
+  int index;
+  int width;  // as required by the file, or <= 0
+  int height;
+  std::vector<unsigned char> bytes;
+};
+}  // namespace
+
+// Image loader callback: keeps the encoded bytes for later.
+static bool
+collectImage(tinygltf::Image *image, const int index, std::string *err,
+    std::string *warn, int width, int height, const unsigned char *bytes,
+    int size, void *user)
+{
+  (void)image, (void)err, (void)warn;
+  auto *pending = static_cast<std::vector<PendingImage> *>(user);
+  MemoryScope scope(MEMORY_IMAGES);
+  pending->push_back({index, width, height, {bytes, bytes + size}});
+  return true;
+}
+
+// Files read while parsing are buffers, or images going by their extension.
+static bool
+readFile(std::vector<unsigned char> *out, std::string *err,
+    const std::string &path, void *user)
+{
+  size_t dot = path.find_last_of('.');
+  std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+  bool image = ext == "png" || ext == "jpg" || ext == "jpeg" ||
+               ext == "bmp" || ext == "gif" || ext == "webp" || ext == "ktx2";
+  MemoryScope scope(image ? MEMORY_IMAGES : MEMORY_BUFFERS);
+  return tinygltf::ReadWholeFile(out, err, path, user);
+}
+
+bool
+loadModel(const std::string &filename, tinygltf::Model *model,
+    std::string *err, std::string *warn, JobSystem *jobs)
+{
+  PROFILE_ZONE("load model");
+  std::vector<PendingImage> pending;
+  tinygltf::TinyGLTF loader;
+  loader.SetImageLoader(collectImage, &pending);
+  loader.SetFsCallbacks({tinygltf::FileExists, tinygltf::ExpandFilePath,
+      readFile, tinygltf::WriteWholeFile, nullptr});
+
+  size_t dot = filename.find_last_of('.');
+  std::string ext = dot == std::string::npos ? "" : filename.substr(dot + 1);
+  bool ok;
+  {
+    PROFILE_ZONE("parse glTF");
+    MemoryScope scope(MEMORY_JSON);
+    ok = ext == "glb" ? loader.LoadBinaryFromFile(model, err, warn, filename)
+                      : loader.LoadASCIIFromFile(model, err, warn, filename);
+  }
+  if (!ok) return false;
+  for (const tinygltf::Buffer &buffer : model->buffers)
+    memoryRetag(buffer.data.data(), MEMORY_BUFFERS);
+
+  std::vector<std::string> errors(pending.size());
+  std::vector<std::string> warnings(pending.size());
+  jobParallelFor(jobs, pending.size(), 1, [&](size_t begin, size_t end) {
+    MemoryScope scope(MEMORY_IMAGES);
+    for (size_t i = begin; i < end; i++) {
+      PROFILE_ZONE("decode image");
+      PendingImage &p = pending[i];
+      tinygltf::LoadImageData(&model->images[p.index], p.index, &errors[i],
+          &warnings[i], p.width, p.height, p.bytes.data(),
+          (int)p.bytes.size(), nullptr);
+      std::vector<unsigned char>().swap(p.bytes);
+    }
+  });
+
+  for (size_t i = 0; i < pending.size(); i++) {
+    if (warn) *warn += warnings[i];
+    if (err) *err += errors[i];
+    if (!errors[i].empty()) ok = false;
+  }
+  return ok;
+}
+
+size_t
+releaseModelData(tinygltf::Model *model)
+{
+  size_t bytes = 0;
+  for (tinygltf::Buffer &buffer : model->buffers) {
+    bytes += buffer.data.capacity();
+    std::vector<unsigned char>().swap(buffer.data);
+  }
+  for (tinygltf::Image &image : model->images) {
+    bytes += image.image.capacity();
+    std::vector<unsigned char>().swap(image.image);
+  }
+  // Large vectors are mapped and unmapped on their own, but smaller ones
+  // stay in the heap unless trimmed.
+#if defined(__GLIBC__)
+  malloc_trim(0);
+#endif
+  return bytes;
+}
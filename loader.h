@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+#include "jobs.h"
+#include "tiny_gltf.h"
+
+// Loads a .gltf or .glb file. The JSON is parsed on the caller; images are
+// only collected while parsing and decoded afterwards on `jobs`, one job per
+// image. Returns false with `err` set on failure.
+bool loadModel(const std::string &filename, tinygltf::Model *model,
+    std::string *err, std::string *warn, JobSystem *jobs);
+
+// Frees Buffer::data and Image::image once everything reading them has run,
+// and gives the freed heap back to the system. Accessors, buffer views and
+// images keep describing data that is no longer there. Returns the bytes
+// freed.
+size_t releaseModelData(tinygltf::Model *model);
@@ -0,0 +1,462 @@
+#include "lod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "mesh_data.h"
+
+typedef struct {
+  double a00, a11, a22, a01, a02, a12;
+  double b0, b1, b2;
+  double c;
+  double w;
+} Quadric;
+
+enum VertexKind {
+  kManifold,  // interior vertex, free to collapse onto any neighbour
+  kBorder,    // on an open edge, may only slide along it
+  kLocked,    // attribute seam or degenerate topology, never moves
+};
+
+static void
+quadricAddPlane(Quadric &q, double a, double b, double c, double d, double w)
+{
+  q.a00 += w * a * a;
+  q.a11 += w * b * b;
+  q.a22 += w * c * c;
+  q.a01 += w * a * b;
+  q.a02 += w * a * c;
+  q.a12 += w * b * c;
+  q.b0 += w * a * d;
+  q.b1 += w * b * d;
+  q.b2 += w * c * d;
+  q.c += w * d * d;
+  q.w += w;
+}
+
+static void
+quadricAdd(Quadric &q, const Quadric &r)
+{
+  q.a00 += r.a00;
+  q.a11 += r.a11;
+  q.a22 += r.a22;
+  q.a01 += r.a01;
+  q.a02 += r.a02;
+  q.a12 += r.a12;
+  q.b0 += r.b0;
+  q.b1 += r.b1;
+  q.b2 += r.b2;
+  q.c += r.c;
+  q.w += r.w;
+}
+
+// Mean squared distance of `p` to the planes accumulated in `q`.
+static double
+quadricError(const Quadric &q, const float *p)
+{
+  double x = p[0], y = p[1], z = p[2];
+  double e = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z +
+             2 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z) +
+             2 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+  return q.w > 0 ? fabs(e) / q.w : 0.0;
+}
+
+static void
+triangleNormal(const float *a, const float *b, const float *c, double n[3])
+{
+  double e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  double e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static uint64_t
+edgeKey(uint32_t a, uint32_t b)
+{
+  return ((uint64_t)a << 32) | b;
+}
+
+typedef struct {
+  uint32_t v;  // vertex that disappears
+  uint32_t t;  // vertex it collapses onto
+  float cost;
+} Collapse;
+
+std::vector<uint32_t>
+simplifyTriangles(const std::vector<uint32_t> &indices, const float *positions,
+    size_t vertexCount, const float *attributes, int attributeStride,
+    size_t targetIndexCount, float targetError, float *resultError)
+{
+  std::vector<uint32_t> result(indices);
+  *resultError = 0.0f;
+  if (indices.size() % 3 != 0 || indices.size() <= targetIndexCount)
+    return result;
+
+  // Work in a unit-sized space so errors are relative to the mesh extent.
+  float minp[3] = {INFINITY, INFINITY, INFINITY};
+  float maxp[3] = {-INFINITY, -INFINITY, -INFINITY};
+  for (size_t i = 0; i < vertexCount; i++) {
+    for (int k = 0; k < 3; k++) {
+      minp[k] = std::min(minp[k], positions[i * 3 + k]);
+      maxp[k] = std::max(maxp[k], positions[i * 3 + k]);
+    }
+  }
+  float extent = std::max(
+      maxp[0] - minp[0], std::max(maxp[1] - minp[1], maxp[2] - minp[2]));
+  if (!(extent > 0.0f)) return result;
+  std::vector<float> pos(vertexCount * 3);
+  for (size_t i = 0; i < vertexCount; i++)
+    for (int k = 0; k < 3; k++)
+      pos[i * 3 + k] = (positions[i * 3 + k] - minp[k]) / extent;
+
+  // Vertices sharing a position are wedges of one point; edges are
+  // identified through the first wedge so seams do not look like borders.
+  std::vector<uint32_t> wedge(vertexCount);
+  std::vector<uint32_t> wedgeCount(vertexCount, 0);
+  {
+    struct Key {
+      float p[3];
+      bool operator==(const Key &o) const
+      {
+        return memcmp(p, o.p, sizeof(p)) == 0;
+      }
+    };
+    struct KeyHash {
+      size_t operator()(const Key &k) const
+      {
+        uint32_t h[3];
+        memcpy(h, k.p, sizeof(h));
+        return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+      }
+    };
+    std::unordered_map<Key, uint32_t, KeyHash> first;
+    first.reserve(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++) {
+      Key k;
+      memcpy(k.p, &positions[i * 3], sizeof(k.p));
+      auto it = first.emplace(k, (uint32_t)i).first;
+      wedge[i] = it->second;
+      wedgeCount[it->second]++;
+    }
+  }
+
+  std::vector<unsigned char> locked(vertexCount, 0);
+  for (size_t i = 0; i < vertexCount; i++)
+    if (wedgeCount[wedge[i]] > 1) locked[i] = 1;
+
+  // Plane quadrics, weighted by triangle area.
+  std::vector<Quadric> quadrics(vertexCount);
+  memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+  for (size_t i = 0; i < result.size(); i += 3) {
+    const float *p0 = &pos[result[i] * 3];
+    const float *p1 = &pos[result[i + 1] * 3];
+    const float *p2 = &pos[result[i + 2] * 3];
+    double n[3];
+    triangleNormal(p0, p1, p2, n);
+    double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (len == 0.0) continue;
+    double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]) / len;
+    for (int k = 0; k < 3; k++)
+      quadricAddPlane(quadrics[result[i + k]], n[0] / len, n[1] / len,
+          n[2] / len, d, len * 0.5);
+  }
+
+  std::vector<unsigned char> kind(vertexCount);
+  std::vector<uint32_t> remap(vertexCount);
+  std::vector<unsigned char> touched(vertexCount);
+  std::vector<uint32_t> triOffset(vertexCount + 1), triList;
+  std::unordered_set<uint64_t> edges;
+  bool bordersSeeded = false;
+  float maxError = 0.0f;
+  float errorLimit = targetError * targetError;
+
+  while (result.size() > targetIndexCount) {
+    size_t triangleCount = result.size() / 3;
+
+    // Open edges: directed edges whose opposite is missing.
+    edges.clear();
+    edges.reserve(result.size());
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t a = wedge[result[i + k]], b = wedge[result[i + (k + 1) % 3]];
+        edges.insert(edgeKey(a, b));
+      }
+    }
+    for (size_t i = 0; i < vertexCount; i++)
+      kind[i] = locked[i] ? kLocked : kManifold;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t va = result[i + k], vb = result[i + (k + 1) % 3];
+        if (edges.count(edgeKey(wedge[vb], wedge[va]))) continue;
+        if (kind[va] == kManifold) kind[va] = kBorder;
+        if (kind[vb] == kManifold) kind[vb] = kBorder;
+
+        // Keep open boundaries in place with planes perpendicular to the
+        // adjacent face, added once from the source mesh.
+        if (!bordersSeeded) {
+          const float *p0 = &pos[result[i] * 3];
+          const float *p1 = &pos[result[i + 1] * 3];
+          const float *p2 = &pos[result[i + 2] * 3];
+          double n[3];
+          triangleNormal(p0, p1, p2, n);
+          const float *a = &pos[va * 3], *b = &pos[vb * 3];
+          double e[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+          double bn[3] = {e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2],
+              e[0] * n[1] - e[1] * n[0]};
+          double len = sqrt(bn[0] * bn[0] + bn[1] * bn[1] + bn[2] * bn[2]);
+          if (len == 0.0) continue;
+          double d = -(bn[0] * a[0] + bn[1] * a[1] + bn[2] * a[2]) / len;
+          double w = (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]) * 10.0;
+          quadricAddPlane(
+              quadrics[va], bn[0] / len, bn[1] / len, bn[2] / len, d, w);
+          quadricAddPlane(
+              quadrics[vb], bn[0] / len, bn[1] / len, bn[2] / len, d, w);
+        }
+      }
+    }
+    bordersSeeded = true;
+
+    // Vertex -> triangle adjacency for flip checks.
+    std::fill(triOffset.begin(), triOffset.end(), 0);
+    for (uint32_t v : result) triOffset[v + 1]++;
+    for (size_t i = 0; i < vertexCount; i++) triOffset[i + 1] += triOffset[i];
+    triList.resize(result.size());
+    {
+      std::vector<uint32_t> fill(triOffset.begin(), triOffset.end() - 1);
+      for (size_t i = 0; i < result.size(); i++)
+        triList[fill[result[i]]++] = (uint32_t)(i / 3);
+    }
+
+    std::vector<Collapse> collapses;
+    collapses.reserve(result.size());
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = result[i + k], t = result[i + (k + 1) % 3];
+        for (int dir = 0; dir < 2; dir++, std::swap(v, t)) {
+          if (kind[v] == kLocked) continue;
+          if (kind[v] == kBorder) {
+            // Only slide along the open edge itself.
+            bool open = !edges.count(edgeKey(wedge[t], wedge[v])) ||
+                        !edges.count(edgeKey(wedge[v], wedge[t]));
+            if (kind[t] == kManifold || !open) continue;
+          }
+
+          Quadric q = quadrics[v];
+          quadricAdd(q, quadrics[t]);
+          float cost = (float)quadricError(q, &pos[t * 3]);
+          if (attributes) {
+            const float *pa = &pos[v * 3], *pb = &pos[t * 3];
+            float edge2 = (pa[0] - pb[0]) * (pa[0] - pb[0]) +
+                          (pa[1] - pb[1]) * (pa[1] - pb[1]) +
+                          (pa[2] - pb[2]) * (pa[2] - pb[2]);
+            float attr2 = 0.0f;
+            for (int a = 0; a < attributeStride; a++) {
+              float d = attributes[v * attributeStride + a] -
+                        attributes[t * attributeStride + a];
+              attr2 += d * d;
+            }
+            cost += attr2 * edge2;
+          }
+          if (cost <= errorLimit) collapses.push_back({v, t, cost});
+        }
+      }
+    }
+    if (collapses.empty()) break;
+    std::sort(collapses.begin(), collapses.end(),
+        [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+    for (size_t i = 0; i < vertexCount; i++) remap[i] = (uint32_t)i;
+    std::fill(touched.begin(), touched.end(), 0);
+
+    size_t removeGoal = (result.size() - targetIndexCount) / 3;
+    size_t removed = 0;
+    for (const Collapse &c : collapses) {
+      if (removed >= removeGoal) break;
+      if (touched[c.v] || touched[c.t]) continue;
+
+      // Reject collapses that flip or degenerate any face around v.
+      bool ok = true;
+      size_t shared = 0;
+      for (uint32_t j = triOffset[c.v]; j < triOffset[c.v + 1] && ok; j++) {
+        const uint32_t *tri = &result[triList[j] * 3];
+        if (tri[0] == c.t || tri[1] == c.t || tri[2] == c.t) {
+          shared++;
+          continue;
+        }
+        const float *p[3], *q[3];
+        for (int k = 0; k < 3; k++) {
+          p[k] = &pos[tri[k] * 3];
+          q[k] = tri[k] == c.v ? &pos[c.t * 3] : p[k];
+        }
+        double n0[3], n1[3];
+        triangleNormal(p[0], p[1], p[2], n0);
+        triangleNormal(q[0], q[1], q[2], n1);
+        double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+        double l0 = n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2];
+        double l1 = n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2];
+        if (dot <= 0.25 * sqrt(l0 * l1)) ok = false;
+      }
+      if (!ok || shared == 0) continue;
+
+      remap[c.v] = c.t;
+      quadricAdd(quadrics[c.t], quadrics[c.v]);
+      maxError = std::max(maxError, c.cost);
+      removed += shared;
+      for (uint32_t j = triOffset[c.v]; j < triOffset[c.v + 1]; j++) {
+        const uint32_t *tri = &result[triList[j] * 3];
+        touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+      }
+    }
+    if (removed == 0) break;
+
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      uint32_t a = remap[result[i]], b = remap[result[i + 1]],
+               c = remap[result[i + 2]];
+      if (a == b || b == c || a == c) continue;
+      result[write++] = a;
+      result[write++] = b;
+      result[write++] = c;
+    }
+    result.resize(write);
+    if (result.size() / 3 == triangleCount) break;
+  }
+
+  *resultError = sqrtf(maxError) * extent;
+  return result;
+}
+
+std::vector<LodLevel>
+buildLodChain(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  std::vector<LodLevel> levels;
+  int mode = primitive.mode < 0 ? TINYGLTF_MODE_TRIANGLES : primitive.mode;
+  if (mode != TINYGLTF_MODE_TRIANGLES) return levels;
+
+  auto pit = primitive.attributes.find("POSITION");
+  if (pit == primitive.attributes.end()) return levels;
+
+  std::vector<uint32_t> indices;
+  if (!readIndices(model, primitive, &indices)) return levels;
+  if (indices.size() / 3 < LOD_MIN_TRIANGLES) return levels;
+
+  std::vector<float> positions;
+  int components = 0;
+  if (!readAccessorFloats(model, pit->second, &positions, &components) ||
+      components != 3)
+    return levels;
+  size_t vertexCount = positions.size() / 3;
+  for (uint32_t i : indices)
+    if (i >= vertexCount) return levels;
+
+  // NORMAL and TEXCOORD_0 steer collapses away from shading discontinuities.
+  const int attributeStride = 5;
+  std::vector<float> attributes(vertexCount * attributeStride, 0.0f);
+  bool hasAttributes = false;
+  const char *names[2] = {"NORMAL", "TEXCOORD_0"};
+  const int widths[2] = {3, 2};
+  int offset = 0;
+  for (int a = 0; a < 2; offset += widths[a], a++) {
+    auto it = primitive.attributes.find(names[a]);
+    if (it == primitive.attributes.end()) continue;
+    std::vector<float> data;
+    int n = 0;
+    if (!readAccessorFloats(model, it->second, &data, &n) || n != widths[a] ||
+        data.size() / n != vertexCount)
+      continue;
+    for (size_t v = 0; v < vertexCount; v++)
+      for (int k = 0; k < n; k++)
+        attributes[v * attributeStride + offset + k] = data[v * n + k];
+    hasAttributes = true;
+  }
+
+  const std::vector<uint32_t> *source = &indices;
+  float error = 0.0f;
+  for (int level = 0; level < LOD_MAX_LEVELS; level++) {
+    size_t target = (source->size() / 2) / 3 * 3;
+    float levelError = 0.0f;
+    std::vector<uint32_t> simplified = simplifyTriangles(*source,
+        positions.data(), vertexCount,
+        hasAttributes ? attributes.data() : NULL, attributeStride, target,
+        0.1f, &levelError);
+
+    // Not worth another draw path when the reduction is marginal.
+    if (simplified.empty() || simplified.size() > source->size() * 85 / 100)
+      break;
+
+    // Each level is simplified from the previous one, whose quadrics only
+    // know that level: the deviation from the source is at most the sum.
+    error += levelError;
+    levels.push_back({std::move(simplified), error});
+    source = &levels.back().indices;
+    if (source->size() / 3 < LOD_MIN_TRIANGLES) break;
+  }
+
+  return levels;
+}
+
+float
+lodPixelsPerUnit(float distance, float fovy, int viewportHeight)
+{
+  float projScale =
+      viewportHeight / (2.0f * tanf(fovy * (float)M_PI / 360.0f));
+  return projScale / std::max(distance, 1e-4f);
+}
+
+int
+selectLod(const std::vector<float> &errors, float pixelsPerUnit,
+    float pixelThreshold)
+{
+  int selected = 0;
+  for (size_t i = 0; i < errors.size(); i++) {
+    if (errors[i] * pixelsPerUnit > pixelThreshold) break;
+    selected = (int)i + 1;
+  }
+  return selected;
+}
+
+std::vector<int>
+msftLodIds(const tinygltf::Node &node)
+{
+  std::vector<int> ids;
+  auto it = node.extensions.find("MSFT_lod");
+  if (it == node.extensions.end() || !it->second.Has("ids")) return ids;
+  const tinygltf::Value &array = it->second.Get("ids");
+  for (size_t i = 0; i < array.ArrayLen(); i++) {
+    const tinygltf::Value &v = array.Get((int)i);
+    if (v.IsNumber()) ids.push_back(v.GetNumberAsInt());
+  }
+  return ids;
+}
+
+std::vector<double>
+msftScreenCoverage(const tinygltf::Node &node)
+{
+  std::vector<double> coverage;
+  if (!node.extras.IsObject() || !node.extras.Has("MSFT_screencoverage"))
+    return coverage;
+  const tinygltf::Value &array = node.extras.Get("MSFT_screencoverage");
+  for (size_t i = 0; i < array.ArrayLen(); i++) {
+    const tinygltf::Value &v = array.Get((int)i);
+    if (v.IsNumber()) coverage.push_back(v.GetNumberAsDouble());
+  }
+  return coverage;
+}
+
+int
+selectMsftLod(const std::vector<double> &coverage, size_t levelCount,
+    float screenCoverage)
+{
+  if (coverage.empty()) return 0;
+  for (size_t i = 0; i < levelCount && i < coverage.size(); i++) {
+    if (screenCoverage >= coverage[i]) return (int)i;
+  }
+  // A trailing threshold for the coarsest level culls below it.
+  if (coverage.size() >= levelCount) return -1;
+  return (int)levelCount - 1;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "tiny_gltf.h"
+
+// Level of detail generation and selection.
+//
+// Levels are generated at load time by edge-collapse simplification driven by
+// quadric error metrics. Only the index buffer changes between levels, so
+// every level shares the vertex buffers of the source primitive. Vertices on
+// attribute seams (same position, different normal/uv) never move, which
+// keeps uv islands and hard edges intact.
+
+typedef struct {
+  std::vector<uint32_t> indices;
+  float error;  // deviation from the source mesh, in object-space units
+} LodLevel;
+
+#define LOD_MAX_LEVELS 4
+#define LOD_MIN_TRIANGLES 64
+
+// Simplifies a triangle list down to roughly `targetIndexCount` indices
+// without exceeding `targetError` (relative to the mesh extent).
+// `attributes` may be NULL; otherwise it holds `attributeStride` floats per
+// vertex which are penalized when they differ across a collapsed edge.
+std::vector<uint32_t> simplifyTriangles(const std::vector<uint32_t> &indices,
+    const float *positions, size_t vertexCount, const float *attributes,
+    int attributeStride, size_t targetIndexCount, float targetError,
+    float *resultError);
+
+// Returns progressively coarser versions of a triangle primitive, excluding
+// the source itself. Empty when the primitive is not worth simplifying.
+std::vector<LodLevel> buildLodChain(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive);
+
+// Projected size in pixels of one object-space unit at `distance`.
+float lodPixelsPerUnit(float distance, float fovy, int viewportHeight);
+
+// Picks the coarsest level whose projected error stays under
+// `pixelThreshold`. `errors` holds the error of levels 1..n; level 0 is the
+// source primitive.
+int selectLod(const std::vector<float> &errors, float pixelsPerUnit,
+    float pixelThreshold);
+
+// MSFT_lod: alternative nodes for `node`, highest detail first (the node
+// itself is not included), and the optional MSFT_screencoverage thresholds.
+std::vector<int> msftLodIds(const tinygltf::Node &node);
+std::vector<double> msftScreenCoverage(const tinygltf::Node &node);
+
+// Index into [node, ids...] for a given screen coverage (0..1 of the
+// viewport height), or -1 when the node should not be drawn at all.
+int selectMsftLod(const std::vector<double> &coverage, size_t levelCount,
+    float screenCoverage);
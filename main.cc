@@ -1,21 +1,71 @@
 #include <GL/glew.h>
-#define GLFW_INCLUDE_GLU
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <limits>
+#include <set>
 #include <string>
 #include <vector>
 
+#include "animation.h"
+#include "bvh.h"
+#include "capture.h"
+#include "instancing.h"
+#include "jobs.h"
+#include "loader.h"
+#include "lod.h"
+#include "material.h"
+#include "memory_stats.h"
+#include "mesh_data.h"
+#include "morph.h"
+#include "occlusion.h"
+#include "profiler.h"
+#include "raster.h"
+#include "render_queue.h"
+#include "scene.h"
+#include "skinning.h"
+#include "texture_atlas.h"
 #include "tiny_gltf.h"
+#include "transform.h"
 
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 #define CAM_Z (3.0f)
+#define CAM_FOVY (45.0f)
+#define CAM_NEAR (0.1f)
+#define CAM_FAR (1000.0f)
+#define JOINT_TEXTURE_UNIT 1
+#define MORPH_TEXTURE_UNIT 2
+#define MATERIAL_TEXTURE_UNIT 3  // to 7, one per slot of material.h
+
+// Vertex attribute locations, also written in shader.vert. Matrices take one
+// location per column.
+#define ATTRIB_POSITION 0
+#define ATTRIB_NORMAL 1
+#define ATTRIB_TEXCOORD 2
+#define ATTRIB_JOINTS 3
+#define ATTRIB_WEIGHTS 4
+#define ATTRIB_INSTANCE_MODEL 5
+#define ATTRIB_INSTANCE_NORMAL 9
+#define ATTRIB_INSTANCE_PALETTE 12
+#define ATTRIB_COLOR 13
+
+#define CAMERA_BLOCK_BINDING 0
+#define DRAW_BLOCK_BINDING 1
+#define MATERIAL_BLOCK_BINDING 2
+#define STREAM_FRAMES 3          // frames in flight in the stream buffer
+#define STREAM_FRAME_SIZE 65536  // initial bytes per frame, grows as needed
+#define CAPTURE_BUFFERS 3  // pixel pack buffers read back into in turn
+#define CAPTURE_QUEUE 8    // frames waiting for the PNG writer at most
 int width = 768;
 int height = 768;
 
@@ -26,17 +76,284 @@ float eye[3], lookat[3], up[3];
 
 GLFWwindow *window;
 
+// Frames are only rendered when something changes, unless --continuous.
+bool continuousRendering = false;
+bool sceneDirty = true;         // camera, scene or shaders changed
+bool windowDamaged = false;     // contents lost, e.g. by an expose
+bool reloadRequested = false;   // R pressed
+bool pickRequested = false;     // shift + left click, at pickX, pickY
+double pickX, pickY;
+bool frameCacheEnabled = false;  // redraw from a copy of the last frame
+std::string traceFile;           // Chrome trace written at exit
+std::string memoryReportFile;    // memory report written at exit and on M
+bool captureEveryFrame = false;  // --capture
+bool captureRequested = false;   // P pressed, for the next frame
+std::string capturePrefix = "capture-";  // files are <prefix>NNNNN.png
+int turntableFrames = 0;  // --turntable: frames of a turn of the camera
+bool gpuResident = false;  // free the model's buffers and images once uploaded
+bool depthPrepass = false;     // lay down depth before shading
+bool measureOverdraw = false;  // count shaded fragments with and without
+GLuint depthProgram;           // of the pre-pass, 0 when not used
+bool normalShading = false;    // --normals, as the software renderer draws
+bool softwareRendering = false;  // --software: no GL, needs --screenshot
+std::string screenshotFile;  // frames timed and the last one written to it
+GLuint overdrawQuery;  // GL_SAMPLES_PASSED over the shading pass, or 0
+
+// Last rendered frame, blitted to the window when only its contents were
+// lost.
 typedef struct {
+  GLuint framebuffer;
+  GLuint color;
+  GLuint depth;
+  int width;
+  int height;
+  bool valid;
+} GLFrameCache;
+
+// A frame read back into a pixel pack buffer. glReadPixels only queues the
+// copy; the buffer is mapped once its fence signals, which is at most
+// CAPTURE_BUFFERS - 1 frames later, so capturing does not stall the GPU.
+typedef struct {
+  GLuint buffer;
+  size_t size;
+  GLsync fence;  // 0 when the buffer holds no frame
+  int width;
+  int height;
+  std::string filename;
+} GLCaptureSlot;
+
+// A program being compiled and linked.
+typedef struct {
+  const char *vertexFile;
+  const char *fragmentFile;
+  GLuint vertex;
+  GLuint fragment;
+  GLuint program;
+} GLProgramBuild;
+
+#define PERMUTATION_COMPILING 0
+#define PERMUTATION_LINKED 1  // vertex streams not rebuilt for it yet
+#define PERMUTATION_READY 2
+#define PERMUTATION_FAILED 3
+
+// A permutation of shader.vert and shader.frag, see material.h. Until it is
+// ready its primitives are drawn with permutation 0, the fallback, which is
+// built before anything else.
+typedef struct {
+  uint32_t features;  // MATERIAL_* bits
+  int state;          // PERMUTATION_*
+  GLProgramBuild build;  // while compiling
+  GLuint program;
+  std::vector<std::string> attributes;  // vertex attributes it reads
+} GLPermutation;
+
+// Indices of a primitive or of one of its LODs. Primitives without indices
+// have no buffer and count vertices instead.
+typedef struct {
+  GLuint ib;     // 0 to draw arrays
+  GLenum type;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+  GLsizei count;
+  GLuint start;  // smallest and largest index, for glDrawRangeElements
+  GLuint end;
+} GLIndexState;
+
+// One attribute of a vertex stream.
+typedef struct {
+  GLint location;
+  GLint size;
+  GLenum type;
+  GLboolean normalized;
+  size_t offset;
+} GLVertexAttrib;
+
+// Vertices of a primitive rebuilt at load time from whatever layout the
+// exporter chose: the attributes the program reads interleaved in one
+// buffer, and the positions alone, packed, for passes that only need depth.
+typedef struct {
+  GLuint vb;
+  GLsizei stride;
+  std::vector<GLVertexAttrib> attribs;
+  GLuint positions;  // 3 floats per vertex, 0 without POSITION
+  GLsizei count;
+} GLVertexStream;
+
+typedef struct {
+  Bounds bounds;
+  std::vector<float> lodErrors;  // per level >= 1, max over primitives
+  std::vector<int> primitivePrograms;  // into glPermutations, -1 if broken
+  std::vector<int> primitiveStreams;  // into glVertexStreams, -1 if unreadable
+  std::vector<GLIndexState> primitiveIndices;  // [primitive]
+  std::vector<std::vector<GLIndexState>> primitiveLods;  // [primitive][level-1]
+} GLMeshState;
+
+typedef struct {
+  std::vector<int> ids;  // MSFT_lod alternatives, highest detail first
+  std::vector<double> coverage;
+} NodeLodState;
+
+typedef struct {
+  GLuint buffer;  // vertex buffer holding InstanceData
+  size_t offset;  // byte offset of the first instance
+  GLsizei count;
+} InstanceRange;
+
+// Visible instances of one mesh at one LOD, gathered during traversal.
+typedef struct {
+  int mesh;
+  int lod;
+  std::vector<InstanceData> instances;
+  std::vector<float> depths;  // per instance, see drawDepth
+} DrawBatch;
+
+// One primitive of a batch, morphed node or GPU instanced node, submitted in
+// render queue order.
+typedef struct {
+  int mesh;
+  int primitive;
+  int lod;
+  int morphNode;  // -1 when not morphed
+  InstanceRange instances;
+  size_t uniforms;  // offset of its Draw block in the stream buffer
+  GLuint morphed;   // CPU blended vertices, or 0
+} DrawItem;
+
+// std140 layout of the Camera block.
+typedef struct {
+  float viewProj[16];
+  float eye[4];  // w unused
+} CameraUniforms;
+
+// std140 layout of the Draw block: the int and float arrays are ivec4 and
+// vec4 arrays in the shaders, which pack them without padding.
+typedef struct {
+  int32_t morphCount;
+  int32_t morphBase;
+  int32_t morphVertices;
+  int32_t pad;  // the arrays start on a 16 byte boundary
+  int32_t morphTargets[MORPH_MAX_ACTIVE];
+  float morphWeights[MORPH_MAX_ACTIVE];
+} DrawUniforms;
+
+// Uniform blocks of the last STREAM_FRAMES frames, one region per frame.
+// With buffer storage the buffer stays mapped and is written in place, a
+// fence per region telling when the GPU is done with it; without, the frame
+// is staged in memory and uploaded with one glBufferSubData.
+typedef struct {
+  GLuint buffer;
+  size_t size;  // of one region
+  int frame;    // region being written
+  size_t used;
+  GLint alignment;
+  unsigned char *mapped;  // NULL when staged
+  std::vector<unsigned char> staging;
+  GLsync fences[STREAM_FRAMES];
+} GLStreamBuffer;
+
+// GL_TIME_ELAPSED queries cannot nest, so GPU zones are consecutive parts of
+// the frame. Results are read back in order once available, usually a frame
+// or two later, without waiting for them.
+typedef struct {
+  GLuint query;
+  const char *name;
+  uint64_t submitted;
+} GLGpuZone;
+
+typedef struct {
+  int pass;         // RENDER_PASS_*
+  size_t uniforms;  // offset of its Material block in materialBuffer
+  GLuint textures[MATERIAL_TEXTURES];  // 0 for unused slots
+  bool atlas;  // textures are the atlas texture arrays
+} GLMaterialState;
+
+// Instances of a node using EXT_mesh_gpu_instancing. They are static
+// relative to the node, so the buffer is only rebuilt when the node moves.
+typedef struct {
+  std::vector<Mat4> local;
+  Bounds bounds;  // of all instances, relative to the node
   GLuint vb;
-} GLBufferState;
+  Mat4 bakedWorld;
+  bool baked;
+} GLGpuInstancingState;
 
+// Morph targets of a mesh, kept on the CPU for the fallback path.
 typedef struct {
-  std::map<std::string, GLint> attribs;
-  std::map<std::string, GLint> uniforms;
-} GLProgramState;
+  std::vector<MorphPrimitive> primitives;
+  std::vector<int> base;  // first texel of each primitive, -1 without targets
+} GLMorphState;
 
-std::map<int, GLBufferState> glBufferState;
-GLProgramState glProgramState;
+// A node whose mesh has morph targets. Weights are per node, so these are
+// drawn one at a time rather than batched.
+typedef struct {
+  int node;
+  int mesh;
+  int lod;
+  float depth;
+  InstanceData instance;
+} MorphDraw;
+
+std::vector<GLVertexStream> glVertexStreams;
+std::vector<GLMeshState> glMeshState;
+std::vector<NodeLodState> nodeLodState;
+std::vector<GLPermutation> glPermutations;  // the program field of sort keys
+std::map<uint32_t, int> permutationIndex;   // by features
+bool parallelCompile = false;  // KHR or ARB_parallel_shader_compile
+int permutationsCompiling = 0;
+int permutationsStarted = 0;  // since none were compiling
+double compileStart;          // glfwGetTime() of the first of them
+
+JobSystem *jobs;     // shared by loading and per-frame CPU work
+int threadCount = 0;  // 0 uses every core
+
+SceneState sceneState;
+Mat4 viewProj;
+
+std::vector<AnimationClip> animations;
+int animationIndex = 0;  // -1 disables playback
+
+std::vector<SkinData> skins;
+JointPalette jointPalette;
+GLuint jointBuffer, jointTexture;  // texture buffer over the palette
+
+std::vector<GLMorphState> glMorphState;  // by mesh
+GLuint morphBuffer, morphTexture;  // texture buffer over all target deltas
+std::map<int, std::vector<GLuint>> cpuMorphBuffers;  // by node, per primitive
+std::vector<MorphDraw> morphDraws;
+bool cpuMorph = false;
+
+std::vector<DrawBatch> drawBatches;
+std::vector<int> drawBatchIndex;  // [mesh * (LOD_MAX_LEVELS + 1) + lod]
+std::vector<InstanceData> frameInstances;
+GLuint frameInstanceBuffer;
+std::map<int, GLGpuInstancingState> glGpuInstancing;  // by node
+std::vector<int> gpuInstancedDraws;  // visible nodes, this frame
+PickScene pickScene;  // hierarchies of the picked meshes, see bvh.h
+bool pickStale = true;  // nodes moved since the last pick
+std::vector<DrawItem> drawItems;
+RenderQueue renderQueue;
+GLStreamBuffer streamBuffer;
+GLFrameCache frameCache;
+GLCaptureSlot captureSlots[CAPTURE_BUFFERS];
+int captureNext;   // slot of the next readback, the oldest in flight
+int captureCount;  // frames captured, numbering the files
+CaptureWriter *captureWriter;  // started by the first capture
+std::vector<GLuint> gpuQueryPool;
+std::deque<GLGpuZone> gpuZones;  // in flight, oldest first
+bool gpuTiming = false;
+bool compatProfile = false;  // never ask for a core profile
+bool coreProfile = false;
+bool persistentMapping = false;
+std::vector<GLMaterialState> glMaterialState;  // by material, then default
+GLuint materialBuffer;  // Material blocks of every material
+std::map<std::pair<int, bool>, GLuint> glTextures;  // by texture and sRGB
+
+bool atlasEnabled = true;  // pack small textures into texture arrays
+bool lodEnabled = true;
+float lodPixelThreshold = 1.0f;
+
+std::vector<OccluderMesh> occluderMeshes;
+std::vector<int> meshOccluder;  // index into occluderMeshes, or -1
+OcclusionBuffer occlusionBuffer;
+bool occlusionEnabled = true;
 
 void
 checkErrors(std::string desc)
@@ -48,19 +365,13 @@ checkErrors(std::string desc)
   }
 }
 
-static std::string
-getFilePathExtension(const std::string &FileName)
-{
-  if (FileName.find_last_of(".") != std::string::npos)
-    return FileName.substr(FileName.find_last_of(".") + 1);
-  return "";
-}
-
+// Starts compiling a shader. Only fails when the file cannot be read: the
+// compile status is checked by checkShader, so that several shaders can
+// compile at once.
 bool
-loadShader(GLenum shaderType, GLuint &shader, const char *shaderSourceFilename)
+loadShader(GLenum shaderType, GLuint &shader, const char *shaderSourceFilename,
+    const std::string &defines)
 {
-  GLint val = 0;
-
   if (shader != 0) {
     glDeleteShader(shader);
   }
@@ -79,12 +390,26 @@ loadShader(GLenum shaderType, GLuint &shader, const char *shaderSourceFilename)
   srcbuf[len] = 0;
   fclose(fp);
 
-  const GLchar *srcs[1];
-  srcs[0] = &srcbuf.at(0);
+  // The version line and LOCATION() depend on the profile of the context.
+  const GLchar *srcs[3];
+  srcs[0] = coreProfile ? "#version 410 core\n"
+                          "#define LOCATION(n) layout(location = n)\n"
+                        : "#version 150 compatibility\n"
+                          "#define LOCATION(n)\n";
+  srcs[1] = defines.c_str();
+  srcs[2] = &srcbuf.at(0);
 
   shader = glCreateShader(shaderType);
-  glShaderSource(shader, 1, srcs, NULL);
+  glShaderSource(shader, 3, srcs, NULL);
   glCompileShader(shader);
+  return true;
+}
+
+// Waits for a shader started by loadShader and reports its status.
+bool
+checkShader(GLuint shader, const char *shaderSourceFilename)
+{
+  GLint val = 0;
   glGetShaderiv(shader, GL_COMPILE_STATUS, &val);
   if (val != GL_TRUE) {
     char log[4096];
@@ -100,11 +425,10 @@ loadShader(GLenum shaderType, GLuint &shader, const char *shaderSourceFilename)
   return true;
 }
 
-bool
+// Starts linking a program; its status is checked by checkProgram.
+void
 linkShader(GLuint &prog, GLuint &vertShader, GLuint &fragShader)
 {
-  GLint val = 0;
-
   if (prog != 0) {
     glDeleteProgram(prog);
   }
@@ -113,10 +437,35 @@ linkShader(GLuint &prog, GLuint &vertShader, GLuint &fragShader)
 
   glAttachShader(prog, vertShader);
   glAttachShader(prog, fragShader);
+  if (!coreProfile) {
+    // GLSL 1.50 has no layout locations.
+    glBindAttribLocation(prog, ATTRIB_POSITION, "in_vertex");
+    glBindAttribLocation(prog, ATTRIB_NORMAL, "in_normal");
+    glBindAttribLocation(prog, ATTRIB_TEXCOORD, "in_texcoord");
+    glBindAttribLocation(prog, ATTRIB_JOINTS, "in_joints");
+    glBindAttribLocation(prog, ATTRIB_WEIGHTS, "in_weights");
+    glBindAttribLocation(prog, ATTRIB_INSTANCE_MODEL, "in_model");
+    glBindAttribLocation(prog, ATTRIB_INSTANCE_NORMAL, "in_normal_matrix");
+    glBindAttribLocation(prog, ATTRIB_INSTANCE_PALETTE, "in_palette");
+    glBindAttribLocation(prog, ATTRIB_COLOR, "in_color");
+  }
   glLinkProgram(prog);
+}
 
+// Waits for a program started by linkShader and reports its status.
+bool
+checkProgram(GLuint prog)
+{
+  GLint val = 0;
   glGetProgramiv(prog, GL_LINK_STATUS, &val);
-  assert(val == GL_TRUE && "failed to link shader");
+  if (val != GL_TRUE) {
+    char log[4096];
+    GLsizei msglen;
+    glGetProgramInfoLog(prog, 4096, &msglen, log);
+    printf("%s\n", log);
+    printf("ERR: Failed to link shader\n");
+    return false;
+  }
 
   printf("Link shader OK\n");
 
@@ -126,6 +475,12 @@ linkShader(GLuint &prog, GLuint &vertShader, GLuint &fragShader)
 void
 pointerButtonHandler(GLFWwindow *window, int button, int action, int mods)
 {
+  if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS &&
+      (mods & GLFW_MOD_SHIFT)) {
+    glfwGetCursorPos(window, &pickX, &pickY);
+    pickRequested = true;
+    return;
+  }
   if ((button == GLFW_MOUSE_BUTTON_LEFT)) {
     if (action == GLFW_PRESS) {
       mouseLeftPressed = true;
@@ -159,329 +514,2495 @@ pointerMotionHandler(GLFWwindow *window, double mouse_x, double mouse_y)
     lookat[2] += transScale * (mouse_y - prevMouseY) / (float)height;
   }
 
+  if (mouseLeftPressed || mouseRightPressed) sceneDirty = true;
   prevMouseX = mouse_x;
   prevMouseY = mouse_y;
 }
 
+// To the --memory-report file, or stdout without one.
 static void
-setupBuffer(tinygltf::Model &model, GLuint progId)
+writeMemoryReport()
 {
-  {
-    for (int i = 0; i < (int)model.bufferViews.size(); ++i) {
-      const tinygltf::BufferView &bufferView = model.bufferViews[i];
-      if (bufferView.target == 0) {
-        std::cout << "TODO: bufferView.target is zero (unsupported)"
-                  << std::endl;
-        continue;
-      }
+  if (memoryReportFile.empty()) {
+    memoryWriteReport(stdout);
+    return;
+  }
+  FILE *fp = fopen(memoryReportFile.c_str(), "w");
+  if (!fp) {
+    std::cerr << "failed to write " << memoryReportFile << std::endl;
+    return;
+  }
+  memoryWriteReport(fp);
+  fclose(fp);
+  std::cout << "memory report written to " << memoryReportFile << std::endl;
+}
 
-      int sparse_accessor = -1;
-      for (int a_i = 0; a_i < (int)model.accessors.size(); ++a_i) {
-        const auto &accessor = model.accessors[a_i];
-        if (accessor.bufferView == i) {
-          std::cout << i << " is used by accessor " << a_i << std::endl;
-          if (accessor.sparse.isSparse) {
-            std::cout << "TODO: support sparse_accessor" << std::endl;
-            sparse_accessor = a_i;
-            break;
-          }
-        }
-      }
+void
+keyHandler(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+  if (key == GLFW_KEY_R && action == GLFW_PRESS) reloadRequested = true;
+  if (key == GLFW_KEY_M && action == GLFW_PRESS) writeMemoryReport();
+  if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+    captureRequested = true;
+    sceneDirty = true;
+  }
+}
 
-      const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
-      GLBufferState state;
-      glGenBuffers(1, &state.vb);
-      glBindBuffer(bufferView.target, state.vb);
-      std::cout << "buffer.size= " << buffer.data.size()
-                << ", byteOffset = " << bufferView.byteOffset << std::endl;
-
-      if (sparse_accessor < 0)
-        glBufferData(bufferView.target, bufferView.byteLength,
-            &buffer.data.at(0) + bufferView.byteOffset, GL_STATIC_DRAW);
-      else {
-        std::cout << "TODO: support sparse_accessor" << std::endl;
-      }
+void
+refreshHandler(GLFWwindow *window)
+{
+  windowDamaged = true;
+}
 
-      glBindBuffer(bufferView.target, 0);
+void
+framebufferSizeHandler(GLFWwindow *window, int w, int h)
+{
+  width = w;
+  height = h;
+  sceneDirty = true;
+}
 
-      glBufferState[i] = state;
-    }
+// Starts compiling and linking a vertex and a fragment shader, with
+// `defines` before the source of both. The driver may do it on its own
+// threads while the viewer goes on; finishProgram waits for the result.
+static bool
+startProgram(GLProgramBuild *build, const char *vertexFile,
+    const char *fragmentFile, const std::string &defines)
+{
+  *build = {vertexFile, fragmentFile, 0, 0, 0};
+  if (loadShader(GL_VERTEX_SHADER, build->vertex, vertexFile, defines) &&
+      loadShader(GL_FRAGMENT_SHADER, build->fragment, fragmentFile, defines)) {
+    linkShader(build->program, build->vertex, build->fragment);
+    return true;
   }
+  if (build->vertex) glDeleteShader(build->vertex);
+  if (build->fragment) glDeleteShader(build->fragment);
+  return false;
+}
 
-  glUseProgram(progId);
-
-  glProgramState.attribs["POSITION"] = glGetAttribLocation(progId, "in_vertex");
-  glProgramState.attribs["NORMAL"] = glGetAttribLocation(progId, "in_normal");
-  glProgramState.attribs["TEXCOORD_0"] =
-      glGetAttribLocation(progId, "in_texcoord");
-};
+// Whether finishProgram would not block. Without
+// KHR_parallel_shader_compile there is no way to tell, so it always would.
+static bool
+programCompleted(const GLProgramBuild &build)
+{
+  if (!parallelCompile) return true;
+  GLint done = GL_FALSE;
+  glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &done);
+  return done == GL_TRUE;
+}
 
+// Drops a build started by startProgram without waiting for it.
 static void
-drawMesh(tinygltf::Model &model, const tinygltf::Mesh &mesh)
+discardProgram(GLProgramBuild *build)
 {
-  for (size_t i = 0; i < mesh.primitives.size(); i++) {
-    const tinygltf::Primitive &primitive = mesh.primitives[i];
+  glDeleteShader(build->vertex);
+  glDeleteShader(build->fragment);
+  glDeleteProgram(build->program);
+}
 
-    if (primitive.indices < 0) return;
+// Checks a build started by startProgram. Nothing is left behind on
+// failure, so a running program can be kept.
+static bool
+finishProgram(GLProgramBuild *build, GLuint *program)
+{
+  bool ok = checkShader(build->vertex, build->vertexFile) &&
+            checkShader(build->fragment, build->fragmentFile) &&
+            checkProgram(build->program);
+  if (!ok) {
+    discardProgram(build);
+    return false;
+  }
+  glDeleteShader(build->vertex);
+  glDeleteShader(build->fragment);
+  *program = build->program;
+  return true;
+}
 
-    std::map<std::string, int>::const_iterator it(primitive.attributes.begin());
-    std::map<std::string, int>::const_iterator itEnd(
-        primitive.attributes.end());
+static bool
+buildProgram(GLuint *program, const char *vertexFile,
+    const char *fragmentFile, const std::string &defines)
+{
+  GLProgramBuild build;
+  return startProgram(&build, vertexFile, fragmentFile, defines) &&
+         finishProgram(&build, program);
+}
 
-    for (auto [attribute, index] : primitive.attributes) {
-      assert(index >= 0);
-      const tinygltf::Accessor &accessor = model.accessors[index];
-      glBindBuffer(GL_ARRAY_BUFFER, glBufferState[accessor.bufferView].vb);
-      checkErrors("bind buffer");
-      int size = 1;
-      if (accessor.type == TINYGLTF_TYPE_SCALAR) {
-        size = 1;
-      } else if (accessor.type == TINYGLTF_TYPE_VEC2) {
-        size = 2;
-      } else if (accessor.type == TINYGLTF_TYPE_VEC3) {
-        size = 3;
-      } else if (accessor.type == TINYGLTF_TYPE_VEC4) {
-        size = 4;
-      } else {
-        assert(0);
-      }
-      if ((attribute == "POSITION") || (attribute == "NORMAL") ||
-          (attribute == "TEXCOORD_0")) {
-        if (glProgramState.attribs[attribute] >= 0) {
-          // compute byteStride from accessor + bufferView.
-          int byteStride =
-              accessor.ByteStride(model.bufferViews[accessor.bufferView]);
-          assert(byteStride != -1);
-          glVertexAttribPointer(glProgramState.attribs[attribute], size,
-              accessor.componentType, accessor.normalized ? GL_TRUE : GL_FALSE,
-              byteStride, BUFFER_OFFSET(accessor.byteOffset));
-          checkErrors("vertex attrib pointer");
-          glEnableVertexAttribArray(glProgramState.attribs[attribute]);
-          checkErrors("enable vertex attrib array");
-        }
-      }
-    }
+// Vertex attributes the viewer knows, with their shader inputs.
+typedef struct {
+  const char *attribute;
+  const char *name;
+  GLint location;
+} VertexInput;
+
+static const VertexInput vertexInputs[] = {
+    {"POSITION", "in_vertex", ATTRIB_POSITION},
+    {"NORMAL", "in_normal", ATTRIB_NORMAL},
+    {"TEXCOORD_0", "in_texcoord", ATTRIB_TEXCOORD},
+    {"JOINTS_0", "in_joints", ATTRIB_JOINTS},
+    {"WEIGHTS_0", "in_weights", ATTRIB_WEIGHTS},
+    {"COLOR_0", "in_color", ATTRIB_COLOR},
+};
 
-    const tinygltf::Accessor &indexAccessor =
-        model.accessors[primitive.indices];
-    glBindBuffer(
-        GL_ELEMENT_ARRAY_BUFFER, glBufferState[indexAccessor.bufferView].vb);
-    checkErrors("bind buffer");
-    int mode = -1;
-    if (primitive.mode == TINYGLTF_MODE_TRIANGLES) {
-      mode = GL_TRIANGLES;
-    } else if (primitive.mode == TINYGLTF_MODE_TRIANGLE_STRIP) {
-      mode = GL_TRIANGLE_STRIP;
-    } else if (primitive.mode == TINYGLTF_MODE_TRIANGLE_FAN) {
-      mode = GL_TRIANGLE_FAN;
-    } else if (primitive.mode == TINYGLTF_MODE_POINTS) {
-      mode = GL_POINTS;
-    } else if (primitive.mode == TINYGLTF_MODE_LINE) {
-      mode = GL_LINES;
-    } else if (primitive.mode == TINYGLTF_MODE_LINE_LOOP) {
-      mode = GL_LINE_LOOP;
-    } else {
-      assert(0);
-    }
-    glDrawElements(mode, indexAccessor.count, indexAccessor.componentType,
-        BUFFER_OFFSET(indexAccessor.byteOffset));
-    checkErrors("draw elements");
-
-    {
-      for (auto [attribute, _] : primitive.attributes) {
-        if (attribute == "POSITION" || attribute == "NORMAL" ||
-            attribute == "TEXCOORD_0") {
-          if (glProgramState.attribs[attribute] >= 0) {
-            glDisableVertexAttribArray(glProgramState.attribs[attribute]);
-          }
-        }
-      }
-    }
+// Points the samplers and uniform blocks of `program` at the units and
+// binding points the viewer uses.
+static void
+setupProgram(GLuint program)
+{
+  static const char *maps[MATERIAL_TEXTURES] = {"u_base_color_map",
+      "u_metallic_roughness_map", "u_normal_map", "u_occlusion_map",
+      "u_emissive_map"};
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "u_joint_matrices"),
+      JOINT_TEXTURE_UNIT);
+  glUniform1i(
+      glGetUniformLocation(program, "u_morph_deltas"), MORPH_TEXTURE_UNIT);
+  for (int i = 0; i < MATERIAL_TEXTURES; i++)
+    glUniform1i(
+        glGetUniformLocation(program, maps[i]), MATERIAL_TEXTURE_UNIT + i);
+  static const char *blocks[3] = {"Camera", "Draw", "Material"};
+  static const GLuint bindings[3] = {
+      CAMERA_BLOCK_BINDING, DRAW_BLOCK_BINDING, MATERIAL_BLOCK_BINDING};
+  for (int i = 0; i < 3; i++) {
+    // The depth program has no Material block.
+    GLuint index = glGetUniformBlockIndex(program, blocks[i]);
+    if (index != GL_INVALID_INDEX)
+      glUniformBlockBinding(program, index, bindings[i]);
   }
+  checkErrors("setup program");
 }
 
-static void
-drawNode(tinygltf::Model &model, const tinygltf::Node &node)
+// Vertex attributes `program` reads, in vertexInputs order.
+static std::vector<std::string>
+programAttributes(GLuint program)
 {
-  glPushMatrix();
-  if (node.matrix.size() == 16) {
-    // ModelView行列に相対位置をかける
-    glMultMatrixd(node.matrix.data());
-  } else {
-    // Trans x Rotate x Scale
-    if (node.translation.size() == 3) {
-      std::cout << "TODO: support node translation matrix" << std::endl;
-      // glTranslated(
-      // node.translation[0], node.translation[1], node.translation[2]);
-    }
+  std::vector<std::string> attributes;
+  for (const VertexInput &input : vertexInputs)
+    if (glGetAttribLocation(program, input.name) >= 0)
+      attributes.push_back(input.attribute);
+  return attributes;
+}
 
-    if (node.rotation.size() == 4) {
-      std::cout << "TODO: support node rotation matrix" << std::endl;
-      // glRotated();
-    }
+static GLint
+attributeLocation(const std::string &attribute)
+{
+  for (const VertexInput &input : vertexInputs)
+    if (attribute == input.attribute) return input.location;
+  return -1;
+}
 
-    if (node.scale.size() == 3) {
-      std::cout << "TODO: support node scale matrix" << std::endl;
-      // glScaled(node.scale[0], node.scale[1], node.scale[2]);
-    }
-  }
+// Defines of the shaders of a permutation. --normals shades every one with
+// the normal visualization.
+static std::string
+shaderDefines(uint32_t features)
+{
+  std::string defines = materialDefines(features);
+  if (normalShading) defines += "#define NORMALS\n";
+  return defines;
+}
 
-  if (node.mesh > -1) {
-    assert(node.mesh < (int)model.meshes.size());
-    drawMesh(model, model.meshes[node.mesh]);
+// Index of the permutation with `features`, whose build starts on first
+// use. -1 when its shaders cannot be read.
+static int
+permutation(uint32_t features)
+{
+  auto it = permutationIndex.find(features);
+  if (it != permutationIndex.end()) return it->second;
+  GLPermutation permutation = {features, PERMUTATION_COMPILING};
+  if (!startProgram(&permutation.build, "shader.vert", "shader.frag",
+          shaderDefines(features))) {
+    permutationIndex[features] = -1;
+    return -1;
   }
-
-  for (size_t i = 0; i < node.children.size(); i++) {
-    assert(node.children[i] < (int)model.nodes.size());
-    drawNode(model, model.nodes[node.children[i]]);
+  if (permutationsCompiling++ == 0) {
+    permutationsStarted = 0;
+    compileStart = glfwGetTime();
   }
+  permutationsStarted++;
+  int index = (int)glPermutations.size();
+  glPermutations.push_back(permutation);
+  permutationIndex[features] = index;
+  return index;
+}
 
-  glPopMatrix();
+// Attributes the vertex streams of a permutation's primitives hold: those
+// of the fallback until the permutation is linked.
+static const std::vector<std::string> &
+streamAttributes(int index)
+{
+  const GLPermutation &permutation = glPermutations[index];
+  if (permutation.state == PERMUTATION_LINKED ||
+      permutation.state == PERMUTATION_READY)
+    return permutation.attributes;
+  return glPermutations[0].attributes;
 }
 
-static void
-drawModel(tinygltf::Model &model)
+// Permutation a primitive is drawn with right now.
+static int
+drawnPermutation(int index)
 {
-  assert(model.scenes.size() > 0);
+  return glPermutations[index].state == PERMUTATION_READY ? index : 0;
+}
 
-  int scene_to_display = model.defaultScene > -1 ? model.defaultScene : 0;
-  const tinygltf::Scene &scene = model.scenes[scene_to_display];
-  for (size_t i = 0; i < scene.nodes.size(); i++) {
-    drawNode(model, model.nodes[scene.nodes[i]]);
+// Checks the permutations being compiled, waiting for them with `wait` and
+// otherwise only taking those the driver is done with. Those reading the
+// same attributes as the fallback are drawn right away; tells whether the
+// others need the vertex streams rebuilt, once nothing is compiling.
+static bool
+pollPermutations(bool wait)
+{
+  if (permutationsCompiling == 0) return false;
+  bool linked = false;
+  for (size_t i = 0; i < glPermutations.size(); i++) {
+    GLPermutation &permutation = glPermutations[i];
+    if (permutation.state == PERMUTATION_LINKED) linked = true;
+    if (permutation.state != PERMUTATION_COMPILING ||
+        (!wait && !programCompleted(permutation.build)))
+      continue;
+    permutationsCompiling--;
+    sceneDirty = true;
+    if (!finishProgram(&permutation.build, &permutation.program)) {
+      std::cout << "permutation " << i << " failed, drawn with the fallback"
+                << std::endl;
+      permutation.state = PERMUTATION_FAILED;
+      continue;
+    }
+    setupProgram(permutation.program);
+    permutation.attributes = programAttributes(permutation.program);
+    if (i == 0 || permutation.attributes == glPermutations[0].attributes) {
+      permutation.state = PERMUTATION_READY;
+    } else {
+      permutation.state = PERMUTATION_LINKED;
+      linked = true;
+    }
   }
+  if (permutationsCompiling > 0) return false;
+  printf("%d shader permutations compiled in %.1f ms (%s)\n",
+      permutationsStarted, (glfwGetTime() - compileStart) * 1000.0,
+      parallelCompile ? "parallel" : "serial");
+  return linked;
 }
 
-int
-main(int argc, char **argv)
+// Rebuilds every permutation from the shader files, keeping the running
+// programs unless all of them build. All are started before any is
+// checked, so that they compile in parallel. Tells whether the vertex
+// attributes read changed, which makes the vertex streams stale.
+static bool
+reloadPermutations(bool *attributesChanged)
 {
-  tinygltf::Model model;
-  tinygltf::TinyGLTF loader;
-  std::string err;
-  std::string warn;
+  pollPermutations(true);
+  double start = glfwGetTime();
+  std::vector<GLProgramBuild> builds;
+  for (const GLPermutation &permutation : glPermutations) {
+    GLProgramBuild build;
+    if (!startProgram(&build, "shader.vert", "shader.frag",
+            shaderDefines(permutation.features)))
+      break;
+    builds.push_back(build);
+  }
+  bool ok = builds.size() == glPermutations.size();
+  std::vector<GLuint> programs;
+  for (GLProgramBuild &build : builds) {
+    GLuint program;
+    if (!ok)
+      discardProgram(&build);
+    else if (finishProgram(&build, &program))
+      programs.push_back(program);
+    else
+      ok = false;
+  }
+  if (!ok) {
+    for (GLuint program : programs) glDeleteProgram(program);
+    return false;
+  }
 
-  if (argc < 2) {
-    std::cout << argv[0] << " "
-              << "<model path>.gltf <binary path>.bin" << std::endl;
-    return EXIT_FAILURE;
+  *attributesChanged = false;
+  for (size_t i = 0; i < programs.size(); i++) {
+    GLPermutation &permutation = glPermutations[i];
+    std::vector<std::string> attributes = programAttributes(programs[i]);
+    if (attributes != streamAttributes((int)i)) *attributesChanged = true;
+    if (permutation.program) glDeleteProgram(permutation.program);
+    permutation.program = programs[i];
+    permutation.attributes = attributes;
+    permutation.state = PERMUTATION_READY;
+    setupProgram(permutation.program);
   }
+  printf("%zu shader permutations compiled in %.1f ms (%s)\n",
+      programs.size(), (glfwGetTime() - start) * 1000.0,
+      parallelCompile ? "parallel" : "serial");
+  return true;
+}
 
-  std::string filename(argv[1]);
-  std::string ext = getFilePathExtension(filename);
+// Builds shader.vert with depth.frag, replacing the running depth program
+// on success. The shading pass tests against its depth with GL_EQUAL, which
+// holds because gl_Position is invariant and computed by the same source:
+// the same expressions and control flow on the same inputs, including the
+// Draw block and the palette of each instance.
+static bool
+buildDepthProgram()
+{
+  GLuint program;
+  if (!buildProgram(&program, "shader.vert", "depth.frag", "")) return false;
+  setupProgram(program);
+  if (depthProgram) glDeleteProgram(depthProgram);
+  depthProgram = program;
+  checkErrors("setup depth program");
+  return true;
+}
 
-  bool ret = false;
-  if (ext.compare("glb") == 0) {
-    ret = loader.LoadBinaryFromFile(&model, &err, &warn, filename.c_str());
-  } else {
-    ret = loader.LoadASCIIFromFile(&model, &err, &warn, filename.c_str());
+// (Re)builds the vertex stream of every primitive for the attributes its
+// permutation reads, or those of the fallback until it is linked.
+// Primitives using the same accessors with the same attributes share one.
+static void
+setupVertexStreams(tinygltf::Model &model)
+{
+  PROFILE_ZONE("setupVertexStreams");
+  for (GLVertexStream &stream : glVertexStreams) {
+    memorySetGpu(MEMORY_GPU_BUFFERS, stream.vb, 0, nullptr);
+    glDeleteBuffers(1, &stream.vb);
+    if (stream.positions) {
+      memorySetGpu(MEMORY_GPU_BUFFERS, stream.positions, 0, nullptr);
+      glDeleteBuffers(1, &stream.positions);
+    }
   }
+  glVertexStreams.clear();
+
+  typedef std::pair<std::map<std::string, int>, std::vector<std::string>> Key;
+  std::map<Key, int> shared;  // by accessors and attributes read
+  size_t bytes = 0;
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    const tinygltf::Mesh &mesh = model.meshes[m];
+    std::vector<int> &streams = glMeshState[m].primitiveStreams;
+    streams.assign(mesh.primitives.size(), -1);
+    for (size_t p = 0; p < mesh.primitives.size(); p++) {
+      const tinygltf::Primitive &primitive = mesh.primitives[p];
+      int program = glMeshState[m].primitivePrograms[p];
+      if (program < 0) continue;
+      Key key(primitive.attributes, streamAttributes(program));
+      auto it = shared.find(key);
+      if (it != shared.end()) {
+        streams[p] = it->second;
+        continue;
+      }
 
-  if (!warn.empty()) {
-    printf("Warn: %s\n", warn.c_str());
-  }
+      std::vector<VertexElement> elements;
+      size_t stride, count;
+      std::vector<unsigned char> data;
+      if (!interleaveVertices(model, primitive, key.second, &elements,
+              &stride, &count, &data)) {
+        std::cout << "mesh " << m << " primitive " << p
+                  << ": unreadable vertex attributes" << std::endl;
+        shared[key] = -1;
+        continue;
+      }
+      GLVertexStream stream = {};
+      stream.stride = (GLsizei)stride;
+      stream.count = (GLsizei)count;
+      for (const VertexElement &element : elements) {
+        stream.attribs.push_back({attributeLocation(element.attribute),
+            element.components, (GLenum)element.componentType,
+            (GLboolean)element.normalized, element.offset});
+      }
+      glGenBuffers(1, &stream.vb);
+      glBindBuffer(GL_ARRAY_BUFFER, stream.vb);
+      glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+      memorySetGpu(MEMORY_GPU_BUFFERS, stream.vb, data.size(), "vertices");
+      bytes += data.size();
+
+      std::vector<float> positions;
+      int components;
+      auto position = primitive.attributes.find("POSITION");
+      if (position != primitive.attributes.end() &&
+          readAccessorFloats(model, position->second, &positions,
+              &components) &&
+          components == 3 && positions.size() == count * 3) {
+        size_t size = positions.size() * sizeof(float);
+        glGenBuffers(1, &stream.positions);
+        glBindBuffer(GL_ARRAY_BUFFER, stream.positions);
+        glBufferData(
+            GL_ARRAY_BUFFER, size, positions.data(), GL_STATIC_DRAW);
+        memorySetGpu(
+            MEMORY_GPU_BUFFERS, stream.positions, size, "positions");
+        bytes += size;
+      }
 
-  if (!err.empty()) {
-    printf("ERR: %s\n", err.c_str());
-    return EXIT_FAILURE;
-  }
-  if (!ret) {
-    printf("Failed to load .glTF : %s\n", argv[1]);
-    return EXIT_FAILURE;
+      streams[p] = (int)glVertexStreams.size();
+      shared[key] = streams[p];
+      glVertexStreams.push_back(std::move(stream));
+    }
   }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-  {
-    eye[0] = 0.0f;
-    eye[1] = 0.0f;
-    eye[2] = CAM_Z;
+  std::cout << glVertexStreams.size() << " vertex streams ("
+            << bytes / 1024 << " KiB)" << std::endl;
 
-    lookat[0] = 0.0f;
-    lookat[1] = 0.0f;
-    lookat[2] = 0.0f;
+  // Linked permutations have their attributes now.
+  for (GLPermutation &permutation : glPermutations)
+    if (permutation.state == PERMUTATION_LINKED)
+      permutation.state = PERMUTATION_READY;
+}
 
-    up[0] = 0.0f;
-    up[1] = 1.0f;
-    up[2] = 0.0f;
-  }
+// Per-instance attributes and the buffer they are streamed from.
+static void
+setupInstanceBuffer()
+{
+  for (int i = 0; i < 4; i++)
+    glVertexAttribDivisor(ATTRIB_INSTANCE_MODEL + i, 1);
+  for (int i = 0; i < 3; i++)
+    glVertexAttribDivisor(ATTRIB_INSTANCE_NORMAL + i, 1);
+  glVertexAttribDivisor(ATTRIB_INSTANCE_PALETTE, 1);
 
-  if (!glfwInit()) {
-    std::cerr << "Failed to initialize GLFW." << std::endl;
-    return EXIT_FAILURE;
-  }
+  glGenBuffers(1, &frameInstanceBuffer);
+};
 
-  window = glfwCreateWindow(width, height, "glTF Viewer", NULL, NULL);
-  if (window == NULL) {
-    std::cerr << "Failed to open GLFW window. " << std::endl;
-    glfwTerminate();
-    return EXIT_FAILURE;
+static void
+gpuZoneBegin(const char *name)
+{
+  if (!gpuTiming) return;
+  GLuint query;
+  if (gpuQueryPool.empty()) {
+    glGenQueries(1, &query);
+  } else {
+    query = gpuQueryPool.back();
+    gpuQueryPool.pop_back();
   }
+  glBeginQuery(GL_TIME_ELAPSED, query);
+  gpuZones.push_back({query, name, profilerNow()});
+}
 
-  glfwGetWindowSize(window, &width, &height);
+static void
+gpuZoneEnd()
+{
+  if (gpuTiming) glEndQuery(GL_TIME_ELAPSED);
+}
 
-  glfwMakeContextCurrent(window);
+static void
+collectGpuZones()
+{
+  while (!gpuZones.empty()) {
+    const GLGpuZone &zone = gpuZones.front();
+    GLint available = 0;
+    glGetQueryObjectiv(zone.query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) break;
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(zone.query, GL_QUERY_RESULT, &elapsed);
+    profilerRecordGpu(zone.name, zone.submitted, elapsed);
+    gpuQueryPool.push_back(zone.query);
+    gpuZones.pop_front();
+  }
+}
 
-  glfwSetMouseButtonCallback(window, pointerButtonHandler);
-  glfwSetCursorPosCallback(window, pointerMotionHandler);
+static void
+streamCreate(GLStreamBuffer *stream, size_t size)
+{
+  *stream = GLStreamBuffer();
+  stream->size = size;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &stream->alignment);
+  glGenBuffers(1, &stream->buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, stream->buffer);
+  if (persistentMapping) {
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_UNIFORM_BUFFER, size * STREAM_FRAMES, NULL, flags);
+    stream->mapped = (unsigned char *)glMapBufferRange(
+        GL_UNIFORM_BUFFER, 0, size * STREAM_FRAMES, flags);
+  } else {
+    glBufferData(
+        GL_UNIFORM_BUFFER, size * STREAM_FRAMES, NULL, GL_STREAM_DRAW);
+    stream->staging.resize(size);
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  memorySetGpu(MEMORY_GPU_BUFFERS, stream->buffer, size * STREAM_FRAMES,
+      "uniform stream");
+  checkErrors("stream buffer");
+}
 
-  glewExperimental = true;
-  if (glewInit() != GLEW_OK) {
-    std::cerr << "Failed to initialize GLEW." << std::endl;
-    return EXIT_FAILURE;
+// Moves to the next region, waiting for the GPU to be done with it, and
+// makes room for `bytes` in it.
+static void
+streamBegin(GLStreamBuffer *stream, size_t bytes)
+{
+  if (bytes > stream->size) {
+    // Replacing the buffer needs every frame in flight to have finished.
+    glFinish();
+    for (GLsync &fence : stream->fences)
+      if (fence) glDeleteSync(fence);
+    if (stream->mapped) {
+      glBindBuffer(GL_UNIFORM_BUFFER, stream->buffer);
+      glUnmapBuffer(GL_UNIFORM_BUFFER);
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    memorySetGpu(MEMORY_GPU_BUFFERS, stream->buffer, 0, nullptr);
+    glDeleteBuffers(1, &stream->buffer);
+    streamCreate(stream, std::max(bytes, stream->size * 2));
+    return;
   }
 
-  GLuint programId = 0, vertexId = 0, fragmentId = 0;
+  stream->frame = (stream->frame + 1) % STREAM_FRAMES;
+  stream->used = 0;
+  GLsync &fence = stream->fences[stream->frame];
+  if (fence) {
+    GLenum status;
+    do {
+      status =
+          glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(fence);
+    fence = 0;
+  }
+}
 
-  const char *shader_frag_filename = "shader.frag";
-  const char *shader_vert_filename = "shader.vert";
+// Returns the buffer offset of `size` new bytes and where to write them.
+static size_t
+streamAlloc(GLStreamBuffer *stream, size_t size, void **data)
+{
+  size_t align = (size_t)stream->alignment;
+  size_t offset = (stream->used + align - 1) / align * align;
+  assert(offset + size <= stream->size);
+  stream->used = offset + size;
+  *data = (stream->mapped ? stream->mapped + stream->frame * stream->size
+                          : stream->staging.data()) +
+          offset;
+  return stream->frame * stream->size + offset;
+}
 
-  if (!loadShader(GL_VERTEX_SHADER, vertexId, shader_vert_filename))
-    return EXIT_FAILURE;
-  checkErrors("load vert shader");
+// Makes the writes of the frame visible, before drawing with them.
+static void
+streamFlush(GLStreamBuffer *stream)
+{
+  if (stream->mapped || stream->used == 0) return;
+  glBindBuffer(GL_UNIFORM_BUFFER, stream->buffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, stream->frame * stream->size,
+      stream->used, stream->staging.data());
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
 
-  if (!loadShader(GL_FRAGMENT_SHADER, fragmentId, shader_frag_filename))
-    return EXIT_FAILURE;
-  checkErrors("load frag shader");
+// Fences the region after the last draw reading it.
+static void
+streamEnd(GLStreamBuffer *stream)
+{
+  if (stream->mapped)
+    stream->fences[stream->frame] =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
 
-  if (!linkShader(programId, vertexId, fragmentId)) return EXIT_FAILURE;
-  checkErrors("link");
+static void
+setupSkinning(tinygltf::Model &model)
+{
+  PROFILE_ZONE("setupSkinning");
+  buildSkins(model, &skins);
+
+  glGenBuffers(1, &jointBuffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, jointBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(Mat4), NULL, GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  memorySetGpu(MEMORY_GPU_BUFFERS, jointBuffer, sizeof(Mat4), "joint palette");
+
+  glGenTextures(1, &jointTexture);
+  glActiveTexture(GL_TEXTURE0 + JOINT_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, jointTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, jointBuffer);
+  glActiveTexture(GL_TEXTURE0);
+
+  if (!skins.empty())
+    std::cout << skins.size() << " skins" << std::endl;
+}
 
-  {
-    GLint vtxLoc = glGetAttribLocation(programId, "in_vertex");
-    if (vtxLoc < 0) {
-      printf("in_vertex loc not found.\n");
-      return EXIT_FAILURE;
+// Packs the deltas of every morph target into one texture buffer. Falls back
+// to blending on the CPU when they do not fit.
+static void
+setupMorphTargets(tinygltf::Model &model)
+{
+  PROFILE_ZONE("setupMorphTargets");
+  std::vector<float> texels;
+  size_t morphed = 0;
+  glMorphState.resize(model.meshes.size());
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    const tinygltf::Mesh &mesh = model.meshes[m];
+    GLMorphState &state = glMorphState[m];
+    state.primitives.resize(mesh.primitives.size());
+    state.base.assign(mesh.primitives.size(), -1);
+    for (size_t p = 0; p < mesh.primitives.size(); p++) {
+      MorphPrimitive &morph = state.primitives[p];
+      if (!buildMorphPrimitive(model, mesh.primitives[p], &morph)) continue;
+      state.base[p] = (int)(texels.size() / 4);
+      packMorphDeltas(morph, &texels);
+      morphed++;
     }
   }
+  if (morphed == 0) return;
+
+  GLint maxTexels = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+  if (!cpuMorph && texels.size() / 4 > (size_t)maxTexels) {
+    std::cout << "morph targets exceed the texture buffer size, blending on "
+              << "the CPU" << std::endl;
+    cpuMorph = true;
+  }
+  std::cout << morphed << " primitives with morph targets, "
+            << (cpuMorph ? "CPU" : "GPU") << " blending" << std::endl;
+  if (cpuMorph) return;
+
+  glGenBuffers(1, &morphBuffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, morphBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(float),
+      texels.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  memorySetGpu(MEMORY_GPU_BUFFERS, morphBuffer, texels.size() * sizeof(float),
+      "morph targets");
+
+  glGenTextures(1, &morphTexture);
+  glActiveTexture(GL_TEXTURE0 + MORPH_TEXTURE_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, morphTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, morphBuffer);
+  glActiveTexture(GL_TEXTURE0);
+}
 
-  glUseProgram(programId);
-  checkErrors("useProgram");
+// Applies the weights of `node` to primitive `p` of `meshIndex`. On the GPU
+// path this fills the morph fields of `uniforms` and returns 0; on the CPU
+// path it returns a buffer holding the blended positions, followed by the
+// blended normals.
+static GLuint
+prepareMorph(int meshIndex, size_t p, int node, DrawUniforms *uniforms)
+{
+  const GLMorphState &state = glMorphState[meshIndex];
+  if (state.base[p] < 0) return 0;
+  const MorphPrimitive &morph = state.primitives[p];
+
+  int *targets = uniforms->morphTargets;
+  float *weights = uniforms->morphWeights;
+  int count = activeMorphTargets(
+      &sceneState.weights[sceneState.weightOffset[node]],
+      sceneState.weightCount[node], morph.targetCount, targets, weights);
+
+  if (!cpuMorph) {
+    uniforms->morphCount = count;
+    uniforms->morphBase = state.base[p];
+    uniforms->morphVertices = (int32_t)morph.vertexCount;
+    return 0;
+  }
 
-  setupBuffer(model, programId);
-  checkErrors("setupBuffer");
+  std::vector<GLuint> &buffers = cpuMorphBuffers[node];
+  if (buffers.empty()) {
+    buffers.resize(state.primitives.size());
+    glGenBuffers((GLsizei)buffers.size(), buffers.data());
+  }
+  static std::vector<float> blended;
+  blended.resize(morph.vertexCount * 6);
+  morphBlend(morph, targets, weights, count, blended.data(),
+      blended.data() + morph.vertexCount * 3);
+  glBindBuffer(GL_ARRAY_BUFFER, buffers[p]);
+  glBufferData(GL_ARRAY_BUFFER, blended.size() * sizeof(float),
+      blended.data(), GL_STREAM_DRAW);
+  memorySetGpu(MEMORY_GPU_BUFFERS, buffers[p], blended.size() * sizeof(float),
+      "morphed vertices");
+  return buffers[p];
+}
 
-  while (glfwWindowShouldClose(window) == GL_FALSE) {
-    glfwPollEvents();
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Computes every joint matrix of the frame and uploads them in one call.
+static void
+updateSkinning()
+{
+  if (skins.empty()) return;
+  PROFILE_ZONE("skinning");
+  updateJointPalette(skins, sceneState.world, &jointPalette, jobs);
+  glBindBuffer(GL_TEXTURE_BUFFER, jointBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, jointPalette.matrices.size() * sizeof(float),
+      jointPalette.matrices.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  memorySetGpu(MEMORY_GPU_BUFFERS, jointBuffer,
+      jointPalette.matrices.size() * sizeof(float), "joint palette");
+}
 
-    glEnable(GL_DEPTH_TEST);
+static void
+setupGpuInstancing(tinygltf::Model &model)
+{
+  for (size_t n = 0; n < model.nodes.size(); n++) {
+    const tinygltf::Node &node = model.nodes[n];
+    GLGpuInstancingState state;
+    if (node.mesh < 0 || !readGpuInstances(model, node, &state.local))
+      continue;
+
+    Bounds mesh = meshBounds(model, model.meshes[node.mesh]);
+    state.bounds = boundsEmpty();
+    if (boundsValid(mesh)) {
+      for (const Mat4 &local : state.local) {
+        Bounds b = boundsTransform(local, mesh);
+        boundsExtend(state.bounds, b.min);
+        boundsExtend(state.bounds, b.max);
+      }
+    }
+    glGenBuffers(1, &state.vb);
+    state.baked = false;
+    std::cout << "node " << n << ": " << state.local.size()
+              << " GPU instances" << std::endl;
+    glGpuInstancing[(int)n] = std::move(state);
+  }
+}
 
-    glViewport(0, 0, width, height);
+// GL mode of a glTF primitive mode, or -1 for one glTF does not define.
+static int
+primitiveMode(int mode)
+{
+  switch (mode) {
+    case TINYGLTF_MODE_POINTS:
+      return GL_POINTS;
+    case TINYGLTF_MODE_LINE:
+      return GL_LINES;
+    case TINYGLTF_MODE_LINE_LOOP:
+      return GL_LINE_LOOP;
+    case TINYGLTF_MODE_LINE_STRIP:
+      return GL_LINE_STRIP;
+    case -1:  // not set
+    case TINYGLTF_MODE_TRIANGLES:
+      return GL_TRIANGLES;
+    case TINYGLTF_MODE_TRIANGLE_STRIP:
+      return GL_TRIANGLE_STRIP;
+    case TINYGLTF_MODE_TRIANGLE_FAN:
+      return GL_TRIANGLE_FAN;
+    default:
+      return -1;
+  }
+}
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(45.0, (float)width / (float)height, 0.1f, 1000.0f);
-    gluLookAt(eye[0], eye[1], eye[2], lookat[0], lookat[1], lookat[2], up[0],
-        up[1], up[2]);
-    glPushMatrix();
+// Uploads `indices` into a new element buffer, as 16-bit indices when the
+// largest one fits.
+static GLIndexState
+uploadIndices(const std::vector<uint32_t> &indices, const char *label)
+{
+  GLIndexState state = {0, GL_UNSIGNED_INT, (GLsizei)indices.size(), 0, 0};
+  if (indices.empty()) return state;
+  auto range = std::minmax_element(indices.begin(), indices.end());
+  state.start = *range.first;
+  state.end = *range.second;
+
+  glGenBuffers(1, &state.ib);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.ib);
+  size_t size;
+  if (state.end <= 0xffff) {
+    std::vector<uint16_t> narrow(indices.begin(), indices.end());
+    state.type = GL_UNSIGNED_SHORT;
+    size = narrow.size() * sizeof(uint16_t);
+    glBufferData(
+        GL_ELEMENT_ARRAY_BUFFER, size, narrow.data(), GL_STATIC_DRAW);
+  } else {
+    size = indices.size() * sizeof(uint32_t);
+    glBufferData(
+        GL_ELEMENT_ARRAY_BUFFER, size, indices.data(), GL_STATIC_DRAW);
+  }
+  memorySetGpu(MEMORY_GPU_BUFFERS, state.ib, size, label);
+  return state;
+}
 
-    glMatrixMode(GL_MODELVIEW);
-    drawModel(model);  // Push, Pop
+// Element buffers of every primitive at full detail, shared by primitives
+// using the same accessor. They are rebuilt from the accessors instead of
+// drawn from the buffer views, so that 32-bit indices are narrowed when the
+// vertices allow, 8-bit ones widened, and every draw knows its index range.
+static void
+setupIndices(tinygltf::Model &model)
+{
+  PROFILE_ZONE("setupIndices");
+  std::map<int, GLIndexState> shared;  // by accessor
+  size_t narrowed = 0;
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    const tinygltf::Mesh &mesh = model.meshes[m];
+    std::vector<GLIndexState> &states = glMeshState[m].primitiveIndices;
+    states.resize(mesh.primitives.size());
+    for (size_t p = 0; p < mesh.primitives.size(); p++) {
+      const tinygltf::Primitive &primitive = mesh.primitives[p];
+      GLIndexState &state = states[p];
+      if (primitiveMode(primitive.mode) < 0)
+        std::cout << "mesh " << m << " primitive " << p
+                  << ": unsupported mode " << primitive.mode << std::endl;
+
+      if (primitive.indices < 0) {
+        auto it = primitive.attributes.find("POSITION");
+        GLsizei count = it == primitive.attributes.end()
+                            ? 0
+                            : (GLsizei)model.accessors[it->second].count;
+        state = {0, GL_UNSIGNED_INT, count, 0, 0};
+        continue;
+      }
+      auto it = shared.find(primitive.indices);
+      if (it != shared.end()) {
+        state = it->second;
+        continue;
+      }
+
+      std::vector<uint32_t> indices;
+      if (!readIndices(model, primitive, &indices)) {
+        std::cout << "mesh " << m << " primitive " << p
+                  << ": unreadable indices" << std::endl;
+        indices.clear();
+      }
+      state = uploadIndices(indices, "indices");
+      if (state.ib && state.type == GL_UNSIGNED_SHORT &&
+          model.accessors[primitive.indices].componentType ==
+              TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
+        narrowed++;
+      shared[primitive.indices] = state;
+    }
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  if (narrowed)
+    std::cout << narrowed << " index buffers narrowed to 16 bits"
+              << std::endl;
+}
+
+// Draws `indices`, or arrays without a buffer. Single instances use the
+// non-instanced calls, which gives the driver the index range.
+static void
+drawIndices(GLenum mode, const GLIndexState &indices, GLsizei instances)
+{
+  if (!indices.ib) {
+    if (instances == 1)
+      glDrawArrays(mode, 0, indices.count);
+    else
+      glDrawArraysInstanced(mode, 0, indices.count, instances);
+    return;
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.ib);
+  if (instances == 1)
+    glDrawRangeElements(mode, indices.start, indices.end, indices.count,
+        indices.type, BUFFER_OFFSET(0));
+  else
+    glDrawElementsInstanced(
+        mode, indices.count, indices.type, BUFFER_OFFSET(0), instances);
+}
+
+static void
+setupLods(tinygltf::Model &model)
+{
+  PROFILE_ZONE("setupLods");
+  glMeshState.resize(model.meshes.size());
+  nodeLodState.resize(model.nodes.size());
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    glMeshState[m].bounds = meshBounds(model, model.meshes[m]);
+    glMeshState[m].primitiveLods.resize(model.meshes[m].primitives.size());
+  }
+  if (!lodEnabled) return;
+
+  // Simplification dominates load time and needs no GL, so every primitive
+  // is simplified on the job system and only the uploads stay here.
+  std::vector<std::pair<int, int>> primitives;
+  for (size_t m = 0; m < model.meshes.size(); m++)
+    for (size_t p = 0; p < model.meshes[m].primitives.size(); p++)
+      primitives.push_back(std::make_pair((int)m, (int)p));
+  std::vector<std::vector<LodLevel>> chains(primitives.size());
+  jobParallelFor(jobs, primitives.size(), 1, [&](size_t begin, size_t end) {
+    MemoryScope scope(MEMORY_SCENE);
+    for (size_t i = begin; i < end; i++) {
+      PROFILE_ZONE("simplify");
+      const tinygltf::Mesh &mesh = model.meshes[primitives[i].first];
+      chains[i] = buildLodChain(model, mesh.primitives[primitives[i].second]);
+    }
+  });
+
+  for (size_t i = 0; i < primitives.size(); i++) {
+    int m = primitives[i].first, p = primitives[i].second;
+    GLMeshState &state = glMeshState[m];
+    const std::vector<LodLevel> &levels = chains[i];
+    for (size_t l = 0; l < levels.size(); l++) {
+      state.primitiveLods[p].push_back(
+          uploadIndices(levels[l].indices, "LOD indices"));
+
+      if (state.lodErrors.size() <= l) state.lodErrors.push_back(0.0f);
+      state.lodErrors[l] = std::max(state.lodErrors[l], levels[l].error);
+    }
+    if (!levels.empty())
+      std::cout << "mesh " << m << " primitive " << p << ": "
+                << levels.size() << " LODs, coarsest "
+                << levels.back().indices.size() / 3 << " triangles"
+                << std::endl;
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  // A primitive without a level reuses its coarsest one, which only becomes
+  // a problem when another primitive has a coarser level: take the errors
+  // as running maxima so selection stays conservative.
+  for (GLMeshState &state : glMeshState)
+    for (size_t l = 1; l < state.lodErrors.size(); l++)
+      state.lodErrors[l] =
+          std::max(state.lodErrors[l], state.lodErrors[l - 1]);
+}
+
+static void
+bindInstances(const InstanceRange &instances, bool enable)
+{
+  GLint model = ATTRIB_INSTANCE_MODEL;
+  GLint normal = ATTRIB_INSTANCE_NORMAL;
+  GLint palette = ATTRIB_INSTANCE_PALETTE;
+  if (!enable) {
+    for (int i = 0; i < 4; i++) glDisableVertexAttribArray(model + i);
+    for (int i = 0; i < 3; i++) glDisableVertexAttribArray(normal + i);
+    glDisableVertexAttribArray(palette);
+    return;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, instances.buffer);
+  for (int i = 0; i < 4; i++) {
+    glVertexAttribPointer(model + i, 4, GL_FLOAT, GL_FALSE,
+        sizeof(InstanceData),
+        BUFFER_OFFSET(instances.offset + offsetof(InstanceData, model) +
+                      i * 4 * sizeof(float)));
+    glEnableVertexAttribArray(model + i);
+  }
+  for (int i = 0; i < 3; i++) {
+    glVertexAttribPointer(normal + i, 3, GL_FLOAT, GL_FALSE,
+        sizeof(InstanceData),
+        BUFFER_OFFSET(instances.offset + offsetof(InstanceData, normal) +
+                      i * 3 * sizeof(float)));
+    glEnableVertexAttribArray(normal + i);
+  }
+  glVertexAttribPointer(palette, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+      BUFFER_OFFSET(instances.offset + offsetof(InstanceData, palette)));
+  glEnableVertexAttribArray(palette);
+  checkErrors("bind instances");
+}
+
+// Draws the indices of the item's LOD, with the attributes bound.
+static void
+drawLevel(GLenum mode, const DrawItem &item, GLsizei instances)
+{
+  const GLMeshState &mesh = glMeshState[item.mesh];
+  const std::vector<GLIndexState> &lods = mesh.primitiveLods[item.primitive];
+  if (item.lod > 0 && !lods.empty())
+    drawIndices(mode, lods[std::min(item.lod, (int)lods.size()) - 1],
+        instances);
+  else
+    drawIndices(mode, mesh.primitiveIndices[item.primitive], instances);
+  checkErrors("draw");
+}
+
+// Draws every instance of one primitive, with its uniform blocks already
+// in the stream buffer. `depthOnly` binds the position stream alone, for
+// the depth program.
+static void
+drawPrimitive(tinygltf::Model &model, const DrawItem &item, bool depthOnly)
+{
+  const tinygltf::Primitive &primitive =
+      model.meshes[item.mesh].primitives[item.primitive];
+  int mode = primitiveMode(primitive.mode);
+  int streamIndex = glMeshState[item.mesh].primitiveStreams[item.primitive];
+  if (mode < 0 || streamIndex < 0) return;
+
+  const InstanceRange &instances = item.instances;
+  bindInstances(instances, true);
+
+  const GLVertexStream &stream = glVertexStreams[streamIndex];
+  if (depthOnly) {
+    glBindBuffer(GL_ARRAY_BUFFER, stream.positions);
+    glVertexAttribPointer(
+        ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    drawLevel(mode, item, instances.count);
+    glDisableVertexAttribArray(ATTRIB_POSITION);
+    bindInstances(instances, false);
+    return;
+  }
+
+  // Morphed positions and normals come from the CPU blend instead.
+  glBindBuffer(GL_ARRAY_BUFFER, stream.vb);
+  for (const GLVertexAttrib &attrib : stream.attribs) {
+    bool blended = item.morphed && (attrib.location == ATTRIB_POSITION ||
+                                       attrib.location == ATTRIB_NORMAL);
+    if (blended) continue;
+    glVertexAttribPointer(attrib.location, attrib.size, attrib.type,
+        attrib.normalized, stream.stride, BUFFER_OFFSET(attrib.offset));
+    glEnableVertexAttribArray(attrib.location);
+  }
+  if (item.morphed) {
+    glBindBuffer(GL_ARRAY_BUFFER, item.morphed);
+    for (const GLVertexAttrib &attrib : stream.attribs) {
+      if (attrib.location != ATTRIB_POSITION &&
+          attrib.location != ATTRIB_NORMAL)
+        continue;
+      size_t offset =
+          attrib.location == ATTRIB_NORMAL ? stream.count * 12 : 0;
+      glVertexAttribPointer(attrib.location, 3, GL_FLOAT, GL_FALSE, 0,
+          BUFFER_OFFSET(offset));
+      glEnableVertexAttribArray(attrib.location);
+    }
+  }
+  checkErrors("vertex attrib pointer");
+
+  drawLevel(mode, item, instances.count);
+
+  for (const GLVertexAttrib &attrib : stream.attribs)
+    glDisableVertexAttribArray(attrib.location);
+
+  bindInstances(instances, false);
+}
+
+// GL texture of glTF texture `texture`, with the filters and wrap modes of
+// its sampler, uploaded on first use. Base color and emissive maps are
+// sRGB, so a source used both ways is uploaded twice. 0 when the image was
+// not decoded.
+static GLuint
+textureObject(tinygltf::Model &model, int texture, bool srgb)
+{
+  auto key = std::make_pair(texture, srgb);
+  auto it = glTextures.find(key);
+  if (it != glTextures.end()) return it->second;
+
+  const tinygltf::Texture &t = model.textures[texture];
+  const tinygltf::Image &image = model.images[t.source];
+  GLuint id = 0;
+  if (image.image.empty() || image.component != 4 ||
+      (image.bits != 8 && image.bits != 16)) {
+    std::cout << "texture " << texture << ": image " << t.source
+              << " is not decoded as RGBA" << std::endl;
+    glTextures[key] = 0;
+    return 0;
+  }
+
+  int minFilter = GL_LINEAR_MIPMAP_LINEAR, magFilter = GL_LINEAR;
+  int wrapS = GL_REPEAT, wrapT = GL_REPEAT;
+  if (t.sampler >= 0 && t.sampler < (int)model.samplers.size()) {
+    const tinygltf::Sampler &sampler = model.samplers[t.sampler];
+    if (sampler.minFilter > 0) minFilter = sampler.minFilter;
+    if (sampler.magFilter > 0) magFilter = sampler.magFilter;
+    wrapS = sampler.wrapS;
+    wrapT = sampler.wrapT;
+  }
+  bool mipmaps = minFilter != GL_NEAREST && minFilter != GL_LINEAR;
+
+  glGenTextures(1, &id);
+  glBindTexture(GL_TEXTURE_2D, id);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8,
+      image.width, image.height, 0, GL_RGBA,
+      image.bits == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE,
+      image.image.data());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+  if (mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  size_t bytes = (size_t)image.width * image.height * 4;
+  memorySetGpu(MEMORY_GPU_IMAGES, id, mipmaps ? bytes * 4 / 3 : bytes,
+      "texture");
+  glTextures[key] = id;
+  return id;
+}
+
+static bool
+srgbMap(int slot)
+{
+  return (1u << slot) == MATERIAL_BASE_COLOR_MAP ||
+         (1u << slot) == MATERIAL_EMISSIVE_MAP;
+}
+
+// Texture array holding the layers of `atlas`. Mipmaps stop at the level
+// the borders allow.
+static GLuint
+atlasObject(const TextureAtlas &atlas, bool srgb)
+{
+  GLuint id;
+  glGenTextures(1, &id);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8,
+      atlas.size, atlas.size, atlas.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+      atlas.pixels.data());
+  glTexParameteri(
+      GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, ATLAS_MIP_LEVELS);
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  memorySetGpu(MEMORY_GPU_IMAGES, id, atlas.pixels.size() * 4 / 3,
+      "texture atlas");
+  return id;
+}
+
+// Materials whose maps are all small enough to be packed, and the textures
+// they use, linear ones first then sRGB ones. Nothing when there are fewer
+// than two textures to pack, as nothing would be batched.
+static std::vector<bool>
+atlasMaterials(tinygltf::Model &model, std::vector<int> packed[2])
+{
+  size_t count = model.materials.size();
+  std::vector<bool> atlased(count + 1, false);
+  if (!atlasEnabled) return atlased;
+  std::set<int> textures[2];
+  for (size_t m = 0; m < count; m++) {
+    int slots[MATERIAL_TEXTURES];
+    materialTextures(model, (int)m, slots);
+    bool maps = false, small = true;
+    for (int i = 0; i < MATERIAL_TEXTURES; i++) {
+      if (slots[i] < 0) continue;
+      maps = true;
+      small = small && atlasCandidate(model, slots[i]);
+    }
+    if (!maps || !small) continue;
+    atlased[m] = true;
+    for (int i = 0; i < MATERIAL_TEXTURES; i++)
+      if (slots[i] >= 0) textures[srgbMap(i)].insert(slots[i]);
+  }
+  if (textures[0].size() + textures[1].size() < 2)
+    return std::vector<bool>(count + 1, false);
+  for (int k = 0; k < 2; k++)
+    packed[k].assign(textures[k].begin(), textures[k].end());
+  return atlased;
+}
+
+// Pass, Material block and textures of every material, and of the default
+// material after them. The blocks are uploaded once into one buffer.
+// Materials with small maps only sample the atlases, so that switching
+// between them binds no texture.
+static void
+setupMaterials(tinygltf::Model &model)
+{
+  PROFILE_ZONE("setupMaterials");
+  std::vector<int> packed[2];
+  std::vector<bool> atlased = atlasMaterials(model, packed);
+  TextureAtlas atlases[2];
+  GLuint atlasIds[2] = {0, 0};
+  if (!packed[0].empty() || !packed[1].empty()) {
+    GLint maxSize, maxLayers;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    for (int k = 0; k < 2; k++)
+      buildAtlas(model, packed[k], std::min(maxSize, ATLAS_MAX_SIZE),
+          &atlases[k]);
+    if (atlases[0].layers <= maxLayers && atlases[1].layers <= maxLayers) {
+      for (int k = 0; k < 2; k++)
+        if (atlases[k].layers) atlasIds[k] = atlasObject(atlases[k], k);
+      std::cout << packed[0].size() + packed[1].size()
+                << " textures packed into " << atlases[0].layers << " + "
+                << atlases[1].layers << " atlas layers" << std::endl;
+    } else {
+      atlased.assign(atlased.size(), false);
+    }
+  }
+
+  size_t count = model.materials.size() + 1;
+  size_t align = (size_t)streamBuffer.alignment;
+  size_t stride = (sizeof(MaterialUniforms) + align - 1) / align * align;
+  std::vector<unsigned char> blocks(count * stride);
+  glMaterialState.resize(count);
+  for (size_t m = 0; m < count; m++) {
+    int material = m < model.materials.size() ? (int)m : -1;
+    GLMaterialState &state = glMaterialState[m];
+    state.pass = renderPass(model, material);
+    state.uniforms = m * stride;
+    state.atlas = atlased[m];
+    MaterialUniforms *uniforms =
+        (MaterialUniforms *)(blocks.data() + state.uniforms);
+    materialUniforms(model, material, uniforms);
+
+    int textures[MATERIAL_TEXTURES];
+    materialTextures(model, material, textures);
+    for (int i = 0; i < MATERIAL_TEXTURES; i++) {
+      state.textures[i] = 0;
+      if (textures[i] < 0) continue;
+      bool srgb = srgbMap(i);
+      if (!state.atlas) {
+        state.textures[i] = textureObject(model, textures[i], srgb);
+        continue;
+      }
+      const TextureAtlas &atlas = atlases[srgb];
+      const AtlasEntry *entry = atlasEntry(atlas, textures[i]);
+      float size = (float)atlas.size;
+      float *rect = uniforms->mapRects[i], *layer = uniforms->mapLayers[i];
+      rect[0] = entry->x / size;
+      rect[1] = entry->y / size;
+      rect[2] = entry->width / size;
+      rect[3] = entry->height / size;
+      layer[0] = (float)entry->layer;
+      layer[1] = (float)entry->wrapS;
+      layer[2] = (float)entry->wrapT;
+      state.textures[i] = atlasIds[srgb];
+    }
+  }
+
+  glGenBuffers(1, &materialBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, materialBuffer);
+  glBufferData(
+      GL_UNIFORM_BUFFER, blocks.size(), blocks.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  memorySetGpu(
+      MEMORY_GPU_BUFFERS, materialBuffer, blocks.size(), "materials");
+  std::cout << model.materials.size() << " materials, " << glTextures.size()
+            << " textures" << std::endl;
+}
+
+static const GLMaterialState &
+materialState(int material)
+{
+  if (material < 0 || material >= (int)glMaterialState.size() - 1)
+    return glMaterialState.back();
+  return glMaterialState[material];
+}
+
+// Binds the Material block and textures of `material`. Textures already
+// bound, such as the atlases, are not bound again.
+static void
+bindMaterial(int material)
+{
+  const GLMaterialState &state = materialState(material);
+  glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, materialBuffer,
+      state.uniforms, sizeof(MaterialUniforms));
+  static GLuint bound[MATERIAL_TEXTURES];
+  bool changed = false;
+  for (int i = 0; i < MATERIAL_TEXTURES; i++) {
+    if (state.textures[i] == bound[i]) continue;
+    bound[i] = state.textures[i];
+    changed = true;
+    glActiveTexture(GL_TEXTURE0 + MATERIAL_TEXTURE_UNIT + i);
+    glBindTexture(state.atlas ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D,
+        state.textures[i]);
+  }
+  if (changed) glActiveTexture(GL_TEXTURE0);
+}
+
+// Picks the permutation of every primitive from its material and
+// attributes, starting the build of each one once. They compile while the
+// rest of the scene is set up, and afterwards while frames are drawn.
+static void
+setupPermutations(tinygltf::Model &model)
+{
+  PROFILE_ZONE("setupPermutations");
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    const tinygltf::Mesh &mesh = model.meshes[m];
+    std::vector<int> &programs = glMeshState[m].primitivePrograms;
+    programs.resize(mesh.primitives.size());
+    for (size_t p = 0; p < mesh.primitives.size(); p++) {
+      const tinygltf::Primitive &primitive = mesh.primitives[p];
+      uint32_t features = materialFeatures(model, primitive);
+      if ((features & MATERIAL_MAPS) && materialState(primitive.material).atlas)
+        features |= MATERIAL_ATLAS;
+      programs[p] = permutation(features);
+    }
+  }
+  std::cout << glPermutations.size() << " shader permutations, "
+            << permutationsCompiling << " compiling" << std::endl;
+}
+
+static void
+setupOcclusion(tinygltf::Model &model)
+{
+  PROFILE_ZONE("setupOcclusion");
+  meshOccluder.assign(model.meshes.size(), -1);
+  if (!occlusionEnabled) return;
+
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    OccluderMesh occluder;
+    if (buildOccluderMesh(model, model.meshes[m],
+            meshIsTaggedOccluder(model.meshes[m]), &occluder)) {
+      meshOccluder[m] = (int)occluderMeshes.size();
+      occluderMeshes.push_back(std::move(occluder));
+    }
+  }
+  occlusionInit(&occlusionBuffer, OCCLUSION_WIDTH, OCCLUSION_HEIGHT, jobs);
+  std::cout << occluderMeshes.size() << " of " << model.meshes.size()
+            << " meshes can occlude" << std::endl;
+}
+
+// World-space bounding sphere of the box `b` drawn with `world`.
+static void
+boundsSphere(
+    const Bounds &b, const Mat4 &world, float center[3], float *radius)
+{
+  if (!boundsValid(b)) {
+    mat4TransformPoint(world, eye, center);
+    *radius = 0.0f;
+    return;
+  }
+  float c[3], half[3];
+  for (int i = 0; i < 3; i++) {
+    c[i] = 0.5f * (b.min[i] + b.max[i]);
+    half[i] = 0.5f * (b.max[i] - b.min[i]);
+  }
+  mat4TransformPoint(world, c, center);
+  *radius = sqrtf(half[0] * half[0] + half[1] * half[1] + half[2] * half[2]) *
+            mat4MaxScale(world);
+}
+
+// Distance from the eye to the closest point of the sphere, clamped to the
+// near plane.
+static float
+sphereDistance(const float center[3], float radius)
+{
+  float d[3] = {center[0] - eye[0], center[1] - eye[1], center[2] - eye[2]};
+  float dist = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) - radius;
+  return std::max(dist, CAM_NEAR);
+}
+
+static int
+selectMeshLod(int meshIndex, const Mat4 &world, const Bounds &bounds)
+{
+  const GLMeshState &state = glMeshState[meshIndex];
+  if (state.lodErrors.empty()) return 0;
+
+  float center[3], radius;
+  boundsSphere(bounds, world, center, &radius);
+  float ppu =
+      lodPixelsPerUnit(sphereDistance(center, radius), CAM_FOVY, height);
+  return selectLod(
+      state.lodErrors, ppu * mat4MaxScale(world), lodPixelThreshold);
+}
+
+static void
+collectOccluders(tinygltf::Model &model, int nodeIndex,
+    std::vector<std::pair<float, OccluderInstance>> *candidates)
+{
+  const tinygltf::Node &node = model.nodes[nodeIndex];
+  // Skinned meshes deform, their bind pose does not occlude anything.
+  if (node.mesh > -1 && node.skin < 0 && meshOccluder[node.mesh] >= 0) {
+    const Mat4 &world = sceneState.world[nodeIndex];
+    float center[3], radius;
+    boundsSphere(glMeshState[node.mesh].bounds, world, center, &radius);
+    float score = radius / sphereDistance(center, radius);
+    candidates->push_back({score,
+        {&occluderMeshes[meshOccluder[node.mesh]], mat4Mul(viewProj, world)}});
+  }
+  for (int child : node.children) collectOccluders(model, child, candidates);
+}
 
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
+// Rasterizes the occluders that cover the most of the screen.
+static void
+renderOcclusion(tinygltf::Model &model, const tinygltf::Scene &scene)
+{
+  std::vector<std::pair<float, OccluderInstance>> candidates;
+  for (int root : scene.nodes) collectOccluders(model, root, &candidates);
+
+  size_t count = std::min(candidates.size(), (size_t)OCCLUSION_MAX_OCCLUDERS);
+  std::partial_sort(candidates.begin(), candidates.begin() + count,
+      candidates.end(), [](const auto &a, const auto &b) {
+        return a.first > b.first;
+      });
+
+  std::vector<OccluderInstance> occluders;
+  for (size_t i = 0; i < count; i++) occluders.push_back(candidates[i].second);
+  occlusionRender(&occlusionBuffer, occluders);
+}
+
+// Squared distance from the eye to the center of `bounds` drawn with
+// `world`, which orders draws in the render queue.
+static float
+drawDepth(const Bounds &bounds, const Mat4 &world)
+{
+  float center[3], radius;
+  boundsSphere(bounds, world, center, &radius);
+  float d[3] = {center[0] - eye[0], center[1] - eye[1], center[2] - eye[2]};
+  return d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+}
+
+static void
+addInstance(int mesh, int lod, const Mat4 &world, int palette, float depth)
+{
+  int key = mesh * (LOD_MAX_LEVELS + 1) + lod;
+  if (drawBatchIndex[key] < 0) {
+    drawBatchIndex[key] = (int)drawBatches.size();
+    drawBatches.push_back({mesh, lod, {}, {}});
+  }
+  DrawBatch &batch = drawBatches[drawBatchIndex[key]];
+  batch.instances.emplace_back();
+  instanceFromWorld(world, &batch.instances.back());
+  batch.instances.back().palette = (float)palette;
+  batch.depths.push_back(depth);
+}
 
+// Culls the subtree of `nodeIndex` and adds what is visible to the batches.
+static void
+collectNode(tinygltf::Model &model, int nodeIndex)
+{
+  const tinygltf::Node &node = model.nodes[nodeIndex];
+  const Mat4 &world = sceneState.world[nodeIndex];
+
+  auto gpuInstancing = glGpuInstancing.find(nodeIndex);
+  if (gpuInstancing != glGpuInstancing.end()) {
+    const Bounds &bounds = gpuInstancing->second.bounds;
+    if (!occlusionEnabled || !boundsValid(bounds) ||
+        occlusionTestBox(&occlusionBuffer, mat4Mul(viewProj, world), bounds))
+      gpuInstancedDraws.push_back(nodeIndex);
+    for (int child : node.children) collectNode(model, child);
+    return;
+  }
+
+  // MSFT_lod swaps the mesh of this node for one of its alternatives, picked
+  // from the screen coverage of the full detail mesh. Transforms and
+  // children of the alternative nodes are not used.
+  int meshNode = nodeIndex;
+  const NodeLodState &msft = nodeLodState[nodeIndex];
+  if (!msft.ids.empty() && node.mesh > -1) {
+    float center[3], radius;
+    boundsSphere(glMeshState[node.mesh].bounds, world, center, &radius);
+    float ppu =
+        lodPixelsPerUnit(sphereDistance(center, radius), CAM_FOVY, height);
+    float coverage = 2.0f * radius * ppu / (float)height;
+    int level = selectMsftLod(msft.coverage, msft.ids.size() + 1, coverage);
+    if (level < 0)
+      meshNode = -1;
+    else if (level > 0 && msft.ids[level - 1] < (int)model.nodes.size())
+      meshNode = msft.ids[level - 1];
+  }
+
+  if (meshNode > -1 && model.nodes[meshNode].mesh > -1) {
+    int mesh = model.nodes[meshNode].mesh;
+    assert(mesh < (int)model.meshes.size());
+
+    // Skinned meshes are placed by their joints, not by the node, and are
+    // bounded by the joint palette.
+    int skin = node.skin < (int)skins.size() ? node.skin : -1;
+    static const Mat4 identity = mat4Identity();
+    const Mat4 &placement = skin < 0 ? world : identity;
+    const Bounds &bounds =
+        skin < 0 ? glMeshState[mesh].bounds : jointPalette.bounds[skin];
+
+    bool visible = true;
+    if (occlusionEnabled && boundsValid(bounds)) {
+      visible = occlusionTestBox(
+          &occlusionBuffer, mat4Mul(viewProj, placement), bounds);
+    }
+    if (visible) {
+      int lod = lodEnabled ? selectMeshLod(mesh, placement, bounds) : 0;
+      int palette = skin < 0 ? -1 : jointPalette.offset[skin];
+      float depth = drawDepth(bounds, placement);
+      if (sceneState.weightOffset[nodeIndex] >= 0 && meshNode == nodeIndex) {
+        MorphDraw draw = {nodeIndex, mesh, lod, depth, {}};
+        instanceFromWorld(placement, &draw.instance);
+        draw.instance.palette = (float)palette;
+        morphDraws.push_back(draw);
+      } else {
+        addInstance(mesh, lod, placement, palette, depth);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < node.children.size(); i++) {
+    assert(node.children[i] < (int)model.nodes.size());
+    collectNode(model, node.children[i]);
+  }
+}
+
+// Refreshes the instance buffer of a GPU instanced node if it moved.
+static InstanceRange
+bakeGpuInstances(int nodeIndex)
+{
+  GLGpuInstancingState &state = glGpuInstancing[nodeIndex];
+  const Mat4 &world = sceneState.world[nodeIndex];
+  if (!state.baked || memcmp(&state.bakedWorld, &world, sizeof(Mat4)) != 0) {
+    std::vector<InstanceData> data(state.local.size());
+    for (size_t i = 0; i < state.local.size(); i++)
+      instanceFromWorld(mat4Mul(world, state.local[i]), &data[i]);
+    glBindBuffer(GL_ARRAY_BUFFER, state.vb);
+    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(InstanceData),
+        data.data(), GL_STATIC_DRAW);
+    memorySetGpu(MEMORY_GPU_BUFFERS, state.vb,
+        data.size() * sizeof(InstanceData), "GPU instances");
+    state.bakedWorld = world;
+    state.baked = true;
+  }
+
+  return {state.vb, 0, (GLsizei)state.local.size()};
+}
+
+// Queues every primitive of a mesh drawn with `instances`. Blended
+// primitives are split into one draw per instance so that they sort back to
+// front with everything else, unless `depths` only has one entry.
+static void
+queueMesh(tinygltf::Model &model, int mesh, int lod, int morphNode,
+    const InstanceRange &instances, const float *depths, size_t depthCount)
+{
+  float nearest = *std::min_element(depths, depths + depthCount);
+  const std::vector<tinygltf::Primitive> &primitives =
+      model.meshes[mesh].primitives;
+  for (size_t p = 0; p < primitives.size(); p++) {
+    int program = glMeshState[mesh].primitivePrograms[p];
+    if (program < 0) continue;
+    int material = primitives[p].material;
+    int pass = materialState(material).pass;
+    DrawItem item = {mesh, (int)p, lod, morphNode, instances, 0, 0};
+    if (pass != RENDER_PASS_BLEND || depthCount == 1) {
+      renderQueuePush(&renderQueue,
+          renderSortKey(pass, program, material, mesh, nearest),
+          (uint32_t)drawItems.size());
+      drawItems.push_back(item);
+      continue;
+    }
+    item.instances.count = 1;
+    for (size_t i = 0; i < depthCount; i++) {
+      item.instances.offset = instances.offset + i * sizeof(InstanceData);
+      renderQueuePush(&renderQueue,
+          renderSortKey(pass, program, material, mesh, depths[i]),
+          (uint32_t)drawItems.size());
+      drawItems.push_back(item);
+    }
+  }
+}
+
+// After a depth pre-pass, opaque and masked draws only shade the fragments
+// whose depth it wrote.
+static void
+setRenderPass(int pass, bool prepassed)
+{
+  if (pass == RENDER_PASS_BLEND) {
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LESS);
+  } else {
+    glDisable(GL_BLEND);
+    glDepthMask(prepassed ? GL_FALSE : GL_TRUE);
+    glDepthFunc(prepassed ? GL_EQUAL : GL_LESS);
+  }
+}
+
+// Draws that the depth program can lay down from positions alone: skinned
+// and morphed ones need the shading program's vertex streams, and masked
+// ones its fragment shader.
+static bool
+positionsOnly(tinygltf::Model &model, const DrawItem &item)
+{
+  const tinygltf::Primitive &primitive =
+      model.meshes[item.mesh].primitives[item.primitive];
+  const GLMeshState &state = glMeshState[item.mesh];
+  int stream = state.primitiveStreams[item.primitive];
+  int program = drawnPermutation(state.primitivePrograms[item.primitive]);
+  return item.morphNode < 0 && stream >= 0 &&
+         glVertexStreams[stream].positions &&
+         !primitive.attributes.count("JOINTS_0") &&
+         !(glPermutations[program].features & MATERIAL_ALPHA_MASK);
+}
+
+// Switches to the permutation and material of `item` if they differ from
+// `*program` and `*material`, which are updated. -2 forces both.
+static void
+bindShading(tinygltf::Model &model, const DrawItem &item, int *program,
+    int *material)
+{
+  const GLMeshState &state = glMeshState[item.mesh];
+  int p = drawnPermutation(state.primitivePrograms[item.primitive]);
+  if (p != *program) {
+    *program = p;
+    glUseProgram(glPermutations[p].program);
+  }
+  int m = model.meshes[item.mesh].primitives[item.primitive].material;
+  if (m != *material) {
+    *material = m;
+    bindMaterial(m);
+  }
+}
+
+// Writes the depth of the opaque and masked draws, front to back as they
+// are sorted, without color.
+static void
+drawDepthPrepass(tinygltf::Model &model, size_t count)
+{
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  setRenderPass(RENDER_PASS_OPAQUE, false);
+
+  // Blended draws sort last.
+  size_t opaque = 0;
+  while (opaque < count &&
+         renderKeyPass(renderQueue.keys[opaque]) != RENDER_PASS_BLEND)
+    opaque++;
+
+  // shader.vert reads the Draw block of the item, as when it is shaded.
+  glUseProgram(depthProgram);
+  size_t bound = (size_t)-1;
+  for (size_t i = 0; i < opaque; i++) {
+    const DrawItem &item = drawItems[renderQueue.items[i]];
+    if (!positionsOnly(model, item)) continue;
+    if (item.uniforms != bound) {
+      bound = item.uniforms;
+      glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_BLOCK_BINDING,
+          streamBuffer.buffer, bound, sizeof(DrawUniforms));
+    }
+    drawPrimitive(model, item, true);
+  }
+
+  int program = -2, material = -2;
+  for (size_t i = 0; i < opaque; i++) {
+    const DrawItem &item = drawItems[renderQueue.items[i]];
+    if (positionsOnly(model, item)) continue;
+    bindShading(model, item, &program, &material);
+    if (item.uniforms != bound) {
+      bound = item.uniforms;
+      glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_BLOCK_BINDING,
+          streamBuffer.buffer, bound, sizeof(DrawUniforms));
+    }
+    drawPrimitive(model, item, false);
+  }
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// Draws the queue in key order. The Camera block, a Draw block per morphed
+// primitive and one shared by the others are written to the stream buffer
+// first; blend state, programs, materials and block bindings only change
+// between runs of draws.
+static void
+submitQueue(tinygltf::Model &model)
+{
+  PROFILE_ZONE("submit");
+  renderQueueSort(&renderQueue);
+
+  size_t count = renderQueue.keys.size();
+  size_t align = (size_t)streamBuffer.alignment;
+  streamBegin(&streamBuffer,
+      (count + 1) * (sizeof(DrawUniforms) + align) + sizeof(CameraUniforms));
+
+  CameraUniforms *camera;
+  size_t cameraOffset = streamAlloc(
+      &streamBuffer, sizeof(CameraUniforms), (void **)&camera);
+  memcpy(camera->viewProj, viewProj.m, sizeof(camera->viewProj));
+  memcpy(camera->eye, eye, sizeof(eye));
+  camera->eye[3] = 1.0f;
+
+  DrawUniforms *unmorphed;
+  size_t shared = streamAlloc(
+      &streamBuffer, sizeof(DrawUniforms), (void **)&unmorphed);
+  memset(unmorphed, 0, sizeof(DrawUniforms));
+  for (size_t i = 0; i < count; i++) {
+    DrawItem &item = drawItems[renderQueue.items[i]];
+    if (item.morphNode < 0) {
+      item.uniforms = shared;
+      continue;
+    }
+
+    DrawUniforms uniforms = {};
+    item.morphed =
+        prepareMorph(item.mesh, item.primitive, item.morphNode, &uniforms);
+    void *data;
+    item.uniforms =
+        streamAlloc(&streamBuffer, sizeof(DrawUniforms), &data);
+    memcpy(data, &uniforms, sizeof(uniforms));
+  }
+  streamFlush(&streamBuffer);
+
+  glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING,
+      streamBuffer.buffer, cameraOffset, sizeof(CameraUniforms));
+  bool prepassed = depthPrepass && depthProgram;
+  if (prepassed) {
+    gpuZoneBegin("depth prepass");
+    drawDepthPrepass(model, count);
+    gpuZoneEnd();
+  }
+
+  gpuZoneBegin("draw");
+  if (overdrawQuery) glBeginQuery(GL_SAMPLES_PASSED, overdrawQuery);
+  int pass = -1, program = -2, material = -2;
+  size_t bound = (size_t)-1;
+  for (size_t i = 0; i < count; i++) {
+    const DrawItem &item = drawItems[renderQueue.items[i]];
+    if (renderKeyPass(renderQueue.keys[i]) != pass) {
+      pass = renderKeyPass(renderQueue.keys[i]);
+      setRenderPass(pass, prepassed);
+    }
+    bindShading(model, item, &program, &material);
+    if (item.uniforms != bound) {
+      bound = item.uniforms;
+      glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_BLOCK_BINDING,
+          streamBuffer.buffer, bound, sizeof(DrawUniforms));
+    }
+    drawPrimitive(model, item, false);
+  }
+  if (overdrawQuery) glEndQuery(GL_SAMPLES_PASSED);
+  setRenderPass(RENDER_PASS_OPAQUE, false);
+  gpuZoneEnd();
+  streamEnd(&streamBuffer);
+}
+
+static void
+drawModel(tinygltf::Model &model)
+{
+  assert(model.scenes.size() > 0);
+
+  PROFILE_ZONE("drawModel");
+  int scene_to_display = displayedScene(model);
+  const tinygltf::Scene &scene = model.scenes[scene_to_display];
+  if (animationIndex >= 0 && animationIndex < (int)animations.size()) {
+    PROFILE_ZONE("animation");
+    AnimationClip &clip = animations[animationIndex];
+    float duration = clip.end - clip.start;
+    float t = clip.start;
+    if (duration > 0.0f) t += fmodf((float)glfwGetTime(), duration);
+    animationApply(&clip, t, &sceneState);
+    pickStale = true;
+  }
+  {
+    PROFILE_ZONE("world transforms");
+    sceneUpdateWorld(&sceneState, jobs);
+  }
+  updateSkinning();
+  float aspect = (float)width / (float)height;
+  viewProj = mat4Mul(mat4Perspective(CAM_FOVY, aspect, CAM_NEAR, CAM_FAR),
+      mat4LookAt(eye, lookat, up));
+
+  if (occlusionEnabled) {
+    PROFILE_ZONE("occlusion");
+    renderOcclusion(model, scene);
+  }
+
+  // Group nodes sharing a mesh so that each mesh/LOD pair is one instanced
+  // draw per primitive.
+  for (const DrawBatch &batch : drawBatches)
+    drawBatchIndex[batch.mesh * (LOD_MAX_LEVELS + 1) + batch.lod] = -1;
+  drawBatches.clear();
+  drawBatchIndex.resize(model.meshes.size() * (LOD_MAX_LEVELS + 1), -1);
+  gpuInstancedDraws.clear();
+  morphDraws.clear();
+  {
+    PROFILE_ZONE("collect");
+    for (size_t i = 0; i < scene.nodes.size(); i++) {
+      collectNode(model, scene.nodes[i]);
+    }
+  }
+
+  // All batches share one buffer, refilled once per frame.
+  frameInstances.clear();
+  std::vector<InstanceRange> ranges;
+  for (const DrawBatch &batch : drawBatches) {
+    ranges.push_back({frameInstanceBuffer,
+        frameInstances.size() * sizeof(InstanceData),
+        (GLsizei)batch.instances.size()});
+    frameInstances.insert(frameInstances.end(), batch.instances.begin(),
+        batch.instances.end());
+  }
+  size_t morphInstances = frameInstances.size();
+  for (const MorphDraw &draw : morphDraws)
+    frameInstances.push_back(draw.instance);
+  glBindBuffer(GL_ARRAY_BUFFER, frameInstanceBuffer);
+  glBufferData(GL_ARRAY_BUFFER, frameInstances.size() * sizeof(InstanceData),
+      frameInstances.data(), GL_STREAM_DRAW);
+  memorySetGpu(MEMORY_GPU_BUFFERS, frameInstanceBuffer,
+      frameInstances.size() * sizeof(InstanceData), "frame instances");
+
+  // Every primitive becomes a queue item, drawn in sort key order rather
+  // than traversal order.
+  drawItems.clear();
+  renderQueueClear(&renderQueue);
+  for (size_t i = 0; i < drawBatches.size(); i++) {
+    const DrawBatch &batch = drawBatches[i];
+    queueMesh(model, batch.mesh, batch.lod, -1, ranges[i],
+        batch.depths.data(), batch.depths.size());
+  }
+  for (size_t i = 0; i < morphDraws.size(); i++) {
+    const MorphDraw &draw = morphDraws[i];
+    InstanceRange range = {frameInstanceBuffer,
+        (morphInstances + i) * sizeof(InstanceData), 1};
+    queueMesh(model, draw.mesh, draw.lod, draw.node, range, &draw.depth, 1);
+  }
+  for (int node : gpuInstancedDraws) {
+    float depth = drawDepth(
+        glGpuInstancing[node].bounds, sceneState.world[node]);
+    queueMesh(model, model.nodes[node].mesh, 0, -1, bakeGpuInstances(node),
+        &depth, 1);
+  }
+  submitQueue(model);
+}
+
+static bool
+animating()
+{
+  if (animationIndex < 0 || animationIndex >= (int)animations.size())
+    return false;
+  return animations[animationIndex].end > animations[animationIndex].start;
+}
+
+// Places the nodes and EXT_mesh_gpu_instancing instances of the scene in
+// the pick scene, building the hierarchies of meshes not picked before.
+static void
+updatePickInstances(const tinygltf::Model &model)
+{
+  PROFILE_ZONE("pick instances");
+  std::vector<PickInstance> instances;
+  for (int node : sceneState.order) {
+    int mesh = model.nodes[node].mesh;
+    if (mesh < 0 || mesh >= (int)model.meshes.size()) continue;
+    const Mat4 &world = sceneState.world[node];
+    auto gpuInstancing = glGpuInstancing.find(node);
+    if (gpuInstancing == glGpuInstancing.end()) {
+      instances.push_back({node, 0, mesh, world});
+      continue;
+    }
+    const std::vector<Mat4> &local = gpuInstancing->second.local;
+    for (size_t i = 0; i < local.size(); i++)
+      instances.push_back({node, (int)i, mesh, mat4Mul(world, local[i])});
+  }
+  pickSetInstances(model, instances, &pickScene);
+  pickStale = false;
+}
+
+// Prints what is under the cursor at pickX, pickY, as last drawn. Mesh
+// hierarchies are built the first time a mesh may be hit, or at load time
+// with --gpu-resident.
+static void
+pickAtCursor(const tinygltf::Model &model)
+{
+  if (pickStale) updatePickInstances(model);
+
+  // Through the cursor, from the eye. The cursor is in window coordinates,
+  // which may differ from the framebuffer's.
+  int windowWidth, windowHeight;
+  glfwGetWindowSize(window, &windowWidth, &windowHeight);
+  if (windowWidth <= 0 || windowHeight <= 0) return;
+  float x = 2.0f * (float)pickX / windowWidth - 1.0f;
+  float y = 1.0f - 2.0f * (float)pickY / windowHeight;
+  float tanHalf = tanf(CAM_FOVY * (float)M_PI / 360.0f);
+  float aspect = (float)width / (float)height;
+  float view[3] = {x * tanHalf * aspect, y * tanHalf, -1.0f}, direction[3];
+  mat4TransformVector(mat4AffineInverse(mat4LookAt(eye, lookat, up)), view,
+      direction);
+
+  PickHit hit;
+  double start = glfwGetTime();
+  bool found;
+  {
+    PROFILE_ZONE("pick");
+    found = pickRay(pickScene, eye, direction, &hit);
+  }
+  double ms = (glfwGetTime() - start) * 1000.0;
+  if (!found) {
+    printf("pick: nothing (%.3f ms)\n", ms);
+    return;
+  }
+  printf("pick: node %d \"%s\", instance %d, mesh %d, primitive %d, "
+         "triangle %d at %.3f, %.3f, %.3f (%.3f ms)\n",
+      hit.node, model.nodes[hit.node].name.c_str(), hit.instance, hit.mesh,
+      hit.primitive, hit.triangle, hit.position[0], hit.position[1],
+      hit.position[2], ms);
+}
+
+// (Re)allocates the frame cache at the window size and binds it.
+static void
+bindFrameCache()
+{
+  GLFrameCache &cache = frameCache;
+  if (cache.framebuffer && (cache.width != width || cache.height != height)) {
+    glDeleteFramebuffers(1, &cache.framebuffer);
+    memorySetGpu(MEMORY_GPU_IMAGES, cache.color, 0, nullptr);
+    memorySetGpu(MEMORY_GPU_IMAGES, cache.depth, 0, nullptr);
+    glDeleteRenderbuffers(1, &cache.color);
+    glDeleteRenderbuffers(1, &cache.depth);
+    cache.framebuffer = 0;
+  }
+  if (!cache.framebuffer) {
+    glGenFramebuffers(1, &cache.framebuffer);
+    glGenRenderbuffers(1, &cache.color);
+    glGenRenderbuffers(1, &cache.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, cache.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, cache.depth);
+    glRenderbufferStorage(
+        GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    // Depth is assumed padded to 32 bits, as drivers store it.
+    memorySetGpu(MEMORY_GPU_IMAGES, cache.color, (size_t)width * height * 4,
+        "frame cache color");
+    memorySetGpu(MEMORY_GPU_IMAGES, cache.depth, (size_t)width * height * 4,
+        "frame cache depth");
+    glBindFramebuffer(GL_FRAMEBUFFER, cache.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_RENDERBUFFER, cache.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_RENDERBUFFER, cache.depth);
+    cache.width = width;
+    cache.height = height;
+    checkErrors("frame cache");
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, cache.framebuffer);
+}
+
+// Renders the scene, into the frame cache when it is enabled.
+static void
+renderFrame(tinygltf::Model &model)
+{
+  if (frameCacheEnabled) bindFrameCache();
+  gpuZoneBegin("clear");
+  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  gpuZoneEnd();
+
+  glEnable(GL_DEPTH_TEST);
+
+  glViewport(0, 0, width, height);
+
+  // Instances carry their world transform, the camera is in the Camera
+  // block.
+  drawModel(model);
+
+  if (frameCacheEnabled) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    frameCache.valid = true;
+  }
+}
+
+static void
+presentFrameCache()
+{
+  PROFILE_ZONE("present");
+  gpuZoneBegin("present");
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, frameCache.framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, frameCache.width, frameCache.height, 0, 0,
+      frameCache.width, frameCache.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gpuZoneEnd();
+}
+
+// Hands the frame read back into `slot` to the PNG writer. Without `wait`,
+// returns false when the GPU has not written it yet.
+static bool
+captureCollect(GLCaptureSlot *slot, bool wait)
+{
+  GLenum status =
+      glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  while (wait && status == GL_TIMEOUT_EXPIRED)
+    status =
+        glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+  if (status == GL_TIMEOUT_EXPIRED) return false;
+  glDeleteSync(slot->fence);
+  slot->fence = 0;
+
+  PROFILE_ZONE("capture map");
+  size_t size = (size_t)slot->width * slot->height * 4;
+  std::vector<unsigned char> pixels = captureWriterBuffer(captureWriter, size);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+  void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+  if (data) {
+    memcpy(pixels.data(), data, size);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  if (data)
+    captureWriterQueue(captureWriter, slot->filename, slot->width,
+        slot->height, std::move(pixels));
+  else
+    std::cerr << "failed to map the capture of " << slot->filename
+              << std::endl;
+  return true;
+}
+
+// Collects the frames in flight, oldest first, stopping at the first the
+// GPU has not written yet unless `wait`.
+static void
+captureCollectReady(bool wait)
+{
+  for (int i = 0; i < CAPTURE_BUFFERS; i++) {
+    GLCaptureSlot &slot = captureSlots[(captureNext + i) % CAPTURE_BUFFERS];
+    if (slot.fence && !captureCollect(&slot, wait)) break;
+  }
+}
+
+static bool
+captureInFlight()
+{
+  for (const GLCaptureSlot &slot : captureSlots)
+    if (slot.fence) return true;
+  return false;
+}
+
+// Reads the frame just rendered back into the next pixel pack buffer,
+// first collecting the frame still in it.
+static void
+captureFrame()
+{
+  PROFILE_ZONE("capture");
+  gpuZoneBegin("capture");
+  if (!captureWriter) captureWriter = captureWriterCreate(CAPTURE_QUEUE);
+  GLCaptureSlot &slot = captureSlots[captureNext];
+  if (slot.fence) captureCollect(&slot, true);
+  captureNext = (captureNext + 1) % CAPTURE_BUFFERS;
+
+  size_t size = (size_t)width * height * 4;
+  if (!slot.buffer) glGenBuffers(1, &slot.buffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+  if (slot.size != size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    slot.size = size;
+    memorySetGpu(MEMORY_GPU_BUFFERS, slot.buffer, size, "capture");
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER,
+      frameCacheEnabled ? frameCache.framebuffer : 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.width = width;
+  slot.height = height;
+  char number[16];
+  snprintf(number, sizeof(number), "%05d.png", captureCount++);
+  slot.filename = capturePrefix + number;
+  gpuZoneEnd();
+}
+
+// Writes the frames in flight and waits for the PNG writer.
+static void
+captureFinish()
+{
+  if (!captureWriter) return;
+  captureCollectReady(true);
+  size_t written, failed;
+  captureWriterDestroy(captureWriter, &written, &failed);
+  captureWriter = NULL;
+  std::cout << "captured " << written << " frames to " << capturePrefix
+            << "*.png";
+  if (failed) std::cout << ", " << failed << " failed to write";
+  std::cout << std::endl;
+}
+
+// --turntable: turns the eye about the vertical axis through `lookat`, by
+// one step of the turn.
+static void
+turntableStep()
+{
+  float angle = 2.0f * (float)M_PI / turntableFrames;
+  float c = cosf(angle), s = sinf(angle);
+  float x = eye[0] - lookat[0], z = eye[2] - lookat[2];
+  eye[0] = lookat[0] + c * x + s * z;
+  eye[2] = lookat[2] - s * x + c * z;
+}
+
+// Renders frames without then with the depth pre-pass and prints how many
+// fragments the shading pass wrote per pixel and the GPU time of a frame,
+// to tell whether the pre-pass pays off for a scene.
+static void
+reportOverdraw(tinygltf::Model &model)
+{
+  const int frames = 10;
+  bool timing = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+  GLuint timer = 0;
+  if (timing) glGenQueries(1, &timer);
+  glGenQueries(1, &overdrawQuery);
+  gpuTiming = false;  // its zones cannot nest in the timer query
+
+  for (int prepass = 0; prepass < 2; prepass++) {
+    depthPrepass = prepass == 1;
+    renderFrame(model);  // warm up
+    GLuint samples = 0;
+    GLuint64 elapsed = 0;
+    for (int i = 0; i < frames; i++) {
+      if (timing) glBeginQuery(GL_TIME_ELAPSED, timer);
+      renderFrame(model);
+      if (timing) glEndQuery(GL_TIME_ELAPSED);
+      glGetQueryObjectuiv(overdrawQuery, GL_QUERY_RESULT, &samples);
+      if (timing) {
+        GLuint64 ns;
+        glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &ns);
+        elapsed += ns;
+      }
+    }
+    printf("%s depth pre-pass: %.2f fragments shaded per pixel",
+        prepass ? "with" : "without", (double)samples / (width * height));
+    if (timing) printf(", %.3f ms GPU per frame", elapsed / 1e6 / frames);
+    printf("\n");
+  }
+
+  glDeleteQueries(1, &overdrawQuery);
+  overdrawQuery = 0;
+  if (timer) glDeleteQueries(1, &timer);
+}
+
+// Renders and times frames into the frame cache, with glFinish after each so
+// that the time includes the GPU, and writes the last one to
+// `screenshotFile`.
+static bool
+writeScreenshot(tinygltf::Model &model)
+{
+  const int frames = 10;
+  renderFrame(model);  // warm up
+  glFinish();
+  double start = glfwGetTime();
+  for (int i = 0; i < frames; i++) {
+    renderFrame(model);
+    glFinish();
+  }
+  double ms = (glfwGetTime() - start) * 1000.0 / frames;
+  printf("%s: %.2f ms per frame\n", (const char *)glGetString(GL_RENDERER),
+      ms);
+
+  std::vector<unsigned char> pixels((size_t)width * height * 4);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, frameCache.framebuffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  checkErrors("screenshot");
+  return captureWritePng(screenshotFile, width, height, (size_t)width * 4,
+      pixels.data());
+}
+
+// --software: the scene at rest drawn by the software renderer, timed like
+// writeScreenshot and written to `screenshotFile`. No GL is involved.
+static bool
+renderSoftware(const tinygltf::Model &model)
+{
+  const int frames = 10;
+  sceneInit(model, displayedScene(model), &sceneState);
+  sceneUpdateWorld(&sceneState, jobs);
+  SoftwareRenderer renderer;
+  rasterInit(model, width, height, jobs, &renderer);
+  Mat4 viewProj = mat4Mul(
+      mat4Perspective(CAM_FOVY, (float)width / height, CAM_NEAR, CAM_FAR),
+      mat4LookAt(eye, lookat, up));
+
+  rasterFrame(&renderer, model, sceneState, viewProj);  // warm up
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++)
+    rasterFrame(&renderer, model, sceneState, viewProj);
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  printf("software renderer, %d threads: %.2f ms per frame, %zu draws, "
+         "%zu triangles\n",
+      jobSystemThreads(jobs), elapsed.count() / frames, renderer.draws,
+      renderer.triangles);
+  return captureWritePng(screenshotFile, width, height,
+      (size_t)renderer.pitch * 4, (const unsigned char *)renderer.color.data());
+}
+
+int
+main(int argc, char **argv)
+{
+  tinygltf::Model model;
+  std::string err;
+  std::string warn;
+
+  std::string filename;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--no-lod") {
+      lodEnabled = false;
+    } else if (arg == "--no-atlas") {
+      atlasEnabled = false;
+    } else if (arg == "--no-occlusion") {
+      occlusionEnabled = false;
+    } else if (arg == "--lod-threshold" && i + 1 < argc) {
+      lodPixelThreshold = (float)atof(argv[++i]);
+    } else if (arg == "--threads" && i + 1 < argc) {
+      threadCount = atoi(argv[++i]);
+    } else if (arg == "--trace" && i + 1 < argc) {
+      traceFile = argv[++i];
+    } else if (arg == "--memory-report" && i + 1 < argc) {
+      memoryReportFile = argv[++i];
+    } else if (arg == "--depth-prepass") {
+      depthPrepass = true;
+    } else if (arg == "--measure-overdraw") {
+      measureOverdraw = true;
+    } else if (arg == "--capture" && i + 1 < argc) {
+      captureEveryFrame = true;
+      capturePrefix = argv[++i];
+    } else if (arg == "--turntable" && i + 1 < argc) {
+      turntableFrames = std::max(atoi(argv[++i]), 0);
+    } else if (arg == "--normals") {
+      normalShading = true;
+    } else if (arg == "--screenshot" && i + 1 < argc) {
+      screenshotFile = argv[++i];
+    } else if (arg == "--software") {
+      softwareRendering = true;
+    } else if (arg == "--gpu-resident") {
+      gpuResident = true;
+    } else if (arg == "--continuous") {
+      continuousRendering = true;
+    } else if (arg == "--frame-cache") {
+      frameCacheEnabled = true;
+    } else if (arg == "--compat-profile") {
+      compatProfile = true;
+    } else if (arg == "--cpu-morph") {
+      cpuMorph = true;
+    } else if (arg == "--no-animation") {
+      animationIndex = -1;
+    } else if (arg == "--animation" && i + 1 < argc) {
+      animationIndex = atoi(argv[++i]);
+    } else if (filename.empty()) {
+      filename = arg;
+    }
+  }
+
+  if (filename.empty() || (softwareRendering && screenshotFile.empty())) {
+    std::cout << argv[0] << " "
+              << "[--no-lod] [--lod-threshold <pixels>] [--no-occlusion] "
+              << "[--animation <index> | --no-animation] [--cpu-morph] "
+              << "[--threads <count>] [--compat-profile] "
+              << "[--continuous] [--frame-cache] [--trace <file.json>] "
+              << "[--memory-report <file.json>] [--gpu-resident] "
+              << "[--depth-prepass] [--measure-overdraw] [--normals] "
+              << "[--screenshot <file.png> [--software]] "
+              << "[--capture <prefix>] [--turntable <frames>] "
+              << "<model path>.gltf <binary path>.bin" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!traceFile.empty()) profilerStart();
+  profilerSetThreadName("main");
+  jobs = jobSystemCreate(threadCount);
+  pickScene.jobs = jobs;
+  bool ret = loadModel(filename, &model, &err, &warn, jobs);
+
+  if (!warn.empty()) {
+    printf("Warn: %s\n", warn.c_str());
+  }
+
+  if (!err.empty()) {
+    printf("ERR: %s\n", err.c_str());
+    return EXIT_FAILURE;
+  }
+  if (!ret) {
+    printf("Failed to load .glTF : %s\n", filename.c_str());
+    return EXIT_FAILURE;
+  }
+
+  {
+    eye[0] = 0.0f;
+    eye[1] = 0.0f;
+    eye[2] = CAM_Z;
+
+    lookat[0] = 0.0f;
+    lookat[1] = 0.0f;
+    lookat[2] = 0.0f;
+
+    up[0] = 0.0f;
+    up[1] = 1.0f;
+    up[2] = 0.0f;
+  }
+
+  if (softwareRendering) {
+    bool written = renderSoftware(model);
+    jobSystemDestroy(jobs);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (!glfwInit()) {
+    std::cerr << "Failed to initialize GLFW." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // A 4.x core profile when available, the compatibility profile otherwise.
+  // Drivers give the newest version compatible with the one asked for.
+  // Overdraw and screenshots are rendered in a hidden window, into the
+  // frame cache.
+  window = NULL;
+  bool headless = measureOverdraw || !screenshotFile.empty();
+  int visible = headless ? GLFW_FALSE : GLFW_TRUE;
+  if (headless) frameCacheEnabled = true;
+  glfwWindowHint(GLFW_VISIBLE, visible);
+  if (!compatProfile) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+    window = glfwCreateWindow(width, height, "glTF Viewer", NULL, NULL);
+    coreProfile = window != NULL;
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_VISIBLE, visible);
+  }
+  if (window == NULL)
+    window = glfwCreateWindow(width, height, "glTF Viewer", NULL, NULL);
+  if (window == NULL) {
+    std::cerr << "Failed to open GLFW window. " << std::endl;
+    glfwTerminate();
+    return EXIT_FAILURE;
+  }
+
+  glfwGetFramebufferSize(window, &width, &height);
+
+  glfwMakeContextCurrent(window);
+
+  glfwSetMouseButtonCallback(window, pointerButtonHandler);
+  glfwSetCursorPosCallback(window, pointerMotionHandler);
+  glfwSetKeyCallback(window, keyHandler);
+  glfwSetWindowRefreshCallback(window, refreshHandler);
+  glfwSetFramebufferSizeCallback(window, framebufferSizeHandler);
+
+  glewExperimental = true;
+  if (glewInit() != GLEW_OK) {
+    std::cerr << "Failed to initialize GLEW." << std::endl;
+    return EXIT_FAILURE;
+  }
+  // glewInit queries extensions the old way, an error on core profiles.
+  glGetError();
+
+  // Texture buffers and GLSL 1.50 for skinning, attribute divisors for
+  // instancing.
+  if (!GLEW_VERSION_3_2 || !(GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays)) {
+    std::cerr << "OpenGL 3.2 with instanced arrays is required." << std::endl;
+    return EXIT_FAILURE;
+  }
+  persistentMapping = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+  gpuTiming = profilerEnabled && (GLEW_VERSION_3_3 || GLEW_ARB_timer_query);
+  std::cout << (coreProfile ? "core" : "compatibility") << " profile, "
+            << (persistentMapping ? "persistently mapped" : "staged")
+            << " uniform stream" << std::endl;
+
+  // Core profiles have no default vertex array object. One is enough: every
+  // draw sets up its attributes anyway.
+  GLuint vertexArray;
+  glGenVertexArrays(1, &vertexArray);
+  glBindVertexArray(vertexArray);
+
+  // With KHR_parallel_shader_compile, the driver compiles on as many
+  // threads as it likes and tells when it is done without blocking.
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xffffffff);
+    parallelCompile = true;
+  } else if (GLEW_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xffffffff);
+    parallelCompile = true;
+  }
+
+  // The material-less permutation is the fallback, built up front so that
+  // broken shaders stop here.
+  if (permutation(0) < 0) return EXIT_FAILURE;
+  pollPermutations(true);
+  if (glPermutations[0].state != PERMUTATION_READY) return EXIT_FAILURE;
+  if ((depthPrepass || measureOverdraw) && !buildDepthProgram())
+    return EXIT_FAILURE;
+
+  {
+    MemoryScope scope(MEMORY_SCENE);
+    setupInstanceBuffer();
+
+    streamCreate(&streamBuffer, STREAM_FRAME_SIZE);
+
+    setupLods(model);
+    checkErrors("setupLods");
+
+    setupIndices(model);
+    checkErrors("setupIndices");
+
+    setupMaterials(model);
+    checkErrors("setupMaterials");
+
+    setupPermutations(model);
+
+    // Streams are only built once more when permutations read other
+    // attributes than the fallback, which needs the model data, and the
+    // overdraw measurement and screenshots want the final programs.
+    if (gpuResident || headless) pollPermutations(true);
+    setupVertexStreams(model);
+    checkErrors("setupVertexStreams");
+
+    setupGpuInstancing(model);
+    checkErrors("setupGpuInstancing");
+
+    setupOcclusion(model);
+
+    setupSkinning(model);
+    checkErrors("setupSkinning");
+
+    setupMorphTargets(model);
+    checkErrors("setupMorphTargets");
+
+    sceneInit(model, displayedScene(model), &sceneState);
+    buildAnimationClips(model, &animations);
+
+    // Picking cannot build hierarchies once the buffers are released, so
+    // every mesh of the scene gets one now; they copy what they read.
+    if (gpuResident) {
+      sceneUpdateWorld(&sceneState, jobs);
+      updatePickInstances(model);
+    }
+  }
+
+  // Everything above has copied what it needs from the buffers: frames only
+  // read the model's nodes, meshes and accessors.
+  if (gpuResident) {
+    size_t before = memoryResident();
+    size_t released = releaseModelData(&model);
+    size_t after = memoryResident();
+    std::cout << "released " << released / (1 << 20) << " MiB of model data, "
+              << "resident " << before / (1 << 20) << " -> "
+              << after / (1 << 20) << " MiB" << std::endl;
+  }
+
+  if (measureOverdraw) {
+    reportOverdraw(model);
+    glfwTerminate();
+    jobSystemDestroy(jobs);
+    return EXIT_SUCCESS;
+  }
+
+  if (!screenshotFile.empty()) {
+    bool written = writeScreenshot(model);
+    glfwTerminate();
+    jobSystemDestroy(jobs);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  while (glfwWindowShouldClose(window) == GL_FALSE) {
+    // Sleep until an event arrives, unless something changes by itself.
+    bool continuous =
+        continuousRendering || animating() || turntableFrames > 0;
+    if (continuous) {
+      glfwPollEvents();
+    } else if (permutationsCompiling > 0 || captureInFlight()) {
+      PROFILE_ZONE("wait events");
+      glfwWaitEventsTimeout(0.005);
+    } else {
+      PROFILE_ZONE("wait events");
+      glfwWaitEvents();
+    }
+    collectGpuZones();
+    captureCollectReady(false);
+
+    // Permutations that are done replace the fallback as they come.
+    // With --gpu-resident they were all waited for before.
+    if (pollPermutations(false)) setupVertexStreams(model);
+
+    if (reloadRequested) {
+      reloadRequested = false;
+      bool changed;
+      if (depthProgram) buildDepthProgram();
+      if (reloadPermutations(&changed)) {
+        sceneDirty = true;
+        // The streams hold what the previous programs read.
+        if (changed) {
+          if (gpuResident)
+            std::cout << "the shaders read other vertex attributes, but the "
+                      << "model data is released" << std::endl;
+          else
+            setupVertexStreams(model);
+        }
+      }
+    }
+
+    if (pickRequested) {
+      pickRequested = false;
+      pickAtCursor(model);
+    }
+
+    // Lost window contents come back from the frame cache if there is one.
+    bool restore = frameCacheEnabled && frameCache.valid;
+    bool render = continuous || sceneDirty || (windowDamaged && !restore);
+    if (!render && !windowDamaged) continue;
+    PROFILE_ZONE("frame");
+    if (render) renderFrame(model);
+    if (render && (captureEveryFrame || captureRequested)) {
+      captureRequested = false;
+      captureFrame();
+    }
+    if (render && turntableFrames > 0) {
+      turntableStep();
+      // Once around, when capturing the turn.
+      if (captureEveryFrame && captureCount >= turntableFrames)
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+    }
+    if (frameCacheEnabled) presentFrameCache();
+    sceneDirty = false;
+    windowDamaged = false;
+
+    PROFILE_ZONE("swap buffers");
     glFlush();
     glfwSwapBuffers(window);
   }
 
+  if (!traceFile.empty()) {
+    glFinish();
+    collectGpuZones();
+    if (profilerWriteTrace(traceFile.c_str()))
+      std::cout << "trace written to " << traceFile << std::endl;
+    else
+      std::cerr << "failed to write " << traceFile << std::endl;
+  }
+
+  captureFinish();
+  if (!memoryReportFile.empty()) writeMemoryReport();
+
   glfwTerminate();
+  jobSystemDestroy(jobs);
 }
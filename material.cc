@@ -0,0 +1,92 @@
+#include "material.h"
+
+static const char *featureNames[] = {
+    "BASE_COLOR_MAP",
+    "METALLIC_ROUGHNESS_MAP",
+    "NORMAL_MAP",
+    "OCCLUSION_MAP",
+    "EMISSIVE_MAP",
+    "ALPHA_MASK",
+    "ALPHA_BLEND",
+    "DOUBLE_SIDED",
+    "VERTEX_COLOR",
+    "ATLAS",
+};
+
+void
+materialTextures(const tinygltf::Model &model, int material,
+    int textures[MATERIAL_TEXTURES])
+{
+  for (int i = 0; i < MATERIAL_TEXTURES; i++) textures[i] = -1;
+  if (material < 0 || material >= (int)model.materials.size()) return;
+  const tinygltf::Material &m = model.materials[material];
+  const tinygltf::PbrMetallicRoughness &pbr = m.pbrMetallicRoughness;
+  int sets[MATERIAL_TEXTURES] = {pbr.baseColorTexture.texCoord,
+      pbr.metallicRoughnessTexture.texCoord, m.normalTexture.texCoord,
+      m.occlusionTexture.texCoord, m.emissiveTexture.texCoord};
+  int indices[MATERIAL_TEXTURES] = {pbr.baseColorTexture.index,
+      pbr.metallicRoughnessTexture.index, m.normalTexture.index,
+      m.occlusionTexture.index, m.emissiveTexture.index};
+  for (int i = 0; i < MATERIAL_TEXTURES; i++) {
+    if (sets[i] != 0 || indices[i] < 0 ||
+        indices[i] >= (int)model.textures.size() ||
+        model.textures[indices[i]].source < 0)
+      continue;
+    textures[i] = indices[i];
+  }
+}
+
+uint32_t
+materialFeatures(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  uint32_t features = 0;
+  if (primitive.attributes.count("COLOR_0"))
+    features |= MATERIAL_VERTEX_COLOR;
+
+  int material = primitive.material;
+  if (material < 0 || material >= (int)model.materials.size())
+    return features;
+  const tinygltf::Material &m = model.materials[material];
+  if (primitive.attributes.count("TEXCOORD_0")) {
+    int textures[MATERIAL_TEXTURES];
+    materialTextures(model, material, textures);
+    for (int i = 0; i < MATERIAL_TEXTURES; i++)
+      if (textures[i] >= 0) features |= 1u << i;
+  }
+  if (m.alphaMode == "MASK") features |= MATERIAL_ALPHA_MASK;
+  if (m.alphaMode == "BLEND") features |= MATERIAL_ALPHA_BLEND;
+  if (m.doubleSided) features |= MATERIAL_DOUBLE_SIDED;
+  return features;
+}
+
+std::string
+materialDefines(uint32_t features)
+{
+  std::string defines;
+  for (size_t i = 0; i < sizeof(featureNames) / sizeof(featureNames[0]); i++)
+    if (features & (1u << i))
+      defines += std::string("#define ") + featureNames[i] + "\n";
+  if (features & MATERIAL_MAPS) defines += "#define TEXCOORD\n";
+  return defines;
+}
+
+void
+materialUniforms(
+    const tinygltf::Model &model, int material, MaterialUniforms *out)
+{
+  *out = MaterialUniforms{{1.0f, 1.0f, 1.0f, 1.0f}, {0.0f, 0.0f, 0.0f, 0.0f},
+      1.0f, 1.0f, 0.5f, 1.0f, 1.0f, {}, {}, {}};
+  if (material < 0 || material >= (int)model.materials.size()) return;
+  const tinygltf::Material &m = model.materials[material];
+  const tinygltf::PbrMetallicRoughness &pbr = m.pbrMetallicRoughness;
+  for (size_t i = 0; i < 4 && i < pbr.baseColorFactor.size(); i++)
+    out->baseColor[i] = (float)pbr.baseColorFactor[i];
+  for (size_t i = 0; i < 3 && i < m.emissiveFactor.size(); i++)
+    out->emissive[i] = (float)m.emissiveFactor[i];
+  out->metallic = (float)pbr.metallicFactor;
+  out->roughness = (float)pbr.roughnessFactor;
+  out->alphaCutoff = (float)m.alphaCutoff;
+  out->normalScale = (float)m.normalTexture.scale;
+  out->occlusionStrength = (float)m.occlusionTexture.strength;
+}
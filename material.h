@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "tiny_gltf.h"
+
+// Metallic-roughness materials. Each primitive is drawn with a permutation
+// of shader.vert and shader.frag selected by feature bits: the defines of
+// its bits are prepended to both stages, so a permutation only samples the
+// textures it has and only reads the attributes it uses.
+
+#define MATERIAL_BASE_COLOR_MAP (1u << 0)
+#define MATERIAL_METALLIC_ROUGHNESS_MAP (1u << 1)
+#define MATERIAL_NORMAL_MAP (1u << 2)
+#define MATERIAL_OCCLUSION_MAP (1u << 3)
+#define MATERIAL_EMISSIVE_MAP (1u << 4)
+#define MATERIAL_ALPHA_MASK (1u << 5)
+#define MATERIAL_ALPHA_BLEND (1u << 6)
+#define MATERIAL_DOUBLE_SIDED (1u << 7)
+#define MATERIAL_VERTEX_COLOR (1u << 8)
+#define MATERIAL_ATLAS (1u << 9)  // maps are layers of texture arrays
+#define MATERIAL_MAPS 0x1fu  // the five *_MAP bits
+
+// Texture slots of a material, in MATERIAL_*_MAP bit order.
+#define MATERIAL_TEXTURES 5
+
+// std140 layout of the Material block.
+typedef struct {
+  float baseColor[4];
+  float emissive[4];  // w unused
+  float metallic;
+  float roughness;
+  float alphaCutoff;
+  float normalScale;
+  float occlusionStrength;
+  float pad[3];
+  // With MATERIAL_ATLAS, per map: the offset (xy) and scale (zw) of its
+  // rectangle in the layer, and the layer (x) and ATLAS_* wrap modes of s
+  // and t (y, z).
+  float mapRects[MATERIAL_TEXTURES][4];
+  float mapLayers[MATERIAL_TEXTURES][4];
+} MaterialUniforms;
+
+// Features of `primitive` with its material. Maps are only used with
+// TEXCOORD_0, the only set the shaders read; maps on other sets are left
+// out.
+uint32_t materialFeatures(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive);
+
+// `#define` lines of a permutation, one per feature, and TEXCOORD when any
+// map is sampled.
+std::string materialDefines(uint32_t features);
+
+// Block contents of `material`, -1 for the default material.
+void materialUniforms(
+    const tinygltf::Model &model, int material, MaterialUniforms *out);
+
+// glTF texture indices of the slots of `material`, -1 when unused.
+void materialTextures(const tinygltf::Model &model, int material,
+    int textures[MATERIAL_TEXTURES]);
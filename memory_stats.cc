@@ -0,0 +1,257 @@
+#include "memory_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+// In front of every allocation, keeping the returned pointer aligned as
+// malloc's.
+struct alignas(16) AllocationHeader {
+  uint64_t size;
+  int category;
+};
+
+struct Counter {
+  std::atomic<int64_t> bytes{0};
+  std::atomic<int64_t> peak{0};
+
+  void add(int64_t delta)
+  {
+    int64_t now = bytes.fetch_add(delta, std::memory_order_relaxed) + delta;
+    int64_t high = peak.load(std::memory_order_relaxed);
+    while (now > high &&
+           !peak.compare_exchange_weak(high, now, std::memory_order_relaxed)) {
+    }
+  }
+};
+
+struct GpuObject {
+  size_t bytes;
+  const char *label;
+};
+
+Counter counters[MEMORY_CATEGORIES];
+Counter cpuTotal, gpuTotal;
+std::atomic<uint64_t> allocations{0};
+
+std::mutex gpuMutex;
+std::map<std::pair<int, unsigned>, GpuObject> *gpuObjects;  // never freed
+
+const char *categoryNames[MEMORY_CATEGORIES] = {
+    "other", "json", "buffers", "images", "scene", "buffers", "images"};
+
+}  // namespace
+
+thread_local int memoryCategory = MEMORY_OTHER;
+
+static void
+charge(int category, int64_t delta)
+{
+  counters[category].add(delta);
+  (category < MEMORY_CPU_CATEGORIES ? cpuTotal : gpuTotal).add(delta);
+}
+
+// allocate and release are kept out of line: inlined into the containers
+// of this file, they make GCC warn of free() on memory from operator new.
+__attribute__((noinline)) static void *
+allocate(size_t size)
+{
+  AllocationHeader *header =
+      (AllocationHeader *)malloc(sizeof(AllocationHeader) + size);
+  if (!header) return nullptr;
+  header->size = size;
+  header->category = memoryCategory;
+  charge(header->category, (int64_t)size);
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return header + 1;
+}
+
+__attribute__((noinline)) static void
+release(void *p)
+{
+  if (!p) return;
+  AllocationHeader *header = (AllocationHeader *)p - 1;
+  charge(header->category, -(int64_t)header->size);
+  free(header);
+}
+
+void *
+operator new(size_t size)
+{
+  void *p = allocate(size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void *
+operator new[](size_t size)
+{
+  void *p = allocate(size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void *
+operator new(size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void *
+operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void
+operator delete(void *p) noexcept
+{
+  release(p);
+}
+
+void
+operator delete[](void *p) noexcept
+{
+  release(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept
+{
+  release(p);
+}
+
+void
+operator delete[](void *p, size_t) noexcept
+{
+  release(p);
+}
+
+void
+operator delete(void *p, const std::nothrow_t &) noexcept
+{
+  release(p);
+}
+
+void
+operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+  release(p);
+}
+
+void
+memoryRetag(const void *p, int category)
+{
+  if (!p) return;
+  AllocationHeader *header = (AllocationHeader *)p - 1;
+  if (header->category == category) return;
+  charge(header->category, -(int64_t)header->size);
+  charge(category, (int64_t)header->size);
+  header->category = category;
+}
+
+void
+memorySetGpu(int category, unsigned id, size_t bytes, const char *label)
+{
+  std::lock_guard<std::mutex> lock(gpuMutex);
+  if (!gpuObjects)
+    gpuObjects = new std::map<std::pair<int, unsigned>, GpuObject>;
+  auto it = gpuObjects->find({category, id});
+  int64_t delta = (int64_t)bytes;
+  if (it != gpuObjects->end()) {
+    delta -= (int64_t)it->second.bytes;
+    if (bytes)
+      it->second = {bytes, label};
+    else
+      gpuObjects->erase(it);
+  } else if (bytes) {
+    gpuObjects->insert({{category, id}, {bytes, label}});
+  }
+  charge(category, delta);
+}
+
+int64_t
+memoryBytes(int category)
+{
+  return counters[category].bytes.load(std::memory_order_relaxed);
+}
+
+int64_t
+memoryPeak(int category)
+{
+  return counters[category].peak.load(std::memory_order_relaxed);
+}
+
+uint64_t
+memoryAllocations()
+{
+  return allocations.load(std::memory_order_relaxed);
+}
+
+size_t
+memoryResident()
+{
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (!fp) return 0;
+  unsigned long size, resident;
+  bool ok = fscanf(fp, "%lu %lu", &size, &resident) == 2;
+  fclose(fp);
+  return ok ? resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+}
+
+static void
+writeCounter(FILE *fp, const char *name, const Counter &counter, bool last)
+{
+  fprintf(fp, "    \"%s\": {\"bytes\": %lld, \"peak\": %lld}%s\n", name,
+      (long long)counter.bytes.load(std::memory_order_relaxed),
+      (long long)counter.peak.load(std::memory_order_relaxed),
+      last ? "" : ",");
+}
+
+void
+memoryWriteReport(FILE *fp)
+{
+  fprintf(fp, "{\n  \"cpu\": {\n");
+  writeCounter(fp, "total", cpuTotal, false);
+  for (int c = 0; c < MEMORY_CPU_CATEGORIES; c++)
+    writeCounter(
+        fp, categoryNames[c], counters[c], c == MEMORY_CPU_CATEGORIES - 1);
+  fprintf(fp, "  },\n  \"gpu\": {\n");
+  writeCounter(fp, "total", gpuTotal, false);
+  for (int c = MEMORY_CPU_CATEGORIES; c < MEMORY_CATEGORIES; c++)
+    writeCounter(fp, categoryNames[c], counters[c], c == MEMORY_CATEGORIES - 1);
+  fprintf(fp,
+      "  },\n  \"allocations\": %llu,\n  \"resident\": %zu,\n"
+      "  \"gpu_objects\": [",
+      (unsigned long long)memoryAllocations(), memoryResident());
+
+  // Largest first.
+  std::vector<std::pair<std::pair<int, unsigned>, GpuObject>> objects;
+  {
+    std::lock_guard<std::mutex> lock(gpuMutex);
+    if (gpuObjects) objects.assign(gpuObjects->begin(), gpuObjects->end());
+  }
+  std::stable_sort(objects.begin(), objects.end(),
+      [](const auto &a, const auto &b) {
+        return a.second.bytes > b.second.bytes;
+      });
+  for (size_t i = 0; i < objects.size(); i++) {
+    fprintf(fp,
+        "%s\n    {\"category\": \"%s\", \"id\": %u, \"label\": \"%s\", "
+        "\"bytes\": %zu}",
+        i ? "," : "", categoryNames[objects[i].first.first],
+        objects[i].first.second, objects[i].second.label,
+        objects[i].second.bytes);
+  }
+  fprintf(fp, "%s]\n}\n", objects.empty() ? "" : "\n  ");
+}
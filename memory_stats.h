@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Live and peak bytes by category, for the CPU heap and for GPU objects.
+//
+// CPU bytes are counted by the global operator new and delete in
+// memory_stats.cc, installed in any program that uses this file. Each
+// allocation is charged to its thread's current category (see MemoryScope)
+// and credited back to it when freed, wherever that happens. Allocations
+// with malloc, such as inside stb_image, are not seen.
+//
+// GPU bytes are what the viewer asks GL for; drivers may round up or keep
+// shadow copies.
+
+// CPU categories. JSON is everything allocated while parsing, including the
+// buffers of data URIs and GLB files until parsing ends; external files are
+// charged to buffers or images as they are read.
+#define MEMORY_OTHER 0    // outside any scope
+#define MEMORY_JSON 1     // the JSON document and the model being built
+#define MEMORY_BUFFERS 2  // Buffer::data
+#define MEMORY_IMAGES 3   // encoded image files and decoded Image::image
+#define MEMORY_SCENE 4    // what the viewer derives: LODs, occluders, ...
+#define MEMORY_CPU_CATEGORIES 5
+
+// GPU categories.
+#define MEMORY_GPU_BUFFERS 5
+#define MEMORY_GPU_IMAGES 6  // textures and renderbuffers
+#define MEMORY_CATEGORIES 7
+
+extern thread_local int memoryCategory;  // of the calling thread
+
+// Charges the calling thread's allocations to `category` until destroyed.
+struct MemoryScope {
+  int saved;
+
+  explicit MemoryScope(int category) : saved(memoryCategory)
+  {
+    memoryCategory = category;
+  }
+
+  ~MemoryScope() { memoryCategory = saved; }
+};
+
+// Moves a live allocation from operator new to `category`, for memory that
+// changes owner, e.g. buffers decoded while parsing.
+void memoryRetag(const void *p, int category);
+
+// Sets the size of GPU object `id` (a GL name) of `category`, replacing its
+// previous size; 0 removes it. `label` must outlive the report, e.g. a
+// string literal. GL thread only.
+void memorySetGpu(int category, unsigned id, size_t bytes, const char *label);
+
+int64_t memoryBytes(int category);
+int64_t memoryPeak(int category);
+uint64_t memoryAllocations();  // calls to operator new so far
+
+// Resident set size of the process from /proc/self/statm, or 0 where it
+// cannot be read. Unlike the counters, this includes malloc and the heap
+// the allocator has not given back.
+size_t memoryResident();
+
+// Writes every category, CPU and GPU totals, the resident size and each GPU
+// object, as JSON.
+void memoryWriteReport(FILE *fp);
@@ -0,0 +1,259 @@
+#include "mesh_data.h"
+
+#include <algorithm>
+#include <cstring>
+
+static double
+readComponent(const unsigned char *p, int componentType, bool normalized)
+{
+  switch (componentType) {
+    case TINYGLTF_COMPONENT_TYPE_BYTE: {
+      int8_t v;
+      memcpy(&v, p, 1);
+      return normalized ? std::max(v / 127.0, -1.0) : v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+      uint8_t v = *p;
+      return normalized ? v / 255.0 : v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_SHORT: {
+      int16_t v;
+      memcpy(&v, p, 2);
+      return normalized ? std::max(v / 32767.0, -1.0) : v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+      uint16_t v;
+      memcpy(&v, p, 2);
+      return normalized ? v / 65535.0 : v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+      uint32_t v;
+      memcpy(&v, p, 4);
+      return v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+      float v;
+      memcpy(&v, p, 4);
+      return v;
+    }
+    case TINYGLTF_COMPONENT_TYPE_DOUBLE: {
+      double v;
+      memcpy(&v, p, 8);
+      return v;
+    }
+  }
+  return 0.0;
+}
+
+bool
+readAccessorFloats(const tinygltf::Model &model, int accessorIndex,
+    std::vector<float> *out, int *components)
+{
+  if (accessorIndex < 0 || accessorIndex >= (int)model.accessors.size())
+    return false;
+  const tinygltf::Accessor &accessor = model.accessors[accessorIndex];
+  int numComponents = tinygltf::GetNumComponentsInType(accessor.type);
+  int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  if (numComponents <= 0 || componentSize <= 0) return false;
+
+  *components = numComponents;
+  out->assign(accessor.count * numComponents, 0.0f);
+
+  if (accessor.bufferView >= 0) {
+    const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+    const tinygltf::Buffer &buffer = model.buffers[view.buffer];
+    int stride = accessor.ByteStride(view);
+    if (stride < 0) return false;
+    size_t begin = view.byteOffset + accessor.byteOffset;
+    if (accessor.count > 0 &&
+        begin + (accessor.count - 1) * stride + numComponents * componentSize >
+            buffer.data.size())
+      return false;
+
+    const unsigned char *base = buffer.data.data() + begin;
+    for (size_t i = 0; i < accessor.count; i++) {
+      const unsigned char *elem = base + i * stride;
+      for (int c = 0; c < numComponents; c++) {
+        (*out)[i * numComponents + c] = (float)readComponent(
+            elem + c * componentSize, accessor.componentType,
+            accessor.normalized);
+      }
+    }
+  }
+
+  if (accessor.sparse.isSparse) {
+    const auto &sparse = accessor.sparse;
+    const tinygltf::BufferView &iview =
+        model.bufferViews[sparse.indices.bufferView];
+    const tinygltf::BufferView &vview =
+        model.bufferViews[sparse.values.bufferView];
+    const unsigned char *ip = model.buffers[iview.buffer].data.data() +
+                              iview.byteOffset + sparse.indices.byteOffset;
+    const unsigned char *vp = model.buffers[vview.buffer].data.data() +
+                              vview.byteOffset + sparse.values.byteOffset;
+    int indexSize =
+        tinygltf::GetComponentSizeInBytes(sparse.indices.componentType);
+    for (int i = 0; i < sparse.count; i++) {
+      size_t target = (size_t)readComponent(
+          ip + i * indexSize, sparse.indices.componentType, false);
+      if (target >= accessor.count) return false;
+      for (int c = 0; c < numComponents; c++) {
+        (*out)[target * numComponents + c] = (float)readComponent(
+            vp + (i * numComponents + c) * componentSize,
+            accessor.componentType, accessor.normalized);
+      }
+    }
+  }
+
+  return true;
+}
+
+bool
+readIndices(const tinygltf::Model &model, const tinygltf::Primitive &primitive,
+    std::vector<uint32_t> *out)
+{
+  if (primitive.indices < 0) {
+    auto it = primitive.attributes.find("POSITION");
+    if (it == primitive.attributes.end()) return false;
+    size_t count = model.accessors[it->second].count;
+    out->resize(count);
+    for (size_t i = 0; i < count; i++) (*out)[i] = (uint32_t)i;
+    return true;
+  }
+
+  const tinygltf::Accessor &accessor = model.accessors[primitive.indices];
+  if (accessor.bufferView < 0) return false;
+  const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+  const tinygltf::Buffer &buffer = model.buffers[view.buffer];
+  int stride = accessor.ByteStride(view);
+  if (stride < 0) return false;
+  size_t begin = view.byteOffset + accessor.byteOffset;
+  int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  if (accessor.count > 0 &&
+      begin + (accessor.count - 1) * stride + componentSize >
+          buffer.data.size())
+    return false;
+
+  out->resize(accessor.count);
+  const unsigned char *base = buffer.data.data() + begin;
+  for (size_t i = 0; i < accessor.count; i++) {
+    (*out)[i] = (uint32_t)readComponent(
+        base + i * stride, accessor.componentType, false);
+  }
+  return true;
+}
+
+// Accessors interleaveVertices cannot copy as they are.
+static bool
+writtenAsFloats(const tinygltf::Accessor &accessor)
+{
+  return accessor.sparse.isSparse || accessor.bufferView < 0 ||
+         accessor.componentType == TINYGLTF_COMPONENT_TYPE_DOUBLE;
+}
+
+bool
+interleaveVertices(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive,
+    const std::vector<std::string> &attributes,
+    std::vector<VertexElement> *elements, size_t *stride, size_t *count,
+    std::vector<unsigned char> *data)
+{
+  elements->clear();
+  *stride = 0;
+  *count = 0;
+  for (const std::string &name : attributes) {
+    auto it = primitive.attributes.find(name);
+    if (it == primitive.attributes.end()) continue;
+    if (it->second < 0 || it->second >= (int)model.accessors.size())
+      return false;
+    const tinygltf::Accessor &accessor = model.accessors[it->second];
+    if (elements->empty())
+      *count = accessor.count;
+    else if (accessor.count != *count)
+      return false;
+
+    VertexElement element = {name,
+        tinygltf::GetNumComponentsInType(accessor.type),
+        accessor.componentType, accessor.normalized, *stride};
+    if (element.components <= 0) return false;
+    if (writtenAsFloats(accessor)) {
+      element.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+      element.normalized = false;
+    }
+    int componentSize =
+        tinygltf::GetComponentSizeInBytes(element.componentType);
+    if (componentSize <= 0) return false;
+    *stride += (element.components * componentSize + 3) & ~(size_t)3;
+    elements->push_back(element);
+  }
+
+  data->assign(*count * *stride, 0);
+  for (const VertexElement &element : *elements) {
+    int index = primitive.attributes.at(element.attribute);
+    const tinygltf::Accessor &accessor = model.accessors[index];
+    unsigned char *out = data->data() + element.offset;
+    if (writtenAsFloats(accessor)) {
+      std::vector<float> values;
+      int n;
+      if (!readAccessorFloats(model, index, &values, &n)) return false;
+      for (size_t i = 0; i < *count; i++)
+        memcpy(out + i * *stride, &values[i * n], n * sizeof(float));
+      continue;
+    }
+
+    const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+    const tinygltf::Buffer &buffer = model.buffers[view.buffer];
+    int viewStride = accessor.ByteStride(view);
+    if (viewStride < 0) return false;
+    size_t size = element.components *
+                  tinygltf::GetComponentSizeInBytes(accessor.componentType);
+    size_t begin = view.byteOffset + accessor.byteOffset;
+    if (*count > 0 &&
+        begin + (*count - 1) * viewStride + size > buffer.data.size())
+      return false;
+    const unsigned char *in = buffer.data.data() + begin;
+    for (size_t i = 0; i < *count; i++)
+      memcpy(out + i * *stride, in + i * viewStride, size);
+  }
+  return true;
+}
+
+Bounds
+primitiveBounds(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  Bounds b = boundsEmpty();
+  auto it = primitive.attributes.find("POSITION");
+  if (it == primitive.attributes.end()) return b;
+  const tinygltf::Accessor &accessor = model.accessors[it->second];
+  if (accessor.minValues.size() == 3 && accessor.maxValues.size() == 3) {
+    for (int i = 0; i < 3; i++) {
+      b.min[i] = (float)accessor.minValues[i];
+      b.max[i] = (float)accessor.maxValues[i];
+    }
+    return b;
+  }
+
+  // min/max are required for POSITION, but be lenient with exporters.
+  std::vector<float> positions;
+  int components = 0;
+  if (!readAccessorFloats(model, it->second, &positions, &components) ||
+      components != 3)
+    return b;
+  for (size_t i = 0; i < positions.size(); i += 3)
+    boundsExtend(b, &positions[i]);
+  return b;
+}
+
+Bounds
+meshBounds(const tinygltf::Model &model, const tinygltf::Mesh &mesh)
+{
+  Bounds b = boundsEmpty();
+  for (const auto &primitive : mesh.primitives) {
+    Bounds pb = primitiveBounds(model, primitive);
+    if (!boundsValid(pb)) continue;
+    boundsExtend(b, pb.min);
+    boundsExtend(b, pb.max);
+  }
+  return b;
+}
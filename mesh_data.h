@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tiny_gltf.h"
+#include "transform.h"
+
+// CPU-side access to accessor data, independent of how the exporter laid out
+// the bufferViews.
+
+// Reads an accessor as tightly packed floats. Integer components are
+// converted, normalized ones mapped to [0, 1] / [-1, 1]. Sparse accessors are
+// resolved.
+bool readAccessorFloats(const tinygltf::Model &model, int accessorIndex,
+    std::vector<float> *out, int *components);
+
+// Reads the indices of a primitive as 32-bit values. Non-indexed primitives
+// produce the implicit 0..count-1 sequence.
+bool readIndices(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, std::vector<uint32_t> *out);
+
+// One attribute of an interleaved vertex.
+typedef struct {
+  std::string attribute;  // glTF semantic
+  int components;
+  int componentType;  // TINYGLTF_COMPONENT_TYPE_*, which is the GL type
+  bool normalized;
+  size_t offset;
+} VertexElement;
+
+// Interleaves the `attributes` of `primitive` that it has, in that order,
+// keeping their component types and padding each to 4 bytes. Sparse
+// accessors and accessors without a buffer view are written as floats.
+// Returns false when the attributes differ in count or cannot be read.
+bool interleaveVertices(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive,
+    const std::vector<std::string> &attributes,
+    std::vector<VertexElement> *elements, size_t *stride, size_t *count,
+    std::vector<unsigned char> *data);
+
+// Object-space bounds from the POSITION accessor min/max.
+Bounds primitiveBounds(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive);
+Bounds meshBounds(const tinygltf::Model &model, const tinygltf::Mesh &mesh);
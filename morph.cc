@@ -0,0 +1,154 @@
+#include "morph.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mesh_data.h"
+
+static bool
+readVec3(const tinygltf::Model &model, const std::map<std::string, int> &attrs,
+    const char *name, size_t vertexCount, std::vector<float> *out)
+{
+  auto it = attrs.find(name);
+  if (it == attrs.end()) {
+    out->clear();
+    return true;
+  }
+  int components = 0;
+  return readAccessorFloats(model, it->second, out, &components) &&
+         components == 3 && out->size() == vertexCount * 3;
+}
+
+bool
+buildMorphPrimitive(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, MorphPrimitive *out)
+{
+  if (primitive.targets.empty()) return false;
+  auto position = primitive.attributes.find("POSITION");
+  if (position == primitive.attributes.end() || position->second < 0 ||
+      position->second >= (int)model.accessors.size())
+    return false;
+
+  out->vertexCount = model.accessors[position->second].count;
+  out->targetCount = (int)primitive.targets.size();
+  if (!readVec3(model, primitive.attributes, "POSITION", out->vertexCount,
+          &out->basePositions) ||
+      !readVec3(model, primitive.attributes, "NORMAL", out->vertexCount,
+          &out->baseNormals))
+    return false;
+  out->hasNormals = !out->baseNormals.empty();
+
+  out->positionDeltas.assign(out->targetCount, std::vector<float>());
+  out->normalDeltas.assign(out->targetCount, std::vector<float>());
+  for (int t = 0; t < out->targetCount; t++) {
+    const std::map<std::string, int> &target = primitive.targets[t];
+    if (!readVec3(model, target, "POSITION", out->vertexCount,
+            &out->positionDeltas[t]) ||
+        !readVec3(model, target, "NORMAL", out->vertexCount,
+            &out->normalDeltas[t]))
+      return false;
+    if (!out->hasNormals) out->normalDeltas[t].clear();
+  }
+  return true;
+}
+
+void
+packMorphDeltas(const MorphPrimitive &morph, std::vector<float> *texels)
+{
+  size_t vc = morph.vertexCount;
+  size_t begin = texels->size();
+  texels->resize(begin + morph.targetCount * 2 * vc * 4, 0.0f);
+  float *out = texels->data() + begin;
+  for (int t = 0; t < morph.targetCount; t++) {
+    const std::vector<float> *blocks[2] = {
+        &morph.positionDeltas[t], &morph.normalDeltas[t]};
+    for (const std::vector<float> *block : blocks) {
+      if (!block->empty()) {
+        for (size_t v = 0; v < vc; v++)
+          memcpy(out + v * 4, &(*block)[v * 3], 3 * sizeof(float));
+      }
+      out += vc * 4;
+    }
+  }
+}
+
+int
+activeMorphTargets(const float *weights, int weightCount, int targetCount,
+    int *targets, float *active)
+{
+  int count = 0;
+  int n = std::min(weightCount, targetCount);
+  for (int t = 0; t < n && count < MORPH_MAX_ACTIVE; t++) {
+    if (weights[t] == 0.0f) continue;
+    targets[count] = t;
+    active[count] = weights[t];
+    count++;
+  }
+  return count;
+}
+
+// y += w[0] * x[0] + ... + w[n - 1] * x[n - 1] for up to four streams, so
+// that `y` is read and written once per four targets.
+static void
+accumulate(float *y, const float *const *x, const float *w, int n, size_t len)
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  __m128 w0 = _mm_set1_ps(w[0]);
+  __m128 w1 = _mm_set1_ps(n > 1 ? w[1] : 0.0f);
+  __m128 w2 = _mm_set1_ps(n > 2 ? w[2] : 0.0f);
+  __m128 w3 = _mm_set1_ps(n > 3 ? w[3] : 0.0f);
+  const float *x0 = x[0], *x1 = n > 1 ? x[1] : x[0];
+  const float *x2 = n > 2 ? x[2] : x[0], *x3 = n > 3 ? x[3] : x[0];
+  for (; i + 4 <= len; i += 4) {
+    __m128 s = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(w0, _mm_loadu_ps(x0 + i)),
+            _mm_mul_ps(w1, _mm_loadu_ps(x1 + i))),
+        _mm_add_ps(_mm_mul_ps(w2, _mm_loadu_ps(x2 + i)),
+            _mm_mul_ps(w3, _mm_loadu_ps(x3 + i))));
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), s));
+  }
+#endif
+  for (; i < len; i++) {
+    float s = 0.0f;
+    for (int k = 0; k < n; k++) s += w[k] * x[k][i];
+    y[i] += s;
+  }
+}
+
+static void
+blendStream(float *out, const std::vector<float> &base,
+    const std::vector<std::vector<float>> &deltas, const int *targets,
+    const float *weights, int count)
+{
+  memcpy(out, base.data(), base.size() * sizeof(float));
+  const float *x[4];
+  float w[4];
+  int n = 0;
+  for (int i = 0; i < count; i++) {
+    const std::vector<float> &delta = deltas[targets[i]];
+    if (delta.empty()) continue;
+    x[n] = delta.data();
+    w[n] = weights[i];
+    if (++n == 4) {
+      accumulate(out, x, w, n, base.size());
+      n = 0;
+    }
+  }
+  if (n > 0) accumulate(out, x, w, n, base.size());
+}
+
+void
+morphBlend(const MorphPrimitive &morph, const int *targets,
+    const float *weights, int count, float *positions, float *normals)
+{
+  blendStream(positions, morph.basePositions, morph.positionDeltas, targets,
+      weights, count);
+  if (morph.hasNormals)
+    blendStream(normals, morph.baseNormals, morph.normalDeltas, targets,
+        weights, count);
+}
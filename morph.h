@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "tiny_gltf.h"
+
+// Most targets blended at once by one draw. The vertex shader declares its
+// uniform arrays with the same size.
+#define MORPH_MAX_ACTIVE 64
+
+// POSITION and NORMAL displacements of a primitive's morph targets. Missing
+// attributes of a target are zero.
+typedef struct {
+  size_t vertexCount;
+  int targetCount;
+  bool hasNormals;
+  std::vector<float> basePositions;  // 3 per vertex
+  std::vector<float> baseNormals;    // 3 per vertex, empty without NORMAL
+  std::vector<std::vector<float>> positionDeltas;  // [target], 3 per vertex
+  std::vector<std::vector<float>> normalDeltas;    // [target], 3 per vertex
+} MorphPrimitive;
+
+// Returns false when the primitive has no targets or unreadable accessors.
+bool buildMorphPrimitive(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, MorphPrimitive *out);
+
+// Appends the deltas as RGBA texels for a texture buffer: for each target, a
+// block of position texels then a block of normal texels, one per vertex.
+void packMorphDeltas(const MorphPrimitive &morph, std::vector<float> *texels);
+
+// Compacts the non-zero weights of at most `targetCount` targets into
+// `targets` / `active`, up to MORPH_MAX_ACTIVE of them. Returns the count.
+int activeMorphTargets(const float *weights, int weightCount, int targetCount,
+    int *targets, float *active);
+
+// CPU blend: base attributes plus the weighted deltas of the active targets.
+// `normals` is left untouched without NORMAL.
+void morphBlend(const MorphPrimitive &morph, const int *targets,
+    const float *weights, int count, float *positions, float *normals);
@@ -0,0 +1,356 @@
+#include "occlusion.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mesh_data.h"
+
+bool
+meshIsTaggedOccluder(const tinygltf::Mesh &mesh)
+{
+  return mesh.extras.IsObject() && mesh.extras.Has("occluder") &&
+         mesh.extras.Get("occluder").IsBool() &&
+         mesh.extras.Get("occluder").Get<bool>();
+}
+
+bool
+buildOccluderMesh(const tinygltf::Model &model, const tinygltf::Mesh &mesh,
+    bool force, OccluderMesh *out)
+{
+  out->positions.clear();
+  out->indices.clear();
+  for (const auto &primitive : mesh.primitives) {
+    int mode = primitive.mode < 0 ? TINYGLTF_MODE_TRIANGLES : primitive.mode;
+    if (mode != TINYGLTF_MODE_TRIANGLES) continue;
+    auto it = primitive.attributes.find("POSITION");
+    if (it == primitive.attributes.end()) continue;
+
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    int components = 0;
+    if (!readAccessorFloats(model, it->second, &positions, &components) ||
+        components != 3 || !readIndices(model, primitive, &indices))
+      continue;
+
+    uint32_t base = (uint32_t)(out->positions.size() / 3);
+    uint32_t vertexCount = (uint32_t)(positions.size() / 3);
+    out->positions.insert(
+        out->positions.end(), positions.begin(), positions.end());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount ||
+          indices[i + 2] >= vertexCount)
+        continue;
+      for (int k = 0; k < 3; k++) out->indices.push_back(base + indices[i + k]);
+    }
+  }
+
+  size_t triangles = out->indices.size() / 3;
+  return triangles > 0 &&
+         (force || triangles <= OCCLUSION_MAX_OCCLUDER_TRIANGLES);
+}
+
+void
+occlusionInit(
+    OcclusionBuffer *buffer, int width, int height, JobSystem *jobs)
+{
+  buffer->width = (width + 3) & ~3;  // whole SIMD spans per row
+  buffer->height = height;
+  buffer->levels.clear();
+  buffer->levelWidth.clear();
+  buffer->levelHeight.clear();
+  int w = buffer->width, h = buffer->height;
+  for (;;) {
+    buffer->levels.emplace_back((size_t)w * h, 1.0f);
+    buffer->levelWidth.push_back(w);
+    buffer->levelHeight.push_back(h);
+    if (w == 1 && h == 1) break;
+    w = std::max(1, (w + 1) / 2);
+    h = std::max(1, (h + 1) / 2);
+  }
+
+  buffer->jobs = jobs;
+  buffer->trianglesRasterized = buffer->tested = buffer->occluded = 0;
+}
+
+static void
+transformClip(const Mat4 &m, const float *p, float out[4])
+{
+  for (int r = 0; r < 4; r++)
+    out[r] =
+        m.m[r] * p[0] + m.m[4 + r] * p[1] + m.m[8 + r] * p[2] + m.m[12 + r];
+}
+
+// Clips a triangle against the near plane (z >= -w) and emits the resulting
+// screen-space triangles.
+static void
+setupTriangle(const float c[3][4], int width, int height,
+    std::vector<OcclusionTriangle> *out)
+{
+  float poly[4][4];
+  int n = 0;
+  for (int i = 0; i < 3; i++) {
+    const float *a = c[i], *b = c[(i + 1) % 3];
+    float da = a[2] + a[3], db = b[2] + b[3];
+    if (da >= 0) memcpy(poly[n++], a, sizeof(float) * 4);
+    if ((da >= 0) != (db >= 0)) {
+      float t = da / (da - db);
+      for (int k = 0; k < 4; k++) poly[n][k] = a[k] + (b[k] - a[k]) * t;
+      n++;
+    }
+  }
+  if (n < 3) return;
+
+  float sx[4], sy[4], sz[4];
+  for (int i = 0; i < n; i++) {
+    float w = std::max(poly[i][3], 1e-6f);
+    sx[i] = (poly[i][0] / w * 0.5f + 0.5f) * width;
+    sy[i] = (poly[i][1] / w * 0.5f + 0.5f) * height;
+    sz[i] = poly[i][2] / w * 0.5f + 0.5f;
+  }
+  for (int i = 1; i + 1 < n; i++) {
+    int v[3] = {0, i, i + 1};
+    float minx = INFINITY, maxx = -INFINITY, miny = INFINITY, maxy = -INFINITY;
+    OcclusionTriangle t;
+    for (int k = 0; k < 3; k++) {
+      t.x[k] = sx[v[k]];
+      t.y[k] = sy[v[k]];
+      t.z[k] = sz[v[k]];
+      minx = std::min(minx, t.x[k]);
+      maxx = std::max(maxx, t.x[k]);
+      miny = std::min(miny, t.y[k]);
+      maxy = std::max(maxy, t.y[k]);
+    }
+    if (maxx < 0 || maxy < 0 || minx > width || miny > height) continue;
+    out->push_back(t);
+  }
+}
+
+// Rasterizes the part of `t` that falls into rows [rowBegin, rowEnd), keeping
+// the nearest depth per pixel.
+static void
+rasterTriangle(const OcclusionTriangle &t, float *depth, int width,
+    int rowBegin, int rowEnd)
+{
+  float x0 = t.x[0], y0 = t.y[0];
+  float x1 = t.x[1], y1 = t.y[1];
+  float x2 = t.x[2], y2 = t.y[2];
+  float z0 = t.z[0], z1 = t.z[1], z2 = t.z[2];
+  float area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+  if (fabsf(area) < 1e-8f) return;
+  if (area < 0) {
+    std::swap(x1, x2);
+    std::swap(y1, y2);
+    std::swap(z1, z2);
+    area = -area;
+  }
+
+  int minx = std::max(0, (int)floorf(std::min(x0, std::min(x1, x2))));
+  int maxx = std::min(width - 1, (int)ceilf(std::max(x0, std::max(x1, x2))));
+  int miny = std::max(rowBegin, (int)floorf(std::min(y0, std::min(y1, y2))));
+  int maxy =
+      std::min(rowEnd - 1, (int)ceilf(std::max(y0, std::max(y1, y2))));
+  if (minx > maxx || miny > maxy) return;
+
+  // Edge functions E(x, y) = A x + B y + C, positive inside. Pixels exactly
+  // on an edge are covered by both neighbours so shared edges leave no gaps.
+  float a0 = y0 - y1, b0 = x1 - x0, c0 = x0 * y1 - x1 * y0;  // v0 -> v1
+  float a1 = y1 - y2, b1 = x2 - x1, c1 = x1 * y2 - x2 * y1;  // v1 -> v2
+  float a2 = y2 - y0, b2 = x0 - x2, c2 = x2 * y0 - x0 * y2;  // v2 -> v0
+
+  // Depth is affine in screen space after the perspective divide.
+  float inv = 1.0f / area;
+  float za = (a1 * z0 + a2 * z1 + a0 * z2) * inv;
+  float zb = (b1 * z0 + b2 * z1 + b0 * z2) * inv;
+  float zc = (c1 * z0 + c2 * z1 + c0 * z2) * inv;
+
+  minx &= ~3;
+#ifdef __SSE2__
+  const __m128 offs = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  const __m128 zero = _mm_setzero_ps();
+  for (int y = miny; y <= maxy; y++) {
+    float py = y + 0.5f;
+    float *row = depth + (size_t)y * width;
+    __m128 px = _mm_add_ps(_mm_set1_ps((float)minx), offs);
+    __m128 step = _mm_set1_ps(4.0f);
+    for (int x = minx; x <= maxx; x += 4) {
+      __m128 e0 = _mm_add_ps(
+          _mm_mul_ps(_mm_set1_ps(a0), px), _mm_set1_ps(b0 * py + c0));
+      __m128 e1 = _mm_add_ps(
+          _mm_mul_ps(_mm_set1_ps(a1), px), _mm_set1_ps(b1 * py + c1));
+      __m128 e2 = _mm_add_ps(
+          _mm_mul_ps(_mm_set1_ps(a2), px), _mm_set1_ps(b2 * py + c2));
+      __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero),
+          _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+      if (_mm_movemask_ps(inside)) {
+        __m128 z = _mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(za), px), _mm_set1_ps(zb * py + zc));
+        __m128 old = _mm_load_ps(row + x);
+        __m128 nearer = _mm_min_ps(old, z);
+        _mm_store_ps(row + x,
+            _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+      }
+      px = _mm_add_ps(px, step);
+    }
+  }
+#else
+  for (int y = miny; y <= maxy; y++) {
+    float py = y + 0.5f;
+    float *row = depth + (size_t)y * width;
+    for (int x = minx; x <= maxx; x++) {
+      float px = x + 0.5f;
+      if (a0 * px + b0 * py + c0 < 0 || a1 * px + b1 * py + c1 < 0 ||
+          a2 * px + b2 * py + c2 < 0)
+        continue;
+      row[x] = std::min(row[x], za * px + zb * py + zc);
+    }
+  }
+#endif
+}
+
+static void
+buildPyramid(OcclusionBuffer *buffer)
+{
+  for (size_t l = 1; l < buffer->levels.size(); l++) {
+    const std::vector<float> &src = buffer->levels[l - 1];
+    std::vector<float> &dst = buffer->levels[l];
+    int sw = buffer->levelWidth[l - 1], sh = buffer->levelHeight[l - 1];
+    int dw = buffer->levelWidth[l], dh = buffer->levelHeight[l];
+    for (int y = 0; y < dh; y++) {
+      int sy0 = std::min(2 * y, sh - 1), sy1 = std::min(2 * y + 1, sh - 1);
+      for (int x = 0; x < dw; x++) {
+        int sx0 = std::min(2 * x, sw - 1), sx1 = std::min(2 * x + 1, sw - 1);
+        dst[y * dw + x] = std::max(
+            std::max(src[sy0 * sw + sx0], src[sy0 * sw + sx1]),
+            std::max(src[sy1 * sw + sx0], src[sy1 * sw + sx1]));
+      }
+    }
+  }
+}
+
+void
+occlusionRender(
+    OcclusionBuffer *buffer, const std::vector<OccluderInstance> &occluders)
+{
+  int width = buffer->width, height = buffer->height;
+  std::fill(buffer->levels[0].begin(), buffer->levels[0].end(), 1.0f);
+  buffer->tested = buffer->occluded = 0;
+
+  // Transform, clip and set up triangles, one list per occluder.
+  std::vector<std::vector<OcclusionTriangle>> &binned = buffer->binned;
+  binned.resize(std::max(binned.size(), occluders.size()));
+  for (auto &list : binned) list.clear();
+  jobParallelFor(buffer->jobs, occluders.size(), 1, [&](size_t b, size_t e) {
+    for (size_t o = b; o < e; o++) {
+      const OccluderMesh &mesh = *occluders[o].mesh;
+      const Mat4 &mvp = occluders[o].mvp;
+      for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+        float c[3][4];
+        for (int k = 0; k < 3; k++)
+          transformClip(mvp, &mesh.positions[mesh.indices[i + k] * 3], c[k]);
+        setupTriangle(c, width, height, &binned[o]);
+      }
+    }
+  });
+
+  // Rasterize in horizontal strips so that threads never share a row.
+  const int stripHeight = 8;
+  int strips = (height + stripHeight - 1) / stripHeight;
+  std::atomic<size_t> rasterized{0};
+  jobParallelFor(buffer->jobs, strips, 1, [&](size_t b, size_t e) {
+    size_t count = 0;
+    for (size_t s = b; s < e; s++) {
+      int rowBegin = (int)s * stripHeight;
+      int rowEnd = std::min(height, rowBegin + stripHeight);
+      for (size_t o = 0; o < occluders.size(); o++) {
+        for (const OcclusionTriangle &t : binned[o]) {
+          float miny = std::min(t.y[0], std::min(t.y[1], t.y[2]));
+          float maxy = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+          if (maxy < rowBegin || miny > rowEnd) continue;
+          rasterTriangle(
+              t, buffer->levels[0].data(), width, rowBegin, rowEnd);
+          count++;
+        }
+      }
+    }
+    rasterized += count;
+  });
+  buffer->trianglesRasterized = rasterized;
+
+  buildPyramid(buffer);
+}
+
+bool
+occlusionTestBox(OcclusionBuffer *buffer, const Mat4 &mvp, const Bounds &bounds)
+{
+  buffer->tested++;
+
+  float minx = INFINITY, maxx = -INFINITY, miny = INFINITY, maxy = -INFINITY;
+  float minz = INFINITY;
+  int outside[6] = {0, 0, 0, 0, 0, 0};
+  bool crossesNear = false;
+  for (int i = 0; i < 8; i++) {
+    float p[3] = {(i & 1) ? bounds.max[0] : bounds.min[0],
+        (i & 2) ? bounds.max[1] : bounds.min[1],
+        (i & 4) ? bounds.max[2] : bounds.min[2]};
+    float c[4];
+    transformClip(mvp, p, c);
+    outside[0] += c[0] < -c[3];
+    outside[1] += c[0] > c[3];
+    outside[2] += c[1] < -c[3];
+    outside[3] += c[1] > c[3];
+    outside[4] += c[2] < -c[3];
+    outside[5] += c[2] > c[3];
+    if (c[2] < -c[3] || c[3] <= 1e-6f) {
+      crossesNear = true;
+      continue;
+    }
+    float x = (c[0] / c[3] * 0.5f + 0.5f) * buffer->width;
+    float y = (c[1] / c[3] * 0.5f + 0.5f) * buffer->height;
+    minx = std::min(minx, x);
+    maxx = std::max(maxx, x);
+    miny = std::min(miny, y);
+    maxy = std::max(maxy, y);
+    minz = std::min(minz, c[2] / c[3] * 0.5f + 0.5f);
+  }
+
+  for (int i = 0; i < 6; i++) {
+    if (outside[i] == 8) {
+      buffer->occluded++;
+      return false;
+    }
+  }
+  if (crossesNear) return true;
+
+  int x0 = std::max(0, (int)floorf(minx));
+  int x1 = std::min(buffer->width - 1, (int)floorf(maxx));
+  int y0 = std::max(0, (int)floorf(miny));
+  int y1 = std::min(buffer->height - 1, (int)floorf(maxy));
+  if (x0 > x1 || y0 > y1) {
+    buffer->occluded++;
+    return false;
+  }
+
+  // Pick the level where the rectangle covers at most 2x2 texels (3x3 when
+  // misaligned) and compare against their farthest occluder depth.
+  int level = 0;
+  int size = std::max(x1 - x0, y1 - y0) + 1;
+  while (size > 2 && level + 1 < (int)buffer->levels.size()) {
+    size = (size + 1) / 2;
+    level++;
+  }
+  const std::vector<float> &depth = buffer->levels[level];
+  int lw = buffer->levelWidth[level];
+  for (int y = y0 >> level; y <= (y1 >> level); y++) {
+    for (int x = x0 >> level; x <= (x1 >> level); x++) {
+      if (depth[y * lw + x] >= minz) return true;
+    }
+  }
+  buffer->occluded++;
+  return false;
+}
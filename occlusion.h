@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "jobs.h"
+#include "tiny_gltf.h"
+#include "transform.h"
+
+// Software hierarchical-Z occlusion culling.
+//
+// A handful of occluder meshes is rasterized on the CPU into a small depth
+// buffer, a max-depth pyramid is built from it, and node bounds are tested
+// against the pyramid before they are drawn. Nothing here touches OpenGL, so
+// the whole pass can run and be measured headless.
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_MAX_OCCLUDERS 64
+#define OCCLUSION_MAX_OCCLUDER_TRIANGLES 2048
+
+typedef struct {
+  std::vector<float> positions;  // xyz per vertex
+  std::vector<uint32_t> indices;  // triangle list
+} OccluderMesh;
+
+typedef struct {
+  const OccluderMesh *mesh;
+  Mat4 mvp;  // view projection times world
+} OccluderInstance;
+
+// A clipped triangle in window coordinates.
+typedef struct {
+  float x[3], y[3], z[3];
+} OcclusionTriangle;
+
+typedef struct {
+  int width;
+  int height;
+  // levels[0] holds the rasterized depth (NDC z in [0, 1]), each further level
+  // the max of a 2x2 block of the previous one.
+  std::vector<std::vector<float>> levels;
+  std::vector<int> levelWidth;
+  std::vector<int> levelHeight;
+  JobSystem *jobs;  // NULL rasterizes on the caller
+  std::vector<std::vector<OcclusionTriangle>> binned;  // per occluder
+
+  // Statistics of the last frame.
+  size_t trianglesRasterized;
+  size_t tested;
+  size_t occluded;
+} OcclusionBuffer;
+
+// Occluder geometry for a mesh: its triangle primitives flattened into one
+// list. Returns false for meshes that have no triangles, or more than
+// OCCLUSION_MAX_OCCLUDER_TRIANGLES unless `force` is set.
+bool buildOccluderMesh(const tinygltf::Model &model,
+    const tinygltf::Mesh &mesh, bool force, OccluderMesh *out);
+
+// True when the mesh is tagged with `"occluder": true` in its extras.
+bool meshIsTaggedOccluder(const tinygltf::Mesh &mesh);
+
+void occlusionInit(
+    OcclusionBuffer *buffer, int width, int height, JobSystem *jobs);
+
+// Clears, rasterizes `occluders` and rebuilds the pyramid.
+void occlusionRender(
+    OcclusionBuffer *buffer, const std::vector<OccluderInstance> &occluders);
+
+// False when the box `bounds`, transformed by `mvp`, is outside the frustum
+// or entirely behind the rasterized occluders.
+bool occlusionTestBox(
+    OcclusionBuffer *buffer, const Mat4 &mvp, const Bounds &bounds);
@@ -0,0 +1,152 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define PROFILE_GPU_TID 0  // CPU threads are numbered from 1
+
+namespace {
+
+struct ProfileEvent {
+  const char *name;
+  uint64_t start;
+  uint64_t end;
+};
+
+struct ProfileRing {
+  int tid;
+  std::string name;
+  std::atomic<uint64_t> head{0};  // events ever recorded
+  ProfileEvent events[PROFILE_RING_SIZE];
+
+  void push(const char *event, uint64_t start, uint64_t end)
+  {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    events[h & (PROFILE_RING_SIZE - 1)] = {event, start, end};
+    head.store(h + 1, std::memory_order_release);
+  }
+};
+
+std::chrono::steady_clock::time_point startTime;
+std::mutex ringsMutex;
+std::vector<std::unique_ptr<ProfileRing>> rings;  // one per thread, and GPU
+ProfileRing *gpuRing;
+uint64_t gpuEnd;  // end of the last GPU zone
+thread_local ProfileRing *threadRing = nullptr;
+
+}  // namespace
+
+bool profilerEnabled = false;
+
+static ProfileRing *
+newRing(int tid)
+{
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  rings.emplace_back(new ProfileRing);
+  rings.back()->tid = tid < 0 ? (int)rings.size() : tid;
+  return rings.back().get();
+}
+
+// Registered on first use, which is the only time a thread takes the lock.
+static ProfileRing *
+currentRing()
+{
+  if (!threadRing) threadRing = newRing(-1);
+  return threadRing;
+}
+
+void
+profilerStart()
+{
+  startTime = std::chrono::steady_clock::now();
+  gpuRing = newRing(PROFILE_GPU_TID);
+  gpuRing->name = "GPU";
+  profilerEnabled = true;
+}
+
+uint64_t
+profilerNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - startTime)
+      .count();
+}
+
+void
+profilerSetThreadName(const char *name)
+{
+  if (profilerEnabled) currentRing()->name = name;
+}
+
+void
+profilerRecord(const char *name, uint64_t start, uint64_t end)
+{
+  currentRing()->push(name, start, end);
+}
+
+void
+profilerRecordGpu(const char *name, uint64_t submitted, uint64_t duration)
+{
+  if (!profilerEnabled) return;
+  uint64_t start = std::max(submitted, gpuEnd);
+  gpuEnd = start + duration;
+  gpuRing->push(name, start, gpuEnd);
+}
+
+static void
+writeString(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(fp, "\\u%04x", *s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+bool
+profilerWriteTrace(const char *filename)
+{
+  FILE *fp = fopen(filename, "w");
+  if (!fp) return false;
+
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  for (const std::unique_ptr<ProfileRing> &ring : rings) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    if (!ring->name.empty()) {
+      fprintf(fp, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+                  "\"tid\":%d,\"args\":{\"name\":",
+          first ? "" : ",\n", ring->tid);
+      writeString(fp, ring->name.c_str());
+      fprintf(fp, "}}");
+      first = false;
+    }
+
+    // Timestamps are in microseconds.
+    uint64_t begin = head > PROFILE_RING_SIZE ? head - PROFILE_RING_SIZE : 0;
+    for (uint64_t i = begin; i < head; i++) {
+      const ProfileEvent &e = ring->events[i & (PROFILE_RING_SIZE - 1)];
+      fprintf(fp, "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                  "\"dur\":%.3f,\"name\":",
+          first ? "" : ",\n", ring->tid, e.start / 1000.0,
+          (e.end - e.start) / 1000.0);
+      writeString(fp, e.name);
+      fputc('}', fp);
+      first = false;
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  return fclose(fp) == 0;
+}
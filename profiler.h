@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+// Scoped CPU zones and GPU timings, written out as a Chrome trace (open in
+// chrome://tracing or ui.perfetto.dev).
+//
+// Each thread records its finished zones into a ring of its own, so
+// recording takes no lock; once PROFILE_RING_SIZE zones are recorded the
+// oldest are overwritten. Nothing is recorded before profilerStart, and a
+// disabled zone costs one branch.
+
+#define PROFILE_RING_SIZE 65536  // zones kept per thread, power of two
+
+extern bool profilerEnabled;  // only changed by profilerStart
+
+// Starts recording. Call before starting threads that record zones.
+void profilerStart();
+
+// Nanoseconds since profilerStart.
+uint64_t profilerNow();
+
+// Names the calling thread in the trace.
+void profilerSetThreadName(const char *name);
+
+// `name` must outlive the profiler, e.g. a string literal.
+void profilerRecord(const char *name, uint64_t start, uint64_t end);
+
+// A GPU zone of `duration` ns submitted at `submitted`. GPU zones are placed
+// one after the other on their own track, none starting before it was
+// submitted. Call from one thread only, in submission order.
+void profilerRecordGpu(const char *name, uint64_t submitted, uint64_t duration);
+
+// Writes every recorded zone. Other threads must not be recording.
+bool profilerWriteTrace(const char *filename);
+
+struct ProfileZone {
+  const char *name;
+  uint64_t start;
+
+  explicit ProfileZone(const char *name)
+      : name(profilerEnabled ? name : nullptr),
+        start(profilerEnabled ? profilerNow() : 0)
+  {
+  }
+
+  ~ProfileZone()
+  {
+    if (name) profilerRecord(name, start, profilerNow());
+  }
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+// Times the rest of the enclosing scope.
+#define PROFILE_ZONE(name) \
+  ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
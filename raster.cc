@@ -0,0 +1,730 @@
+#include "raster.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "instancing.h"
+#include "mesh_data.h"
+
+namespace {
+// Frustum planes a clip-space vertex is outside of.
+enum {
+  OUTSIDE_LEFT = 1,
+  OUTSIDE_RIGHT = 2,
+  OUTSIDE_BOTTOM = 4,
+  OUTSIDE_TOP = 8,
+  OUTSIDE_FAR = 16,
+  OUTSIDE_NEAR = 32,
+};
+}  // namespace
+
+// Unwelds `p` so that every triangle has its own vertices, with the normal
+// of its face.
+static void
+flatNormals(RasterPrimitive *p)
+{
+  size_t count = p->indices.size();
+  std::vector<float> positions(count * 3), normals(count * 3);
+  std::vector<float> joints, weights;
+  if (!p->joints.empty()) {
+    joints.resize(count * 4);
+    weights.resize(count * 4);
+  }
+  for (size_t i = 0; i < count; i++) {
+    uint32_t v = p->indices[i];
+    memcpy(&positions[i * 3], &p->positions[v * 3], sizeof(float) * 3);
+    if (!joints.empty()) {
+      memcpy(&joints[i * 4], &p->joints[v * 4], sizeof(float) * 4);
+      memcpy(&weights[i * 4], &p->weights[v * 4], sizeof(float) * 4);
+    }
+    p->indices[i] = (uint32_t)i;
+  }
+  for (size_t t = 0; t + 2 < count; t += 3) {
+    const float *a = &positions[t * 3], *b = a + 3, *c = a + 6;
+    float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float n[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2],
+        u[0] * v[1] - u[1] * v[0]};
+    for (int k = 0; k < 3; k++) memcpy(&normals[(t + k) * 3], n, sizeof(n));
+  }
+  p->positions.swap(positions);
+  p->normals.swap(normals);
+  p->joints.swap(joints);
+  p->weights.swap(weights);
+}
+
+// Reads `primitive` into `out`. False when it is not made of triangles or
+// cannot be read.
+static bool
+readPrimitive(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, RasterPrimitive *out)
+{
+  int mode = primitive.mode < 0 ? TINYGLTF_MODE_TRIANGLES : primitive.mode;
+  if (mode != TINYGLTF_MODE_TRIANGLES &&
+      mode != TINYGLTF_MODE_TRIANGLE_STRIP &&
+      mode != TINYGLTF_MODE_TRIANGLE_FAN)
+    return false;
+  auto attribute = [&](const char *name, int components,
+                       std::vector<float> *data) {
+    auto it = primitive.attributes.find(name);
+    int n = 0;
+    if (it == primitive.attributes.end() ||
+        !readAccessorFloats(model, it->second, data, &n) || n != components) {
+      data->clear();
+      return false;
+    }
+    return true;
+  };
+  std::vector<uint32_t> source;
+  if (!attribute("POSITION", 3, &out->positions) ||
+      !readIndices(model, primitive, &source))
+    return false;
+  size_t count = out->positions.size() / 3;
+  if (attribute("NORMAL", 3, &out->normals) &&
+      out->normals.size() != count * 3)
+    out->normals.clear();
+  if (!attribute("JOINTS_0", 4, &out->joints) ||
+      !attribute("WEIGHTS_0", 4, &out->weights) ||
+      out->joints.size() != count * 4 || out->weights.size() != count * 4) {
+    out->joints.clear();
+    out->weights.clear();
+  }
+
+  auto triangle = [&](uint32_t a, uint32_t b, uint32_t c) {
+    if (a >= count || b >= count || c >= count) return;
+    out->indices.push_back(a);
+    out->indices.push_back(b);
+    out->indices.push_back(c);
+  };
+  size_t n = source.size();
+  if (mode == TINYGLTF_MODE_TRIANGLES) {
+    for (size_t i = 0; i + 2 < n; i += 3)
+      triangle(source[i], source[i + 1], source[i + 2]);
+  } else if (mode == TINYGLTF_MODE_TRIANGLE_STRIP) {
+    // Every other triangle swaps its last two vertices to keep the winding.
+    for (size_t i = 0; i + 2 < n; i++) {
+      size_t odd = i & 1;
+      triangle(source[i], source[i + 1 + odd], source[i + 2 - odd]);
+    }
+  } else {
+    for (size_t i = 1; i + 1 < n; i++)
+      triangle(source[0], source[i], source[i + 1]);
+  }
+  if (out->indices.empty()) return false;
+
+  out->bounds = boundsEmpty();
+  for (size_t v = 0; v < count; v++)
+    boundsExtend(out->bounds, &out->positions[v * 3]);
+  if (out->normals.empty()) flatNormals(out);
+  return true;
+}
+
+void
+rasterInit(const tinygltf::Model &model, int width, int height,
+    JobSystem *jobs, SoftwareRenderer *renderer)
+{
+  SoftwareRenderer &r = *renderer;
+  r.width = width;
+  r.height = height;
+  r.pitch = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE *
+            RASTER_TILE_SIZE;
+  r.jobs = jobs;
+  int rows = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE *
+             RASTER_TILE_SIZE;
+  r.color.assign((size_t)r.pitch * rows, 0xff000000u);
+  r.depth.assign((size_t)r.pitch * rows, 1.0f);
+  r.draws = r.culled = r.triangles = r.binned = 0;
+
+  r.meshStart.clear();
+  int primitiveCount = 0;
+  for (const tinygltf::Mesh &mesh : model.meshes) {
+    r.meshStart.push_back(primitiveCount);
+    primitiveCount += (int)mesh.primitives.size();
+  }
+  r.meshStart.push_back(primitiveCount);
+  r.primitives.assign(primitiveCount, RasterPrimitive());
+  std::vector<MorphPrimitive> morphs(primitiveCount);
+  std::vector<unsigned char> morphed(primitiveCount, 0);
+  jobParallelFor(jobs, model.meshes.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t m = begin; m < end; m++) {
+      const tinygltf::Mesh &mesh = model.meshes[m];
+      for (size_t i = 0; i < mesh.primitives.size(); i++) {
+        int index = r.meshStart[m] + (int)i;
+        RasterPrimitive &p = r.primitives[index];
+        p.morph = -1;
+        if (!readPrimitive(model, mesh.primitives[i], &p)) {
+          p = RasterPrimitive();
+          p.morph = -1;
+          continue;
+        }
+        // Unwelded primitives no longer match the targets.
+        morphed[index] =
+            !mesh.primitives[i].targets.empty() &&
+            buildMorphPrimitive(model, mesh.primitives[i], &morphs[index]) &&
+            morphs[index].vertexCount * 3 == p.positions.size();
+      }
+    }
+  });
+  r.morphs.clear();
+  for (int i = 0; i < primitiveCount; i++) {
+    if (!morphed[i]) continue;
+    r.primitives[i].morph = (int)r.morphs.size();
+    r.morphs.push_back(std::move(morphs[i]));
+  }
+
+  buildSkins(model, &r.skins);
+  r.gpuInstances.assign(model.nodes.size(), std::vector<Mat4>());
+  for (size_t n = 0; n < model.nodes.size(); n++) {
+    if (!readGpuInstances(model, model.nodes[n], &r.gpuInstances[n]))
+      r.gpuInstances[n].clear();
+  }
+}
+
+// False when `bounds` placed by `mvp` is entirely outside a frustum plane.
+static bool
+boxVisible(const Mat4 &mvp, const Bounds &bounds)
+{
+  int outside[6] = {0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 8; i++) {
+    float p[3] = {(i & 1) ? bounds.max[0] : bounds.min[0],
+        (i & 2) ? bounds.max[1] : bounds.min[1],
+        (i & 4) ? bounds.max[2] : bounds.min[2]};
+    float c[4];
+    for (int k = 0; k < 4; k++)
+      c[k] = mvp.m[k] * p[0] + mvp.m[4 + k] * p[1] + mvp.m[8 + k] * p[2] +
+             mvp.m[12 + k];
+    outside[0] += c[0] < -c[3];
+    outside[1] += c[0] > c[3];
+    outside[2] += c[1] < -c[3];
+    outside[3] += c[1] > c[3];
+    outside[4] += c[2] < -c[3];
+    outside[5] += c[2] > c[3];
+  }
+  for (int i = 0; i < 6; i++)
+    if (outside[i] == 8) return false;
+  return true;
+}
+
+// Adds the primitives of `mesh` as placed by `placement`.
+static void
+addDraws(SoftwareRenderer *r, int mesh, const Mat4 &viewProj,
+    const Mat4 &placement, int skin, const float *weights, int weightCount)
+{
+  Mat4 mvp = mat4Mul(viewProj, placement);
+  for (int i = r->meshStart[mesh]; i < r->meshStart[mesh + 1]; i++) {
+    const RasterPrimitive &p = r->primitives[i];
+    if (p.indices.empty()) continue;
+    bool skinned = skin >= 0 && !p.joints.empty();
+    const Bounds &bounds = skinned ? r->palette.bounds[skin] : p.bounds;
+    // Morph targets move vertices out of the primitive's bounds.
+    if (p.morph < 0 && boundsValid(bounds) && !boxVisible(mvp, bounds)) {
+      r->culled++;
+      continue;
+    }
+    RasterDraw draw;
+    draw.primitive = i;
+    draw.mvp = mvp;
+    mat4NormalMatrix(placement, draw.normalMatrix);
+    draw.skin = skinned ? &r->palette.matrices[r->palette.offset[skin] * 16]
+                        : nullptr;
+    draw.weights = p.morph >= 0 ? weights : nullptr;
+    draw.weightCount = weightCount;
+    draw.positions = p.positions.data();
+    draw.normals = p.normals.data();
+    r->drawList.push_back(draw);
+  }
+}
+
+// Blends the morph targets of the draws that have weights.
+static void
+blendMorphs(SoftwareRenderer *r)
+{
+  std::vector<RasterDraw> &draws = r->drawList;
+  std::vector<std::vector<float>> &morphPositions = r->morphPositions;
+  std::vector<std::vector<float>> &morphNormals = r->morphNormals;
+  if (morphPositions.size() < draws.size()) {
+    morphPositions.resize(draws.size());
+    morphNormals.resize(draws.size());
+  }
+  jobParallelFor(r->jobs, draws.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t d = begin; d < end; d++) {
+      RasterDraw &draw = draws[d];
+      if (!draw.weights) continue;
+      const MorphPrimitive &morph =
+          r->morphs[r->primitives[draw.primitive].morph];
+      int targets[MORPH_MAX_ACTIVE];
+      float active[MORPH_MAX_ACTIVE];
+      int count = activeMorphTargets(draw.weights, draw.weightCount,
+          morph.targetCount, targets, active);
+      morphPositions[d].resize(morph.vertexCount * 3);
+      morphNormals[d].assign(morph.vertexCount * 3, 0.0f);
+      if (morph.hasNormals) {
+        morphBlend(morph, targets, active, count, morphPositions[d].data(),
+            morphNormals[d].data());
+        draw.normals = morphNormals[d].data();
+      } else {
+        morphBlend(morph, targets, active, count, morphPositions[d].data(),
+            nullptr);
+      }
+      draw.positions = morphPositions[d].data();
+    }
+  });
+}
+
+static void
+transformVertex(const RasterDraw &draw, const RasterPrimitive &p, size_t v,
+    float clip[4], float normal[3])
+{
+  const float *position = draw.positions + v * 3;
+  float n[3];
+  memcpy(n, draw.normals + v * 3, sizeof(n));
+  float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+  if (length > 0.0f)
+    for (int k = 0; k < 3; k++) n[k] /= length;
+
+  float world[3];
+  if (draw.skin) {
+    // Same as the vertex shader: the weighted sum of the joint matrices.
+    float s[12] = {};
+    for (int j = 0; j < 4; j++) {
+      float w = p.weights[v * 4 + j];
+      if (w == 0.0f) continue;
+      const float *m = draw.skin + (size_t)p.joints[v * 4 + j] * 16;
+      for (int c = 0; c < 4; c++)
+        for (int row = 0; row < 3; row++) s[c * 3 + row] += w * m[c * 4 + row];
+    }
+    float skinned[3];
+    for (int row = 0; row < 3; row++) {
+      world[row] = s[row] * position[0] + s[3 + row] * position[1] +
+                   s[6 + row] * position[2] + s[9 + row];
+      skinned[row] = s[row] * n[0] + s[3 + row] * n[1] + s[6 + row] * n[2];
+    }
+    memcpy(n, skinned, sizeof(n));
+    position = world;
+  }
+
+  const Mat4 &m = draw.mvp;
+  for (int k = 0; k < 4; k++)
+    clip[k] = m.m[k] * position[0] + m.m[4 + k] * position[1] +
+              m.m[8 + k] * position[2] + m.m[12 + k];
+  const float *nm = draw.normalMatrix;
+  for (int k = 0; k < 3; k++)
+    normal[k] = nm[k] * n[0] + nm[3 + k] * n[1] + nm[6 + k] * n[2];
+}
+
+// floorf and ceilf are library calls without SSE4.1; these are not, for
+// values well within the range of int.
+static inline int
+floorInt(float x)
+{
+  int i = (int)x;
+  return i - (x < (float)i);
+}
+
+static inline int
+ceilInt(float x)
+{
+  int i = (int)x;
+  return i + (x > (float)i);
+}
+
+// Fills in the window coordinates of `v` at `clip`. Far off-screen
+// vertices are clamped so that the conversions to pixels cannot overflow.
+static void
+project(const SoftwareRenderer &r, const float clip[4], RasterVertex *v)
+{
+  float w = clip[3];
+  v->outside = (clip[0] < -w ? OUTSIDE_LEFT : 0) |
+               (clip[0] > w ? OUTSIDE_RIGHT : 0) |
+               (clip[1] < -w ? OUTSIDE_BOTTOM : 0) |
+               (clip[1] > w ? OUTSIDE_TOP : 0) |
+               (clip[2] > w ? OUTSIDE_FAR : 0) |
+               (clip[2] < -w ? OUTSIDE_NEAR : 0);
+  if (v->outside & OUTSIDE_NEAR) return;
+  const float guard = 1 << 19;
+  float invW = 1.0f / w;
+  float x = (clip[0] * invW * 0.5f + 0.5f) * r.width;
+  float y = (clip[1] * invW * 0.5f + 0.5f) * r.height;
+  x = std::min(std::max(x, -guard), guard);
+  y = std::min(std::max(y, -guard), guard);
+  v->window[0] =
+      (float)floorInt(x * RASTER_SUBPIXELS + 0.5f) / RASTER_SUBPIXELS;
+  v->window[1] =
+      (float)floorInt(y * RASTER_SUBPIXELS + 0.5f) / RASTER_SUBPIXELS;
+  v->window[2] = clip[2] * invW * 0.5f + 0.5f;
+  v->invW = invW;
+}
+
+// Sets up a triangle in front of the eye and bins it into the tiles it may
+// cover.
+//
+// Edge functions are taken relative to the first pixel center of the
+// bounding box, which with vertices snapped to RASTER_SUBPIXELS keeps them
+// exact in floats for triangles up to about a hundred pixels: two
+// triangles sharing an edge then agree on every pixel along it, and the
+// top-left rule gives it to exactly one of them.
+static void
+setupTriangle(const SoftwareRenderer &r, const RasterVertex *v[3],
+    std::vector<RasterTriangle> *out, std::vector<uint32_t> *tileBins)
+{
+  float x[3], y[3];
+  for (int i = 0; i < 3; i++) {
+    x[i] = v[i]->window[0];
+    y[i] = v[i]->window[1];
+  }
+  RasterTriangle t;
+  // Pixels whose center is in the bounding box.
+  float minx = std::min(x[0], std::min(x[1], x[2]));
+  float maxx = std::max(x[0], std::max(x[1], x[2]));
+  float miny = std::min(y[0], std::min(y[1], y[2]));
+  float maxy = std::max(y[0], std::max(y[1], y[2]));
+  t.minx = std::max(0, ceilInt(minx - 0.5f));
+  t.maxx = std::min(r.width - 1, floorInt(maxx - 0.5f));
+  t.miny = std::max(0, ceilInt(miny - 0.5f));
+  t.maxy = std::min(r.height - 1, floorInt(maxy - 0.5f));
+  if (t.minx > t.maxx || t.miny > t.maxy) return;
+
+  float z[3], n[3][3];
+  for (int i = 0; i < 3; i++) {
+    x[i] -= t.minx;
+    y[i] -= t.miny;
+    z[i] = v[i]->window[2];
+    // Only the direction of the normal is used, so interpolating it over w
+    // affinely is perspective correct without dividing by 1 / w.
+    for (int k = 0; k < 3; k++) n[k][i] = v[i]->normal[k] * v[i]->invW;
+  }
+  float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (area == 0.0f || !std::isfinite(area)) return;
+  if (area < 0.0f) {
+    std::swap(x[1], x[2]);
+    std::swap(y[1], y[2]);
+    std::swap(z[1], z[2]);
+    for (int k = 0; k < 3; k++) std::swap(n[k][1], n[k][2]);
+    area = -area;
+  }
+
+  // Edge i is opposite vertex i, so E_i / area is its barycentric weight.
+  float inv = 1.0f / area;
+  for (int i = 0; i < 3; i++) {
+    int j = (i + 1) % 3, k = (i + 2) % 3;
+    t.a[i] = y[j] - y[k];
+    t.b[i] = x[k] - x[j];
+    t.c[i] = x[j] * y[k] - x[k] * y[j];
+    // Counter-clockwise with y up: left edges rise in x, top edges are
+    // horizontal with the inside below.
+    t.topLeft[i] = t.a[i] > 0.0f || (t.a[i] == 0.0f && t.b[i] < 0.0f);
+  }
+  // Relative to the first vertex, which the weights of the others are
+  // small next to on tiny triangles.
+  auto plane = [&](const float value[3], float out[3]) {
+    float d1 = value[1] - value[0], d2 = value[2] - value[0];
+    out[0] = (t.a[1] * d1 + t.a[2] * d2) * inv;
+    out[1] = (t.b[1] * d1 + t.b[2] * d2) * inv;
+    out[2] = (t.c[1] * d1 + t.c[2] * d2) * inv + value[0];
+  };
+  plane(z, t.z);
+  for (int k = 0; k < 3; k++) plane(n[k], t.n[k]);
+
+  uint32_t index = (uint32_t)out->size();
+  out->push_back(t);
+  int tilesX = r.pitch / RASTER_TILE_SIZE;
+  for (int ty = t.miny / RASTER_TILE_SIZE; ty <= t.maxy / RASTER_TILE_SIZE;
+       ty++) {
+    for (int tx = t.minx / RASTER_TILE_SIZE;
+         tx <= t.maxx / RASTER_TILE_SIZE; tx++)
+      tileBins[ty * tilesX + tx].push_back(index);
+  }
+}
+
+// Clips triangle `triangle` of `draw`, which crosses the near plane
+// (z >= -w), and sets up what is left.
+static void
+clipTriangle(const SoftwareRenderer &r, const RasterDraw &draw,
+    size_t triangle, std::vector<RasterTriangle> *out,
+    std::vector<uint32_t> *tileBins)
+{
+  const RasterPrimitive &p = r.primitives[draw.primitive];
+  float clip[3][4], normal[3][3];
+  for (int i = 0; i < 3; i++)
+    transformVertex(draw, p, p.indices[triangle * 3 + i], clip[i], normal[i]);
+
+  RasterVertex poly[4];
+  int count = 0;
+  for (int i = 0; i < 3; i++) {
+    int j = (i + 1) % 3;
+    float da = clip[i][2] + clip[i][3], db = clip[j][2] + clip[j][3];
+    if (da >= 0.0f) {
+      project(r, clip[i], &poly[count]);
+      memcpy(poly[count++].normal, normal[i], sizeof(normal[i]));
+    }
+    if ((da >= 0.0f) != (db >= 0.0f)) {
+      float s = da / (da - db), c[4];
+      RasterVertex &v = poly[count++];
+      for (int k = 0; k < 4; k++)
+        c[k] = clip[i][k] + (clip[j][k] - clip[i][k]) * s;
+      for (int k = 0; k < 3; k++)
+        v.normal[k] = normal[i][k] + (normal[j][k] - normal[i][k]) * s;
+      // On the plane, which rounding may put just outside.
+      c[2] = std::max(c[2], -c[3]);
+      project(r, c, &v);
+    }
+  }
+  for (int i = 1; i + 1 < count; i++) {
+    const RasterVertex *t[3] = {&poly[0], &poly[i], &poly[i + 1]};
+    if (!((t[0]->outside | t[1]->outside | t[2]->outside) & OUTSIDE_NEAR))
+      setupTriangle(r, t, out, tileBins);
+  }
+}
+
+// Draws the part of `t` inside the tile at x0, y0 with a strict less depth
+// test, so that of equal depths the first triangle wins.
+static void
+rasterTriangle(SoftwareRenderer *r, const RasterTriangle &t, int x0, int y0)
+{
+  int minx = std::max(t.minx, x0) & ~3;
+  int maxx = std::min(t.maxx, x0 + RASTER_TILE_SIZE - 1);
+  int miny = std::max(t.miny, y0);
+  int maxy = std::min(t.maxy, y0 + RASTER_TILE_SIZE - 1);
+  if (minx > maxx || miny > maxy) return;
+
+#ifdef __SSE2__
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f), three = _mm_set1_ps(3.0f);
+  const __m128 scale = _mm_set1_ps(127.5f);
+  const __m128 top = _mm_set1_ps(255.0f);
+  const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+  __m128 a[3], tl[3];
+  for (int i = 0; i < 3; i++) {
+    a[i] = _mm_set1_ps(t.a[i]);
+    tl[i] = _mm_castsi128_ps(_mm_set1_epi32(t.topLeft[i] ? -1 : 0));
+  }
+  __m128 za = _mm_set1_ps(t.z[0]);
+  __m128 na[3];
+  for (int k = 0; k < 3; k++) na[k] = _mm_set1_ps(t.n[k][0]);
+  const __m128 offs = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  for (int y = miny; y <= maxy; y++) {
+    float py = y - t.miny + 0.5f;
+    float *depthRow = r->depth.data() + (size_t)y * r->pitch;
+    uint32_t *colorRow = r->color.data() + (size_t)y * r->pitch;
+    __m128 row[3];
+    for (int i = 0; i < 3; i++) row[i] = _mm_set1_ps(t.b[i] * py + t.c[i]);
+    __m128 zrow = _mm_set1_ps(t.z[1] * py + t.z[2]);
+    __m128 nrow[3];
+    for (int k = 0; k < 3; k++)
+      nrow[k] = _mm_set1_ps(t.n[k][1] * py + t.n[k][2]);
+    __m128 px = _mm_add_ps(_mm_set1_ps((float)(minx - t.minx)), offs);
+    for (int x = minx; x <= maxx; x += 4, px = _mm_add_ps(px, _mm_set1_ps(4))) {
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      for (int i = 0; i < 3; i++) {
+        __m128 e = _mm_add_ps(_mm_mul_ps(a[i], px), row[i]);
+        inside = _mm_and_ps(inside,
+            _mm_or_ps(_mm_cmpgt_ps(e, zero),
+                _mm_and_ps(_mm_cmpeq_ps(e, zero), tl[i])));
+      }
+      if (!_mm_movemask_ps(inside)) continue;
+      __m128 z = _mm_add_ps(_mm_mul_ps(za, px), zrow);
+      __m128 old = _mm_load_ps(depthRow + x);
+      __m128 pass = _mm_and_ps(inside,
+          _mm_and_ps(_mm_cmplt_ps(z, old), _mm_cmple_ps(z, one)));
+      if (!_mm_movemask_ps(pass)) continue;
+      _mm_store_ps(depthRow + x,
+          _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old)));
+
+      __m128 n[3];
+      for (int k = 0; k < 3; k++)
+        n[k] = _mm_add_ps(_mm_mul_ps(na[k], px), nrow[k]);
+      __m128 length2 = _mm_add_ps(_mm_mul_ps(n[0], n[0]),
+          _mm_add_ps(_mm_mul_ps(n[1], n[1]), _mm_mul_ps(n[2], n[2])));
+      length2 = _mm_max_ps(length2, _mm_set1_ps(1e-30f));
+      // One Newton step on the estimate is plenty for 8-bit output.
+      __m128 inv = _mm_rsqrt_ps(length2);
+      inv = _mm_mul_ps(_mm_mul_ps(half, inv),
+          _mm_sub_ps(three, _mm_mul_ps(length2, _mm_mul_ps(inv, inv))));
+      __m128i pixel = alpha;
+      for (int k = 0; k < 3; k++) {
+        __m128 c = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(n[k], inv), scale), scale);
+        c = _mm_min_ps(_mm_max_ps(c, zero), top);
+        pixel = _mm_or_si128(
+            pixel, _mm_slli_epi32(_mm_cvtps_epi32(c), 8 * k));
+      }
+      __m128i mask = _mm_castps_si128(pass);
+      __m128i previous = _mm_load_si128((const __m128i *)(colorRow + x));
+      _mm_store_si128((__m128i *)(colorRow + x),
+          _mm_or_si128(_mm_and_si128(mask, pixel),
+              _mm_andnot_si128(mask, previous)));
+    }
+  }
+#else
+  for (int y = miny; y <= maxy; y++) {
+    float py = y - t.miny + 0.5f;
+    float *depthRow = r->depth.data() + (size_t)y * r->pitch;
+    uint32_t *colorRow = r->color.data() + (size_t)y * r->pitch;
+    for (int x = minx; x <= maxx; x++) {
+      float px = x - t.minx + 0.5f;
+      bool inside = true;
+      for (int i = 0; i < 3; i++) {
+        float e = t.a[i] * px + t.b[i] * py + t.c[i];
+        inside = inside && (e > 0.0f || (e == 0.0f && t.topLeft[i]));
+      }
+      if (!inside) continue;
+      float z = t.z[0] * px + t.z[1] * py + t.z[2];
+      if (!(z < depthRow[x]) || z > 1.0f) continue;
+      depthRow[x] = z;
+      float n[3];
+      for (int k = 0; k < 3; k++)
+        n[k] = t.n[k][0] * px + t.n[k][1] * py + t.n[k][2];
+      float inv = 1.0f /
+          sqrtf(std::max(n[0] * n[0] + n[1] * n[1] + n[2] * n[2], 1e-30f));
+      uint32_t pixel = 0xff000000u;
+      for (int k = 0; k < 3; k++) {
+        float c = std::min(std::max(n[k] * inv * 127.5f + 127.5f, 0.0f),
+            255.0f);
+        pixel |= (uint32_t)lrintf(c) << (8 * k);
+      }
+      colorRow[x] = pixel;
+    }
+  }
+#endif
+}
+
+void
+rasterFrame(SoftwareRenderer *renderer, const tinygltf::Model &model,
+    const SceneState &scene, const Mat4 &viewProj)
+{
+  SoftwareRenderer &r = *renderer;
+  if (!r.skins.empty())
+    updateJointPalette(r.skins, scene.world, &r.palette, r.jobs);
+
+  std::vector<RasterDraw> &draws = r.drawList;
+  std::vector<size_t> &vertexStart = r.vertexStart;
+  std::vector<size_t> &triangleStart = r.triangleStart;
+  std::vector<RasterVertex> &vertices = r.vertices;
+  std::vector<std::vector<RasterTriangle>> &setup = r.setup;
+  std::vector<std::vector<uint32_t>> &bins = r.bins;
+
+  // Skinned meshes are placed by their joints, not by their node.
+  draws.clear();
+  r.culled = 0;
+  static const Mat4 identity = mat4Identity();
+  for (int node : scene.order) {
+    int mesh = model.nodes[node].mesh;
+    if (mesh < 0 || mesh >= (int)model.meshes.size()) continue;
+    const Mat4 &world = scene.world[node];
+    const std::vector<Mat4> &instances = r.gpuInstances[node];
+    if (!instances.empty()) {
+      for (const Mat4 &local : instances)
+        addDraws(&r, mesh, viewProj, mat4Mul(world, local), -1, nullptr, 0);
+      continue;
+    }
+    int skin = model.nodes[node].skin;
+    if (skin >= (int)r.skins.size()) skin = -1;
+    const float *weights = nullptr;
+    int weightCount = 0;
+    if (scene.weightOffset[node] >= 0) {
+      weights = &scene.weights[scene.weightOffset[node]];
+      weightCount = scene.weightCount[node];
+    }
+    addDraws(&r, mesh, viewProj, skin < 0 ? world : identity, skin, weights,
+        weightCount);
+  }
+  blendMorphs(&r);
+  r.draws = draws.size();
+
+  vertexStart.assign(1, 0);
+  triangleStart.assign(1, 0);
+  for (RasterDraw &draw : draws) {
+    const RasterPrimitive &p = r.primitives[draw.primitive];
+    draw.firstVertex = vertexStart.back();
+    draw.firstTriangle = triangleStart.back();
+    vertexStart.push_back(draw.firstVertex + p.positions.size() / 3);
+    triangleStart.push_back(draw.firstTriangle + p.indices.size() / 3);
+  }
+  size_t vertexCount = vertexStart.back();
+  size_t triangleCount = triangleStart.back();
+  vertices.resize(vertexCount);
+
+  jobParallelFor(r.jobs, vertexCount, RASTER_CHUNK,
+      [&](size_t begin, size_t end) {
+        size_t d = std::upper_bound(vertexStart.begin(), vertexStart.end(),
+                       begin) -
+                   vertexStart.begin() - 1;
+        for (size_t v = begin; v < end; v++) {
+          while (v >= vertexStart[d + 1]) d++;
+          const RasterDraw &draw = draws[d];
+          float clip[4];
+          transformVertex(draw, r.primitives[draw.primitive],
+              v - draw.firstVertex, clip, vertices[v].normal);
+          project(r, clip, &vertices[v]);
+        }
+      });
+
+  size_t chunks = (triangleCount + RASTER_CHUNK - 1) / RASTER_CHUNK;
+  int tilesX = r.pitch / RASTER_TILE_SIZE;
+  int tilesY = (r.height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+  size_t tiles = (size_t)tilesX * tilesY;
+  if (setup.size() < chunks) setup.resize(chunks);
+  if (bins.size() < chunks * tiles) bins.resize(chunks * tiles);
+  jobParallelFor(r.jobs, chunks, 1, [&](size_t begin, size_t end) {
+    for (size_t chunk = begin; chunk < end; chunk++) {
+      setup[chunk].clear();
+      std::vector<uint32_t> *tileBins = &bins[chunk * tiles];
+      for (size_t t = 0; t < tiles; t++) tileBins[t].clear();
+      size_t first = chunk * RASTER_CHUNK;
+      size_t last = std::min(triangleCount, first + RASTER_CHUNK);
+      size_t d = std::upper_bound(triangleStart.begin(), triangleStart.end(),
+                     first) -
+                 triangleStart.begin() - 1;
+      for (size_t i = first; i < last; d++) {
+        const RasterDraw &draw = draws[d];
+        const uint32_t *indices = r.primitives[draw.primitive].indices.data();
+        const RasterVertex *base = &vertices[draw.firstVertex];
+        size_t drawEnd = std::min(last, triangleStart[d + 1]);
+        for (; i < drawEnd; i++) {
+          size_t triangle = i - draw.firstTriangle;
+          const RasterVertex *v[3] = {&base[indices[triangle * 3]],
+              &base[indices[triangle * 3 + 1]],
+              &base[indices[triangle * 3 + 2]]};
+          // Outside of one plane, or partly behind the eye.
+          uint32_t all = v[0]->outside & v[1]->outside & v[2]->outside;
+          uint32_t any = v[0]->outside | v[1]->outside | v[2]->outside;
+          if (all) continue;
+          if (any & OUTSIDE_NEAR)
+            clipTriangle(r, draw, triangle, &setup[chunk], tileBins);
+          else
+            setupTriangle(r, v, &setup[chunk], tileBins);
+        }
+      }
+    }
+  });
+
+  std::atomic<size_t> binned{0};
+  jobParallelFor(r.jobs, tiles, 1, [&](size_t begin, size_t end) {
+    size_t count = 0;
+    for (size_t tile = begin; tile < end; tile++) {
+      int x0 = (int)(tile % tilesX) * RASTER_TILE_SIZE;
+      int y0 = (int)(tile / tilesX) * RASTER_TILE_SIZE;
+      for (int y = y0; y < y0 + RASTER_TILE_SIZE; y++) {
+        size_t offset = (size_t)y * r.pitch + x0;
+        std::fill_n(r.depth.begin() + offset, RASTER_TILE_SIZE, 1.0f);
+        std::fill_n(r.color.begin() + offset, RASTER_TILE_SIZE, 0xff000000u);
+      }
+      for (size_t chunk = 0; chunk < chunks; chunk++) {
+        for (uint32_t index : bins[chunk * tiles + tile])
+          rasterTriangle(&r, setup[chunk][index], x0, y0);
+        count += bins[chunk * tiles + tile].size();
+      }
+    }
+    binned += count;
+  });
+  r.binned = binned;
+  r.triangles = 0;
+  for (size_t chunk = 0; chunk < chunks; chunk++)
+    r.triangles += setup[chunk].size();
+}
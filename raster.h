@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "jobs.h"
+#include "morph.h"
+#include "scene.h"
+#include "skinning.h"
+#include "tiny_gltf.h"
+#include "transform.h"
+
+// Software rendering of the displayed scene, for machines without a GPU.
+//
+// Every triangle primitive is drawn with the normal visualization of
+// shader.frag built with NORMALS: the interpolated world-space normal,
+// normalized and mapped from [-1, 1] to [0, 1]. Skins and morph weights are
+// applied as the vertex shader does, and EXT_mesh_gpu_instancing instances
+// are drawn, but not LODs. A frame runs in three parallel stages on the job
+// system: vertices are transformed, triangles are clipped against the near
+// plane, set up and binned into the RASTER_TILE_SIZE tiles they overlap,
+// and each tile is rasterized by one job, four pixels at a time with SSE2.
+// Tiles walk their bins in submission order, so the image does not depend
+// on the thread count.
+
+#define RASTER_TILE_SIZE 64
+#define RASTER_CHUNK 16384  // vertices or triangles per job
+#define RASTER_SUBPIXELS 16  // vertex positions per pixel
+
+// Geometry of a triangle, strip or fan primitive as a triangle list.
+// Primitives without NORMAL are unwelded and get flat normals.
+typedef struct {
+  std::vector<float> positions;  // 3 per vertex
+  std::vector<float> normals;    // 3 per vertex
+  std::vector<float> joints;     // 4 per vertex, empty without a skin
+  std::vector<float> weights;    // 4 per vertex, empty without a skin
+  std::vector<uint32_t> indices;
+  int morph;  // into `morphs`, -1 without targets
+  Bounds bounds;
+} RasterPrimitive;
+
+// A primitive of a node instance.
+typedef struct {
+  int primitive;
+  Mat4 mvp;  // view projection times placement
+  float normalMatrix[9];
+  const float *skin;  // first joint matrix in the palette, or null
+  const float *weights;  // morph weights of the node, or null
+  int weightCount;
+  const float *positions;  // the primitive's, or blended morph targets
+  const float *normals;
+  size_t firstVertex;
+  size_t firstTriangle;
+} RasterDraw;
+
+// A transformed vertex. Triangles crossing the near plane are rare, so
+// they transform their vertices again rather than every vertex keeping its
+// clip coordinates.
+typedef struct {
+  // In front of the eye: x and y in pixels, snapped to RASTER_SUBPIXELS,
+  // window z and 1 / w.
+  float window[3];
+  float invW;
+  float normal[3];
+  uint32_t outside;  // frustum planes it is outside of
+} RasterVertex;
+
+// Edge functions E(x, y) = a x + b y + c, positive inside, and planes of
+// the window z and of the normal over w, in pixels from minx, miny.
+typedef struct {
+  float a[3], b[3], c[3];
+  bool topLeft[3];  // pixels on the edge are covered
+  float z[3];
+  float n[3][3];  // [component][plane coefficient]
+  int minx, miny, maxx, maxy;
+} RasterTriangle;
+
+typedef struct {
+  int width;
+  int height;
+  int pitch;  // pixels a row, whole tiles
+  JobSystem *jobs;  // NULL renders on the caller
+
+  std::vector<RasterPrimitive> primitives;
+  std::vector<int> meshStart;  // first primitive of each mesh, plus the total
+  std::vector<MorphPrimitive> morphs;
+  std::vector<SkinData> skins;
+  JointPalette palette;
+  std::vector<std::vector<Mat4>> gpuInstances;  // by node, empty without
+
+  std::vector<uint32_t> color;  // RGBA8, bottom row first
+  std::vector<float> depth;     // window z in [0, 1]
+
+  // Scratch of rasterFrame, kept to reuse its allocations.
+  std::vector<RasterDraw> drawList;
+  std::vector<std::vector<float>> morphPositions;  // by draw
+  std::vector<std::vector<float>> morphNormals;
+  std::vector<size_t> vertexStart;  // by draw, plus the total
+  std::vector<size_t> triangleStart;
+  std::vector<RasterVertex> vertices;
+  std::vector<std::vector<RasterTriangle>> setup;  // by chunk
+  std::vector<std::vector<uint32_t>> bins;  // [chunk * tiles + tile]
+
+  // Statistics of the last frame.
+  size_t draws;
+  size_t culled;  // draws outside the frustum
+  size_t triangles;  // set up after clipping
+  size_t binned;  // triangle and tile pairs
+} SoftwareRenderer;
+
+// Reads the geometry of every mesh of `model`, in parallel on `jobs`.
+void rasterInit(const tinygltf::Model &model, int width, int height,
+    JobSystem *jobs, SoftwareRenderer *renderer);
+
+// Clears to opaque black and draws the nodes of `scene` as placed by its
+// world matrices and morph weights.
+void rasterFrame(SoftwareRenderer *renderer, const tinygltf::Model &model,
+    const SceneState &scene, const Mat4 &viewProj);
@@ -0,0 +1,81 @@
+#include "render_queue.h"
+
+#include <algorithm>
+#include <cstring>
+
+int
+renderPass(const tinygltf::Model &model, int material)
+{
+  if (material < 0 || material >= (int)model.materials.size())
+    return RENDER_PASS_OPAQUE;
+  const std::string &mode = model.materials[material].alphaMode;
+  if (mode == "BLEND") return RENDER_PASS_BLEND;
+  if (mode == "MASK") return RENDER_PASS_MASK;
+  return RENDER_PASS_OPAQUE;
+}
+
+static inline uint64_t
+field(int value, int bits)
+{
+  uint64_t max = (1ull << bits) - 1;
+  return value < 0 ? 0 : std::min((uint64_t)value, max);
+}
+
+uint64_t
+renderSortKey(int pass, int program, int material, int geometry, float depth)
+{
+  // Positive floats compare like their bit patterns.
+  uint32_t bits;
+  depth = std::max(depth, 0.0f);
+  memcpy(&bits, &depth, sizeof(bits));
+  uint64_t d = (bits >> 7) & 0xffffff;
+
+  // The default material (-1) sorts first.
+  uint64_t state = field(program, 8) << 30 | field(material + 1, 14) << 16 |
+                   field(geometry, 16);
+  uint64_t key = field(pass, 2) << 62;
+  if (pass == RENDER_PASS_BLEND) return key | (0xffffff - d) << 38 | state;
+  return key | state << 24 | d;
+}
+
+void
+renderQueueSort(RenderQueue *queue)
+{
+  size_t count = queue->keys.size();
+  if (count < 2) return;
+
+  // One read of the keys builds the histograms of all eight digits.
+  uint32_t histograms[8][256];
+  memset(histograms, 0, sizeof(histograms));
+  for (uint64_t key : queue->keys)
+    for (int d = 0; d < 8; d++) histograms[d][(key >> (d * 8)) & 0xff]++;
+
+  queue->tempKeys.resize(count);
+  queue->tempItems.resize(count);
+  uint64_t *keys = queue->keys.data(), *tempKeys = queue->tempKeys.data();
+  uint32_t *items = queue->items.data(), *tempItems = queue->tempItems.data();
+  for (int d = 0; d < 8; d++) {
+    uint32_t *histogram = histograms[d];
+    int shift = d * 8;
+    if (histogram[(keys[0] >> shift) & 0xff] == count) continue;
+
+    uint32_t offset[256], sum = 0;
+    for (int b = 0; b < 256; b++) {
+      offset[b] = sum;
+      sum += histogram[b];
+    }
+    for (size_t i = 0; i < count; i++) {
+      uint32_t o = offset[(keys[i] >> shift) & 0xff]++;
+      tempKeys[o] = keys[i];
+      tempItems[o] = items[i];
+    }
+    std::swap(keys, tempKeys);
+    std::swap(items, tempItems);
+  }
+
+  // After an odd number of passes the result is in the temporaries.
+  if (keys != queue->keys.data()) {
+    queue->keys.swap(queue->tempKeys);
+    queue->items.swap(queue->tempItems);
+  }
+}
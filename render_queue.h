@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "tiny_gltf.h"
+
+// Draws of a frame, ordered by a 64-bit key so that submission changes as
+// little state as possible and draws opaque geometry front to back.
+//
+// Opaque and masked keys, from the most significant bit:
+//   pass (2) | program (8) | material (14) | geometry (16) | depth (24)
+// Blended keys sort back to front regardless of state:
+//   pass (2) | inverted depth (24) | program (8) | material (14) |
+//   geometry (16)
+// Fields wider than their bits are clamped; depth keeps the top 24 bits of
+// the float, which are monotonic for positive values.
+
+enum {
+  RENDER_PASS_OPAQUE,
+  RENDER_PASS_MASK,  // alpha tested, after opaque to keep early-z intact
+  RENDER_PASS_BLEND,
+};
+
+typedef struct {
+  std::vector<uint64_t> keys;
+  std::vector<uint32_t> items;  // caller-defined draw index, sorted with keys
+  std::vector<uint64_t> tempKeys;
+  std::vector<uint32_t> tempItems;
+} RenderQueue;
+
+// Render pass of a glTF material from its alphaMode. -1 is the default
+// material, which is opaque.
+int renderPass(const tinygltf::Model &model, int material);
+
+// `depth` is any distance from the eye that grows with depth, e.g. squared.
+uint64_t renderSortKey(
+    int pass, int program, int material, int geometry, float depth);
+
+inline int
+renderKeyPass(uint64_t key)
+{
+  return (int)(key >> 62);
+}
+
+inline void
+renderQueueClear(RenderQueue *queue)
+{
+  queue->keys.clear();
+  queue->items.clear();
+}
+
+inline void
+renderQueuePush(RenderQueue *queue, uint64_t key, uint32_t item)
+{
+  queue->keys.push_back(key);
+  queue->items.push_back(item);
+}
+
+// Stable LSD radix sort, 8 bits per pass. Passes over digits that are the
+// same for every key are skipped, which is most of them in a typical scene.
+void renderQueueSort(RenderQueue *queue);
@@ -0,0 +1,126 @@
+#include "scene.h"
+
+#include <algorithm>
+
+int
+displayedScene(const tinygltf::Model &model)
+{
+  return model.defaultScene > -1 ? model.defaultScene : 0;
+}
+
+void
+sceneInit(const tinygltf::Model &model, int sceneIndex, SceneState *scene)
+{
+  size_t count = model.nodes.size();
+  scene->order.clear();
+  scene->depthStart.clear();
+  scene->parent.assign(count, -1);
+  scene->translation.assign(count * 3, 0.0f);
+  scene->rotation.assign(count * 4, 0.0f);
+  scene->scale.assign(count * 3, 1.0f);
+  scene->useMatrix.assign(count, 0);
+  scene->matrix.assign(count, mat4Identity());
+  scene->weightOffset.assign(count, -1);
+  scene->weightCount.assign(count, 0);
+  scene->weights.clear();
+  scene->world.assign(count, mat4Identity());
+
+  for (size_t n = 0; n < count; n++) {
+    const tinygltf::Node &node = model.nodes[n];
+    scene->rotation[n * 4 + 3] = 1.0f;
+    if (node.matrix.size() == 16) {
+      scene->useMatrix[n] = 1;
+      scene->matrix[n] = nodeLocalMatrix(node);
+    }
+    if (node.translation.size() == 3)
+      for (int i = 0; i < 3; i++)
+        scene->translation[n * 3 + i] = (float)node.translation[i];
+    if (node.rotation.size() == 4)
+      for (int i = 0; i < 4; i++)
+        scene->rotation[n * 4 + i] = (float)node.rotation[i];
+    if (node.scale.size() == 3)
+      for (int i = 0; i < 3; i++)
+        scene->scale[n * 3 + i] = (float)node.scale[i];
+
+    // Node weights override the mesh defaults; both may be absent.
+    if (node.mesh < 0 || node.mesh >= (int)model.meshes.size()) continue;
+    const tinygltf::Mesh &mesh = model.meshes[node.mesh];
+    size_t targets = 0;
+    for (const auto &primitive : mesh.primitives)
+      targets = std::max(targets, primitive.targets.size());
+    if (targets == 0) continue;
+    scene->weightOffset[n] = (int)scene->weights.size();
+    scene->weightCount[n] = (int)targets;
+    for (size_t i = 0; i < targets; i++) {
+      double w = 0.0;
+      if (i < node.weights.size())
+        w = node.weights[i];
+      else if (i < mesh.weights.size())
+        w = mesh.weights[i];
+      scene->weights.push_back((float)w);
+    }
+  }
+
+  if (sceneIndex < 0 || sceneIndex >= (int)model.scenes.size()) return;
+
+  // Breadth-first, so every parent precedes its children and each depth is
+  // contiguous.
+  std::vector<unsigned char> visited(count, 0);
+  for (int root : model.scenes[sceneIndex].nodes) {
+    if (root < 0 || root >= (int)count || visited[root]) continue;
+    visited[root] = 1;
+    scene->order.push_back(root);
+  }
+  size_t depthEnd = 0;
+  for (size_t i = 0; i < scene->order.size(); i++) {
+    if (i == depthEnd) {
+      scene->depthStart.push_back(i);
+      depthEnd = scene->order.size();
+    }
+    int n = scene->order[i];
+    for (int child : model.nodes[n].children) {
+      if (child < 0 || child >= (int)count || visited[child]) continue;
+      visited[child] = 1;
+      scene->parent[child] = n;
+      scene->order.push_back(child);
+    }
+  }
+  scene->depthStart.push_back(scene->order.size());
+}
+
+static void
+updateWorldRange(SceneState *scene, size_t begin, size_t end)
+{
+  for (size_t i = begin; i < end; i++) {
+    int n = scene->order[i];
+    Mat4 local = scene->useMatrix[n]
+                     ? scene->matrix[n]
+                     : mat4FromTRS(&scene->translation[n * 3],
+                           &scene->rotation[n * 4], &scene->scale[n * 3]);
+    int p = scene->parent[n];
+    scene->world[n] = p < 0 ? local : mat4Mul(scene->world[p], local);
+  }
+}
+
+void
+sceneUpdateWorld(SceneState *scene, JobSystem *jobs)
+{
+  // Below this, a depth is cheaper to update than to split.
+  const size_t grain = 512;
+  for (size_t d = 0; d + 1 < scene->depthStart.size(); d++) {
+    size_t begin = scene->depthStart[d], end = scene->depthStart[d + 1];
+    jobParallelFor(jobs, end - begin, grain, [&](size_t b, size_t e) {
+      updateWorldRange(scene, begin + b, begin + e);
+    });
+  }
+}
+
+void
+computeWorldMatrices(
+    const tinygltf::Model &model, int sceneIndex, std::vector<Mat4> *world)
+{
+  SceneState scene;
+  sceneInit(model, sceneIndex, &scene);
+  sceneUpdateWorld(&scene);
+  *world = std::move(scene.world);
+}
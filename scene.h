@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include "jobs.h"
+#include "tiny_gltf.h"
+#include "transform.h"
+
+// Runtime node transforms of the displayed scene.
+//
+// Local transforms are kept as structure-of-arrays so animation can write
+// them directly, and world matrices are recomputed in one flat pass over the
+// nodes in parent-before-child order. Nodes of the same depth only depend on
+// the previous depth, so each depth is updated in parallel.
+typedef struct {
+  std::vector<int> order;   // reachable nodes, by depth
+  std::vector<size_t> depthStart;  // into `order`, plus its size
+  std::vector<int> parent;  // -1 for roots and unreachable nodes
+
+  std::vector<float> translation;  // 3 per node
+  std::vector<float> rotation;     // 4 per node, quaternion x, y, z, w
+  std::vector<float> scale;        // 3 per node
+  std::vector<unsigned char> useMatrix;  // node defined by `matrix`
+  std::vector<Mat4> matrix;
+
+  // Morph target weights of nodes whose mesh has targets.
+  std::vector<int> weightOffset;  // into `weights`, -1 without targets
+  std::vector<int> weightCount;
+  std::vector<float> weights;
+
+  std::vector<Mat4> world;
+} SceneState;
+
+// Scene index to display: the default scene, or the first one.
+int displayedScene(const tinygltf::Model &model);
+
+void sceneInit(
+    const tinygltf::Model &model, int sceneIndex, SceneState *scene);
+
+// Recomputes `world` from the local transforms.
+void sceneUpdateWorld(SceneState *scene, JobSystem *jobs = NULL);
+
+// World transforms of every node reachable from `sceneIndex`. Nodes outside
+// the scene keep the identity.
+void computeWorldMatrices(
+    const tinygltf::Model &model, int sceneIndex, std::vector<Mat4> *world);
@@ -1,7 +1,165 @@
-varying vec3 normal;
-varying vec2 texcoord;
+// The #version line and the #defines of the material permutation are
+// prepended by the viewer, see material.h.
+//
+// Metallic-roughness shading with a GGX specular term, lit by a light at the
+// eye and a constant ambient term.
+
+in vec3 position;
+in vec3 normal;
+#ifdef TEXCOORD
+in vec2 texcoord;
+#endif
+#ifdef VERTEX_COLOR
+in vec4 color;
+#endif
+
+// Same block as in shader.vert.
+layout(std140) uniform Camera {
+    mat4 u_view_proj;
+    vec4 u_eye;
+};
+
+// Factors of the material; its maps multiply them.
+layout(std140) uniform Material {
+    vec4  u_base_color;
+    vec4  u_emissive;
+    float u_metallic;
+    float u_roughness;
+    float u_alpha_cutoff;
+    float u_normal_scale;
+    float u_occlusion_strength;
+    vec4  u_map_rects[5];   // offset, scale in the atlas layer
+    vec4  u_map_layers[5];  // layer, wrap s, wrap t
+};
+
+#ifdef ATLAS
+// Maps are rectangles of texture array layers, see texture_atlas.h. The
+// wrap mode is applied here, and the gradients are those of the unwrapped
+// coordinates so that seams pick the same mip level.
+#define MAP sampler2DArray
+#define SAMPLE(map, slot) sampleAtlas(map, slot)
+
+float wrap(float c, float mode)
+{
+    if (mode == 0.0) return clamp(c, 0.0, 1.0);  // ATLAS_CLAMP
+    if (mode == 1.0) return fract(c);            // ATLAS_REPEAT
+    return 1.0 - abs(mod(c, 2.0) - 1.0);         // ATLAS_MIRROR
+}
+
+vec4 sampleAtlas(sampler2DArray map, int slot)
+{
+    vec4 rect = u_map_rects[slot];
+    vec4 layer = u_map_layers[slot];
+    vec2 uv = vec2(wrap(texcoord.x, layer.y), wrap(texcoord.y, layer.z));
+    return textureGrad(map, vec3(rect.xy + uv * rect.zw, layer.x),
+        dFdx(texcoord) * rect.zw, dFdy(texcoord) * rect.zw);
+}
+#else
+#define MAP sampler2D
+#define SAMPLE(map, slot) texture(map, texcoord)
+#endif
+
+// Base color and emissive maps are sRGB textures, decoded by the sampler.
+uniform MAP u_base_color_map;
+uniform MAP u_metallic_roughness_map;
+uniform MAP u_normal_map;
+uniform MAP u_occlusion_map;
+uniform MAP u_emissive_map;
+
+out vec4 fragColor;
+
+const float PI = 3.14159265;
+const float LIGHT = 3.0;     // radiance of the light at the eye
+const float AMBIENT = 0.15;
+
+#ifdef NORMAL_MAP
+// glTF tangents are optional, so the tangent frame is built from screen
+// space derivatives of the position and texture coordinates instead.
+vec3 mapNormal(vec3 n)
+{
+    vec3 dp1 = dFdx(position);
+    vec3 dp2 = dFdy(position);
+    vec2 duv1 = dFdx(texcoord);
+    vec2 duv2 = dFdy(texcoord);
+    vec3 dp2perp = cross(dp2, n);
+    vec3 dp1perp = cross(n, dp1);
+    vec3 t = dp2perp * duv1.x + dp1perp * duv2.x;
+    vec3 b = dp2perp * duv1.y + dp1perp * duv2.y;
+    float scale = inversesqrt(max(max(dot(t, t), dot(b, b)), 1e-20));
+    vec3 m = SAMPLE(u_normal_map, 2).xyz * 2.0 - 1.0;
+    m.xy *= u_normal_scale;
+    return normalize(mat3(t * scale, b * scale, n) * m);
+}
+#endif
 
 void main(void)
 {
-    gl_FragColor = vec4(0.5 * normalize(normal) + 0.5, 1.0);
+#ifdef NORMALS
+    // --normals: what the software renderer draws, to compare the two.
+    fragColor = vec4(0.5 * normalize(normal) + 0.5, 1.0);
+    return;
+#endif
+    vec4 base = u_base_color;
+#ifdef BASE_COLOR_MAP
+    base *= SAMPLE(u_base_color_map, 0);
+#endif
+#ifdef VERTEX_COLOR
+    base *= color;
+#endif
+#ifdef ALPHA_MASK
+    if (base.a < u_alpha_cutoff) discard;
+#endif
+
+    float metallic = u_metallic;
+    float roughness = u_roughness;
+#ifdef METALLIC_ROUGHNESS_MAP
+    vec4 mr = SAMPLE(u_metallic_roughness_map, 1);
+    roughness *= mr.g;
+    metallic *= mr.b;
+#endif
+    roughness = clamp(roughness, 0.04, 1.0);
+
+    vec3 n = normalize(normal);
+#ifdef DOUBLE_SIDED
+    if (!gl_FrontFacing) n = -n;
+#endif
+#ifdef NORMAL_MAP
+    n = mapNormal(n);
+#endif
+
+    // The light is at the eye, so l = h = v: n.h and n.l are n.v, and
+    // Fresnel at v.h = 1 is f0.
+    vec3 v = normalize(u_eye.xyz - position);
+    float NdotV = max(dot(n, v), 1e-4);
+    float a2 = roughness * roughness * roughness * roughness;
+    float d = NdotV * NdotV * (a2 - 1.0) + 1.0;
+    float D = a2 / (PI * d * d);
+    float k = (roughness + 1.0) * (roughness + 1.0) / 8.0;
+    float G = NdotV / (NdotV * (1.0 - k) + k);
+    G *= G;
+    vec3 f0 = mix(vec3(0.04), base.rgb, metallic);
+    vec3 diffuse = (1.0 - f0) * (1.0 - metallic) * base.rgb / PI;
+    vec3 specular = D * G * f0 / (4.0 * NdotV * NdotV);
+
+    float occlusion = 1.0;
+#ifdef OCCLUSION_MAP
+    occlusion = mix(1.0, SAMPLE(u_occlusion_map, 3).r,
+        u_occlusion_strength);
+#endif
+    vec3 ambient =
+        AMBIENT * occlusion * ((1.0 - metallic) * base.rgb + f0);
+    vec3 c = (diffuse + specular) * LIGHT * NdotV + ambient;
+
+    vec3 emissive = u_emissive.rgb;
+#ifdef EMISSIVE_MAP
+    emissive *= SAMPLE(u_emissive_map, 4).rgb;
+#endif
+    c += emissive;
+
+    c = pow(c, vec3(1.0 / 2.2));
+#ifdef ALPHA_BLEND
+    fragColor = vec4(c, base.a);
+#else
+    fragColor = vec4(c, 1.0);
+#endif
 }
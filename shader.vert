@@ -1,16 +1,98 @@
-attribute vec3    in_vertex;
-attribute vec3    in_normal;
-attribute vec2    in_texcoord;
+// The #version line and LOCATION() are prepended by the viewer: explicit
+// locations on core profiles, glBindAttribLocation with the same numbers
+// (ATTRIB_* in main.cc) on the compatibility profile. So are the #defines
+// of the material permutation, see material.h.
 
-varying vec3      normal;
-varying vec2      texcoord;
+LOCATION(0) in vec3   in_vertex;
+LOCATION(1) in vec3   in_normal;
+LOCATION(2) in vec2   in_texcoord;
+LOCATION(3) in vec4   in_joints;
+LOCATION(4) in vec4   in_weights;
+LOCATION(5) in mat4   in_model;          // 5 to 8
+LOCATION(9) in mat3   in_normal_matrix;  // 9 to 11
+LOCATION(12) in float in_palette;
+LOCATION(13) in vec4  in_color;
+
+// Both blocks are ranges of the per-frame stream buffer.
+layout(std140) uniform Camera {
+	mat4 u_view_proj;
+	vec4 u_eye;
+};
+
+// Joint matrices of all skins, four texels each. in_palette is the first
+// joint of the instance's skin, or negative for unskinned instances.
+uniform samplerBuffer u_joint_matrices;
+
+// Morph target deltas of all primitives. For each target, the primitive has
+// u_morph_vertices position texels then as many normal texels, starting at
+// u_morph_base. Only the u_morph_count targets with a non-zero weight are
+// listed, four per vector; 64 is MORPH_MAX_ACTIVE.
+uniform samplerBuffer u_morph_deltas;
+layout(std140) uniform Draw {
+	int   u_morph_count;
+	int   u_morph_base;
+	int   u_morph_vertices;
+	ivec4 u_morph_targets[16];
+	vec4  u_morph_weights[16];
+};
+
+out vec3 position;  // world space
+out vec3 normal;
+#ifdef TEXCOORD
+out vec2 texcoord;
+#endif
+#ifdef VERTEX_COLOR
+out vec4 color;
+#endif
+
+// The depth pre-pass runs this shader too, with depth.frag, and the shading
+// pass tests against its depth with GL_EQUAL. Nothing before gl_Position
+// may depend on the permutation's #defines.
+invariant gl_Position;
+
+mat4 jointMatrix(float joint)
+{
+	int base = (int(in_palette) + int(joint)) * 4;
+	return mat4(texelFetch(u_joint_matrices, base),
+		texelFetch(u_joint_matrices, base + 1),
+		texelFetch(u_joint_matrices, base + 2),
+		texelFetch(u_joint_matrices, base + 3));
+}
 
 void main(void)
 {
-	vec4 p = gl_ModelViewProjectionMatrix * vec4(in_vertex, 1);
+	vec3 v = in_vertex;
+	vec3 n = in_normal;
+	for (int i = 0; i < u_morph_count; i++) {
+		float weight = u_morph_weights[i / 4][i % 4];
+		int texel = u_morph_base +
+			2 * u_morph_targets[i / 4][i % 4] * u_morph_vertices + gl_VertexID;
+		v += weight * texelFetch(u_morph_deltas, texel).xyz;
+		n += weight * texelFetch(u_morph_deltas, texel + u_morph_vertices).xyz;
+	}
+
+	mat4 model = in_model;
+	mat3 normalMatrix = in_normal_matrix;
+	if (in_palette >= 0.0) {
+		mat4 skin = in_weights.x * jointMatrix(in_joints.x) +
+			in_weights.y * jointMatrix(in_joints.y) +
+			in_weights.z * jointMatrix(in_joints.z) +
+			in_weights.w * jointMatrix(in_joints.w);
+		model = model * skin;
+		// Joints are rigid or uniformly scaled in practice, and the normal
+		// is renormalized per fragment.
+		normalMatrix = normalMatrix * mat3(skin);
+	}
+
+	vec4 p = u_view_proj * model * vec4(v, 1);
 	gl_Position = p;
-	vec4 nn = gl_ModelViewMatrixInverseTranspose * vec4(normalize(in_normal), 0);
-	normal = nn.xyz;
+	position = (model * vec4(v, 1)).xyz;
+	normal = normalMatrix * normalize(n);
 
+#ifdef TEXCOORD
 	texcoord = in_texcoord;
+#endif
+#ifdef VERTEX_COLOR
+	color = in_color;
+#endif
 }
@@ -0,0 +1,126 @@
+#include "skinning.h"
+
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mesh_data.h"
+
+void
+buildSkins(const tinygltf::Model &model, std::vector<SkinData> *skins)
+{
+  skins->assign(model.skins.size(), SkinData());
+  for (size_t s = 0; s < model.skins.size(); s++) {
+    const tinygltf::Skin &skin = model.skins[s];
+    SkinData &data = (*skins)[s];
+    data.bounds = boundsEmpty();
+    for (int joint : skin.joints) {
+      if (joint < 0 || joint >= (int)model.nodes.size()) joint = -1;
+      data.joints.push_back(joint);
+    }
+
+    // Without inverseBindMatrices, every joint uses the identity.
+    data.inverseBind.assign(data.joints.size(), mat4Identity());
+    std::vector<float> values;
+    int components = 0;
+    if (skin.inverseBindMatrices >= 0 &&
+        readAccessorFloats(model, skin.inverseBindMatrices, &values,
+            &components) &&
+        components == 16) {
+      size_t count = std::min(data.joints.size(), values.size() / 16);
+      for (size_t j = 0; j < count; j++)
+        memcpy(data.inverseBind[j].m, &values[j * 16], sizeof(Mat4));
+    }
+  }
+
+  for (const tinygltf::Node &node : model.nodes) {
+    if (node.skin < 0 || node.skin >= (int)skins->size() || node.mesh < 0 ||
+        node.mesh >= (int)model.meshes.size())
+      continue;
+    Bounds b = meshBounds(model, model.meshes[node.mesh]);
+    if (!boundsValid(b)) continue;
+    boundsExtend((*skins)[node.skin].bounds, b.min);
+    boundsExtend((*skins)[node.skin].bounds, b.max);
+  }
+}
+
+// out = a * b, for a whole skin at a time.
+static inline void
+mulJoint(const Mat4 &a, const Mat4 &b, float *out)
+{
+#ifdef __SSE2__
+  __m128 c0 = _mm_loadu_ps(&a.m[0]), c1 = _mm_loadu_ps(&a.m[4]);
+  __m128 c2 = _mm_loadu_ps(&a.m[8]), c3 = _mm_loadu_ps(&a.m[12]);
+  for (int c = 0; c < 4; c++) {
+    const float *col = &b.m[c * 4];
+    __m128 r = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(col[0])),
+            _mm_mul_ps(c1, _mm_set1_ps(col[1]))),
+        _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(col[2])),
+            _mm_mul_ps(c3, _mm_set1_ps(col[3]))));
+    _mm_storeu_ps(out + c * 4, r);
+  }
+#else
+  Mat4 r = mat4Mul(a, b);
+  memcpy(out, r.m, sizeof(r.m));
+#endif
+}
+
+static void
+updateSkin(const SkinData &skin, const std::vector<Mat4> &world, float *out,
+    Bounds *result)
+{
+  const Mat4 identity = mat4Identity();
+  const Bounds &bind = skin.bounds;
+  float center[3], extent[3];
+  for (int i = 0; i < 3; i++) {
+    center[i] = 0.5f * (bind.min[i] + bind.max[i]);
+    extent[i] = 0.5f * (bind.max[i] - bind.min[i]);
+  }
+
+  // A skinned vertex is a convex combination of the vertex transformed by
+  // its joints, so the union of the bind bounds under every joint matrix
+  // contains the deformed mesh.
+  Bounds bounds = boundsEmpty();
+  for (size_t j = 0; j < skin.joints.size(); j++, out += 16) {
+    int node = skin.joints[j];
+    const Mat4 &joint =
+        node >= 0 && node < (int)world.size() ? world[node] : identity;
+    mulJoint(joint, skin.inverseBind[j], out);
+    if (!boundsValid(bind)) continue;
+
+    for (int row = 0; row < 3; row++) {
+      float c = out[12 + row], e = 0.0f;
+      for (int k = 0; k < 3; k++) {
+        c += out[k * 4 + row] * center[k];
+        e += fabsf(out[k * 4 + row]) * extent[k];
+      }
+      bounds.min[row] = fminf(bounds.min[row], c - e);
+      bounds.max[row] = fmaxf(bounds.max[row], c + e);
+    }
+  }
+  *result = bounds;
+}
+
+void
+updateJointPalette(const std::vector<SkinData> &skins,
+    const std::vector<Mat4> &world, JointPalette *palette, JobSystem *jobs)
+{
+  size_t joints = 0;
+  palette->offset.resize(skins.size());
+  palette->bounds.resize(skins.size());
+  for (size_t s = 0; s < skins.size(); s++) {
+    palette->offset[s] = (int)joints;
+    joints += skins[s].joints.size();
+  }
+  palette->matrices.resize(joints * 16);
+
+  jobParallelFor(jobs, skins.size(), 16, [&](size_t begin, size_t end) {
+    for (size_t s = begin; s < end; s++) {
+      updateSkin(skins[s], world, &palette->matrices[palette->offset[s] * 16],
+          &palette->bounds[s]);
+    }
+  });
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "jobs.h"
+#include "tiny_gltf.h"
+#include "transform.h"
+
+typedef struct {
+  std::vector<int> joints;
+  std::vector<Mat4> inverseBind;
+  Bounds bounds;  // of the meshes bound to the skin, in bind space
+} SkinData;
+
+// Joint matrices of every skin for one frame, back to back so they are
+// uploaded with a single call. A joint matrix takes a bind-space vertex to
+// world space, so skinned meshes ignore the transform of their node.
+typedef struct {
+  std::vector<float> matrices;  // 16 floats per joint, column-major
+  std::vector<int> offset;      // first joint of each skin
+  std::vector<Bounds> bounds;   // world bounds of each skin
+} JointPalette;
+
+void buildSkins(const tinygltf::Model &model, std::vector<SkinData> *skins);
+
+// Recomputes the palette from the world matrices of the nodes, skins in
+// parallel on `jobs`.
+void updateJointPalette(const std::vector<SkinData> &skins,
+    const std::vector<Mat4> &world, JointPalette *palette,
+    JobSystem *jobs = NULL);
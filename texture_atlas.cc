@@ -0,0 +1,149 @@
+#include "texture_atlas.h"
+
+#include <algorithm>
+#include <cstring>
+
+static int
+wrapMode(int wrap)
+{
+  if (wrap == TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE) return ATLAS_CLAMP;
+  if (wrap == TINYGLTF_TEXTURE_WRAP_MIRRORED_REPEAT) return ATLAS_MIRROR;
+  return ATLAS_REPEAT;
+}
+
+// Texel of an image `size` texels wide that `c`, possibly outside of it,
+// samples with `mode`.
+static int
+wrapTexel(int c, int size, int mode)
+{
+  if (mode == ATLAS_CLAMP) return std::min(std::max(c, 0), size - 1);
+  if (mode == ATLAS_REPEAT) return (c % size + size) % size;
+  int period = 2 * size;
+  int m = (c % period + period) % period;
+  return m < size ? m : period - 1 - m;
+}
+
+// Image size with its border, on the ATLAS_BORDER grid.
+static int
+cellSize(int size)
+{
+  return (size + 3 * ATLAS_BORDER - 1) / ATLAS_BORDER * ATLAS_BORDER;
+}
+
+bool
+atlasCandidate(const tinygltf::Model &model, int texture)
+{
+  if (texture < 0 || texture >= (int)model.textures.size()) return false;
+  const tinygltf::Texture &t = model.textures[texture];
+  if (t.source < 0 || t.source >= (int)model.images.size()) return false;
+  const tinygltf::Image &image = model.images[t.source];
+  if (image.component != 4 || image.bits != 8 || image.width <= 0 ||
+      image.height <= 0 || image.width > ATLAS_MAX_IMAGE ||
+      image.height > ATLAS_MAX_IMAGE ||
+      image.image.size() < (size_t)image.width * image.height * 4)
+    return false;
+  if (t.sampler < 0 || t.sampler >= (int)model.samplers.size()) return true;
+  const tinygltf::Sampler &sampler = model.samplers[t.sampler];
+  bool minLinear = sampler.minFilter <= 0 ||
+                   sampler.minFilter ==
+                       TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR ||
+                   sampler.minFilter ==
+                       TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_NEAREST;
+  bool magLinear = sampler.magFilter <= 0 ||
+                   sampler.magFilter == TINYGLTF_TEXTURE_FILTER_LINEAR;
+  return minLinear && magLinear;
+}
+
+// Shelf packing of `entries`, sorted by decreasing height, into layers of
+// `size`. Returns the number of layers.
+static int
+pack(std::vector<AtlasEntry> &entries, int size)
+{
+  int layer = 0, x = 0, y = 0, shelf = 0;
+  for (AtlasEntry &entry : entries) {
+    int w = cellSize(entry.width), h = cellSize(entry.height);
+    if (x + w > size) {
+      x = 0;
+      y += shelf;
+      shelf = 0;
+    }
+    if (y + h > size) {
+      layer++;
+      x = y = shelf = 0;
+    }
+    entry.layer = layer;
+    entry.x = x + ATLAS_BORDER;
+    entry.y = y + ATLAS_BORDER;
+    x += w;
+    shelf = std::max(shelf, h);
+  }
+  return layer + 1;
+}
+
+void
+buildAtlas(const tinygltf::Model &model, const std::vector<int> &textures,
+    int maxSize, TextureAtlas *atlas)
+{
+  atlas->entries.clear();
+  atlas->pixels.clear();
+  atlas->layers = 0;
+  atlas->size = 0;
+  if (textures.empty()) return;
+
+  for (int texture : textures) {
+    const tinygltf::Texture &t = model.textures[texture];
+    const tinygltf::Image &image = model.images[t.source];
+    AtlasEntry entry = {texture, 0, 0, 0, image.width, image.height,
+        ATLAS_REPEAT, ATLAS_REPEAT};
+    if (t.sampler >= 0 && t.sampler < (int)model.samplers.size()) {
+      entry.wrapS = wrapMode(model.samplers[t.sampler].wrapS);
+      entry.wrapT = wrapMode(model.samplers[t.sampler].wrapT);
+    }
+    atlas->entries.push_back(entry);
+  }
+  std::sort(atlas->entries.begin(), atlas->entries.end(),
+      [](const AtlasEntry &a, const AtlasEntry &b) {
+        if (a.height != b.height) return a.height > b.height;
+        return a.width > b.width;
+      });
+
+  int largest = 0;
+  for (const AtlasEntry &entry : atlas->entries)
+    largest = std::max(largest,
+        std::max(cellSize(entry.width), cellSize(entry.height)));
+  int size = 1 << (32 - __builtin_clz(largest - 1));
+  while (size < maxSize && pack(atlas->entries, size) > 1) size *= 2;
+  size = std::min(size, maxSize);
+  atlas->size = size;
+  atlas->layers = pack(atlas->entries, size);
+
+  atlas->pixels.assign((size_t)atlas->layers * size * size * 4, 0);
+  for (const AtlasEntry &entry : atlas->entries) {
+    const tinygltf::Texture &t = model.textures[entry.texture];
+    const unsigned char *src = model.images[t.source].image.data();
+    unsigned char *layer =
+        atlas->pixels.data() + (size_t)entry.layer * size * size * 4;
+    // The border runs to the edge of the cell, past ATLAS_BORDER when the
+    // image is not a multiple of it, so that no mip level averages in the
+    // zeros left there.
+    int right = cellSize(entry.width) - ATLAS_BORDER;
+    int top = cellSize(entry.height) - ATLAS_BORDER;
+    for (int y = -ATLAS_BORDER; y < top; y++) {
+      int sy = wrapTexel(y, entry.height, entry.wrapT);
+      unsigned char *row =
+          layer + ((size_t)(entry.y + y) * size + entry.x) * 4;
+      for (int x = -ATLAS_BORDER; x < right; x++) {
+        int sx = wrapTexel(x, entry.width, entry.wrapS);
+        memcpy(row + x * 4, src + ((size_t)sy * entry.width + sx) * 4, 4);
+      }
+    }
+  }
+}
+
+const AtlasEntry *
+atlasEntry(const TextureAtlas &atlas, int texture)
+{
+  for (const AtlasEntry &entry : atlas.entries)
+    if (entry.texture == texture) return &entry;
+  return nullptr;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "tiny_gltf.h"
+
+// Packing of small textures into the layers of a texture array, so that
+// materials using them all bind the same texture.
+//
+// Each image is surrounded by ATLAS_BORDER texels continuing it the way its
+// sampler wraps, and placed on a grid of ATLAS_BORDER texels, so filtering
+// down to mip level ATLAS_MIP_LEVELS never reads a neighbour. Shaders apply
+// the wrap mode themselves and sample the image's rectangle of its layer.
+
+#define ATLAS_MAX_IMAGE 256  // larger images keep their own texture
+#define ATLAS_MAX_SIZE 2048  // texels a side of a layer
+#define ATLAS_BORDER 8
+#define ATLAS_MIP_LEVELS 3  // 1 << ATLAS_MIP_LEVELS == ATLAS_BORDER
+
+// Wrap modes, as the shaders read them.
+#define ATLAS_CLAMP 0
+#define ATLAS_REPEAT 1
+#define ATLAS_MIRROR 2
+
+typedef struct {
+  int texture;  // glTF texture
+  int layer;
+  int x, y;  // of the image, inside its border
+  int width, height;
+  int wrapS, wrapT;  // ATLAS_*
+} AtlasEntry;
+
+typedef struct {
+  int size;  // width and height of every layer
+  int layers;
+  std::vector<AtlasEntry> entries;
+  std::vector<unsigned char> pixels;  // RGBA8, one layer after the other
+} TextureAtlas;
+
+// Whether `texture` may be packed: a decoded 8-bit RGBA image of at most
+// ATLAS_MAX_IMAGE texels a side, sampled with linear mipmapped filtering.
+bool atlasCandidate(const tinygltf::Model &model, int texture);
+
+// Packs the images of `textures`, candidates all, into the smallest single
+// layer of at most `maxSize` texels a side, or into as many layers of
+// `maxSize` as they need.
+void buildAtlas(const tinygltf::Model &model, const std::vector<int> &textures,
+    int maxSize, TextureAtlas *atlas);
+
+// Entry of `texture`, null when it is not packed.
+const AtlasEntry *atlasEntry(const TextureAtlas &atlas, int texture);
@@ -0,0 +1,412 @@
+// Writes synthetic glTF scenes of a chosen size, for load and render
+// scaling tests.
+//
+//   gltf-gen <out.gltf|out.glb> [--nodes N] [--depth D] [--share R]
+//            [--vertices V] [--textures T] [--texture-size S]
+//            [--tracks K] [--keys F] [--seed S] [--embed]
+//
+// The nodes form a tree at most D levels deep; every node draws a mesh, and
+// a fraction R of them reuse a mesh drawn by an earlier node. Meshes are
+// bumpy UV spheres of about V vertices, textured with one of T generated
+// images. K animation tracks of F keys move or turn the first K nodes.
+// The same arguments always give the same file.
+//
+// Geometry is split into buffers of at most 1 GiB. A .glb keeps the first
+// one in its BIN chunk and the rest in .bin files next to it, so files of
+// many GiB can be written either way. The scene is built in memory and then
+// streamed out by writeGltf, which adds no copy of the buffers.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gltf_writer.h"
+
+#define BUFFER_LIMIT (1u << 30)
+
+typedef struct {
+  int nodes;
+  int depth;
+  double share;
+  int vertices;
+  int textures;
+  int textureSize;
+  int tracks;
+  int keys;
+  unsigned seed;
+  bool embed;
+} GenOptions;
+
+// Appends `bytes` to the current buffer as a new buffer view, starting a new
+// buffer when the current one is full.
+static int
+addBufferView(tinygltf::Model *model, const void *data, size_t bytes,
+    int target)
+{
+  if (model->buffers.empty() ||
+      model->buffers.back().data.size() + bytes > BUFFER_LIMIT) {
+    // Only touched pages are committed, and growing never copies.
+    model->buffers.emplace_back();
+    model->buffers.back().data.reserve(std::max<size_t>(BUFFER_LIMIT, bytes));
+  }
+  std::vector<unsigned char> &buffer = model->buffers.back().data;
+
+  tinygltf::BufferView view;
+  view.buffer = (int)model->buffers.size() - 1;
+  view.byteOffset = buffer.size();
+  view.byteLength = bytes;
+  view.target = target;
+  buffer.insert(buffer.end(), (const unsigned char *)data,
+      (const unsigned char *)data + bytes);
+  buffer.resize((buffer.size() + 3) & ~size_t(3));  // keep views aligned
+
+  model->bufferViews.push_back(view);
+  return (int)model->bufferViews.size() - 1;
+}
+
+static int
+addAccessor(tinygltf::Model *model, const void *data, size_t count,
+    int componentType, int type, int target)
+{
+  size_t size = tinygltf::GetComponentSizeInBytes(componentType) *
+                tinygltf::GetNumComponentsInType(type);
+  tinygltf::Accessor accessor;
+  accessor.bufferView = addBufferView(model, data, count * size, target);
+  accessor.componentType = componentType;
+  accessor.type = type;
+  accessor.count = count;
+  model->accessors.push_back(accessor);
+  return (int)model->accessors.size() - 1;
+}
+
+// Positions need their bounds.
+static int
+addPositions(tinygltf::Model *model, const std::vector<float> &positions)
+{
+  int accessor = addAccessor(model, positions.data(), positions.size() / 3,
+      TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3,
+      TINYGLTF_TARGET_ARRAY_BUFFER);
+  std::vector<double> &min = model->accessors[accessor].minValues;
+  std::vector<double> &max = model->accessors[accessor].maxValues;
+  min.assign(3, INFINITY);
+  max.assign(3, -INFINITY);
+  for (size_t i = 0; i < positions.size(); i++) {
+    min[i % 3] = std::min(min[i % 3], (double)positions[i]);
+    max[i % 3] = std::max(max[i % 3], (double)positions[i]);
+  }
+  return accessor;
+}
+
+// A UV sphere of (rings + 1) * (2 * rings + 1) vertices, about `vertices`,
+// with a random radius and surface ripple.
+static void
+addMesh(tinygltf::Model *model, int vertices, int material, std::mt19937 &rng)
+{
+  int rings = 2;
+  while ((rings + 1) * (2 * rings + 1) < vertices) rings++;
+  int segments = 2 * rings;
+
+  std::uniform_real_distribution<float> radius(0.2f, 0.5f), ripple(0.0f, 0.1f);
+  std::uniform_int_distribution<int> frequency(2, 12);
+  float r = radius(rng), amplitude = ripple(rng);
+  int f = frequency(rng);
+
+  std::vector<float> positions, normals, texcoords;
+  for (int i = 0; i <= rings; i++) {
+    float v = (float)i / rings, theta = v * (float)M_PI;
+    for (int j = 0; j <= segments; j++) {
+      float u = (float)j / segments, phi = u * 2.0f * (float)M_PI;
+      float n[3] = {sinf(theta) * cosf(phi), cosf(theta),
+          sinf(theta) * sinf(phi)};
+      float d = r * (1.0f + amplitude * sinf(f * theta) * sinf(f * phi));
+      for (int k = 0; k < 3; k++) {
+        positions.push_back(n[k] * d);
+        normals.push_back(n[k]);
+      }
+      texcoords.push_back(u);
+      texcoords.push_back(v);
+    }
+  }
+
+  std::vector<uint32_t> indices;
+  for (int i = 0; i < rings; i++) {
+    for (int j = 0; j < segments; j++) {
+      uint32_t a = i * (segments + 1) + j, b = a + segments + 1;
+      uint32_t quad[6] = {a, b, a + 1, a + 1, b, b + 1};
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+
+  tinygltf::Primitive primitive;
+  primitive.mode = TINYGLTF_MODE_TRIANGLES;
+  primitive.material = material;
+  primitive.attributes["POSITION"] = addPositions(model, positions);
+  primitive.attributes["NORMAL"] = addAccessor(model, normals.data(),
+      normals.size() / 3, TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3,
+      TINYGLTF_TARGET_ARRAY_BUFFER);
+  primitive.attributes["TEXCOORD_0"] = addAccessor(model, texcoords.data(),
+      texcoords.size() / 2, TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC2,
+      TINYGLTF_TARGET_ARRAY_BUFFER);
+  if (positions.size() / 3 <= 65536) {
+    std::vector<uint16_t> narrow(indices.begin(), indices.end());
+    primitive.indices = addAccessor(model, narrow.data(), narrow.size(),
+        TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, TINYGLTF_TYPE_SCALAR,
+        TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+  } else {
+    primitive.indices = addAccessor(model, indices.data(), indices.size(),
+        TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT, TINYGLTF_TYPE_SCALAR,
+        TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+  }
+
+  tinygltf::Mesh mesh;
+  mesh.name = "mesh" + std::to_string(model->meshes.size());
+  mesh.primitives.push_back(primitive);
+  model->meshes.push_back(mesh);
+}
+
+// A checkerboard in two random colors, written out as PNG.
+static void
+addTexture(tinygltf::Model *model, int size, std::mt19937 &rng)
+{
+  unsigned char colors[2][4];
+  for (int c = 0; c < 2; c++) {
+    for (int k = 0; k < 3; k++) colors[c][k] = (unsigned char)rng();
+    colors[c][3] = 255;
+  }
+
+  tinygltf::Image image;
+  image.name = "texture" + std::to_string(model->images.size());
+  image.mimeType = "image/png";
+  image.width = image.height = size;
+  image.component = 4;
+  image.bits = 8;
+  image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+  image.image.resize((size_t)size * size * 4);
+  int cell = std::max(size / 8, 1);
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      const unsigned char *color = colors[(x / cell + y / cell) & 1];
+      memcpy(&image.image[((size_t)y * size + x) * 4], color, 4);
+    }
+  }
+  model->images.push_back(image);
+
+  tinygltf::Texture texture;
+  texture.source = (int)model->images.size() - 1;
+  model->textures.push_back(texture);
+
+  tinygltf::Material material;
+  material.name = "material" + std::to_string(model->materials.size());
+  material.pbrMetallicRoughness.baseColorTexture.index = texture.source;
+  material.pbrMetallicRoughness.metallicFactor = 0.0;
+  model->materials.push_back(material);
+}
+
+static int
+meshCount(const GenOptions &options)
+{
+  return std::max(1, (int)std::lround(options.nodes * (1.0 - options.share)));
+}
+
+// Branching factor of the smallest tree of `depth` levels holding `count`
+// nodes.
+static int
+branching(int count, int depth)
+{
+  if (depth <= 1) return 0;  // every node is a root
+  for (int b = 1;; b++) {
+    double total = 0.0, level = 1.0;
+    for (int d = 0; d < depth; d++, level *= b) total += level;
+    if (total >= count) return b;
+  }
+}
+
+static void
+addNodes(tinygltf::Model *model, const GenOptions &options, std::mt19937 &rng)
+{
+  int b = branching(options.nodes, options.depth);
+  int meshes = meshCount(options);
+  std::uniform_real_distribution<double> offset(-1.0, 1.0);
+  std::uniform_real_distribution<double> angle(0.0, 2.0 * M_PI);
+
+  // Nodes are numbered breadth first, so a node's parent is (i - 1) / b and
+  // its spread shrinks with its level.
+  std::vector<int> level(options.nodes, 0);
+  tinygltf::Scene scene;
+  model->nodes.resize(options.nodes);
+  for (int i = 0; i < options.nodes; i++) {
+    tinygltf::Node &node = model->nodes[i];
+    node.name = "node" + std::to_string(i);
+    node.mesh = i % meshes;
+    if (b == 0 || i == 0) {
+      scene.nodes.push_back(i);
+    } else {
+      int parent = (i - 1) / b;
+      level[i] = level[parent] + 1;
+      model->nodes[parent].children.push_back(i);
+    }
+
+    double spread = b == 0 ? std::cbrt((double)options.nodes)
+                           : 2.0 * std::pow((double)b, -level[i] / 2.0) *
+                                 std::cbrt((double)options.nodes);
+    if (i > 0 || b == 0)
+      node.translation = {offset(rng) * spread, offset(rng) * spread,
+          offset(rng) * spread};
+    double a = angle(rng);
+    node.rotation = {0.0, sin(a / 2.0), 0.0, cos(a / 2.0)};
+  }
+  model->scenes.push_back(scene);
+  model->defaultScene = 0;
+}
+
+// Tracks alternate between translation and rotation, all sharing one time
+// accessor.
+static void
+addAnimation(tinygltf::Model *model, const GenOptions &options,
+    std::mt19937 &rng)
+{
+  int keys = std::max(options.keys, 2);
+  std::vector<float> times(keys);
+  for (int k = 0; k < keys; k++) times[k] = k / 30.0f;
+  int input = addAccessor(model, times.data(), times.size(),
+      TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_SCALAR, 0);
+  model->accessors[input].minValues = {0.0};
+  model->accessors[input].maxValues = {times.back()};
+
+  std::uniform_real_distribution<float> step(-0.1f, 0.1f);
+  tinygltf::Animation animation;
+  animation.name = "tracks";
+  for (int t = 0; t < options.tracks; t++) {
+    bool rotation = t & 1;
+    const tinygltf::Node &node = model->nodes[t % options.nodes];
+    std::vector<float> values;
+    if (rotation) {
+      float a = 0.0f, speed = step(rng);
+      for (int k = 0; k < keys; k++, a += speed) {
+        float q[4] = {0.0f, sinf(a), 0.0f, cosf(a)};
+        values.insert(values.end(), q, q + 4);
+      }
+    } else {
+      float p[3] = {0.0f, 0.0f, 0.0f};
+      for (size_t c = 0; c < node.translation.size(); c++)
+        p[c] = (float)node.translation[c];
+      for (int k = 0; k < keys; k++) {
+        for (int c = 0; c < 3; c++) p[c] += step(rng);
+        values.insert(values.end(), p, p + 3);
+      }
+    }
+
+    tinygltf::AnimationSampler sampler;
+    sampler.input = input;
+    sampler.output = addAccessor(model, values.data(), keys,
+        TINYGLTF_COMPONENT_TYPE_FLOAT,
+        rotation ? TINYGLTF_TYPE_VEC4 : TINYGLTF_TYPE_VEC3, 0);
+    sampler.interpolation = "LINEAR";
+    animation.samplers.push_back(sampler);
+
+    tinygltf::AnimationChannel channel;
+    channel.sampler = (int)animation.samplers.size() - 1;
+    channel.target_node = t % options.nodes;
+    channel.target_path = rotation ? "rotation" : "translation";
+    animation.channels.push_back(channel);
+  }
+  model->animations.push_back(animation);
+}
+
+static void
+generate(tinygltf::Model *model, const GenOptions &options)
+{
+  model->asset.version = "2.0";
+  model->asset.generator = "gltf-gen";
+
+  // Each part draws from its own stream, so changing one option leaves the
+  // others' output alone.
+  std::mt19937 textureRng(options.seed), meshRng(options.seed + 1);
+  std::mt19937 nodeRng(options.seed + 2), animationRng(options.seed + 3);
+
+  for (int t = 0; t < options.textures; t++)
+    addTexture(model, options.textureSize, textureRng);
+  int meshes = meshCount(options);
+  for (int m = 0; m < meshes; m++)
+    addMesh(model, options.vertices,
+        options.textures > 0 ? m % options.textures : -1, meshRng);
+  addNodes(model, options, nodeRng);
+  if (options.tracks > 0) addAnimation(model, options, animationRng);
+}
+
+static void
+usage()
+{
+  fprintf(stderr,
+      "usage: gltf-gen <out.gltf|out.glb> [--nodes N] [--depth D] "
+      "[--share R]\n"
+      "                [--vertices V] [--textures T] [--texture-size S]\n"
+      "                [--tracks K] [--keys F] [--seed S] [--embed]\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  GenOptions options = {1000, 4, 0.9, 2000, 4, 256, 0, 60, 1, false};
+  std::string output;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    bool value = i + 1 < argc;
+    if (arg == "--nodes" && value)
+      options.nodes = atoi(argv[++i]);
+    else if (arg == "--depth" && value)
+      options.depth = atoi(argv[++i]);
+    else if (arg == "--share" && value)
+      options.share = atof(argv[++i]);
+    else if (arg == "--vertices" && value)
+      options.vertices = atoi(argv[++i]);
+    else if (arg == "--textures" && value)
+      options.textures = atoi(argv[++i]);
+    else if (arg == "--texture-size" && value)
+      options.textureSize = atoi(argv[++i]);
+    else if (arg == "--tracks" && value)
+      options.tracks = atoi(argv[++i]);
+    else if (arg == "--keys" && value)
+      options.keys = atoi(argv[++i]);
+    else if (arg == "--seed" && value)
+      options.seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--embed")
+      options.embed = true;
+    else if (arg[0] != '-' && output.empty())
+      output = arg;
+    else {
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (output.empty() || options.nodes < 1 || options.share < 0.0 ||
+      options.share >= 1.0 || options.textureSize < 1) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  tinygltf::Model model;
+  generate(&model, options);
+  size_t bytes = 0;
+  for (const tinygltf::Buffer &buffer : model.buffers)
+    bytes += buffer.data.size();
+  printf("%zu nodes, %zu meshes, %zu textures, %zu tracks, %.1f MiB of "
+         "buffers\n",
+      model.nodes.size(), model.meshes.size(), model.textures.size(),
+      model.animations.empty() ? 0 : model.animations[0].channels.size(),
+      bytes / 1048576.0);
+
+  bool binary = output.size() > 4 &&
+                output.compare(output.size() - 4, 4, ".glb") == 0;
+  std::string err;
+  if (!writeGltf(model, output, options.embed, options.embed, binary, &err)) {
+    fprintf(stderr, "%s\n", err.c_str());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
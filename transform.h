@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+
+#include "tiny_gltf.h"
+
+// Column-major 4x4 matrix, laid out like OpenGL expects (m[col * 4 + row]).
+typedef struct {
+  float m[16];
+} Mat4;
+
+typedef struct {
+  float min[3];
+  float max[3];
+} Bounds;
+
+inline Mat4
+mat4Identity()
+{
+  Mat4 r;
+  memset(r.m, 0, sizeof(r.m));
+  r.m[0] = r.m[5] = r.m[10] = r.m[15] = 1.0f;
+  return r;
+}
+
+inline Mat4
+mat4Mul(const Mat4 &a, const Mat4 &b)
+{
+  Mat4 r;
+  for (int c = 0; c < 4; c++) {
+    for (int row = 0; row < 4; row++) {
+      r.m[c * 4 + row] = a.m[0 * 4 + row] * b.m[c * 4 + 0] +
+                         a.m[1 * 4 + row] * b.m[c * 4 + 1] +
+                         a.m[2 * 4 + row] * b.m[c * 4 + 2] +
+                         a.m[3 * 4 + row] * b.m[c * 4 + 3];
+    }
+  }
+  return r;
+}
+
+// Builds T * R * S from a translation, unit quaternion (x, y, z, w) and scale.
+inline Mat4
+mat4FromTRS(const float t[3], const float q[4], const float s[3])
+{
+  float x = q[0], y = q[1], z = q[2], w = q[3];
+  Mat4 r;
+  r.m[0] = (1 - 2 * (y * y + z * z)) * s[0];
+  r.m[1] = (2 * (x * y + z * w)) * s[0];
+  r.m[2] = (2 * (x * z - y * w)) * s[0];
+  r.m[3] = 0;
+  r.m[4] = (2 * (x * y - z * w)) * s[1];
+  r.m[5] = (1 - 2 * (x * x + z * z)) * s[1];
+  r.m[6] = (2 * (y * z + x * w)) * s[1];
+  r.m[7] = 0;
+  r.m[8] = (2 * (x * z + y * w)) * s[2];
+  r.m[9] = (2 * (y * z - x * w)) * s[2];
+  r.m[10] = (1 - 2 * (x * x + y * y)) * s[2];
+  r.m[11] = 0;
+  r.m[12] = t[0];
+  r.m[13] = t[1];
+  r.m[14] = t[2];
+  r.m[15] = 1;
+  return r;
+}
+
+// Local transform of a node, either its matrix or its TRS properties.
+inline Mat4
+nodeLocalMatrix(const tinygltf::Node &node)
+{
+  if (node.matrix.size() == 16) {
+    Mat4 r;
+    for (int i = 0; i < 16; i++) r.m[i] = (float)node.matrix[i];
+    return r;
+  }
+
+  float t[3] = {0, 0, 0}, q[4] = {0, 0, 0, 1}, s[3] = {1, 1, 1};
+  if (node.translation.size() == 3)
+    for (int i = 0; i < 3; i++) t[i] = (float)node.translation[i];
+  if (node.rotation.size() == 4)
+    for (int i = 0; i < 4; i++) q[i] = (float)node.rotation[i];
+  if (node.scale.size() == 3)
+    for (int i = 0; i < 3; i++) s[i] = (float)node.scale[i];
+  return mat4FromTRS(t, q, s);
+}
+
+// Same as gluLookAt.
+inline Mat4
+mat4LookAt(const float eye[3], const float center[3], const float up[3])
+{
+  float f[3] = {center[0] - eye[0], center[1] - eye[1], center[2] - eye[2]};
+  float fl = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+  for (int i = 0; i < 3; i++) f[i] /= fl;
+  float s[3] = {f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2],
+      f[0] * up[1] - f[1] * up[0]};
+  float sl = sqrtf(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+  for (int i = 0; i < 3; i++) s[i] /= sl;
+  float u[3] = {s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2],
+      s[0] * f[1] - s[1] * f[0]};
+
+  Mat4 r = mat4Identity();
+  r.m[0] = s[0];
+  r.m[4] = s[1];
+  r.m[8] = s[2];
+  r.m[1] = u[0];
+  r.m[5] = u[1];
+  r.m[9] = u[2];
+  r.m[2] = -f[0];
+  r.m[6] = -f[1];
+  r.m[10] = -f[2];
+  r.m[12] = -(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]);
+  r.m[13] = -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]);
+  r.m[14] = f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2];
+  return r;
+}
+
+// Same as gluPerspective, fovy in degrees.
+inline Mat4
+mat4Perspective(float fovy, float aspect, float zNear, float zFar)
+{
+  float f = 1.0f / tanf(fovy * (float)M_PI / 360.0f);
+  Mat4 r;
+  memset(r.m, 0, sizeof(r.m));
+  r.m[0] = f / aspect;
+  r.m[5] = f;
+  r.m[10] = (zFar + zNear) / (zNear - zFar);
+  r.m[11] = -1.0f;
+  r.m[14] = 2.0f * zFar * zNear / (zNear - zFar);
+  return r;
+}
+
+inline void
+mat4TransformPoint(const Mat4 &a, const float p[3], float out[3])
+{
+  for (int row = 0; row < 3; row++) {
+    out[row] = a.m[0 * 4 + row] * p[0] + a.m[1 * 4 + row] * p[1] +
+               a.m[2 * 4 + row] * p[2] + a.m[3 * 4 + row];
+  }
+}
+
+// Largest axis scale of the upper 3x3, used to scale object-space errors.
+inline float
+mat4MaxScale(const Mat4 &a)
+{
+  float sx = a.m[0] * a.m[0] + a.m[1] * a.m[1] + a.m[2] * a.m[2];
+  float sy = a.m[4] * a.m[4] + a.m[5] * a.m[5] + a.m[6] * a.m[6];
+  float sz = a.m[8] * a.m[8] + a.m[9] * a.m[9] + a.m[10] * a.m[10];
+  return sqrtf(fmaxf(sx, fmaxf(sy, sz)));
+}
+
+inline bool
+boundsValid(const Bounds &b)
+{
+  return b.min[0] <= b.max[0];
+}
+
+inline Bounds
+boundsEmpty()
+{
+  Bounds b;
+  for (int i = 0; i < 3; i++) {
+    b.min[i] = INFINITY;
+    b.max[i] = -INFINITY;
+  }
+  return b;
+}
+
+inline void
+boundsExtend(Bounds &b, const float p[3])
+{
+  for (int i = 0; i < 3; i++) {
+    b.min[i] = fminf(b.min[i], p[i]);
+    b.max[i] = fmaxf(b.max[i], p[i]);
+  }
+}
+
+// Bounds of the box `b` after transformation by `a`.
+inline Bounds
+boundsTransform(const Mat4 &a, const Bounds &b)
+{
+  Bounds r = boundsEmpty();
+  for (int i = 0; i < 8; i++) {
+    float p[3] = {(i & 1) ? b.max[0] : b.min[0], (i & 2) ? b.max[1] : b.min[1],
+        (i & 4) ? b.max[2] : b.min[2]};
+    float q[3];
+    mat4TransformPoint(a, p, q);
+    boundsExtend(r, q);
+  }
+  return r;
+}
+
+// Inverse transpose of the upper 3x3, column-major, for transforming normals.
+inline void
+mat4NormalMatrix(const Mat4 &a, float out[9])
+{
+  float m00 = a.m[0], m01 = a.m[4], m02 = a.m[8];
+  float m10 = a.m[1], m11 = a.m[5], m12 = a.m[9];
+  float m20 = a.m[2], m21 = a.m[6], m22 = a.m[10];
+  float c00 = m11 * m22 - m12 * m21;
+  float c01 = m12 * m20 - m10 * m22;
+  float c02 = m10 * m21 - m11 * m20;
+  float det = m00 * c00 + m01 * c01 + m02 * c02;
+  float inv = det != 0.0f ? 1.0f / det : 0.0f;
+
+  // Transpose of the inverse is the cofactor matrix divided by det.
+  out[0] = c00 * inv;
+  out[1] = (m02 * m21 - m01 * m22) * inv;
+  out[2] = (m01 * m12 - m02 * m11) * inv;
+  out[3] = c01 * inv;
+  out[4] = (m00 * m22 - m02 * m20) * inv;
+  out[5] = (m02 * m10 - m00 * m12) * inv;
+  out[6] = c02 * inv;
+  out[7] = (m01 * m20 - m00 * m21) * inv;
+  out[8] = (m00 * m11 - m01 * m10) * inv;
+}
+
+// Inverse of an affine transform (bottom row 0, 0, 0, 1). Singular ones give
+// a zero 3x3.
+inline Mat4
+mat4AffineInverse(const Mat4 &a)
+{
+  float n[9];
+  mat4NormalMatrix(a, n);  // the transpose of the inverse 3x3
+  Mat4 r = mat4Identity();
+  for (int c = 0; c < 3; c++)
+    for (int row = 0; row < 3; row++) r.m[c * 4 + row] = n[row * 3 + c];
+  for (int row = 0; row < 3; row++) {
+    r.m[12 + row] = -(r.m[row] * a.m[12] + r.m[4 + row] * a.m[13] +
+                      r.m[8 + row] * a.m[14]);
+  }
+  return r;
+}
+
+// Direction `d` transformed by the upper 3x3 of `a`.
+inline void
+mat4TransformVector(const Mat4 &a, const float d[3], float out[3])
+{
+  for (int row = 0; row < 3; row++) {
+    out[row] = a.m[0 * 4 + row] * d[0] + a.m[1 * 4 + row] * d[1] +
+               a.m[2 * 4 + row] * d[2];
+  }
+}